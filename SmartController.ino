@@ -46,7 +46,11 @@
 #include "xlxConfig.h"
 #include "xlSmartController.h"
 #include "xlxSerialConsole.h"
+#include "xlxScheduler.h"
+#include "xlxStatusLED.h"
+#include "xlxPerf.h"
 #include "SparkIntervalTimer.h"
+#include "ToneDetect.h"
 
 //------------------------------------------------------------------
 // Program Body Begins Here
@@ -61,6 +65,7 @@
 
 // Define hardware IntervalTimer
 IntervalTimer sysTimer;
+IntervalTimer micTimer;
 
 void SysteTimerCB()
 {
@@ -68,17 +73,22 @@ void SysteTimerCB()
 
   // Change Status Indicator according to system status
   // e.g: fast blink, slow blink, breath, etc
-  // ToDo:
+  theStatusLED.Tick(theSys.GetStatus());
 
-  // ToDo: MIC input (tone detection)
+  // MIC input is sampled by micTimer, tone detection runs in FastProcess
 
   // High speed non-block process
 	if (++fastTick > RTE_TICK_FASTPROCESS) {
 		fastTick = 0;
-  	theSys.FastProcess();
+  	PERF_RECORD( perfFastProcess, theSys.FastProcess() );
 	}
 }
 
+void MicTimerCB()
+{
+  theSys.SampleMIC();
+}
+
 void setup()
 {
   // System Initialization
@@ -92,6 +102,7 @@ void setup()
 
   // Start system timer: callback every n * 0.5ms using hmSec timescale
   //Use TIMER6 to retain PWM capabilities on all pins
+  //TIMER5 runs the status LED (see xlxStatusLED.cpp), TIMER7 the MIC sampler
   sysTimer.begin(SysteTimerCB, RTE_DELAY_SYSTIMER, hmSec, TIMER6);
 
   // Initialization Radio Interfaces
@@ -106,6 +117,11 @@ void setup()
   // Initialize Sensors
   theSys.InitSensors();
 
+  // Start MIC sampling timer, 4KHz
+  if( theConfig.IsSensorEnabled(sensorMIC) ) {
+    micTimer.begin(MicTimerCB, TONE_SAMPLE_PERIOD, uSec, TIMER7);
+  }
+
 	// Initialize Serial Console
   theConsole.Init();
 
@@ -118,28 +134,13 @@ void setup()
 	}
 }
 
-// Notes: approximate RTE_DELAY_SELFCHECK ms per loop
-/// If you need more accurate and faster timer, do it with sysTimer
+// Notes: tasks are registered in theSys.Start(), see xlxScheduler
+/// Each round runs the due tasks, then waits for the earliest deadline or
+/// an event. If you need more accurate and faster timer, do it with sysTimer
 void loop()
 {
-  static UC tick = 0;
-
-  // Process commands
-  IF_MAINLOOP_TIMER( theSys.ProcessCommands(), "ProcessCommands" );
-
-  // Collect data
-  IF_MAINLOOP_TIMER( theSys.CollectData(tick++), "CollectData" );
-
-	// Act on new Rules in Rules chain
-	IF_MAINLOOP_TIMER( theSys.ReadNewRules(), "ReadNewRules" );
-
-  // ToDo: transfer data
-
-  // ToDo: status synchronize
-
-  // Self-test & alarm trigger, also insert delay between each loop
-  IF_MAINLOOP_TIMER( theSys.SelfCheck(RTE_DELAY_SELFCHECK), "SelfCheck" );
-
+  // Process commands, collect data, act on rules, trigger alarms, self-test
+  theScheduler.Run();
 }
 
 #endif
@@ -39,18 +39,19 @@
 #define SERIALPORT_SPEED_HIGH     115200
 #define SERIALPORT_SPEED_DEFAULT  SERIALPORT_SPEED_HIGH
 
-// Sensor Read Speed (in ticks)
-#define SEN_DHT_SPEED_LOW         30
-#define SEN_DHT_SPEED_NORMAL      5
-#define SEN_DHT_SPEED_HIGH        2
+// Sensor Read Period (ms), adaptive between min (value moving) and max (stable),
+/// see xlxSensorSched. Sleep mode stretches them by SEN_SLEEP_FACTOR, except PIR
+#define SEN_DHT_PERIOD_MIN        2500
+#define SEN_DHT_PERIOD_MAX        15000
+#define SEN_DHT_JITTER            500
 
-#define SEN_ALS_SPEED_LOW         10
-#define SEN_ALS_SPEED_NORMAL      2
-#define SEN_ALS_SPEED_HIGH        1
+#define SEN_ALS_PERIOD_MIN        1000
+#define SEN_ALS_PERIOD_MAX        5000
 
-#define SEN_PIR_SPEED_LOW         4
-#define SEN_PIR_SPEED_NORMAL      2
-#define SEN_PIR_SPEED_HIGH        1
+#define SEN_PIR_PERIOD_MIN        500
+#define SEN_PIR_PERIOD_MAX        1000
+
+#define SEN_MIC_PERIOD            500
 
 // Row State Flags for Sync between Cloud, Flash, and Working Memory
 enum OP_FLAG {GET, POST, PUT, DELETE};
@@ -58,7 +59,7 @@ enum FLASH_FLAG {UNSAVED, SAVED};
 enum RUN_FLAG {UNEXECUTED, EXECUTED};
 
 //enum values for CldJSONCommand()
-enum COMMAND {CMD_SERIAL, CMD_POWER, CMD_COLOR, CMD_BRIGHTNESS, CMD_SCENARIO};
+enum COMMAND {CMD_SERIAL, CMD_POWER, CMD_COLOR, CMD_BRIGHTNESS, CMD_SCENARIO, CMD_CCT, CMD_HSV, CMD_EFFECT};
 
 // Macros for UID identifiers
 #define CLS_RULE                  'r'
@@ -105,12 +106,15 @@ typedef enum
   devtypDummy
 } devicetype_t;
 
+// Console output is buffered and drained by the main loop, see xlxSerialOut
+extern Print &gSerialOut;
+
 #ifndef SERIAL
-#define SERIAL        Serial.printf
+#define SERIAL        gSerialOut.printf
 #endif
 
 #ifndef SERIAL_LN
-#define SERIAL_LN     Serial.printlnf
+#define SERIAL_LN     gSerialOut.printlnf
 #endif
 
 //--------------------------------------------------
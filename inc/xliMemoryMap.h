@@ -42,6 +42,9 @@
 #define MEM_RULES_OFFSET          MEM_EXT_FLASH_BASE
 #define MEM_RULES_LEN             0x010000
 
+// Rule conditions (128*32 bytes), within the rules area
+#define MEM_RULE_PROGS_OFFSET     (MEM_RULES_OFFSET + 0x1000)
+
 // Scenarios (65536 bytes)
 #define MEM_SCENARIOS_OFFSET      (MEM_RULES_OFFSET + MEM_RULES_LEN)
 #define MEM_SCENARIOS_LEN         0x010000
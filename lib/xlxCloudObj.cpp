@@ -18,12 +18,20 @@
  * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
  *
  * DESCRIPTION
+ * 1. Sensor data is filtered by per field deadband and min/max reporting
+ *    interval, only changed fields are published, with a periodic keyframe
  *
  * ToDo:
  * 1.
 **/
 
 #include "xlxCloudObj.h"
+#include "xlxMQTTClient.h"
+#include "xlxPerf.h"
+#include "xlxRuleEngine.h"
+
+// Field names of sensor data
+const char *strReportNames[REPORT_DUMMY] = {"DHTt", "DHTh", "ALS", "PIR", "MIC"};
 
 //------------------------------------------------------------------
 // Xlight Cloud Object Class
@@ -36,36 +44,71 @@ CloudObjClass::CloudObjClass()
   m_temperature = 0.0;
   m_humidity = 0.0;
   m_brightness = 0;
-  m_jpRoot = &(m_jBuf.createObject());
+  m_motion = false;
+  m_sound = 0;
   m_strCldCmd = "";
+
+  memset(m_report, 0x00, sizeof(m_report));
+  SetReportParam(REPORT_DHT_T, SEN_DHT_T_DEADBAND, SEN_REPORT_MIN_INTERVAL, SEN_REPORT_MAX_INTERVAL);
+  SetReportParam(REPORT_DHT_H, SEN_DHT_H_DEADBAND, SEN_REPORT_MIN_INTERVAL, SEN_REPORT_MAX_INTERVAL);
+  SetReportParam(REPORT_ALS, SEN_ALS_DEADBAND, SEN_REPORT_MIN_INTERVAL, SEN_REPORT_MAX_INTERVAL);
+  // Motion is reported at once
+  SetReportParam(REPORT_PIR, SEN_PIR_DEADBAND, 0, SEN_REPORT_MAX_INTERVAL);
+  SetReportParam(REPORT_MIC, SEN_MIC_DEADBAND, 0, SEN_REPORT_MAX_INTERVAL);
+  m_reportSeq = 0;
+  m_keyframeTime = 0;
+  m_reportBytes = 0;
+  m_reportStart = 0;
 }
 
 // Initialize Cloud Variables & Functions
 void CloudObjClass::InitCloudObj()
 {
-  if( m_jpRoot->success() ) {
-    (*m_jpRoot)["device"] = m_SysID.c_str();
-    m_jpData = &(m_jpRoot->createNestedObject("sensor"));
-  } else {
-    m_jpData = &(JsonObject::invalid());
-  }
-
 #ifdef USE_PARTICLE_CLOUD
   Particle.variable(CLV_SysID, &m_SysID, STRING);
   Particle.variable(CLV_TimeZone, &m_tzString, STRING);
   Particle.variable(CLV_DevStatus, &m_devStatus, INT);
   Particle.variable(CLV_JSONData, &m_jsonData, STRING);
   Particle.variable(CLV_LastMessage, &m_lastMsg, STRING);
+  Particle.variable(CLV_PerfData, &thePerf.m_snapshot, STRING);
 
-  Particle.function(CLF_SetTimeZone, &CloudObjClass::CldSetTimeZone, this);
-  Particle.function(CLF_PowerSwitch, &CloudObjClass::CldPowerSwitch, this);
-  Particle.function(CLF_JSONCommand, &CloudObjClass::CldJSONCommand, this);
-  Particle.function(CLF_JSONConfig, &CloudObjClass::CldJSONConfig, this);
+  Particle.function(CLF_SetTimeZone, &CloudObjClass::ProbeSetTimeZone, this);
+  Particle.function(CLF_PowerSwitch, &CloudObjClass::ProbePowerSwitch, this);
+  Particle.function(CLF_JSONCommand, &CloudObjClass::ProbeJSONCommand, this);
+  Particle.function(CLF_JSONConfig, &CloudObjClass::ProbeJSONConfig, this);
 
-  Particle.function(CLF_SetTimeZone, &CloudObjClass::CldSetTimeZone, this);
+  Particle.function(CLF_SetTimeZone, &CloudObjClass::ProbeSetTimeZone, this);
 #endif
 }
 
+int CloudObjClass::ProbeSetTimeZone(String tzStr)
+{
+  int rc;
+  PERF_PROBE( perfCldSetTimeZone, rc = CldSetTimeZone(tzStr) );
+  return rc;
+}
+
+int CloudObjClass::ProbePowerSwitch(String swStr)
+{
+  int rc;
+  PERF_PROBE( perfCldPowerSwitch, rc = CldPowerSwitch(swStr) );
+  return rc;
+}
+
+int CloudObjClass::ProbeJSONCommand(String jsonCmd)
+{
+  int rc;
+  PERF_PROBE( perfCldJSONCommand, rc = CldJSONCommand(jsonCmd) );
+  return rc;
+}
+
+int CloudObjClass::ProbeJSONConfig(String jsonData)
+{
+  int rc;
+  PERF_PROBE( perfCldJSONConfig, rc = CldJSONConfig(jsonData) );
+  return rc;
+}
+
 String CloudObjClass::GetSysID()
 {
 	return m_SysID;
@@ -80,69 +123,140 @@ String CloudObjClass::GetSysVersion()
 /// or compose data entries into one larger json string and transfer it in main loop.
 BOOL CloudObjClass::UpdateTemperature(float value)
 {
-  if( m_temperature != value ) {
-    m_temperature = value;
-    if( m_jpData->success() )
-    {
-      (*m_jpData)["DHTt"] = value;
-    }
-    return true;
-  }
-  return false;
+  m_temperature = value;
+  theRuleEngine.OnUpdate(ruleVarTemp);
+  return updateReport(REPORT_DHT_T, value);
 }
 
 BOOL CloudObjClass::UpdateHumidity(float value)
 {
-  if( m_humidity != value ) {
-    m_humidity = value;
-    if( m_jpData->success() )
-    {
-      (*m_jpData)["DHTh"] = value;
-    }
-    return true;
-  }
-  return false;
+  m_humidity = value;
+  theRuleEngine.OnUpdate(ruleVarHumid);
+  return updateReport(REPORT_DHT_H, value);
 }
 
 BOOL CloudObjClass::UpdateBrightness(uint16_t value)
 {
-  if( m_brightness != value ) {
-    m_brightness = value;
-    if( m_jpData->success() )
-    {
-      (*m_jpData)["ALS"] = value;
-    }
-    return true;
-  }
-  return false;
+  m_brightness = value;
+  theRuleEngine.OnUpdate(ruleVarALS);
+  return updateReport(REPORT_ALS, value);
 }
 
 BOOL CloudObjClass::UpdateMotion(bool value)
 {
-  if( m_motion != value ) {
-    m_motion = value;
-    if( m_jpData->success() )
-    {
-      (*m_jpData)["PIR"] = value;
-    }
-    return true;
+  m_motion = value;
+  theRuleEngine.OnUpdate(ruleVarPIR);
+  return updateReport(REPORT_PIR, value);
+}
+
+BOOL CloudObjClass::UpdateSound(UC value)
+{
+  m_sound = value;
+  theRuleEngine.OnUpdate(ruleVarMIC);
+  return updateReport(REPORT_MIC, value);
+}
+
+// Mark the field changed if the value moved out of the deadband
+BOOL CloudObjClass::updateReport(UC field, float value)
+{
+  SensorReport_t &lv_rpt = m_report[field];
+  float lv_diff = value - lv_rpt.reported;
+  if( lv_diff < 0 ) lv_diff = -lv_diff;
+
+  if( lv_rpt.reportTime == 0 || (lv_diff > 0 && lv_diff >= lv_rpt.deadband) ) {
+    lv_rpt.changed = true;
+  }
+  return lv_rpt.changed;
+}
+
+BOOL CloudObjClass::SetReportParam(UC field, float deadband, US minInterval, US maxInterval)
+{
+  if( field >= REPORT_DUMMY || (maxInterval > 0 && maxInterval < minInterval) ) return false;
+
+  m_report[field].deadband = deadband;
+  m_report[field].minInterval = minInterval;
+  m_report[field].maxInterval = maxInterval;
+  return true;
+}
+
+UC CloudObjClass::FindReportField(const char *name)
+{
+  UC i;
+  for( i = 0; i < REPORT_DUMMY; i++ ) {
+    if( strcasecmp(name, strReportNames[i]) == 0 ) break;
   }
-  return false;
+  return i;
 }
 
-// Compose JSON Data String
+// Compose JSON Data String and publish the fields that are due
 void CloudObjClass::UpdateJSONData()
 {
-  if( m_jpData->success() ) {
-    char buf[SENSORDATA_JSON_SIZE];
-    m_jpData->printTo(buf, SENSORDATA_JSON_SIZE);
-    m_jsonData = buf;
+  UL lv_now = Time.now();
+  float lv_value[REPORT_DUMMY] = {m_temperature, m_humidity, (float)m_brightness, (float)m_motion, (float)m_sound};
+  BOOL lv_keyframe = (m_keyframeTime == 0 || lv_now - m_keyframeTime >= SEN_REPORT_KEYFRAME);
+  BOOL lv_due[REPORT_DUMMY];
+  BOOL lv_any = lv_keyframe;
 
-    // Publish sensor data
+  for( UC i = 0; i < REPORT_DUMMY; i++ ) {
+    SensorReport_t &lv_rpt = m_report[i];
+    UL lv_elapsed = lv_now - lv_rpt.reportTime;
+    lv_due[i] = lv_keyframe
+        || (lv_rpt.changed && lv_elapsed >= lv_rpt.minInterval)
+        || (lv_rpt.maxInterval > 0 && lv_elapsed >= lv_rpt.maxInterval);
+    lv_any |= lv_due[i];
+  }
+  if( !lv_any ) return;
+
+  StaticJsonBuffer<SENSORDATA_JSON_SIZE * 2> lv_jBuf;
+  JsonObject& lv_full = lv_jBuf.createObject();
+  JsonObject& lv_delta = lv_jBuf.createObject();
+  for( UC i = 0; i < REPORT_DUMMY; i++ ) {
+    if( i == REPORT_PIR ) {
+      lv_full[strReportNames[i]] = m_motion;
+      if( lv_due[i] ) lv_delta[strReportNames[i]] = m_motion;
+    } else if( i == REPORT_MIC ) {
+      lv_full[strReportNames[i]] = m_sound;
+      if( lv_due[i] ) lv_delta[strReportNames[i]] = m_sound;
+    } else {
+      lv_full[strReportNames[i]] = lv_value[i];
+      if( lv_due[i] ) lv_delta[strReportNames[i]] = lv_value[i];
+    }
+    if( lv_due[i] ) {
+      m_report[i].reported = lv_value[i];
+      m_report[i].reportTime = lv_now;
+      m_report[i].changed = false;
+    }
+  }
+  lv_delta["k"] = (lv_keyframe ? 1 : 0);
+  lv_delta["seq"] = ++m_reportSeq;
+  if( lv_keyframe ) m_keyframeTime = lv_now;
+  if( m_reportStart == 0 ) m_reportStart = lv_now;
+
+  // Cloud variable always holds the full set
+  char buf[SENSORDATA_JSON_SIZE];
+  lv_full.printTo(buf, SENSORDATA_JSON_SIZE);
+  m_jsonData = buf;
+
+  // Publish sensor data
+  int nLen = lv_delta.printTo(buf, SENSORDATA_JSON_SIZE);
+  m_reportBytes += nLen;
 #ifdef USE_PARTICLE_CLOUD
-    Particle.publish(CLT_NAME_SensorData, m_jsonData, CLT_TTL_SensorData, PRIVATE);
+  Particle.publish(CLT_NAME_SensorData, buf, CLT_TTL_SensorData, PRIVATE);
 #endif
+  theMQTT.Publish(MQTT_TOPIC_SENSOR, buf);
+}
+
+// Print reporting parameters and publish rate
+void CloudObjClass::PrintReportInfo()
+{
+  for( UC i = 0; i < REPORT_DUMMY; i++ ) {
+    SERIAL_LN("%s: deadband %.2f, interval %u-%us, last %.2f", strReportNames[i],
+        m_report[i].deadband, m_report[i].minInterval, m_report[i].maxInterval, m_report[i].reported);
   }
+  UL lv_elapsed = (m_reportStart > 0 ? Time.now() - m_reportStart : 0);
+  if( lv_elapsed < 1 ) lv_elapsed = 1;
+  SERIAL_LN("Published %lu frames, %lu bytes; %lu frames/h, %lu bytes/h\n\r", m_reportSeq, m_reportBytes,
+      m_reportSeq * 3600 / lv_elapsed, m_reportBytes * 3600 / lv_elapsed);
 }
 
 // Publish LOG message and update cloud veriable
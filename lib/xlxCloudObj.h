@@ -19,6 +19,7 @@
 #define CLV_DevStatus           "devStatus"       // Can also be a Particle Object
 #define CLV_JSONData            "jsonData"        // Can also be a Particle Object
 #define CLV_LastMessage         "lastMsg"         // Can also be a Particle Object
+#define CLV_PerfData            "perf"            // Profiler snapshot
 #define CLV_SenTemperatur       "senTemp"
 #define CLV_SenHumidity         "senHumid"
 #define CLV_SenBrightness       "senBright"
@@ -41,11 +42,45 @@
 #define CLT_TTL_Alarm           1800              // 0.5 hour
 /// Sensor data update
 #define CLT_NAME_SensorData     "xlc-data-sensor"
-#define CLT_TTL_SensorData      SEN_DHT_SPEED_LOW
+#define CLT_TTL_SensorData      30
 /// LOG Message
 #define CLT_NAME_LOGMSG          "xlc-event-log"
 #define CLT_TTL_LOGMSG           3600              // 1 hour
 
+// Sensor data reporting
+/// Sensor data is published as a JSON object keyed by field name. A delta
+/// frame carries only the fields that moved out of their deadband, a
+/// keyframe ("k":1) carries all fields. "seq" counts published frames.
+enum {
+  REPORT_DHT_T = 0,
+  REPORT_DHT_H,
+  REPORT_ALS,
+  REPORT_PIR,
+  REPORT_MIC,
+  REPORT_DUMMY
+};
+
+/// Default deadbands: change less than this is not reported
+#define SEN_DHT_T_DEADBAND        0.5               // Celsius
+#define SEN_DHT_H_DEADBAND        2.0               // %
+#define SEN_ALS_DEADBAND          3                 // level
+#define SEN_PIR_DEADBAND          0                 // any change
+#define SEN_MIC_DEADBAND          0                 // any change
+/// Default reporting intervals in seconds
+#define SEN_REPORT_MIN_INTERVAL   10                // Hold back changes within
+#define SEN_REPORT_MAX_INTERVAL   600               // Report anyway after
+#define SEN_REPORT_KEYFRAME       3600              // Publish all fields every
+
+typedef struct
+{
+  float deadband;
+  US minInterval;                           // seconds
+  US maxInterval;                           // seconds
+  float reported;                           // Last reported value
+  UL reportTime;                            // Last reported time
+  BOOL changed;                             // Moved out of deadband
+} SensorReport_t;
+
 //------------------------------------------------------------------
 // Xlight CloudObj Class
 //------------------------------------------------------------------
@@ -65,6 +100,7 @@ public:
   float m_humidity;
   uint16_t m_brightness;
   bool m_motion;
+  UC m_sound;                               // toneEvent_t, last MIC event
 
 public:
   CloudObjClass();
@@ -82,15 +118,28 @@ public:
   BOOL UpdateHumidity(float value);
   BOOL UpdateBrightness(uint16_t value);
   BOOL UpdateMotion(bool value);
+  BOOL UpdateSound(UC value);
   void UpdateJSONData();
   BOOL PublishLog(const char *msg);
 
+  BOOL SetReportParam(UC field, float deadband, US minInterval, US maxInterval);
+  UC FindReportField(const char *name);
+  void PrintReportInfo();
+
 protected:
   void InitCloudObj();
+  // Cloud function entries, profiled calls of the Cld* handlers
+  int ProbeSetTimeZone(String tzStr);
+  int ProbePowerSwitch(String swStr);
+  int ProbeJSONCommand(String jsonCmd);
+  int ProbeJSONConfig(String jsonData);
+  BOOL updateReport(UC field, float value);
 
-  StaticJsonBuffer<SENSORDATA_JSON_SIZE> m_jBuf;
-  JsonObject *m_jpRoot;
-  JsonObject *m_jpData;
+  SensorReport_t m_report[REPORT_DUMMY];
+  UL m_reportSeq;
+  UL m_keyframeTime;
+  UL m_reportBytes;
+  UL m_reportStart;
   JsonObject *m_jpCldCmd;
 };
 
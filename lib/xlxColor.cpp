@@ -0,0 +1,132 @@
+/**
+ * xlxColor.cpp - Xlight color conversions: gamma, color temperature and HSV
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. Integer and table driven, these run per lamp per frame in effects
+ * 2. Gamma: 256 entry table of round(255 * (x/255)^2.2)
+ * 3. CCT: CW/WW are mixed linearly in mired (1e6/K), which is close to
+ *    even steps to the eye. The table holds the CW share every 100K from
+ *    COLOR_CCT_MIN to COLOR_CCT_MAX, values in between are interpolated.
+ *    CW + WW equals the gamma corrected brightness
+ * 4. HSV: the usual six sector conversion with rounded 8 bit products,
+ *    then gamma corrected per channel
+ *
+ * ToDo:
+**/
+
+#include "xlxColor.h"
+
+const UC colorGammaTable[256] = {
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,
+    1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+    3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+    6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+   12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+   20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+   30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+   42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+   56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+   73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+   91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+  113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+  137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+  163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+  192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+  223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255
+};
+
+#define COLOR_CCT_ENTRIES         ((COLOR_CCT_MAX - COLOR_CCT_MIN) / COLOR_CCT_STEP + 1)
+
+// CW share, 255 * (mired(2700K) - mired(K)) / (mired(2700K) - mired(6500K))
+const UC colorCCTTable[COLOR_CCT_ENTRIES] = {
+    0,  16,  30,  44,  56,  68,  79,  90, 100, 109, 118, 126, 134,
+  142, 149, 156, 162, 169, 174, 180, 186, 191, 196, 201, 205, 210,
+  214, 218, 222, 226, 230, 233, 237, 240, 243, 246, 249, 252, 255
+};
+
+// a * b / 255, rounded
+static inline UC mul8(UC a, UC b)
+{
+  US lv_p = (US)a * b + 128;
+  return (lv_p + (lv_p >> 8)) >> 8;
+}
+
+UC ColorGamma(UC level)
+{
+  return colorGammaTable[level];
+}
+
+UC ColorCCTMix(US kelvin)
+{
+  if( kelvin <= COLOR_CCT_MIN ) return colorCCTTable[0];
+  if( kelvin >= COLOR_CCT_MAX ) return colorCCTTable[COLOR_CCT_ENTRIES - 1];
+
+  US lv_offset = kelvin - COLOR_CCT_MIN;
+  UC lv_index = lv_offset / COLOR_CCT_STEP;
+  UC lv_frac = lv_offset % COLOR_CCT_STEP;
+  UC lv_a = colorCCTTable[lv_index];
+  UC lv_b = colorCCTTable[lv_index + 1];
+  return lv_a + ((lv_b - lv_a) * lv_frac + COLOR_CCT_STEP / 2) / COLOR_CCT_STEP;
+}
+
+void ColorFromCCT(US kelvin, UC brightness, Hue_t &hue)
+{
+  UC lv_level = colorGammaTable[brightness];
+  UC lv_cw = mul8(lv_level, ColorCCTMix(kelvin));
+
+  hue.State = (lv_level > 0 ? 1 : 0);
+  hue.CW = lv_cw;
+  hue.WW = lv_level - lv_cw;
+  hue.R = 0;
+  hue.G = 0;
+  hue.B = 0;
+}
+
+void ColorFromHSV(US h, UC s, UC v, Hue_t &hue)
+{
+  UC lv_r, lv_g, lv_b;
+
+  h %= 360;
+  if( s == 0 ) {
+    lv_r = lv_g = lv_b = v;
+  } else {
+    UC lv_sector = h / 60;
+    // Position in the sector, 0..255
+    UC lv_rem = ((h - lv_sector * 60) * 255 + 30) / 60;
+    UC lv_p = mul8(v, 255 - s);
+    UC lv_q = mul8(v, 255 - mul8(s, lv_rem));
+    UC lv_t = mul8(v, 255 - mul8(s, 255 - lv_rem));
+
+    switch( lv_sector ) {
+    case 0:   lv_r = v;    lv_g = lv_t; lv_b = lv_p; break;
+    case 1:   lv_r = lv_q; lv_g = v;    lv_b = lv_p; break;
+    case 2:   lv_r = lv_p; lv_g = v;    lv_b = lv_t; break;
+    case 3:   lv_r = lv_p; lv_g = lv_q; lv_b = v;    break;
+    case 4:   lv_r = lv_t; lv_g = lv_p; lv_b = v;    break;
+    default:  lv_r = v;    lv_g = lv_p; lv_b = lv_q; break;
+    }
+  }
+
+  hue.State = (v > 0 ? 1 : 0);
+  hue.CW = 0;
+  hue.WW = 0;
+  hue.R = colorGammaTable[lv_r];
+  hue.G = colorGammaTable[lv_g];
+  hue.B = colorGammaTable[lv_b];
+}
@@ -0,0 +1,22 @@
+//  xlxColor.h - Xlight color conversions: gamma, color temperature and HSV
+
+#ifndef xlxColor_h
+#define xlxColor_h
+
+#include "xliCommon.h"
+#include "xlxConfig.h"
+
+#define COLOR_CCT_MIN             2700        // K, warm white LEDs
+#define COLOR_CCT_MAX             6500        // K, cold white LEDs
+#define COLOR_CCT_STEP            100         // K per CCT table entry
+
+// Perceived level to PWM duty
+UC ColorGamma(UC level);
+// Share of cold white in a CW/WW mix, 0..255, kelvin clamped to the LED range
+UC ColorCCTMix(US kelvin);
+// White rings: color temperature and brightness (0..255 perceived) to CW/WW
+void ColorFromCCT(US kelvin, UC brightness, Hue_t &hue);
+// Color rings: hue (0..359), saturation and value (0..255) to R/G/B
+void ColorFromHSV(US h, UC s, UC v, Hue_t &hue);
+
+#endif /* xlxColor_h */
@@ -26,6 +26,14 @@
  * 2. Use EEPROM class (high level API) to access the emulated EEPROM.
  * 3. Use spark-flashee-eeprom (low level 3rd party API) to access P1 external Flash.
  * 4. Please refer to xliMemoryMap.h for memory allocation.
+ * 5. Node presence: every received message stamps recentActive of its
+ *    sender through a nid -> slot index, sweep() then ages a few nodes per
+ *    call into online / stale / offline and reports the transitions.
+ *    Stamps alone are saved once per NODELIST_SAVE_INTERVAL, not per message
+ * 6. The node list is saved row by row: a bitmap marks the 12 byte rows
+ *    that changed (an insert or remove dirties the rows it shifts), and
+ *    only those are written. Rows changing within NODELIST_COMBINE_WINDOW
+ *    of each other go out together
  *
  * ToDo:
  * 1. Move default config values to header as global #define's
@@ -38,6 +46,7 @@
 #include "xlxLogger.h"
 #include "xliMemoryMap.h"
 #include "xlSmartController.h"
+#include "xlxRuleEngine.h"
 
 using namespace Flashee;
 
@@ -47,6 +56,68 @@ ConfigClass theConfig = ConfigClass();
 //------------------------------------------------------------------
 // Xlight Node List Class
 //------------------------------------------------------------------
+void NodeListClass::rebuildIndex()
+{
+	memset(m_index, 0x00, sizeof(m_index));
+	for(int i = 0; i < _count; i++) {
+		m_index[_pItems[i].nid] = i + 1;
+	}
+}
+
+// Exact matches come from the index, insert positions from the base class
+int NodeListClass::search(NodeIdRow_t *_pT, bool bReplace)
+{
+	if( !_pT ) return -1;
+	if( !bReplace ) return((int)m_index[_pT->nid] - 1);
+	return OrderdList::search(_pT, bReplace);
+}
+
+void NodeListClass::markRows(UL *bitmap, UC from, UC to)
+{
+	for(int i = from; i <= to && i < NODELIST_ROWS; i++) {
+		bitmap[i >> 5] |= (1UL << (i & 0x1F));
+	}
+}
+
+void NodeListClass::setDirty(UC from, UC to)
+{
+	markRows(m_dirty, from, to);
+	m_isChanged = true;
+}
+
+// Insert and remove shift the rows, the index and the dirty rows follow
+int NodeListClass::add(NodeIdRow_t *_pT)
+{
+	UC lv_count = _count;
+	int pos = OrderdList::add(_pT);
+	if( pos >= 0 ) {
+		if( _count != lv_count ) {
+			rebuildIndex();
+			setDirty(pos, _count - 1);
+		} else {
+			setDirty(pos, pos);
+		}
+	}
+	return pos;
+}
+
+bool NodeListClass::remove(NodeIdRow_t *_pT)
+{
+	int pos = search(_pT);
+	if( !OrderdList::remove(_pT) ) return false;
+	rebuildIndex();
+	// Down to the old last row, which is cleared
+	setDirty(pos, _count);
+	return true;
+}
+
+void NodeListClass::removeAll()
+{
+	OrderdList::removeAll();
+	memset(m_index, 0x00, sizeof(m_index));
+	m_sweepPos = 0;
+}
+
 int NodeListClass::getMemSize()
 {
 	return(sizeof(NodeIdRow_t) * _count);
@@ -61,6 +132,7 @@ int NodeListClass::getFlashSize()
 bool NodeListClass::loadList()
 {
 	NodeIdRow_t lv_Node;
+	UC lv_fixed[2] = {0, 0};
 	for(int i = 0; i < theConfig.GetNumNodes(); i++) {
 		int offset = MEM_NODELIST_OFFSET + i * sizeof(NodeIdRow_t);
 		if( offset >= MEM_NODELIST_OFFSET + MEM_NODELIST_LEN - sizeof(NodeIdRow_t) ) break;
@@ -72,50 +144,146 @@ bool NodeListClass::loadList()
 				lv_Node.nid = 1;
 				memset(lv_Node.identify, 0x00, sizeof(lv_Node.identify));
 				lv_Node.recentActive = 0;
-				m_isChanged = true;
+				lv_fixed[0] = lv_Node.nid;
 			}
 		} else if(  i == 1 && theConfig.GetNumNodes() == 2 ) {
 			if( lv_Node.nid != 64 ) {
 				lv_Node.nid = 64;
 				memset(lv_Node.identify, 0x00, sizeof(lv_Node.identify));
 				lv_Node.recentActive = 0;
-				m_isChanged = true;
+				lv_fixed[1] = lv_Node.nid;
 			}
 		} else if( lv_Node.nid == 255 || lv_Node.nid == 0 ) {
 			theConfig.SetNumNodes(count());
 			break;
 		}
+		lv_Node.presence = nodeUnknown;
 		if( add(&lv_Node) < 0 ) break;
 	}
+	// Only the preset fixes need writing back
+	memset(m_dirty, 0x00, sizeof(m_dirty));
+	memset(m_stamped, 0x00, sizeof(m_stamped));
+	m_isChanged = false;
+	m_isActivityChanged = false;
+	for(int i = 0; i < 2; i++) {
+		if( lv_fixed[i] && m_index[lv_fixed[i]] ) setDirty(m_index[lv_fixed[i]] - 1, m_index[lv_fixed[i]] - 1);
+	}
+	m_lastSave = millis();
 	saveList();
 	return true;
 }
 
-bool NodeListClass::saveList()
-{
-	if( m_isChanged ) {
-		m_isChanged = false;
-		/*
-		for(int i = 0; i < count(); i++) {
-			int offset = MEM_NODELIST_OFFSET + i * sizeof(NodeIdRow_t);
-			if( offset > MEM_NODELIST_OFFSET + MEM_NODELIST_LEN - sizeof(NodeIdRow_t) ) break;
-			EEPROM.put(offset, _pItems[i]);
-		}*/
-		NodeIdRow_t lv_buf[MAX_NODE_PER_CONTROLLER];
-		memset(lv_buf, 0x00, sizeof(lv_buf));
-		memcpy(lv_buf, _pItems, sizeof(NodeIdRow_t) * count());
-		EEPROM.put(MEM_NODELIST_OFFSET, lv_buf);
-		theConfig.SetNumNodes(count());
+// Write only the dirty rows, same 12 byte layout as the whole block.
+// Returns true only when rows went to EEPROM, false while holding or idle
+bool NodeListClass::saveList(UL now)
+{
+	// Let changes that come close together share one write
+	if( m_isChanged && m_combineWindow > 0 ) {
+		if( !m_isHolding ) {
+			m_isHolding = true;
+			m_dirtySince = now;
+		}
+		if( now - m_dirtySince < m_combineWindow ) return false;
+	}
+	// Activity stamps ride along with the next change, or go out on their own now and then
+	bool lv_stamps = m_isActivityChanged && (m_isChanged || now - m_lastSave >= NODELIST_SAVE_INTERVAL);
+	if( !m_isChanged && !lv_stamps ) return false;
+
+	for(int w = 0; w < (NODELIST_ROWS + 31) / 32; w++) {
+		UL lv_rows = m_dirty[w] | (lv_stamps ? m_stamped[w] : 0);
+		for(int b = 0; lv_rows; b++, lv_rows >>= 1) {
+			if( !(lv_rows & 1) ) continue;
+			UC lv_slot = w * 32 + b;
+			NodeIdRow_t lv_row;
+			if( lv_slot < _count ) {
+				lv_row = _pItems[lv_slot];
+				lv_row.presence = 0;
+			} else {
+				memset(&lv_row, 0x00, sizeof(lv_row));
+			}
+			putRow(lv_slot, lv_row);
+			m_rowsWritten++;
+			m_bytesWritten += sizeof(NodeIdRow_t);
+		}
+		m_dirty[w] = 0;
+		if( lv_stamps ) m_stamped[w] = 0;
+	}
+
+	if( lv_stamps ) {
+		m_isActivityChanged = false;
+		m_lastSave = now;
 	}
+	m_isChanged = false;
+	m_isHolding = false;
 	return true;
 }
 
+void NodeListClass::putRow(UC slot, const NodeIdRow_t &row)
+{
+	EEPROM.put(MEM_NODELIST_OFFSET + slot * sizeof(NodeIdRow_t), row);
+}
+
 void NodeListClass::showList()
 {
+	const char *lv_presence[] = {"unknown", "online", "stale", "offline"};
 	UL lv_now = Time.now();
 	for(int i=0; i < _count; i++) {
-		SERIAL_LN("Index: %d - NodeID: %d, actived %d seconds ago", i, _pItems[i].nid, (_pItems[i].recentActive > 0 ? lv_now - _pItems[i].recentActive : -1));
+		SERIAL_LN("Index: %d - NodeID: %d, actived %d seconds ago, %s", i, _pItems[i].nid, (_pItems[i].recentActive > 0 ? lv_now - _pItems[i].recentActive : -1),
+				lv_presence[_pItems[i].presence & 0x03]);
 	}
+	SERIAL_LN("Activity stamps: %lu, %s", m_stamps, (m_isActivityChanged ? "not saved yet" : "saved"));
+	SERIAL_LN("EEPROM written: %lu rows, %lu bytes", m_rowsWritten, m_bytesWritten);
+}
+
+// Stamp activity of a node, O(1). Returns false if the node is not listed
+bool NodeListClass::touch(UC nid, UL now)
+{
+	UC lv_slot = m_index[nid];
+	if( lv_slot == 0 ) return false;
+
+	NodeIdRow_t &lv_node = _pItems[lv_slot - 1];
+	lv_node.recentActive = now;
+	markRows(m_stamped, lv_slot - 1, lv_slot - 1);
+	m_isActivityChanged = true;
+	m_stamps++;
+	if( lv_node.presence != nodeOnline ) {
+		UC lv_old = lv_node.presence;
+		lv_node.presence = nodeOnline;
+		if( lv_old != nodeUnknown && m_onPresence ) (*m_onPresence)(nid, nodeOnline);
+	}
+	return true;
+}
+
+// Age up to budget nodes, continuing where the last call stopped.
+/// Returns the number of transitions. The first classification after
+/// boot is silent, only changes from a known state are reported
+UC NodeListClass::sweep(UL now, UC budget)
+{
+	UC lv_changes = 0;
+	if( budget > _count ) budget = _count;
+
+	for(UC n = 0; n < budget; n++) {
+		if( m_sweepPos >= _count ) m_sweepPos = 0;
+		NodeIdRow_t &lv_node = _pItems[m_sweepPos++];
+		// Never heard of
+		if( lv_node.recentActive == 0 ) continue;
+
+		UL lv_age = (now > lv_node.recentActive ? now - lv_node.recentActive : 0);
+		UC lv_presence = (lv_age < NODELIST_STALE ? nodeOnline : (lv_age < NODELIST_OFFLINE ? nodeStale : nodeOffline));
+		if( lv_presence != lv_node.presence ) {
+			UC lv_old = lv_node.presence;
+			lv_node.presence = lv_presence;
+			lv_changes++;
+			if( lv_old != nodeUnknown && m_onPresence ) (*m_onPresence)(lv_node.nid, lv_presence);
+		}
+	}
+	return lv_changes;
+}
+
+UC NodeListClass::getPresence(UC nid)
+{
+	UC lv_slot = m_index[nid];
+	return(lv_slot > 0 ? _pItems[lv_slot - 1].presence : nodeUnknown);
 }
 
 // Get a new NodeID
@@ -221,12 +389,23 @@ BOOL ConfigClass::MemReadScenarioRow(ScenarioRow_t &row, uint32_t address)
 #endif
 }
 
+// Write a table image, e.g. from binary provisioning
+BOOL ConfigClass::MemWriteRaw(const void *data, uint32_t address, US len)
+{
+#ifdef MCU_TYPE_P1
+	return P1Flash->write(data, address, len);
+#else
+	return false;
+#endif
+}
+
 BOOL ConfigClass::LoadConfig()
 {
   // Load System Configuration
   if( sizeof(Config_t) <= MEM_CONFIG_LEN )
   {
     EEPROM.get(MEM_CONFIG_OFFSET, m_config);
+    UC lv_version = m_config.version;
     if( m_config.version == 0xFF
       || m_config.timeZone.id == 0
       || m_config.timeZone.id > 500
@@ -247,6 +426,12 @@ BOOL ConfigClass::LoadConfig()
     {
       LOGI(LOGTAG_MSG, F("Sysconfig loaded."));
     }
+
+    // Stored table layout changed, drop the rows the old version wrote
+    if( lv_version != VERSION_CONFIG_DATA )
+    {
+      UpgradeLayout(lv_version);
+    }
     m_isLoaded = true;
     m_isChanged = false;
   } else {
@@ -268,6 +453,22 @@ BOOL ConfigClass::LoadConfig()
   return m_isLoaded;
 }
 
+// Version 1 schedule rows had an 8 bits alarm_id, so rows are at other
+// offsets now and any stored row may pass the uid check with wrong fields
+void ConfigClass::UpgradeLayout(UC fromVersion)
+{
+  if( fromVersion < 2 || fromVersion == 0xFF )
+  {
+    for( int i = 0; i < MEM_SCHEDULE_LEN; i++ ) {
+      EEPROM.write(MEM_SCHEDULE_OFFSET + i, 0xFF);
+    }
+    LOGW(LOGTAG_MSG, "Schedule table cleared, layout %d->%d", fromVersion, VERSION_CONFIG_DATA);
+  }
+
+  m_config.version = VERSION_CONFIG_DATA;
+  EEPROM.put(MEM_CONFIG_OFFSET, m_config);
+}
+
 BOOL ConfigClass::SaveConfig()
 {
   if( m_isChanged )
@@ -852,6 +1053,10 @@ BOOL ConfigClass::LoadRuleTable()
 					RuleArray[i].op_flag = POST;
 					RuleArray[i].run_flag = UNEXECUTED;
 					RuleArray[i].flash_flag = SAVED;		//Already know it exists in flash
+					// Condition of the rule, if any
+					RuleProg_t lv_prog;
+					if (P1Flash->read<RuleProg_t>(lv_prog, MEM_RULE_PROGS_OFFSET + i*RULE_PROG_SIZE))
+						theRuleEngine.SetProgram(i, lv_prog);
 					if (!theSys.Rule_table.add(RuleArray[i])) //add non-empty row to working memory chain
 					{
 						LOGW(LOGTAG_MSG, F("Rule row %d failed to load from flash"), i);
@@ -917,6 +1122,7 @@ BOOL ConfigClass::SaveRuleTable()
 				{
 	#ifdef MCU_TYPE_P1
 					P1Flash->write<RuleRow_t>(tmpRow, MEM_RULES_OFFSET + row_index*RT_ROW_SIZE);
+					P1Flash->write<RuleProg_t>(*theRuleEngine.GetProgram(row_index), MEM_RULE_PROGS_OFFSET + row_index*RULE_PROG_SIZE);
 	#endif
 					rowptr->data.flash_flag = SAVED; //toggle flash flag
 				}
@@ -961,7 +1167,18 @@ BOOL ConfigClass::SaveNodeIDList()
 {
 	if ( m_isNIDChanged )
 	{
-		// ToDo: save Node ID list
+		lstNodes.setDirty(0, NODELIST_ROWS - 1);
+		m_isNIDChanged = false;
+	}
+
+	// Activity stamps are batched, see NodeListClass::saveList()
+	if ( lstNodes.m_isChanged || lstNodes.m_isActivityChanged )
+	{
+		// The count must not run ahead of the rows, or a reboot loads stale ones
+		if( lstNodes.saveList() ) {
+			SetNumNodes(lstNodes.count());
+			return true;
+		}
 	}
 
 	return false;
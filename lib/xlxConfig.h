@@ -93,7 +93,7 @@ typedef struct
 	BOOL isRepeat		    : 1;	  //values: 0-1
 	UC hour				    : 5;    //values: 0-23
 	UC minute				: 6;    //values: 0-59
-	AlarmId alarm_id	    : 8;
+	AlarmId alarm_id	    : 16;
 } ScheduleRow_t;
 
 #define SCT_ROW_SIZE	sizeof(ScheduleRow_t)
@@ -106,11 +106,30 @@ typedef struct    // Exact 12 bytes
 	__attribute__((packed))
 {
 	UC nid;
-	UC reserved;
+	UC presence;                              // nodePresence_t, RAM only, was reserved
   UC identify[6];
   UL recentActive;
 } NodeIdRow_t;
 
+// Node presence, from the age of recentActive
+typedef enum
+{
+  nodeUnknown = 0,                          // Not classified since boot
+  nodeOnline,
+  nodeStale,
+  nodeOffline
+} nodePresence_t;
+
+#define NODELIST_STALE            300         // Seconds of silence before a node is stale
+#define NODELIST_OFFLINE          1800        // ... and offline
+#define NODELIST_SWEEP_BUDGET     16          // Nodes checked per sweep call
+#define NODELIST_SAVE_INTERVAL    3600000     // ms between saves of activity stamps alone
+#define NODELIST_COMBINE_WINDOW   10000       // ms dirty rows wait for more changes, 0 to write at once
+#define NODELIST_ROWS             (MEM_NODELIST_LEN / sizeof(NodeIdRow_t))
+
+// Presence transition of a node
+typedef void (*NodePresenceFunc_t)(UC nid, UC presence);
+
 //------------------------------------------------------------------
 // Xlight Rule Table Structures
 //------------------------------------------------------------------
@@ -128,7 +147,7 @@ typedef struct
 	UC SCT_uid               : 8;
 	UC SNT_uid               : 8;
 	UC notif_uid             : 8;
-  // ToDo: add other trigger conditions, e.g. sensor data
+  // Sensor conditions are compiled into RuleProg_t, see xlxRuleEngine
 } RuleRow_t;
 
 #define RT_ROW_SIZE 	sizeof(RuleRow_t)
@@ -159,11 +178,37 @@ typedef struct
 // Node List Class
 class NodeListClass : public OrderdList<NodeIdRow_t>
 {
+protected:
+  UC m_index[256];                          // nid -> slot + 1, 0 if not listed
+  UC m_sweepPos;
+  UL m_lastSave;                            // millis() of the last save of stamps
+  UL m_dirtySince;                          // millis() when saveList() first saw dirty rows
+  bool m_isHolding;                         // Combining window is open
+  UL m_dirty[(NODELIST_ROWS + 31) / 32];    // Rows to write, one bit per slot
+  UL m_stamped[(NODELIST_ROWS + 31) / 32];  // Rows with only a newer recentActive
+  NodePresenceFunc_t m_onPresence;
+
+  void rebuildIndex();
+  void markRows(UL *bitmap, UC from, UC to);
+  virtual int search(NodeIdRow_t *_pT, bool bReplace = false);
+  // One row to EEPROM, overridden by the tests to count instead
+  virtual void putRow(UC slot, const NodeIdRow_t &row);
+
 public:
-  bool m_isChanged;
+  bool m_isChanged;                         // Some rows are dirty
+  bool m_isActivityChanged;                 // Only recentActive moved, see saveList()
+  UL m_stamps;
+  UL m_combineWindow;                       // ms, NODELIST_COMBINE_WINDOW by default
+  UL m_bytesWritten;
+  UL m_rowsWritten;
 
   NodeListClass(uint8_t maxl = 64, bool desc = false, uint8_t initlen = 8) : OrderdList(maxl, desc, initlen) {
-    m_isChanged = false; };
+    m_isChanged = false; m_isActivityChanged = false; m_stamps = 0;
+    m_sweepPos = 0; m_lastSave = 0; m_onPresence = NULL;
+    m_dirtySince = 0; m_isHolding = false; m_combineWindow = NODELIST_COMBINE_WINDOW;
+    m_bytesWritten = 0; m_rowsWritten = 0;
+    memset(m_dirty, 0x00, sizeof(m_dirty)); memset(m_stamped, 0x00, sizeof(m_stamped));
+    memset(m_index, 0x00, sizeof(m_index)); };
   virtual int compare(NodeIdRow_t _first, NodeIdRow_t _second) {
     if( _first.nid > _second.nid ) {
       return 1;
@@ -173,11 +218,23 @@ public:
       return 0;
     }
   };
+  virtual int add(NodeIdRow_t *_pT);
+  virtual bool remove(NodeIdRow_t *_pT);
+  virtual void removeAll();
   int getMemSize();
   int getFlashSize();
   bool loadList();
-  bool saveList();
+  bool saveList() { return saveList(millis()); };
+  bool saveList(UL now);
+  // Rows from..to (inclusive) are written with the next save
+  void setDirty(UC from, UC to);
   void showList();
+
+  // Presence
+  void setPresenceCallback(NodePresenceFunc_t func) { m_onPresence = func; };
+  bool touch(UC nid, UL now);
+  UC sweep(UL now, UC budget = NODELIST_SWEEP_BUDGET);
+  UC getPresence(UC nid);
   UC requestNodeID(char type, UC identify[6]);
 };
 
@@ -206,8 +263,10 @@ public:
   // write to P1 using spark-flashee-eeprom
   BOOL MemWriteScenarioRow(ScenarioRow_t row, uint32_t address);
   BOOL MemReadScenarioRow(ScenarioRow_t &row, uint32_t address);
+  BOOL MemWriteRaw(const void *data, uint32_t address, US len);
 
   BOOL LoadConfig();
+  void UpgradeLayout(UC fromVersion);
   BOOL SaveConfig();
   BOOL IsConfigLoaded();
 
@@ -0,0 +1,310 @@
+/**
+ * xlxFlashLog.cpp - Xlight persistent log ring in external flash
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. Circular log over a flash region. The sector after the current one is
+ *    erased ahead of time in Process(), so the writer never waits for an
+ *    erase and the oldest sector is dropped first. A sector that is already
+ *    blank is not erased again
+ * 2. Every sector starts with a header {magic, seq}; the newest sector and
+ *    the write position are recovered by scanning headers at boot
+ * 3. Records are framed: sync, len, level, tag, timestamp, text, checksum.
+ *    A record never spans sectors, 0xFF (erased) marks the end of data.
+ *    Records written before the clock is synced carry FLASHLOG_NO_TIME
+ * 4. Records are batched in RAM and written to flash in one go when the
+ *    buffer is full, on request (Flush), or when they get too old
+ *
+ * Note:
+ * Flashee::CircularBuffer keeps its read/write pointers in RAM and refuses
+ * to overwrite unread data, so it can neither survive a reset nor drop the
+ * oldest records. This class keeps the state in flash instead.
+ * The log lives in logical pages of the wear levelled device that holds the
+ * rule and scenario tables (theConfig.P1Flash), that device owns every
+ * physical page of user flash.
+ *
+ * ToDo:
+**/
+
+#include "xlxFlashLog.h"
+
+using namespace Flashee;
+
+//------------------------------------------------------------------
+// Xlight Flash Log Class
+//------------------------------------------------------------------
+FlashLogClass::FlashLogClass()
+{
+  m_pFlash = NULL;
+  m_sectorSize = 0;
+  m_firstSector = 0;
+  m_sectorCount = 0;
+  m_curSector = 0;
+  m_curSeq = 0;
+  m_writeAddr = 0;
+  m_bufTime = 0;
+  m_dropped = 0;
+  m_spareReady = false;
+  m_bufLen = 0;
+}
+
+// addr and size are logical addresses of pFlash, the log uses the whole
+// device pages inside the range
+BOOL FlashLogClass::Init(FlashDevice* pFlash, UL addr, UL size)
+{
+  if( !pFlash ) return false;
+  m_sectorSize = pFlash->pageSize();
+  m_firstSector = (addr + m_sectorSize - 1) / m_sectorSize;
+  UL lv_endSector = (addr + size) / m_sectorSize;
+  if( lv_endSector > pFlash->pageCount() ) lv_endSector = pFlash->pageCount();
+  if( lv_endSector < m_firstSector + 2 ) return false;
+  m_sectorCount = lv_endSector - m_firstSector;
+  m_pFlash = pFlash;
+
+  // Find the newest sector
+  FlashLogSector_t lv_header;
+  BOOL lv_found = false;
+  for( UL i = 0; i < m_sectorCount; i++ ) {
+    if( readSector(i, lv_header) ) {
+      if( !lv_found || lv_header.seq > m_curSeq ) {
+        m_curSector = i;
+        m_curSeq = lv_header.seq;
+        lv_found = true;
+      }
+    }
+  }
+
+  // The spare sector is erased later from Process()
+  m_spareReady = false;
+  if( lv_found ) {
+    m_writeAddr = scanSector(m_curSector);
+    return true;
+  }
+
+  // Brand new region
+  if( !eraseSector(0) ) return false;
+  return openSector(0, 1);
+}
+
+BOOL FlashLogClass::readSector(UL sector, FlashLogSector_t &header)
+{
+  if( !m_pFlash->read(header, sectorAddr(sector)) ) return false;
+  return(header.magic == FLASHLOG_MAGIC && header.seq != 0xFFFFFFFF);
+}
+
+// Only erase a sector that has data, erased flash needs no wear
+BOOL FlashLogClass::eraseSector(UL sector)
+{
+  UC lv_chunk[32];
+  UL lv_addr = sectorAddr(sector);
+  UL lv_end = sectorAddr(sector + 1);
+
+  while( lv_addr < lv_end ) {
+    UL lv_len = lv_end - lv_addr;
+    if( lv_len > sizeof(lv_chunk) ) lv_len = sizeof(lv_chunk);
+    if( !m_pFlash->readPage(lv_chunk, lv_addr, lv_len) ) break;
+    for( UL i = 0; i < lv_len; i++ ) {
+      if( lv_chunk[i] != 0xFF ) return m_pFlash->erasePage(sectorAddr(sector));
+    }
+    lv_addr += lv_len;
+  }
+  if( lv_addr < lv_end ) return m_pFlash->erasePage(sectorAddr(sector));
+  return true;
+}
+
+// Start writing an erased sector
+BOOL FlashLogClass::openSector(UL sector, UL seq)
+{
+  FlashLogSector_t lv_header;
+  UL lv_addr = sectorAddr(sector);
+
+  lv_header.magic = FLASHLOG_MAGIC;
+  lv_header.seq = seq;
+  m_curSector = sector;
+  m_curSeq = seq;
+  m_writeAddr = lv_addr + sizeof(FlashLogSector_t);
+  return m_pFlash->writePage(&lv_header, lv_addr, sizeof(lv_header));
+}
+
+// Return the first free address in the sector, or the end of the sector
+// if the tail is not clean
+UL FlashLogClass::scanSector(UL sector)
+{
+  FlashLogRecord_t lv_rec;
+  UL lv_end = sectorAddr(sector + 1);
+  UL lv_addr = sectorAddr(sector) + sizeof(FlashLogSector_t);
+
+  while( lv_addr + FLASHLOG_REC_OVERHEAD <= lv_end ) {
+    m_pFlash->readPage(&lv_rec, lv_addr, sizeof(lv_rec));
+    if( lv_rec.sync == 0xFF ) return lv_addr;
+    if( lv_rec.sync != FLASHLOG_SYNC || lv_rec.len > FLASHLOG_MAX_MSG ) break;
+    lv_addr += FLASHLOG_REC_OVERHEAD + lv_rec.len;
+  }
+
+  return lv_end;
+}
+
+// Append one record to the RAM buffer, flush when it is full
+BOOL FlashLogClass::Append(UC level, const char *tag, const char *msg)
+{
+  if( !m_pFlash ) return false;
+
+  US lv_len = strlen(msg);
+  if( lv_len > FLASHLOG_MAX_MSG ) lv_len = FLASHLOG_MAX_MSG;
+  US lv_recLen = FLASHLOG_REC_OVERHEAD + lv_len;
+
+  if( m_bufLen + lv_recLen > FLASHLOG_BUF_SIZE ) Flush();
+  if( m_writeAddr + m_bufLen + lv_recLen > sectorAddr(m_curSector + 1) ) {
+    // Move to the pre-erased next sector, never erase on the caller's time
+    Flush();
+    if( !m_spareReady ) {
+      m_dropped++;
+      return false;
+    }
+    m_spareReady = false;
+    if( !openSector((m_curSector + 1) % m_sectorCount, m_curSeq + 1) ) return false;
+  }
+
+  FlashLogRecord_t *lv_pRec = (FlashLogRecord_t *)(m_buf + m_bufLen);
+  lv_pRec->sync = FLASHLOG_SYNC;
+  lv_pRec->len = lv_len;
+  lv_pRec->level = level;
+  memcpy(lv_pRec->tag, tag, sizeof(lv_pRec->tag));
+  // Before the clock is synced the time is meaningless, see FormatRecord()
+  lv_pRec->timestamp = (Time.isValid() ? Time.now() : FLASHLOG_NO_TIME);
+  memcpy(m_buf + m_bufLen + sizeof(FlashLogRecord_t), msg, lv_len);
+
+  UC lv_sum = 0;
+  for( US i = 0; i < lv_recLen - 1; i++ ) lv_sum += m_buf[m_bufLen + i];
+  m_buf[m_bufLen + lv_recLen - 1] = lv_sum;
+
+  if( m_bufLen == 0 ) m_bufTime = millis();
+  m_bufLen += lv_recLen;
+
+  return true;
+}
+
+// Write pending records to flash
+BOOL FlashLogClass::Flush()
+{
+  if( !m_pFlash || m_bufLen == 0 ) return true;
+
+  BOOL rc = m_pFlash->writePage(m_buf, m_writeAddr, m_bufLen);
+  m_writeAddr += m_bufLen;
+  m_bufLen = 0;
+  return rc;
+}
+
+// Called from main loop: erase the spare sector, which drops the oldest
+// records, and don't keep records in RAM forever
+void FlashLogClass::Process()
+{
+  if( !m_pFlash ) return;
+
+  if( !m_spareReady ) {
+    m_spareReady = eraseSector((m_curSector + 1) % m_sectorCount);
+  }
+
+  if( m_bufLen > 0 && millis() - m_bufTime >= FLASHLOG_FLUSH_INTERVAL * 1000UL ) {
+    Flush();
+  }
+}
+
+// Walk through records from the oldest to the newest
+UL FlashLogClass::ReadRecords(FlashLogReader_t reader, void *param, UL skip)
+{
+  if( !m_pFlash ) return 0;
+  Flush();
+
+  FlashLogSector_t lv_header;
+  FlashLogRecord_t lv_rec;
+  char lv_text[FLASHLOG_MAX_MSG + 2];
+  UL lv_count = 0;
+
+  // Start from the sector following the current one, which is the oldest
+  for( UL i = 1; i <= m_sectorCount; i++ ) {
+    UL lv_sector = (m_curSector + i) % m_sectorCount;
+    if( !readSector(lv_sector, lv_header) ) continue;
+
+    UL lv_end = sectorAddr(lv_sector + 1);
+    UL lv_addr = sectorAddr(lv_sector) + sizeof(FlashLogSector_t);
+    while( lv_addr + FLASHLOG_REC_OVERHEAD <= lv_end ) {
+      m_pFlash->readPage(&lv_rec, lv_addr, sizeof(lv_rec));
+      if( lv_rec.sync != FLASHLOG_SYNC || lv_rec.len > FLASHLOG_MAX_MSG ) break;
+      if( lv_addr + FLASHLOG_REC_OVERHEAD + lv_rec.len > lv_end ) break;
+      m_pFlash->readPage(lv_text, lv_addr + sizeof(lv_rec), lv_rec.len + 1);
+      lv_addr += FLASHLOG_REC_OVERHEAD + lv_rec.len;
+
+      // Verify checksum, skip damaged records
+      UC lv_sum = 0;
+      for( US j = 0; j < sizeof(lv_rec); j++ ) lv_sum += ((UC *)&lv_rec)[j];
+      for( US j = 0; j < lv_rec.len; j++ ) lv_sum += (UC)lv_text[j];
+      if( lv_sum != (UC)lv_text[lv_rec.len] ) continue;
+      lv_text[lv_rec.len] = '\0';
+
+      if( skip > 0 ) {
+        skip--;
+        continue;
+      }
+      lv_count++;
+      if( reader && !reader(lv_rec, lv_text, param) ) return lv_count;
+    }
+  }
+
+  return lv_count;
+}
+
+UL FlashLogClass::CountRecords()
+{
+  return ReadRecords(NULL, NULL);
+}
+
+// One text line per record, without line ending
+int FlashLogClass::FormatRecord(char *buf, int size, const FlashLogRecord_t &rec, const char *msg)
+{
+  if( rec.timestamp == FLASHLOG_NO_TIME ) {
+    return snprintf(buf, size, "%-19s %d %.3s %s", "(not synced)", rec.level, rec.tag, msg);
+  }
+  return snprintf(buf, size, "%s %d %.3s %s", Time.format(rec.timestamp, "%Y-%m-%d %H:%M:%S").c_str(),
+      rec.level, rec.tag, msg);
+}
+
+static bool PrintFlashLogRecord(const FlashLogRecord_t &rec, const char *msg, void *param)
+{
+  char lv_line[FLASHLOG_MAX_MSG + 32];
+  FlashLogClass::FormatRecord(lv_line, sizeof(lv_line), rec, msg);
+  SERIAL_LN("%s", lv_line);
+  return true;
+}
+
+// Print the most recent lines, or all records if lines is 0
+void FlashLogClass::PrintRecords(UL lines)
+{
+  if( !m_pFlash ) {
+    SERIAL_LN("Flash log is not available");
+    return;
+  }
+
+  UL lv_skip = 0;
+  if( lines > 0 ) {
+    UL lv_total = CountRecords();
+    if( lv_total > lines ) lv_skip = lv_total - lines;
+  }
+  UL lv_count = ReadRecords(PrintFlashLogRecord, NULL, lv_skip);
+  SERIAL_LN("%lu records, sector %lu seq %lu, %lu dropped", lv_count, m_curSector, m_curSeq, m_dropped);
+}
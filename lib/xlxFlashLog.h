@@ -0,0 +1,84 @@
+//  xlxFlashLog.h - Xlight persistent log ring in external flash
+
+#ifndef xlxFlashLog_h
+#define xlxFlashLog_h
+
+#include "xliCommon.h"
+#include "flashee-eeprom.h"
+
+// Sector header, at the beginning of every flash sector (page)
+#define FLASHLOG_MAGIC            0x474C5858      // "XXLG"
+// Record sync byte, 0xFF means erased flash (end of data)
+#define FLASHLOG_SYNC             0xA5
+// RAM batch buffer, flushed to flash as a whole
+#define FLASHLOG_BUF_SIZE         256
+// Longest message text kept in one record
+#define FLASHLOG_MAX_MSG          200
+// Flush pending records if they are older than this (seconds)
+#define FLASHLOG_FLUSH_INTERVAL   300
+// Timestamp of records written before the clock was synced
+#define FLASHLOG_NO_TIME          0
+
+typedef struct
+	__attribute__((packed))
+{
+  UL magic;
+  UL seq;                                   // Sector sequence, newest is the largest
+} FlashLogSector_t;
+
+typedef struct
+	__attribute__((packed))
+{
+  UC sync;                                  // FLASHLOG_SYNC
+  UC len;                                   // Length of message text
+  UC level;                                 // Log level
+  char tag[3];                              // Log tag
+  UL timestamp;                             // UTC seconds, or FLASHLOG_NO_TIME
+} FlashLogRecord_t;                         // Followed by text and 1 byte checksum
+
+#define FLASHLOG_REC_OVERHEAD     (sizeof(FlashLogRecord_t) + 1)
+
+// Callback on each record while reading: return false to stop
+typedef bool (*FlashLogReader_t)(const FlashLogRecord_t &rec, const char *msg, void *param);
+
+//------------------------------------------------------------------
+// Xlight Flash Log Class
+//------------------------------------------------------------------
+class FlashLogClass
+{
+private:
+  Flashee::FlashDevice* m_pFlash;
+  UL m_sectorSize;
+  UL m_firstSector;                         // Device page of log sector 0
+  UL m_sectorCount;
+  UL m_curSector;                           // Sector being written
+  UL m_curSeq;                              // Sequence of current sector
+  UL m_writeAddr;                           // Flash address of m_buf[0]
+  UL m_bufTime;                             // millis() of the first pending record
+  UL m_dropped;                             // Records lost while the spare sector was not ready
+  BOOL m_spareReady;                        // Sector after the current one is erased
+  US m_bufLen;
+  UC m_buf[FLASHLOG_BUF_SIZE];
+
+  UL sectorAddr(UL sector) { return((m_firstSector + sector) * m_sectorSize); }
+  BOOL readSector(UL sector, FlashLogSector_t &header);
+  BOOL eraseSector(UL sector);
+  BOOL openSector(UL sector, UL seq);
+  UL scanSector(UL sector);
+
+public:
+  FlashLogClass();
+  BOOL Init(Flashee::FlashDevice* pFlash, UL addr, UL size);
+  BOOL IsReady() { return(m_pFlash != NULL); }
+
+  BOOL Append(UC level, const char *tag, const char *msg);
+  BOOL Flush();
+  void Process();
+
+  static int FormatRecord(char *buf, int size, const FlashLogRecord_t &rec, const char *msg);
+  UL ReadRecords(FlashLogReader_t reader, void *param, UL skip = 0);
+  UL CountRecords();
+  void PrintRecords(UL lines);
+};
+
+#endif /* xlxFlashLog_h */
@@ -0,0 +1,479 @@
+/**
+ * xlxLightEngine.cpp - Xlight timed light transitions and effects with RF frame pacing
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. A transition fades each ring of a lamp from its current Hue_t to the
+ *    target. Frames are computed from the elapsed time in fixed point
+ *    (progress 0..65536), so a skipped frame costs nothing: the next one
+ *    is simply further along. The last frame is exactly the target
+ * 2. Frames are pulled, not queued: a lamp gets a frame when it is due,
+ *    its link is idle and there is airtime. Only changed rings are sent,
+ *    all three in one message if they are equal
+ * 3. Airtime is a token bucket of LIGHT_RF_RATE messages per second shared
+ *    round robin by all lamps. A lamp with a message still in flight
+ *    (radio worker) is skipped, a lamp whose frame failed backs off from
+ *    LIGHT_BACKOFF_MIN up to LIGHT_BACKOFF_MAX
+ * 4. Intermediate frames don't touch DevStatus and aren't published, the
+ *    last frame goes the usual way through OnMessageSent()
+ * 5. Effects are the same pulled frames, rendered from the elapsed time
+ *    and a few bytes of state per lamp: breathe and candle scale the base
+ *    rings, rainbow turns the hue wheel. A lamp that is throttled or busy
+ *    just skips ahead, frames that would be superseded are never queued
+ * 6. Lamps that are failing are served after the healthy ones, so a dead
+ *    lamp neither eats airtime nor delays the others. If there was nothing
+ *    left, it goes first next time: one frame per backoff keeps probing
+ * 7. The engine is sized per instance: the controller drives one lamp per
+ *    device (LIGHT_MAX_LAMPS), the simulator in the tests goes up to 64
+ *
+ * Throughput model, nRF24L01+ at 1Mbps with setRetries(5,15):
+ *   - a delivered 32 byte message is ~0.4ms on air plus ~0.6ms for the
+ *     ack and turnarounds, i.e. ~1ms
+ *   - a lost one retries 15 times 1.5ms apart, ~25ms of blocked radio
+ *   - LIGHT_RF_RATE 100 keeps light frames at ~10% of the channel when
+ *     links are good, leaving room for sensors and commands
+ *   - frames per second of each lamp:
+ *       min(1000 / LIGHT_FRAME_INTERVAL, LIGHT_RF_RATE / (lamps x msgs))
+ *     msgs is 1 when the rings match, up to 3 otherwise. 1 lamp: 20fps,
+ *     8 lamps: 12.5fps, 16 lamps: 6.25fps (2fps with 3 different rings)
+ *   - simulated effects, one failing lamp: breathe and candle 18.5, 6.6
+ *     and 1.6fps for 1, 16 and 64 lamps; rainbow (3 rings) 19.8, 2.2 and
+ *     0.5fps. 64 lamps is past what looks smooth, hence one per device
+ *
+ * ToDo:
+**/
+
+#include "xlxLightEngine.h"
+#include "xlxColor.h"
+#include "xlxLogger.h"
+
+#define LIGHT_FULL                65536UL
+#define LIGHT_RING_ALL            0x80        // Send ring 0 (all rings) in planFrame()
+#define LIGHT_NO_LAMP             0xFF
+
+//------------------------------------------------------------------
+// the one and only instance of LightEngineClass
+LightEngineClass theLightEngine;
+
+static const Hue_t lightBlack = {0, 0, 0, 0, 0, 0};
+
+static inline UC lerp8(UC a, UC b, UL progress)
+{
+  return a + (((int32_t)b - a) * (int32_t)progress >> 16);
+}
+
+static inline BOOL sameHue(const Hue_t &a, const Hue_t &b)
+{
+  return(a.State == b.State && a.CW == b.CW && a.WW == b.WW && a.R == b.R && a.G == b.G && a.B == b.B);
+}
+
+//------------------------------------------------------------------
+// Xlight Light Engine Class
+//------------------------------------------------------------------
+LightEngineClass::LightEngineClass(UC maxLamps)
+{
+  m_maxLamps = maxLamps;
+  m_lamps = new LightLamp_t[maxLamps];
+  Init(NULL);
+}
+
+void LightEngineClass::Init(LightSendFunc_t send)
+{
+  memset(m_lamps, 0x00, sizeof(LightLamp_t) * m_maxLamps);
+  m_send = send;
+  m_tokens = LIGHT_RF_BURST * 1000;
+  m_lastRefill = 0;
+  m_now = 0;
+  m_next = 0;
+  m_probe = LIGHT_NO_LAMP;
+  m_sent = 0;
+  m_failed = 0;
+  m_throttled = 0;
+}
+
+// A ring that is off fades from or to black
+void LightEngineClass::Interpolate(const Hue_t &from, const Hue_t &to, UL progress, Hue_t &out)
+{
+  if( progress >= LIGHT_FULL || (!from.State && !to.State) ) {
+    out = to;
+    return;
+  }
+  out.State = (to.State ? to.State : from.State);
+  out.CW = lerp8(from.State ? from.CW : 0, to.State ? to.CW : 0, progress);
+  out.WW = lerp8(from.State ? from.WW : 0, to.State ? to.WW : 0, progress);
+  out.R = lerp8(from.State ? from.R : 0, to.State ? to.R : 0, progress);
+  out.G = lerp8(from.State ? from.G : 0, to.State ? to.G : 0, progress);
+  out.B = lerp8(from.State ? from.B : 0, to.State ? to.B : 0, progress);
+}
+
+LightLamp_t *LightEngineClass::findLamp(UC node_id)
+{
+  for( UC i = 0; i < m_maxLamps; i++ ) {
+    if( m_lamps[i].node_id == node_id && (m_lamps[i].mode != lightIdle || m_lamps[i].inflight > 0) )
+      return &m_lamps[i];
+  }
+  return NULL;
+}
+
+LightLamp_t *LightEngineClass::allocLamp(UC node_id)
+{
+  for( UC i = 0; i < m_maxLamps; i++ ) {
+    if( m_lamps[i].mode == lightIdle && m_lamps[i].inflight == 0 ) {
+      memset(&m_lamps[i], 0x00, sizeof(LightLamp_t));
+      m_lamps[i].node_id = node_id;
+      return &m_lamps[i];
+    }
+  }
+  return NULL;
+}
+
+BOOL LightEngineClass::Fade(UC node_id, const Hue_t *from, const Hue_t *to, UL duration)
+{
+  LightLamp_t *lv_lamp = findLamp(node_id);
+  if( lv_lamp ) {
+    // Retarget, go on from the last frame
+    if( lv_lamp->mode != lightIdle ) from = lv_lamp->cur;
+  } else {
+    lv_lamp = allocLamp(node_id);
+    if( !lv_lamp ) return false;
+  }
+
+  for( UC r = 0; r < LIGHT_RINGS; r++ ) {
+    lv_lamp->from[r] = from[r];
+    lv_lamp->to[r] = to[r];
+    lv_lamp->cur[r] = from[r];
+  }
+  lv_lamp->mode = lightFade;
+  lv_lamp->duration = duration;
+  lv_lamp->started = false;
+  lv_lamp->final = false;
+  lv_lamp->fails = 0;
+  lv_lamp->frames = 0;
+  lv_lamp->skipped = 0;
+  return true;
+}
+
+BOOL LightEngineClass::Effect(UC node_id, UC effect, const Hue_t *base, UL period, UL duration, UC level)
+{
+  LightLamp_t *lv_lamp = findLamp(node_id);
+
+  if( effect == effectNone ) {
+    // Back to the base rings with the next frame
+    if( lv_lamp && lv_lamp->mode == lightEffect ) {
+      lv_lamp->duration = 1;
+      lv_lamp->final = false;
+    }
+    return true;
+  }
+  if( effect >= effectMax ) return false;
+
+  if( !lv_lamp ) {
+    lv_lamp = allocLamp(node_id);
+    if( !lv_lamp ) return false;
+    for( UC r = 0; r < LIGHT_RINGS; r++ ) lv_lamp->cur[r] = base[r];
+    // Nothing known about the lamp yet
+    lv_lamp->resync = true;
+  }
+
+  for( UC r = 0; r < LIGHT_RINGS; r++ ) {
+    lv_lamp->from[r] = base[r];
+    lv_lamp->to[r] = base[r];
+  }
+  lv_lamp->mode = lightEffect;
+  lv_lamp->effect = effect;
+  lv_lamp->period = (period > 0 && period <= 0xFFFF ? period : LIGHT_EFFECT_PERIOD);
+  lv_lamp->level = (effect == effectCandle ? 255 : level);
+  lv_lamp->seed = node_id * 40503U + 1;
+  lv_lamp->duration = duration;
+  lv_lamp->started = false;
+  lv_lamp->final = false;
+  lv_lamp->fails = 0;
+  lv_lamp->frames = 0;
+  lv_lamp->skipped = 0;
+  return true;
+}
+
+void LightEngineClass::renderEffect(LightLamp_t &lamp, UL elapsed, Hue_t *frame)
+{
+  // Position in the cycle, 0..65535
+  UL lv_phase = ((elapsed % lamp.period) << 16) / lamp.period;
+  UL lv_level;
+
+  switch( lamp.effect ) {
+  case effectBreathe:
+    // Triangle squared eases in and out, 1/8 at the bottom keeps it lit
+    lv_level = (lv_phase < 32768 ? lv_phase : 65535 - lv_phase) >> 7;
+    lv_level = 8192 + lv_level * lv_level * 7 / 8;
+    for( UC r = 0; r < LIGHT_RINGS; r++ )
+      Interpolate(lightBlack, lamp.to[r], lv_level, frame[r]);
+    break;
+
+  case effectRainbow:
+    for( UC r = 0; r < LIGHT_RINGS; r++ )
+      ColorFromHSV(((lv_phase * 360) >> 16) + r * 120, 255, lamp.level, frame[r]);
+    break;
+
+  case effectCandle:
+    // New random target each frame, smoothed 3:1 so it flickers, not blinks
+    lamp.seed = lamp.seed * 25173U + 13849U;
+    lamp.level = (lamp.level * 3 + 160 + (lamp.seed >> 8) % 96 + 2) / 4;
+    for( UC r = 0; r < LIGHT_RINGS; r++ )
+      Interpolate(lightBlack, lamp.to[r], (UL)lamp.level << 8, frame[r]);
+    break;
+
+  default:
+    for( UC r = 0; r < LIGHT_RINGS; r++ ) frame[r] = lamp.to[r];
+    break;
+  }
+}
+
+void LightEngineClass::Stop(UC node_id)
+{
+  LightLamp_t *lv_lamp = findLamp(node_id);
+  if( lv_lamp ) lv_lamp->mode = lightIdle;
+}
+
+BOOL LightEngineClass::IsActive()
+{
+  for( UC i = 0; i < m_maxLamps; i++ ) {
+    if( m_lamps[i].mode != lightIdle ) return true;
+  }
+  return false;
+}
+
+const Hue_t *LightEngineClass::GetCurrent(UC node_id)
+{
+  LightLamp_t *lv_lamp = findLamp(node_id);
+  if( lv_lamp && lv_lamp->mode != lightIdle ) return lv_lamp->cur;
+  return NULL;
+}
+
+const Hue_t *LightEngineClass::GetTarget(UC node_id)
+{
+  LightLamp_t *lv_lamp = findLamp(node_id);
+  if( lv_lamp && lv_lamp->mode != lightIdle ) return lv_lamp->to;
+  return NULL;
+}
+
+UL LightEngineClass::GetFrames(UC node_id)
+{
+  for( UC i = 0; i < m_maxLamps; i++ ) {
+    if( m_lamps[i].node_id == node_id ) return m_lamps[i].frames;
+  }
+  return 0;
+}
+
+// Rings to send, 0 if nothing changed
+UC LightEngineClass::planFrame(LightLamp_t &lamp, const Hue_t *frame, BOOL final)
+{
+  UC lv_rings = 0;
+  for( UC r = 0; r < LIGHT_RINGS; r++ ) {
+    if( final || lamp.resync || !sameHue(frame[r], lamp.cur[r]) ) lv_rings |= (1 << r);
+  }
+  if( lv_rings == 0x07 && sameHue(frame[0], frame[1]) && sameHue(frame[0], frame[2]) )
+    lv_rings = LIGHT_RING_ALL;
+  return lv_rings;
+}
+
+void LightEngineClass::sendFrame(LightLamp_t &lamp, const Hue_t *frame, UC rings)
+{
+  // Hold a reference, synchronous results come back while sending
+  lamp.inflight++;
+  lamp.frameFailed = false;
+  for( UC r = 0; r < LIGHT_RINGS; r++ ) {
+    if( rings != LIGHT_RING_ALL && !(rings & (1 << r)) ) continue;
+    lamp.inflight++;
+    if( m_send && (*m_send)(lamp.node_id, (rings == LIGHT_RING_ALL ? 0 : r + 1), frame[r]) ) {
+      m_sent++;
+    } else {
+      lamp.inflight--;
+      lamp.frameFailed = true;
+    }
+    if( rings == LIGHT_RING_ALL ) break;
+  }
+  for( UC r = 0; r < LIGHT_RINGS; r++ ) lamp.cur[r] = frame[r];
+  lamp.frames++;
+
+  if( --lamp.inflight == 0 ) endFrame(lamp);
+}
+
+// All results of a frame are in
+void LightEngineClass::endFrame(LightLamp_t &lamp)
+{
+  if( lamp.frameFailed ) {
+    m_failed++;
+    if( lamp.fails < 0xFF ) lamp.fails++;
+    UL lv_backoff = LIGHT_BACKOFF_MIN << (lamp.fails < 5 ? lamp.fails - 1 : 4);
+    lamp.holdUntil = m_now + (lv_backoff < LIGHT_BACKOFF_MAX ? lv_backoff : LIGHT_BACKOFF_MAX);
+    lamp.resync = true;
+    if( lamp.final ) {
+      if( lamp.fails >= LIGHT_FINAL_RETRIES ) {
+        LOGW(LOGTAG_MSG, "Transition of node %d failed", lamp.node_id);
+        lamp.mode = lightIdle;
+      }
+      lamp.final = false;
+    }
+    return;
+  }
+
+  lamp.fails = 0;
+  lamp.resync = false;
+  if( lamp.final ) lamp.mode = lightIdle;
+}
+
+// Link busy or backing off: skip, the next frame catches up
+BOOL LightEngineClass::isDue(const LightLamp_t &lamp)
+{
+  if( lamp.mode == lightIdle || lamp.inflight > 0 ) return false;
+  if( (long)(m_now - lamp.holdUntil) < 0 ) return false;
+  return(m_now - lamp.lastFrame >= LIGHT_FRAME_INTERVAL);
+}
+
+// Returns false if the lamp is due but there is no airtime left
+BOOL LightEngineClass::serveLamp(LightLamp_t &lamp)
+{
+  Hue_t lv_frame[LIGHT_RINGS];
+
+  if( !lamp.started ) {
+    lamp.started = true;
+    lamp.start = m_now;
+    lamp.lastFrame = m_now - LIGHT_FRAME_INTERVAL;
+    lamp.holdUntil = m_now;
+  }
+  if( !isDue(lamp) ) return true;
+
+  UL lv_elapsed = m_now - lamp.start;
+  BOOL lv_final;
+  if( lamp.mode == lightEffect ) {
+    lv_final = (lamp.duration > 0 && lv_elapsed >= lamp.duration);
+    if( lv_final ) {
+      for( UC r = 0; r < LIGHT_RINGS; r++ ) lv_frame[r] = lamp.to[r];
+    } else {
+      renderEffect(lamp, lv_elapsed, lv_frame);
+    }
+  } else {
+    UL lv_progress;
+    if( lv_elapsed >= lamp.duration ) {
+      lv_progress = LIGHT_FULL;
+    } else {
+      lv_progress = (UL)(((uint64_t)lv_elapsed << 16) / lamp.duration);
+    }
+    lv_final = (lv_progress >= LIGHT_FULL);
+    for( UC r = 0; r < LIGHT_RINGS; r++ )
+      Interpolate(lamp.from[r], lamp.to[r], lv_progress, lv_frame[r]);
+  }
+
+  UC lv_rings = planFrame(lamp, lv_frame, lv_final);
+  if( lv_rings == 0 ) {
+    // Nothing visible changed
+    lamp.lastFrame = m_now;
+    lamp.skipped++;
+    return true;
+  }
+
+  UL lv_cost = (lv_rings == LIGHT_RING_ALL ? 1 : ((lv_rings & 1) + ((lv_rings >> 1) & 1) + ((lv_rings >> 2) & 1))) * 1000;
+  if( m_tokens < lv_cost ) {
+    m_throttled++;
+    return false;
+  }
+  m_tokens -= lv_cost;
+  lamp.lastFrame = m_now;
+  lamp.final = lv_final;
+  sendFrame(lamp, lv_frame, lv_rings);
+  return true;
+}
+
+// Remember a failing lamp that is due but won't get airtime
+void LightEngineClass::starveProbe(UC from)
+{
+  if( m_probe < m_maxLamps ) return;
+  for( UC k = from; k < m_maxLamps; k++ ) {
+    UC i = (m_next + k) % m_maxLamps;
+    if( m_lamps[i].fails > 0 && isDue(m_lamps[i]) ) {
+      m_probe = i;
+      return;
+    }
+  }
+}
+
+BOOL LightEngineClass::Process(UL now)
+{
+  m_now = now;
+  UL lv_elapsed = now - m_lastRefill;
+  m_lastRefill = now;
+  if( lv_elapsed > 1000 ) lv_elapsed = 1000;
+  m_tokens += lv_elapsed * LIGHT_RF_RATE;
+  if( m_tokens > LIGHT_RF_BURST * 1000 ) m_tokens = LIGHT_RF_BURST * 1000;
+
+  if( !IsActive() ) return false;
+
+  // A failing lamp that was starved gets the first frame
+  if( m_probe < m_maxLamps ) {
+    if( !serveLamp(m_lamps[m_probe]) ) return true;
+    m_probe = LIGHT_NO_LAMP;
+  }
+
+  // Healthy lamps first, then the failing ones with what is left
+  for( UC lv_pass = 0; lv_pass < 2; lv_pass++ ) {
+    for( UC k = 0; k < m_maxLamps; k++ ) {
+      UC i = (m_next + k) % m_maxLamps;
+      LightLamp_t &lv_lamp = m_lamps[i];
+      if( lv_lamp.mode == lightIdle ) continue;
+      if( (lv_lamp.fails > 0) != (lv_pass > 0) ) continue;
+      if( !serveLamp(lv_lamp) ) {
+        // Out of airtime, this lamp goes first next time
+        if( lv_pass == 0 ) m_next = i;
+        starveProbe(lv_pass == 0 ? 0 : k);
+        return true;
+      }
+    }
+  }
+
+  m_next = (m_next + 1) % m_maxLamps;
+  return true;
+}
+
+BOOL LightEngineClass::OnSendResult(UC node_id, BOOL ok)
+{
+  // Any result for the node while a frame is out is taken as the frame's
+  LightLamp_t *lv_lamp = findLamp(node_id);
+  if( !lv_lamp || lv_lamp->inflight == 0 ) return false;
+
+  BOOL lv_final = lv_lamp->final;
+  if( !ok ) lv_lamp->frameFailed = true;
+  if( --lv_lamp->inflight == 0 ) endFrame(*lv_lamp);
+  return !lv_final;
+}
+
+void LightEngineClass::PrintStatus()
+{
+  SERIAL_LN("Light engine: sent %lu, failed frames %lu, throttled %lu, tokens %lu/%d",
+      m_sent, m_failed, m_throttled, m_tokens / 1000, LIGHT_RF_BURST);
+  for( UC i = 0; i < m_maxLamps; i++ ) {
+    LightLamp_t &lv_lamp = m_lamps[i];
+    if( lv_lamp.mode == lightIdle ) continue;
+    UL lv_elapsed = (lv_lamp.started ? m_now - lv_lamp.start : 0);
+    if( lv_lamp.mode == lightEffect ) {
+      SERIAL_LN("  node %d: effect %d period %ums, %lu/%lums, frames %lu, skipped %lu, fails %d, in flight %d",
+          lv_lamp.node_id, lv_lamp.effect, lv_lamp.period, lv_elapsed, lv_lamp.duration, lv_lamp.frames, lv_lamp.skipped, lv_lamp.fails, lv_lamp.inflight);
+    } else {
+      SERIAL_LN("  node %d: fade %lu/%lums, frames %lu, skipped %lu, fails %d, in flight %d",
+          lv_lamp.node_id, lv_elapsed, lv_lamp.duration, lv_lamp.frames, lv_lamp.skipped, lv_lamp.fails, lv_lamp.inflight);
+    }
+  }
+}
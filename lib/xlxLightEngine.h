@@ -0,0 +1,131 @@
+//  xlxLightEngine.h - Xlight timed light transitions and effects with RF frame pacing
+
+#ifndef xlxLightEngine_h
+#define xlxLightEngine_h
+
+#include "xliCommon.h"
+#include "xliConfig.h"
+#include "xlxConfig.h"
+
+#define LIGHT_MAX_LAMPS           MAX_DEVICE_PER_CONTROLLER   // Default, one per device
+#define LIGHT_RINGS               3
+#define LIGHT_FRAME_INTERVAL      50          // ms, fastest frame pace of a lamp (20fps)
+#define LIGHT_RF_RATE             100         // Light messages per second, see throughput model
+#define LIGHT_RF_BURST            8           // Messages sent back to back at most
+#define LIGHT_BACKOFF_MIN         200         // ms of silence after a failed frame, doubles
+#define LIGHT_BACKOFF_MAX         3200
+#define LIGHT_FINAL_RETRIES       5           // Attempts of the last frame of a transition
+#define LIGHT_EFFECT_PERIOD       4000        // ms, default cycle of breathe and rainbow
+
+// Lamp modes
+typedef enum
+{
+  lightIdle = 0,
+  lightFade,
+  lightEffect
+} lightMode_t;
+
+// Effects, also the filter field of a scenario
+typedef enum
+{
+  effectNone = 0,
+  effectBreathe,                            // Base rings pulse between 1/8 and full
+  effectRainbow,                            // Hue wheel, rings 120 degrees apart
+  effectCandle,                             // Base rings flicker at random
+  effectMax
+} lightEffect_t;
+
+// Send one ring (0 for all) of a lamp. Returns false if it couldn't be sent
+// or queued, otherwise the result comes back later through OnSendResult()
+typedef BOOL (*LightSendFunc_t)(UC node_id, UC ring, const Hue_t &hue);
+
+typedef struct
+{
+  UC node_id;
+  UC mode;                                  // lightMode_t
+  UC inflight;                              // Messages waiting for a send result
+  UC fails;                                 // Consecutive failed frames
+  UC effect;                                // lightEffect_t
+  UC level;                                 // Rainbow value, candle flicker state
+  US seed;                                  // Candle random state
+  US period;                                // ms of an effect cycle
+  BOOL started;                             // Clock starts at the first Process()
+  BOOL final;                               // The last frame is on its way
+  BOOL frameFailed;
+  BOOL resync;                              // Lamp state unsure, send all rings
+  UL start;                                 // ms
+  UL duration;                              // Effects: 0 runs until stopped
+  UL lastFrame;
+  UL holdUntil;                             // Backoff after failure
+  Hue_t from[LIGHT_RINGS];
+  Hue_t to[LIGHT_RINGS];                    // Target, base rings of an effect
+  Hue_t cur[LIGHT_RINGS];                   // Last frame sent
+  UL frames;
+  UL skipped;
+} LightLamp_t;
+
+//------------------------------------------------------------------
+// Xlight Light Engine Class
+//------------------------------------------------------------------
+class LightEngineClass
+{
+private:
+  LightLamp_t *m_lamps;
+  UC m_maxLamps;
+  LightSendFunc_t m_send;
+  UL m_tokens;                              // Token bucket, 1/1000 message
+  UL m_lastRefill;
+  UL m_now;
+  UC m_next;                                // Round robin start
+  UC m_probe;                               // Failing lamp starved last time
+  UL m_sent;
+  UL m_failed;
+  UL m_throttled;
+
+  LightLamp_t *findLamp(UC node_id);
+  LightLamp_t *allocLamp(UC node_id);
+  void renderEffect(LightLamp_t &lamp, UL elapsed, Hue_t *frame);
+  BOOL isDue(const LightLamp_t &lamp);
+  BOOL serveLamp(LightLamp_t &lamp);
+  void starveProbe(UC from);
+  UC planFrame(LightLamp_t &lamp, const Hue_t *frame, BOOL final);
+  void sendFrame(LightLamp_t &lamp, const Hue_t *frame, UC rings);
+  void endFrame(LightLamp_t &lamp);
+
+public:
+  LightEngineClass(UC maxLamps = LIGHT_MAX_LAMPS);
+  void Init(LightSendFunc_t send);
+
+  // progress: 0..65536, fixed point fraction of the transition
+  static void Interpolate(const Hue_t &from, const Hue_t &to, UL progress, Hue_t &out);
+
+  // Fade a lamp from its current rings to the target over duration ms,
+  // 0 for instant. A lamp already moving continues from where it is
+  BOOL Fade(UC node_id, const Hue_t *from, const Hue_t *to, UL duration);
+  // Run an effect on top of the base rings for duration ms, 0 until stopped.
+  // period 0 for LIGHT_EFFECT_PERIOD, level is the rainbow brightness.
+  // effectNone ends a running effect on its base rings
+  BOOL Effect(UC node_id, UC effect, const Hue_t *base, UL period, UL duration, UC level = 255);
+  void Stop(UC node_id);
+  BOOL IsActive();
+  // Rings of a lamp as last sent, NULL if the engine doesn't drive it
+  const Hue_t *GetCurrent(UC node_id);
+  // Target of a fade, base rings of an effect, NULL if none
+  const Hue_t *GetTarget(UC node_id);
+
+  // Send due frames, returns false once all lamps are idle
+  BOOL Process(UL now);
+  // Returns true if the message was an intermediate frame, i.e. nothing
+  // else (DevStatus, publishing) should happen with it
+  BOOL OnSendResult(UC node_id, BOOL ok);
+
+  UL GetFrames(UC node_id);
+  void PrintStatus();
+};
+
+//------------------------------------------------------------------
+// Function & Class Helper
+//------------------------------------------------------------------
+extern LightEngineClass theLightEngine;
+
+#endif /* xlxLightEngine_h */
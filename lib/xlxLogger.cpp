@@ -20,16 +20,17 @@
  * DESCRIPTION
  * 1. Define basic interfaces
  * 2. Serial logging
+ * 3. Flash logging, in a loop overwrite ring (see xlxFlashLog.cpp)
+ * 4. Syslog over UDP, queued and sent from main loop (see xlxSysLog.cpp)
  *
  * ToDo:
- * 1. syslog, refer to psyslog.cpp
- * 2. http/cloud
- * 3. Flash
- * 4. Offline Data Cache in Flash (loop overwrite)
+ * 1. http/cloud
 **/
 
 #include "xlxLogger.h"
 #include "xlSmartController.h"
+#include "xliPinMap.h"
+#include "xlxSerialConsole.h"
 
 // the one and only instance of LoggerClass
 LoggerClass theLog = LoggerClass();
@@ -52,16 +53,23 @@ void LoggerClass::Init(String sysid)
   m_SysID = sysid;
 }
 
-BOOL LoggerClass::InitFlash(UL addr, UL size)
+BOOL LoggerClass::InitFlash(Flashee::FlashDevice* pFlash, UL addr, UL size)
 {
-  //ToDo:
-  return true;
+#ifdef MCU_TYPE_P1
+  return m_flashLog.Init(pFlash, addr, size);
+#else
+  return false;
+#endif
 }
 
 BOOL LoggerClass::InitSysLog(String host, US port)
 {
-  //ToDo:
-  return true;
+  IPAddress lv_server;
+  if( host.length() == 0 ) return false;
+  if( !theConsole.String2IP(host.c_str(), lv_server) ) return false;
+  if( lv_server == IPAddress(0UL) ) return false;
+
+  return m_sysLog.Init(lv_server, port);
 }
 
 BOOL LoggerClass::InitCloud(String url, String uid, String key)
@@ -98,24 +106,55 @@ void LoggerClass::WriteLog(UC level, const char *tag, const char *msg, ...)
   va_list args;
   va_start(args, msg);
   nSize = vsnprintf(buf + nPos, MAX_MESSAGE_LEN - nPos, msg, args);
+  va_end(args);
 
   // Send message to serial port
   if( level <= m_level[LOGDEST_SERIAL] )
   {
-    Serial.println(buf);
+    gSerialOut.println(buf);
   }
 
   // Output Log to Particle cloud variable
-  buf[nSize] = NULL;
   if( level <= m_level[LOGDEST_CLOUD] ) {
     theSys.PublishLog(buf);
   }
 
-  // ToDo: send log to other destinations
-  //if( level <= m_level[LOGDEST_SYSLOG] ) {
-  //;}
-  //if( level <= m_level[LOGDEST_FLASH] ) {
-  //}
+  // Keep message in flash, timestamp is stored in binary
+  if( level <= m_level[LOGDEST_FLASH] ) {
+    m_flashLog.Append(level, tag, buf + nPos);
+    // Don't lose serious problems on a sudden reset
+    if( level <= LEVEL_CRITICAL ) m_flashLog.Flush();
+  }
+
+  // Queue message for syslog server, sent later from main loop
+  if( level <= m_level[LOGDEST_SYSLOG] && m_sysLog.IsReady() ) {
+    m_sysLog.Append(level, tag, buf + nPos, m_SysID.c_str());
+  }
+}
+
+// Called from main loop
+void LoggerClass::Process()
+{
+  m_flashLog.Process();
+  m_sysLog.Process();
+}
+
+// Write pending flash records, e.g. before reset
+void LoggerClass::FlushFlash()
+{
+  m_flashLog.Flush();
+}
+
+// Print recent flash log records, 0 means all
+void LoggerClass::PrintFlashLog(UL lines)
+{
+  m_flashLog.PrintRecords(lines);
+}
+
+// Walk through all flash log records, from the oldest
+UL LoggerClass::ReadFlashLog(FlashLogReader_t reader, void *param)
+{
+  return m_flashLog.ReadRecords(reader, param);
 }
 
 bool LoggerClass::ChangeLogLevel(String &strMsg)
@@ -168,6 +207,10 @@ String LoggerClass::PrintDestInfo()
     strShortDesc += "@";
     strShortDesc += strDestNames[lv_Dest];
   }
+  if( m_sysLog.IsReady() ) {
+    SERIAL_LN("syslog sent: %lu, queued: %lu bytes, dropped: %lu",
+        m_sysLog.GetSent(), m_sysLog.GetQueueLength(), m_sysLog.GetDropped());
+  }
   SERIAL_LN("");
 
   return strShortDesc;
@@ -4,6 +4,8 @@
 #define xlxLogger_h
 
 #include "xliCommon.h"
+#include "xlxFlashLog.h"
+#include "xlxSysLog.h"
 
 #define MAX_MESSAGE_LEN     480
 
@@ -43,18 +45,24 @@ class LoggerClass
 private:
   UC m_level[LOGDEST_DUMMY];
   String m_SysID;
+  FlashLogClass m_flashLog;
+  SysLogClass m_sysLog;
 
 public:
   LoggerClass();
   void Init(String sysid);
 
-  BOOL InitFlash(UL addr, UL size);
+  BOOL InitFlash(Flashee::FlashDevice* pFlash, UL addr, UL size);
   BOOL InitSysLog(String host, US port);
   BOOL InitCloud(String url, String uid, String key);
 
   UC GetLevel(UC logDest);
   void SetLevel(UC logDest, UC logLevel);
   void WriteLog(UC level, const char *tag, const char *msg, ...);
+  void Process();
+  void FlushFlash();
+  void PrintFlashLog(UL lines);
+  UL ReadFlashLog(FlashLogReader_t reader, void *param);
   bool ChangeLogLevel(String &strMsg);
   String PrintDestInfo();
 };
@@ -0,0 +1,329 @@
+/**
+ * xlxMQTTClient.cpp - Xlight MQTT channel for cloud commands and telemetry
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. Works alongside Particle cloud objects, without the 63 bytes argument
+ *    and 1 event per second limits
+ * 2. Subscribe <root>/<SysID>/cmd and <root>/<SysID>/config, messages are
+ *    passed to CldJSONCommand and CldJSONConfig respectively. A payload that
+ *    doesn't fit the receive buffer is rejected, never parsed cut
+ * 3. Publish sensor data and device status through a bounded FIFO of QoS1
+ *    messages. A message leaves the queue only after PUBACK, so it survives
+ *    reconnection. When the queue is full, the oldest message is dropped
+ * 4. Reconnect is attempted every MQTT_RECONNECT_INTERVAL
+ * 5. Publishing <root>/<SysID>/get with "table" or "log" exports the whole
+ *    DevStatus table or the flash log. These payloads are larger than the
+ *    MQTT packet buffer, so they are streamed to the TCP client in two
+ *    passes: the first one measures the length, the second one writes
+ *
+ * ToDo:
+**/
+
+#include "xlxMQTTClient.h"
+#include "xlSmartController.h"
+#include "xlxLogger.h"
+
+//------------------------------------------------------------------
+// the one and only instance of MQTTClientClass
+MQTTClientClass theMQTT;
+
+//------------------------------------------------------------------
+// Global Callback Function Helper
+void gc_mqttCallback(char *topic, uint8_t *payload, unsigned int length) { theMQTT.OnMessage(topic, payload, length); }
+void gc_mqttQosCallback(unsigned int msgId) { theMQTT.OnAck(msgId); }
+
+//------------------------------------------------------------------
+// Xlight MQTT Client Class
+//------------------------------------------------------------------
+MQTTClientClass::MQTTClientClass()
+{
+  m_pClient = NULL;
+  m_lastConnect = 0;
+  m_head = 0;
+  m_count = 0;
+  m_sent = 0;
+  m_acked = 0;
+  m_dropped = 0;
+  m_received = 0;
+  m_oversized = 0;
+  m_request = 0;
+  memset(m_queue, 0x00, sizeof(m_queue));
+}
+
+BOOL MQTTClientClass::Init(const char *host, US port, String clientID)
+{
+  if( strlen(host) == 0 ) return false;
+
+  if( !m_pClient ) {
+    m_host = host;
+    m_clientID = clientID;
+    m_pClient = new MQTT(const_cast<char *>(m_host.c_str()), port, gc_mqttCallback);
+    if( !m_pClient ) return false;
+    m_pClient->addQosCallback(gc_mqttQosCallback);
+  }
+
+  return reconnect();
+}
+
+BOOL MQTTClientClass::IsConnected()
+{
+  return(m_pClient && m_pClient->isConnected());
+}
+
+void MQTTClientClass::makeTopic(char *topic, const char *leaf)
+{
+  snprintf(topic, MQTT_MAX_TOPIC, "%s/%s/%s", XLA_MQTT_TOPIC_ROOT, m_clientID.c_str(), leaf);
+}
+
+BOOL MQTTClientClass::reconnect()
+{
+  char lv_topic[MQTT_MAX_TOPIC];
+
+  m_lastConnect = millis();
+  if( !WiFi.ready() ) return false;
+  if( !m_pClient->connect(m_clientID.c_str()) ) {
+    LOGW(LOGTAG_MSG, "MQTT failed to connect %s", m_host.c_str());
+    return false;
+  }
+
+  makeTopic(lv_topic, MQTT_TOPIC_CMD);
+  m_pClient->subscribe(lv_topic, MQTT::QOS1);
+  makeTopic(lv_topic, MQTT_TOPIC_CONFIG);
+  m_pClient->subscribe(lv_topic, MQTT::QOS1);
+  makeTopic(lv_topic, MQTT_TOPIC_GET);
+  m_pClient->subscribe(lv_topic, MQTT::QOS1);
+
+  // Message IDs restart from 1 on a new session, send unacked messages again
+  for( UC i = 0; i < m_count; i++ ) {
+    MQTTMessage_t &lv_msg = m_queue[(m_head + i) % MQTT_QUEUE_SLOTS];
+    if( lv_msg.state == mqttSlotInflight ) lv_msg.state = mqttSlotPending;
+  }
+
+  LOGN(LOGTAG_MSG, "MQTT connected to %s, %d messages queued", m_host.c_str(), m_count);
+  return true;
+}
+
+// Called from main loop
+void MQTTClientClass::Process()
+{
+  if( !m_pClient ) return;
+
+  if( !m_pClient->isConnected() ) {
+    if( millis() - m_lastConnect < MQTT_RECONNECT_INTERVAL ) return;
+    if( !reconnect() ) return;
+  }
+
+  m_pClient->loop();
+  // The library drops packets bigger than its buffer before OnMessage() sees them
+  if( m_pClient->getOversized() != m_oversized ) {
+    LOGW(LOGTAG_MSG, "MQTT dropped %lu packet(s) over %d bytes",
+        m_pClient->getOversized() - m_oversized, MQTT_MAX_PACKET_SIZE);
+    m_oversized = m_pClient->getOversized();
+  }
+  sendPending();
+
+  // Serve export requests
+  if( m_request & MQTT_REQ_TABLE ) {
+    m_request &= ~MQTT_REQ_TABLE;
+    ExportDevStatusTable();
+  }
+  if( m_request & MQTT_REQ_LOG ) {
+    m_request &= ~MQTT_REQ_LOG;
+    ExportFlashLog();
+  }
+}
+
+void MQTTClientClass::sendPending()
+{
+  char lv_topic[MQTT_MAX_TOPIC];
+  UC lv_burst = 0;
+  UL lv_now = millis();
+
+  for( UC i = 0; i < m_count && lv_burst < MQTT_MAX_BURST; i++ ) {
+    MQTTMessage_t &lv_msg = m_queue[(m_head + i) % MQTT_QUEUE_SLOTS];
+    if( lv_msg.state == mqttSlotInflight && lv_now - lv_msg.sentTime >= MQTT_ACK_TIMEOUT ) {
+      lv_msg.state = mqttSlotPending;
+    }
+    if( lv_msg.state != mqttSlotPending ) continue;
+
+    makeTopic(lv_topic, lv_msg.leaf);
+    if( !m_pClient->publish(lv_topic, (const uint8_t *)lv_msg.payload, lv_msg.len,
+        false, MQTT::QOS1, &lv_msg.msgId) ) break;
+    lv_msg.state = mqttSlotInflight;
+    lv_msg.sentTime = lv_now;
+    m_sent++;
+    lv_burst++;
+  }
+}
+
+// Queue a message, it is sent from main loop
+BOOL MQTTClientClass::Publish(const char *leaf, const char *payload)
+{
+  if( !m_pClient ) return false;
+
+  US lv_len = strlen(payload);
+  if( lv_len > MQTT_QUEUE_PAYLOAD ) {
+    LOGW(LOGTAG_MSG, "MQTT payload too long: %d", lv_len);
+    return false;
+  }
+
+  if( m_count >= MQTT_QUEUE_SLOTS ) {
+    // Drop the oldest
+    m_queue[m_head].state = mqttSlotFree;
+    m_head = (m_head + 1) % MQTT_QUEUE_SLOTS;
+    m_count--;
+    m_dropped++;
+  }
+
+  MQTTMessage_t &lv_msg = m_queue[(m_head + m_count) % MQTT_QUEUE_SLOTS];
+  lv_msg.state = mqttSlotPending;
+  lv_msg.msgId = 0;
+  strncpy(lv_msg.leaf, leaf, sizeof(lv_msg.leaf) - 1);
+  lv_msg.leaf[sizeof(lv_msg.leaf) - 1] = '\0';
+  memcpy(lv_msg.payload, payload, lv_len);
+  lv_msg.len = lv_len;
+  m_count++;
+
+  return true;
+}
+
+void MQTTClientClass::OnMessage(char *topic, UC *payload, unsigned int length)
+{
+  char lv_buf[MQTT_MAX_PACKET_SIZE + 1];
+
+  // Always fits, oversized packets never get here, see Process()
+  m_received++;
+  memcpy(lv_buf, payload, length);
+  lv_buf[length] = '\0';
+
+  const char *lv_leaf = strrchr(topic, '/');
+  lv_leaf = (lv_leaf ? lv_leaf + 1 : topic);
+  if( strcmp(lv_leaf, MQTT_TOPIC_CMD) == 0 ) {
+    theSys.CldJSONCommand(lv_buf);
+  } else if( strcmp(lv_leaf, MQTT_TOPIC_CONFIG) == 0 ) {
+    theSys.CldJSONConfig(lv_buf);
+  } else if( strcmp(lv_leaf, MQTT_TOPIC_GET) == 0 ) {
+    if( strcmp(lv_buf, MQTT_TOPIC_TABLE) == 0 ) m_request |= MQTT_REQ_TABLE;
+    else if( strcmp(lv_buf, MQTT_TOPIC_LOG) == 0 ) m_request |= MQTT_REQ_LOG;
+  } else {
+    LOGW(LOGTAG_MSG, "MQTT unknown topic %s", topic);
+  }
+}
+
+void MQTTClientClass::OnAck(unsigned int msgId)
+{
+  for( UC i = 0; i < m_count; i++ ) {
+    MQTTMessage_t &lv_msg = m_queue[(m_head + i) % MQTT_QUEUE_SLOTS];
+    if( lv_msg.state == mqttSlotInflight && lv_msg.msgId == msgId ) {
+      lv_msg.state = mqttSlotFree;
+      m_acked++;
+      break;
+    }
+  }
+
+  // Release acknowledged messages at the front
+  while( m_count > 0 && m_queue[m_head].state == mqttSlotFree ) {
+    m_head = (m_head + 1) % MQTT_QUEUE_SLOTS;
+    m_count--;
+  }
+}
+
+// Stream DevStatus table as a JSON array, one row at a time
+BOOL MQTTClientClass::ExportDevStatusTable()
+{
+  char lv_topic[MQTT_MAX_TOPIC];
+  char lv_row[MQTT_QUEUE_PAYLOAD];
+  UL lv_total = 2;                          // []
+  ListNode<DevStatusRow_t> *rowptr;
+
+  if( !IsConnected() ) return false;
+
+  for( rowptr = theSys.DevStatus_table.getRoot(); rowptr; rowptr = rowptr->next ) {
+    if( rowptr != theSys.DevStatus_table.getRoot() ) lv_total++;
+    lv_total += theSys.FormatDevStatus(lv_row, sizeof(lv_row), rowptr->data);
+  }
+
+  makeTopic(lv_topic, MQTT_TOPIC_TABLE);
+  if( !m_pClient->beginPublish(lv_topic, lv_total, false, MQTT::QOS0, NULL) ) return false;
+  m_pClient->writePayload((const uint8_t *)"[", 1);
+  for( rowptr = theSys.DevStatus_table.getRoot(); rowptr; rowptr = rowptr->next ) {
+    if( rowptr != theSys.DevStatus_table.getRoot() ) m_pClient->writePayload((const uint8_t *)",", 1);
+    int nLen = theSys.FormatDevStatus(lv_row, sizeof(lv_row), rowptr->data);
+    m_pClient->writePayload((const uint8_t *)lv_row, nLen);
+  }
+  m_pClient->writePayload((const uint8_t *)"]", 1);
+  return m_pClient->endPublish();
+}
+
+typedef struct
+{
+  MQTT *client;
+  UL total;                                 // Bytes counted (pass 1)
+} MQTTLogStream_t;
+
+// Pass 1 (client is NULL) counts bytes, pass 2 writes lines
+bool MQTTClientClass::streamLogRecord(const FlashLogRecord_t &rec, const char *msg, void *param)
+{
+  MQTTLogStream_t *lv_pStream = (MQTTLogStream_t *)param;
+  char lv_line[FLASHLOG_MAX_MSG + 32];
+  int nLen = FlashLogClass::FormatRecord(lv_line, sizeof(lv_line) - 1, rec, msg);
+  if( nLen > (int)sizeof(lv_line) - 2 ) nLen = sizeof(lv_line) - 2;
+  lv_line[nLen++] = '\n';
+
+  if( lv_pStream->client ) {
+    // Stop at the declared length, newer records may have arrived in between
+    if( (UL)nLen > lv_pStream->total ) nLen = lv_pStream->total;
+    lv_pStream->client->writePayload((const uint8_t *)lv_line, nLen);
+    lv_pStream->total -= nLen;
+    return(lv_pStream->total > 0);
+  }
+  lv_pStream->total += nLen;
+  return true;
+}
+
+// Stream flash log as text lines, from the oldest
+BOOL MQTTClientClass::ExportFlashLog()
+{
+  char lv_topic[MQTT_MAX_TOPIC];
+  MQTTLogStream_t lv_stream = {NULL, 0};
+
+  if( !IsConnected() ) return false;
+
+  theLog.ReadFlashLog(streamLogRecord, &lv_stream);
+  if( lv_stream.total == 0 ) return true;
+
+  makeTopic(lv_topic, MQTT_TOPIC_LOG);
+  if( !m_pClient->beginPublish(lv_topic, lv_stream.total, false, MQTT::QOS0, NULL) ) return false;
+  lv_stream.client = m_pClient;
+  theLog.ReadFlashLog(streamLogRecord, &lv_stream);
+  // Pad if records were dropped in between, the declared length must be met
+  while( lv_stream.total > 0 ) {
+    m_pClient->writePayload((const uint8_t *)"\n", 1);
+    lv_stream.total--;
+  }
+  return m_pClient->endPublish();
+}
+
+void MQTTClientClass::PrintStatus()
+{
+  SERIAL_LN("**MQTT broker: %s, %s", (m_pClient ? m_host.c_str() : "not configured"),
+      (IsConnected() ? "connected" : "disconnected"));
+  SERIAL_LN("  queued: %d, sent: %lu, acked: %lu, dropped: %lu, received: %lu, oversized: %lu\n\r",
+      m_count, m_sent, m_acked, m_dropped, m_received, m_oversized);
+}
@@ -0,0 +1,97 @@
+//  xlxMQTTClient.h - Xlight MQTT channel for cloud commands and telemetry
+
+#ifndef xlxMQTTClient_h
+#define xlxMQTTClient_h
+
+#include "xliCommon.h"
+#include "mqtt.h"
+#include "xlxFlashLog.h"
+
+// Topic layout: <root>/<SysID>/<leaf>
+/// Subscribed
+#define MQTT_TOPIC_CMD            "cmd"             // -> CldJSONCommand
+#define MQTT_TOPIC_CONFIG         "config"          // -> CldJSONConfig
+#define MQTT_TOPIC_GET            "get"             // "table" or "log", export request
+/// Published
+#define MQTT_TOPIC_SENSOR         "sensor"          // Sensor data
+#define MQTT_TOPIC_DEVSTATUS      "status"          // Device status row
+#define MQTT_TOPIC_PRESENCE       "presence"        // Node presence transition
+#define MQTT_TOPIC_TABLE          "table"           // Whole DevStatus table, streamed
+#define MQTT_TOPIC_LOG            "log"             // Flash log export, streamed
+
+// Outbound QoS1 queue
+#define MQTT_QUEUE_SLOTS          8
+#define MQTT_QUEUE_PAYLOAD        192
+#define MQTT_MAX_TOPIC            48
+#define MQTT_MAX_BURST            2                 // Messages sent per process round
+
+#define MQTT_RECONNECT_INTERVAL   10000             // ms
+#define MQTT_ACK_TIMEOUT          10000             // ms, resend if no PUBACK
+
+// Export requests, served from main loop
+#define MQTT_REQ_TABLE            0x01
+#define MQTT_REQ_LOG              0x02
+
+typedef enum
+{
+  mqttSlotFree = 0,
+  mqttSlotPending,                          // Waiting to be sent
+  mqttSlotInflight                          // Sent, waiting for PUBACK
+} mqttSlotState_t;
+
+typedef struct
+{
+  UC state;
+  US msgId;
+  UL sentTime;
+  char leaf[8];
+  US len;
+  char payload[MQTT_QUEUE_PAYLOAD];
+} MQTTMessage_t;
+
+//------------------------------------------------------------------
+// Xlight MQTT Client Class
+//------------------------------------------------------------------
+class MQTTClientClass
+{
+private:
+  MQTT *m_pClient;
+  String m_host;
+  String m_clientID;
+  UL m_lastConnect;
+
+  MQTTMessage_t m_queue[MQTT_QUEUE_SLOTS];  // FIFO ring
+  UC m_head;
+  UC m_count;
+  UL m_sent;
+  UL m_acked;
+  UL m_dropped;
+  UL m_received;
+  UL m_oversized;                     // Last seen MQTT::getOversized()
+  UC m_request;
+
+  void makeTopic(char *topic, const char *leaf);
+  BOOL reconnect();
+  void sendPending();
+  static bool streamLogRecord(const FlashLogRecord_t &rec, const char *msg, void *param);
+
+public:
+  MQTTClientClass();
+  BOOL Init(const char *host, US port, String clientID);
+  BOOL IsConnected();
+  void Process();
+
+  BOOL Publish(const char *leaf, const char *payload);
+  BOOL ExportDevStatusTable();
+  BOOL ExportFlashLog();
+  void OnMessage(char *topic, UC *payload, unsigned int length);
+  void OnAck(unsigned int msgId);
+  void PrintStatus();
+};
+
+//------------------------------------------------------------------
+// Function & Class Helper
+//------------------------------------------------------------------
+extern MQTTClientClass theMQTT;
+
+#endif /* xlxMQTTClient_h */
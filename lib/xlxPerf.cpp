@@ -0,0 +1,144 @@
+/**
+ * xlxPerf.cpp - Xlight execution time profiler
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. PERF_PROBE wraps a statement with two reads of the cycle counter
+ *    (System.ticks), the duration goes into a log2 histogram along with
+ *    count, min, max and total. A probe costs well below 1us
+ * 2. Always on, each section is written from one context only (main loop
+ *    or system timer ISR), so no locking is needed
+ * 3. 'show perf' prints the statistics, the cloud variable 'perf' carries
+ *    a compact snapshot: name:count/avg/p99/max (us) per section
+ *
+ * ToDo:
+**/
+
+#include "xlxPerf.h"
+
+//------------------------------------------------------------------
+// the one and only instance of PerfClass
+PerfClass thePerf;
+
+const char *strPerfNames[] = {
+  "command",
+  "collect",
+  "rules",
+  "check",
+  "alarms",
+  "log",
+  "save",
+  "nodes",
+  "fastproc",
+  "cldTZ",
+  "cldPower",
+  "cldCmd",
+  "cldConfig"
+};
+
+//------------------------------------------------------------------
+// Xlight Profiler Class
+//------------------------------------------------------------------
+PerfClass::PerfClass()
+{
+  // Safe default until Init() reads the actual clock
+  m_ticksPerUs = 120;
+  Reset();
+}
+
+void PerfClass::Init()
+{
+  m_ticksPerUs = System.ticksPerMicrosecond();
+  if( m_ticksPerUs == 0 ) m_ticksPerUs = 1;
+  Reset();
+}
+
+void PerfClass::Reset()
+{
+  memset(m_stats, 0x00, sizeof(m_stats));
+  memset(m_lastUs, 0x00, sizeof(m_lastUs));
+  for( UC i = 0; i < perfSectionMax; i++ ) {
+    m_stats[i].minUs = 0xFFFFFFFF;
+  }
+  m_startTime = millis();
+}
+
+const char *PerfClass::GetName(UC id)
+{
+  return(id < perfSectionMax ? strPerfNames[id] : "?");
+}
+
+// Upper bound of the bucket where the percentile falls in, capped by max
+UL PerfClass::percentile(const PerfStat_t &stat, UC pct)
+{
+  if( stat.count == 0 ) return 0;
+
+  UL lv_target = (UL)(((unsigned long long)stat.count * pct + 99) / 100);
+  UL lv_sum = 0;
+  for( UC i = 0; i < PERF_BUCKETS; i++ ) {
+    lv_sum += stat.buckets[i];
+    if( lv_sum >= lv_target ) {
+      UL lv_bound = (1UL << i);
+      return(lv_bound < stat.maxUs ? lv_bound : stat.maxUs);
+    }
+  }
+  return stat.maxUs;
+}
+
+// Refresh cloud variable
+void PerfClass::UpdateSnapshot()
+{
+  char lv_buf[512];
+  int lv_len = 0;
+
+  for( UC i = 0; i < perfSectionMax && lv_len < (int)sizeof(lv_buf); i++ ) {
+    const PerfStat_t &lv_stat = m_stats[i];
+    if( lv_stat.count == 0 ) continue;
+    lv_len += snprintf(lv_buf + lv_len, sizeof(lv_buf) - lv_len, "%s%s:%lu/%lu/%lu/%lu",
+        (lv_len > 0 ? ";" : ""), strPerfNames[i], lv_stat.count,
+        (UL)(lv_stat.totalUs / lv_stat.count), percentile(lv_stat, 99), lv_stat.maxUs);
+  }
+  if( lv_len >= (int)sizeof(lv_buf) ) lv_len = sizeof(lv_buf) - 1;
+  lv_buf[lv_len] = '\0';
+  m_snapshot = lv_buf;
+}
+
+void PerfClass::PrintStats(BOOL detail)
+{
+  SERIAL_LN("Profiler: %lu s, times in us", (millis() - m_startTime) / 1000);
+  SERIAL_LN("  %-9s %8s %8s %8s %8s %8s %8s", "section", "count", "min", "avg", "p50", "p99", "max");
+  for( UC i = 0; i < perfSectionMax; i++ ) {
+    const PerfStat_t &lv_stat = m_stats[i];
+    if( lv_stat.count == 0 ) {
+      SERIAL_LN("  %-9s %8d", strPerfNames[i], 0);
+      continue;
+    }
+    SERIAL_LN("  %-9s %8lu %8lu %8lu %8lu %8lu %8lu", strPerfNames[i], lv_stat.count, lv_stat.minUs,
+        (UL)(lv_stat.totalUs / lv_stat.count), percentile(lv_stat, 50), percentile(lv_stat, 99), lv_stat.maxUs);
+    if( detail ) {
+      // Non-empty buckets only, as <upper bound>:<count>
+      char lv_line[160];
+      int lv_len = 0;
+      for( UC j = 0; j < PERF_BUCKETS && lv_len < (int)sizeof(lv_line); j++ ) {
+        if( lv_stat.buckets[j] == 0 ) continue;
+        lv_len += snprintf(lv_line + lv_len, sizeof(lv_line) - lv_len, " <%lu:%lu", (1UL << j), lv_stat.buckets[j]);
+      }
+      SERIAL_LN("           %s", lv_line);
+    }
+  }
+}
@@ -0,0 +1,97 @@
+//  xlxPerf.h - Xlight execution time profiler
+
+#ifndef xlxPerf_h
+#define xlxPerf_h
+
+#include "xliCommon.h"
+
+// Histogram bucket n holds durations in [2^(n-1), 2^n) us, bucket 0 is < 1us.
+// The last bucket also takes everything longer
+#define PERF_BUCKETS              16
+
+// Profiled sections
+typedef enum
+{
+  perfCommands = 0,
+  perfCollectData,
+  perfReadNewRules,
+  perfSelfCheck,
+  perfAlarms,
+  perfLog,
+  perfSaveConfig,
+  perfNodeSweep,
+  perfFastProcess,                          // System timer ISR
+  perfCldSetTimeZone,
+  perfCldPowerSwitch,
+  perfCldJSONCommand,
+  perfCldJSONConfig,
+  perfSectionMax
+} perfSection_t;
+
+typedef struct
+{
+  UL count;
+  UL minUs;
+  UL maxUs;
+  unsigned long long totalUs;
+  UL buckets[PERF_BUCKETS];
+} PerfStat_t;
+
+// Measure the statement x and record it against section id
+#define PERF_RECORD(id, x) ({UL _perfStart = System.ticks(); x; thePerf.Record((id), System.ticks() - _perfStart);})
+
+// Same for the main loop. With MAINLOOP_TIMER defined, every measurement
+// is also printed, so don't use it in ISR
+#ifdef MAINLOOP_TIMER
+  #define PERF_PROBE(id, x) ({PERF_RECORD(id, x); SERIAL_LN("%s spent %lu us", thePerf.GetName(id), thePerf.GetLastUs(id));})
+#else
+  #define PERF_PROBE(id, x) PERF_RECORD(id, x)
+#endif
+
+//------------------------------------------------------------------
+// Xlight Profiler Class
+//------------------------------------------------------------------
+class PerfClass
+{
+private:
+  PerfStat_t m_stats[perfSectionMax];
+  UL m_lastUs[perfSectionMax];
+  UL m_ticksPerUs;
+  UL m_startTime;
+
+  UL percentile(const PerfStat_t &stat, UC pct);
+
+public:
+  String m_snapshot;                        // Cloud variable
+
+  PerfClass();
+  void Init();
+  void Reset();
+
+  // Keep it short, also called in ISR
+  inline void Record(UC id, UL ticks) {
+    if( id >= perfSectionMax ) return;
+    UL lv_us = ticks / m_ticksPerUs;
+    PerfStat_t &lv_stat = m_stats[id];
+    UC lv_bucket = (lv_us == 0 ? 0 : 32 - __builtin_clz(lv_us));
+    if( lv_bucket >= PERF_BUCKETS ) lv_bucket = PERF_BUCKETS - 1;
+    lv_stat.buckets[lv_bucket]++;
+    if( lv_us < lv_stat.minUs ) lv_stat.minUs = lv_us;
+    if( lv_us > lv_stat.maxUs ) lv_stat.maxUs = lv_us;
+    lv_stat.totalUs += lv_us;
+    lv_stat.count++;
+    m_lastUs[id] = lv_us;
+  }
+
+  const char *GetName(UC id);
+  UL GetLastUs(UC id) { return(id < perfSectionMax ? m_lastUs[id] : 0); }
+  void UpdateSnapshot();
+  void PrintStats(BOOL detail = false);
+};
+
+//------------------------------------------------------------------
+// Function & Class Helper
+//------------------------------------------------------------------
+extern PerfClass thePerf;
+
+#endif /* xlxPerf_h */
@@ -0,0 +1,365 @@
+/**
+ * xlxProvision.cpp - Xlight binary bulk provisioning over the serial port
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. 'sys bin' switches the console to binary mode, where the serial input
+ *    goes here instead of SerialCommand: no echo, no line buffer
+ * 2. Rows frames carry packed table rows (same layout as in memory). Rules
+ *    and device status go to the working memory tables. Schedules and
+ *    scenarios only hold a few rows in memory, so they are written straight
+ *    to flash unless cached. Image frames are written to flash as is and
+ *    take effect after reset
+ * 3. Sliding window: the host sends up to PROV_WINDOW frames ahead, the
+ *    device acks every half window with the next expected seq. A bad or
+ *    missing frame gets a NAK, frames are dropped until the host goes back
+ *    to that seq. Duplicates of acked frames are acked again
+ * 4. An End frame saves the tables and leaves binary mode, so does
+ *    PROV_TIMEOUT without input
+ * 5. Log output may interleave with acks, host side must sync on PROV_SOF
+ *    and the CRC
+ * 6. A dry run checks and counts rows without applying or saving them, for
+ *    link tests
+ *
+ * ToDo:
+**/
+
+#include "xlxProvision.h"
+#include "xlSmartController.h"
+#include "xlxConfig.h"
+#include "xlxLogger.h"
+#include "xlxRuleEngine.h"
+#include "xliMemoryMap.h"
+
+#define PROV_ACK_EVERY            (PROV_WINDOW / 2)
+
+//------------------------------------------------------------------
+// the one and only instance of ProvisionClass
+ProvisionClass theProvision;
+
+//------------------------------------------------------------------
+// Xlight Provisioning Class
+//------------------------------------------------------------------
+ProvisionClass::ProvisionClass()
+{
+  m_active = false;
+  m_dryRun = false;
+  m_out = NULL;
+  m_pos = 0;
+  m_len = 0;
+  m_nextSeq = 0;
+  m_unacked = 0;
+  m_rejecting = false;
+  m_imageWritten = false;
+  m_lastInput = 0;
+  m_startTime = 0;
+  m_rows = 0;
+  m_frames = 0;
+  m_errors = 0;
+}
+
+US ProvisionClass::CRC16(const UC *data, US len, US crc)
+{
+  while( len-- ) {
+    crc ^= (US)(*data++) << 8;
+    for( UC i = 0; i < 8; i++ ) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
+US ProvisionClass::BuildFrame(UC *buf, UC type, UC seq, const UC *payload, US len)
+{
+  buf[0] = PROV_SOF;
+  buf[1] = type;
+  buf[2] = seq;
+  buf[3] = len & 0xFF;
+  buf[4] = len >> 8;
+  if( len > 0 ) memcpy(buf + PROV_HEADER_SIZE, payload, len);
+  US lv_crc = CRC16(buf + 1, PROV_HEADER_SIZE - 1 + len);
+  buf[PROV_HEADER_SIZE + len] = lv_crc & 0xFF;
+  buf[PROV_HEADER_SIZE + len + 1] = lv_crc >> 8;
+  return len + PROV_OVERHEAD;
+}
+
+US ProvisionClass::GetRowSize(UC table)
+{
+  switch( table ) {
+  case provTabDevStatus:  return DST_ROW_SIZE;
+  case provTabSchedule:   return SCT_ROW_SIZE;
+  case provTabScenario:   return SNT_ROW_SIZE;
+  case provTabRule:       return RT_ROW_SIZE;
+  case provTabRuleProg:   return RULE_PROG_SIZE;
+  }
+  return 0;
+}
+
+void ProvisionClass::Start(Print *out, BOOL dryRun)
+{
+  m_out = out;
+  m_dryRun = dryRun;
+  m_pos = 0;
+  m_nextSeq = 0;
+  m_unacked = 0;
+  m_rejecting = false;
+  m_imageWritten = false;
+  m_rows = 0;
+  m_frames = 0;
+  m_errors = 0;
+  m_startTime = m_lastInput = millis();
+  m_active = true;
+}
+
+void ProvisionClass::Process()
+{
+  if( !m_active ) return;
+
+  int lv_data;
+  while( m_active && (lv_data = Serial.read()) >= 0 ) {
+    Feed((UC)lv_data);
+  }
+
+  if( m_active && millis() - m_lastInput > PROV_TIMEOUT ) {
+    LOGW(LOGTAG_MSG, "Binary provisioning timed out");
+    finish();
+  }
+}
+
+void ProvisionClass::Feed(UC data)
+{
+  m_lastInput = millis();
+  // Wait for start of frame
+  if( m_pos == 0 && data != PROV_SOF ) return;
+
+  m_frame[m_pos++] = data;
+  if( m_pos == PROV_HEADER_SIZE ) {
+    m_len = m_frame[3] | (m_frame[4] << 8);
+    if( m_len > PROV_MAX_PAYLOAD ) {
+      // Not a frame, resync
+      m_errors++;
+      m_pos = 0;
+    }
+  } else if( m_pos > PROV_HEADER_SIZE && m_pos == m_len + PROV_OVERHEAD ) {
+    handleFrame();
+    m_pos = 0;
+  }
+}
+
+void ProvisionClass::handleFrame()
+{
+  US lv_crc = m_frame[PROV_HEADER_SIZE + m_len] | (m_frame[PROV_HEADER_SIZE + m_len + 1] << 8);
+  if( CRC16(m_frame + 1, PROV_HEADER_SIZE - 1 + m_len) != lv_crc ) {
+    m_errors++;
+    if( !m_rejecting ) sendAck(provFrameNak, provErrCRC);
+    m_rejecting = true;
+    return;
+  }
+
+  UC lv_diff = (UC)(m_frame[2] - m_nextSeq);
+  if( lv_diff != 0 ) {
+    if( lv_diff >= 256 - 2 * PROV_WINDOW ) {
+      // Resent after a lost ack, tell the host where we are
+      sendAck(provFrameAck, provOK);
+    } else if( !m_rejecting ) {
+      // A frame is missing
+      m_errors++;
+      sendAck(provFrameNak, provErrSeq);
+      m_rejecting = true;
+    }
+    return;
+  }
+
+  m_rejecting = false;
+  m_nextSeq++;
+  m_frames++;
+
+  const UC *lv_payload = m_frame + PROV_HEADER_SIZE;
+  UC lv_status = provErrFormat;
+  switch( m_frame[1] ) {
+  case provFrameRows:
+    if( m_len > 1 ) lv_status = applyRows(lv_payload[0], lv_payload + 1, m_len - 1);
+    break;
+  case provFrameImage:
+    if( m_len > 3 ) lv_status = writeImage(lv_payload[0], lv_payload + 1, m_len - 1);
+    break;
+  case provFrameEnd:
+    sendAck(provFrameAck, provOK);
+    finish();
+    return;
+  }
+
+  if( lv_status != provOK ) {
+    // Consumed anyway, report it right away
+    m_errors++;
+    sendAck(provFrameAck, lv_status);
+  } else if( ++m_unacked >= PROV_ACK_EVERY ) {
+    sendAck(provFrameAck, provOK);
+  }
+}
+
+// Flags of a row in flash: 111 occupied, 000 deleted
+template<typename T>
+static void setStoredFlags(T &row)
+{
+  BOOL lv_used = (row.op_flag != DELETE);
+  row.op_flag = (OP_FLAG)lv_used;
+  row.flash_flag = (FLASH_FLAG)lv_used;
+  row.run_flag = (RUN_FLAG)lv_used;
+}
+
+UC ProvisionClass::applyRows(UC table, const UC *data, US len)
+{
+  US lv_size = GetRowSize(table);
+  if( lv_size == 0 || table == provTabRuleProg || len % lv_size != 0 ) return provErrFormat;
+  if( m_dryRun ) {
+    m_rows += len / lv_size;
+    return provOK;
+  }
+
+  BOOL lv_ok = true;
+  for( US lv_pos = 0; lv_pos < len; lv_pos += lv_size ) {
+    switch( table ) {
+    case provTabDevStatus:
+    {
+      DevStatusRow_t lv_row;
+      memcpy(&lv_row, data + lv_pos, lv_size);
+      lv_row.run_flag = EXECUTED;
+      lv_row.flash_flag = UNSAVED;
+      ListNode<DevStatusRow_t> *lv_ptr = theSys.DevStatus_table.search(lv_row.uid);
+      if( lv_ptr ) {
+        lv_ptr->data = lv_row;
+      } else if( !theSys.DevStatus_table.add(lv_row) ) {
+        lv_ok = false;
+        continue;
+      }
+      theConfig.SetDSTChanged(true);
+      break;
+    }
+    case provTabSchedule:
+    {
+      // Cached rows are updated in place, the others go to flash, where
+      // SearchSchedule() picks them up
+      ScheduleRow_t lv_row;
+      memcpy(&lv_row, data + lv_pos, lv_size);
+      if( theSys.Schedule_table.search(lv_row.uid) ) {
+        if( !theSys.Change_Schedule(lv_row) ) { lv_ok = false; continue; }
+      } else if( lv_row.uid < MAX_SCT_ROWS ) {
+        setStoredFlags(lv_row);
+        EEPROM.put(MEM_SCHEDULE_OFFSET + lv_row.uid*SCT_ROW_SIZE, lv_row);
+      } else { lv_ok = false; continue; }
+      break;
+    }
+    case provTabScenario:
+    {
+      ScenarioRow_t lv_row;
+      memcpy(&lv_row, data + lv_pos, lv_size);
+      if( theSys.Scenario_table.search(lv_row.uid) ) {
+        if( !theSys.Change_Scenario(lv_row) ) { lv_ok = false; continue; }
+      } else if( lv_row.uid < MAX_SNT_ROWS ) {
+        setStoredFlags(lv_row);
+        if( !theConfig.MemWriteScenarioRow(lv_row, MEM_SCENARIOS_OFFSET + lv_row.uid*SNT_ROW_SIZE) ) { lv_ok = false; continue; }
+      } else { lv_ok = false; continue; }
+      break;
+    }
+    case provTabRule:
+    {
+      RuleRow_t lv_row;
+      memcpy(&lv_row, data + lv_pos, lv_size);
+      if( !theSys.Change_Rule(lv_row) ) { lv_ok = false; continue; }
+      break;
+    }
+    }
+    m_rows++;
+  }
+
+  return(lv_ok ? provOK : provErrApply);
+}
+
+UC ProvisionClass::writeImage(UC table, const UC *data, US len)
+{
+  US lv_offset = data[0] | (data[1] << 8);
+  data += 2;
+  len -= 2;
+
+  // Storage of each table, see xliMemoryMap.h
+  UL lv_base, lv_limit;
+  BOOL lv_eeprom = false;
+  switch( table ) {
+  case provTabDevStatus:
+    lv_base = MEM_DEVICE_STATUS_OFFSET; lv_limit = MEM_DEVICE_STATUS_LEN; lv_eeprom = true;
+    break;
+  case provTabSchedule:
+    lv_base = MEM_SCHEDULE_OFFSET; lv_limit = MEM_SCHEDULE_LEN; lv_eeprom = true;
+    break;
+  case provTabScenario:
+    lv_base = MEM_SCENARIOS_OFFSET; lv_limit = MEM_SCENARIOS_LEN;
+    break;
+  case provTabRule:
+    lv_base = MEM_RULES_OFFSET; lv_limit = MAX_RT_ROWS * RT_ROW_SIZE;
+    break;
+  case provTabRuleProg:
+    lv_base = MEM_RULE_PROGS_OFFSET; lv_limit = MAX_RT_ROWS * RULE_PROG_SIZE;
+    break;
+  default:
+    return provErrFormat;
+  }
+  if( (UL)lv_offset + len > lv_limit ) return provErrFormat;
+  if( m_dryRun ) return provOK;
+
+  if( lv_eeprom ) {
+    for( US i = 0; i < len; i++ ) EEPROM.write(lv_base + lv_offset + i, data[i]);
+  } else if( !theConfig.MemWriteRaw(data, lv_base + lv_offset, len) ) {
+    return provErrApply;
+  }
+  m_imageWritten = true;
+  return provOK;
+}
+
+void ProvisionClass::sendAck(UC type, UC status)
+{
+  m_unacked = 0;
+  if( !m_out ) return;
+
+  UC lv_payload[4];
+  lv_payload[0] = m_nextSeq;
+  lv_payload[1] = status;
+  lv_payload[2] = m_rows & 0xFF;
+  lv_payload[3] = (m_rows >> 8) & 0xFF;
+  UC lv_buf[sizeof(lv_payload) + PROV_OVERHEAD];
+  US lv_len = BuildFrame(lv_buf, type, 0, lv_payload, sizeof(lv_payload));
+  m_out->write(lv_buf, lv_len);
+}
+
+void ProvisionClass::finish()
+{
+  m_active = false;
+  if( m_rows > 0 && !m_dryRun ) theConfig.SaveConfig();
+  if( m_imageWritten ) {
+    LOGN(LOGTAG_MSG, "Table images written, reset to load them");
+  }
+  PrintStatus();
+}
+
+void ProvisionClass::PrintStatus()
+{
+  UL lv_ms = (m_active ? millis() : m_lastInput) - m_startTime;
+  SERIAL_LN("Binary provisioning %s: %lu frames, %lu rows, %lu errors, %lu ms, %lu rows/s",
+      (m_active ? "active" : "done"), m_frames, m_rows, m_errors, lv_ms,
+      (lv_ms > 0 ? m_rows * 1000 / lv_ms : 0));
+}
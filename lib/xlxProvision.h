@@ -0,0 +1,102 @@
+//  xlxProvision.h - Xlight binary bulk provisioning over the serial port
+
+#ifndef xlxProvision_h
+#define xlxProvision_h
+
+#include "xliCommon.h"
+
+// Frame: [SOF][type][seq][len lo][len hi][payload][crc lo][crc hi]
+// CRC-16/CCITT (0x1021, init 0xFFFF) over type, seq, len and payload
+#define PROV_SOF                  0xA5
+#define PROV_HEADER_SIZE          5
+#define PROV_OVERHEAD             (PROV_HEADER_SIZE + 2)
+#define PROV_MAX_PAYLOAD          512
+#define PROV_WINDOW               8           // Frames the host may send ahead of the ack
+#define PROV_TIMEOUT              5000        // ms without input before leaving binary mode
+
+// Frame types
+typedef enum
+{
+  provFrameRows = 0x01,                     // [table][row]...[row], packed table rows
+  provFrameImage,                           // [table][offset lo][offset hi][data], raw table storage
+  provFrameEnd,                             // Save and leave binary mode
+  provFrameAck = 0x80,                      // [next seq][status][rows lo][rows hi], device to host
+  provFrameNak                              // Same payload, resend from next seq
+} provFrame_t;
+
+// Tables
+typedef enum
+{
+  provTabDevStatus = 0,
+  provTabSchedule,
+  provTabScenario,
+  provTabRule,
+  provTabRuleProg,                          // RuleProg_t, image only
+  provTabMax
+} provTable_t;
+
+// Ack status
+typedef enum
+{
+  provOK = 0,
+  provErrCRC,
+  provErrSeq,
+  provErrFormat,
+  provErrApply
+} provStatus_t;
+
+//------------------------------------------------------------------
+// Xlight Provisioning Class
+//------------------------------------------------------------------
+class ProvisionClass
+{
+private:
+  BOOL m_active;
+  BOOL m_dryRun;                            // Check and count rows, don't apply them
+  Print *m_out;
+  UC m_frame[PROV_OVERHEAD + PROV_MAX_PAYLOAD];
+  US m_pos;
+  US m_len;
+  UC m_nextSeq;
+  UC m_unacked;                             // Frames accepted since the last ack
+  BOOL m_rejecting;                         // NAK sent, waiting for the resend
+  BOOL m_imageWritten;
+  UL m_lastInput;
+  UL m_startTime;
+  UL m_rows;
+  UL m_frames;
+  UL m_errors;
+
+  void handleFrame();
+  UC applyRows(UC table, const UC *data, US len);
+  UC writeImage(UC table, const UC *data, US len);
+  void sendAck(UC type, UC status);
+  void finish();
+
+public:
+  ProvisionClass();
+
+  static US CRC16(const UC *data, US len, US crc = 0xFFFF);
+  // Build a frame into buf (at least len + PROV_OVERHEAD), returns its size
+  static US BuildFrame(UC *buf, UC type, UC seq, const UC *payload, US len);
+  static US GetRowSize(UC table);
+
+  // Enter binary mode, acks go to out (NULL for none). A dry run goes
+  // through the whole protocol but leaves the tables and flash alone
+  void Start(Print *out = &Serial, BOOL dryRun = false);
+  BOOL IsActive() { return m_active; }
+  void Feed(UC data);
+  // Read the serial port while in binary mode
+  void Process();
+
+  UL GetRows() { return m_rows; }
+  UL GetErrors() { return m_errors; }
+  void PrintStatus();
+};
+
+//------------------------------------------------------------------
+// Function & Class Helper
+//------------------------------------------------------------------
+extern ProvisionClass theProvision;
+
+#endif /* xlxProvision_h */
@@ -28,7 +28,15 @@
  * 2. Address algorithm
  * 3. PipePool (0 AdminPipe, Read & Write; 1-5 pipe pool, Read)
  * 4. Session manager, optional address shifting
- * 5.
+ * 5. With RF_WORKER_THREAD, send and receive run on a dedicated thread, so
+ *    flash writes or sensor reads in the main loop don't stall radio traffic.
+ *    The application posts messages to m_txQueue, the worker puts send
+ *    results and received messages into m_rxQueue and signals the command
+ *    task. ProcessResults() drains them on the application thread, which is
+ *    the only place that touches DevStatus and the logger
+ * 6. Every public entry point that touches the nRF24 takes m_radioLock,
+ *    so console RF commands can still call ProcessSend() directly. The lock
+ *    is recursive, as entry points call each other
  *
  * ToDo:
  * 1. Two pipes collaboration for security: divide a message into two parts
@@ -40,6 +48,7 @@
 #include "xliPinMap.h"
 #include "xlSmartController.h"
 #include "xlxLogger.h"
+#include "xlxScheduler.h"
 
 #include "MyParserSerial.h"
 
@@ -48,7 +57,10 @@
 RF24ServerClass theRadio(PIN_RF24_CE, PIN_RF24_CS);
 MyMessage msg;
 MyParserSerial msgParser;
-UC *msgData = (UC *)&(msg.msg);
+
+#ifdef RF_USE_WORKER
+os_thread_return_t gc_rfWorker(void *param) { ((RF24ServerClass *)param)->WorkerLoop(); }
+#endif
 
 RF24ServerClass::RF24ServerClass(uint8_t ce, uint8_t cs, uint8_t paLevel)
 	:	MyTransportNRF24(ce, cs, paLevel)
@@ -56,21 +68,49 @@ RF24ServerClass::RF24ServerClass(uint8_t ce, uint8_t cs, uint8_t paLevel)
 	_times = 0;
 	_succ = 0;
 	_received = 0;
+	m_notifyTask = SCHED_INVALID_TASK;
+	m_txSeq = 0;
+	m_txDropped = 0;
+	m_rxDropped = 0;
+	m_rxCorrupt = 0;
+	m_latencyMax = 0;
+	m_latencyTotal = 0;
+	m_latencyCount = 0;
+#ifdef RF_USE_WORKER
+	m_pWorker = NULL;
+	m_radioLock = NULL;
+#endif
 }
 
 bool RF24ServerClass::ServerBegin()
 {
   // Initialize RF module
-	if( !init() ) {
+	lockRadio();
+	bool lv_ok = init();
+  // Set role to Controller or Gateway
+	if( lv_ok ) SetRole_Gateway();
+	unlockRadio();
+	if( !lv_ok ) {
     LOGC(LOGTAG_MSG, F("RF24 module is not valid!"));
 		return false;
 	}
-
-  // Set role to Controller or Gateway
-	SetRole_Gateway();
   return true;
 }
 
+void RF24ServerClass::lockRadio()
+{
+#ifdef RF_USE_WORKER
+	if( m_radioLock ) os_mutex_recursive_lock(m_radioLock);
+#endif
+}
+
+void RF24ServerClass::unlockRadio()
+{
+#ifdef RF_USE_WORKER
+	if( m_radioLock ) os_mutex_recursive_unlock(m_radioLock);
+#endif
+}
+
 // Make NetworkID with the right 4 bytes of device MAC address
 uint64_t RF24ServerClass::GetNetworkID()
 {
@@ -88,15 +128,15 @@ uint64_t RF24ServerClass::GetNetworkID()
 
 bool RF24ServerClass::ChangeNodeID(const uint8_t bNodeID)
 {
-	if( bNodeID == getAddress() ) {
-			return true;
-	}
-
-	if( bNodeID == 0 ) {
-		SetRole_Gateway();
-	} else {
-		setAddress(bNodeID, RF24_BASE_RADIO_ID);
+	lockRadio();
+	if( bNodeID != getAddress() ) {
+		if( bNodeID == 0 ) {
+			SetRole_Gateway();
+		} else {
+			setAddress(bNodeID, RF24_BASE_RADIO_ID);
+		}
 	}
+	unlockRadio();
 
 	return true;
 }
@@ -104,12 +144,54 @@ bool RF24ServerClass::ChangeNodeID(const uint8_t bNodeID)
 void RF24ServerClass::SetRole_Gateway()
 {
 	uint64_t lv_networkID = GetNetworkID();
+	lockRadio();
 	setAddress(GATEWAY_ADDRESS, lv_networkID);
+	unlockRadio();
 }
 
-bool RF24ServerClass::ProcessSend(String &strMsg, MyMessage &my_msg)
+bool RF24ServerClass::isValid()
 {
-	bool sentOK = false;
+	lockRadio();
+	bool lv_valid = MyTransportNRF24::isValid();
+	unlockRadio();
+	return lv_valid;
+}
+
+void RF24ServerClass::PrintRFDetails()
+{
+	lockRadio();
+	MyTransportNRF24::PrintRFDetails();
+	unlockRadio();
+}
+
+void RF24ServerClass::enableBaseNetwork(bool sw)
+{
+	lockRadio();
+	MyTransportNRF24::enableBaseNetwork(sw);
+	unlockRadio();
+}
+
+bool RF24ServerClass::switch2BaseNetwork()
+{
+	lockRadio();
+	bool lv_ok = MyTransportNRF24::switch2BaseNetwork();
+	unlockRadio();
+	return lv_ok;
+}
+
+bool RF24ServerClass::switch2MyNetwork()
+{
+	lockRadio();
+	bool lv_ok = MyTransportNRF24::switch2MyNetwork();
+	unlockRadio();
+	return lv_ok;
+}
+
+// Parse a console / command string into a message, doesn't send it and prints
+// nothing on success; the optional pDesc names the message for the caller's log
+bool RF24ServerClass::BuildMessage(String &strMsg, MyMessage &my_msg, const char **pDesc)
+{
+	const char *lv_desc = "message";
 	bool bMsgReady = false;
 	int iValue;
 	float fValue;
@@ -136,9 +218,6 @@ bool RF24ServerClass::ProcessSend(String &strMsg, MyMessage &my_msg)
 		strBuffer[iValue] = 0;
 		// Serail format to MySensors message structure
 		bMsgReady = msgParser.parse(msg, strBuffer);
-		if (bMsgReady) {
-			SERIAL("Now sending message...");
-		}
 		break;
 
 	case 1:   // Request new node ID
@@ -150,7 +229,7 @@ bool RF24ServerClass::ProcessSend(String &strMsg, MyMessage &my_msg)
 			msg.build(AUTO, BASESERVICE_ADDRESS, NODE_SENSOR_ID, C_INTERNAL, I_ID_REQUEST, false);
 			msg.set("DTIT-is-great");     // Optional Key
 			bMsgReady = true;
-			SERIAL("Now sending request node id message...");
+			lv_desc = "request node id message";
 		}
 		break;
 
@@ -158,14 +237,14 @@ bool RF24ServerClass::ProcessSend(String &strMsg, MyMessage &my_msg)
 		msg.build(getAddress(), lv_nNodeID, NODE_SENSOR_ID, C_PRESENTATION, S_LIGHT, true);
 		msg.set("Found Sunny");
 		bMsgReady = true;
-		SERIAL("Now sending lamp present message...");
+		lv_desc = "lamp present message";
 		break;
 
 	case 3:   // Temperature sensor present with sensor id 1, req no ack
 		msg.build(getAddress(), lv_nNodeID, 1, C_PRESENTATION, S_TEMP, false);
 		msg.set("");
 		bMsgReady = true;
-		SERIAL("Now sending DHT11 present message...");
+		lv_desc = "DHT11 present message";
 		break;
 
 	case 4:   // Temperature set to 23.5, req no ack
@@ -173,7 +252,7 @@ bool RF24ServerClass::ProcessSend(String &strMsg, MyMessage &my_msg)
 		fValue = 23.5;
 		msg.set(fValue, 2);
 		bMsgReady = true;
-		SERIAL("Now sending set temperature message...");
+		lv_desc = "set temperature message";
 		break;
 
 	case 5:   // Humidity set to 45, req no ack
@@ -181,14 +260,26 @@ bool RF24ServerClass::ProcessSend(String &strMsg, MyMessage &my_msg)
 		iValue = 45;
 		msg.set(iValue);
 		bMsgReady = true;
-		SERIAL("Now sending set humidity message...");
+		lv_desc = "set humidity message";
 		break;
 	}
 
 	if (bMsgReady) {
-		SERIAL("to %d...", msg.getDestination());
-		sentOK = ProcessSend();
 		my_msg = msg;
+		if (pDesc) *pDesc = lv_desc;
+	}
+
+	return bMsgReady;
+}
+
+bool RF24ServerClass::ProcessSend(String &strMsg, MyMessage &my_msg)
+{
+	bool sentOK = false;
+
+	const char *lv_desc;
+	if (BuildMessage(strMsg, my_msg, &lv_desc)) {
+		SERIAL("Now sending %s to %d...", lv_desc, my_msg.getDestination());
+		sentOK = ProcessSend(&my_msg);
 		SERIAL_LN(sentOK ? "OK" : "failed");
 	}
 
@@ -201,82 +292,114 @@ bool RF24ServerClass::ProcessSend(String &strMsg)
 	return ProcessSend(strMsg, tempMsg);
 }
 
-// ToDo: add message to queue instead of sending out directly
-bool RF24ServerClass::ProcessSend(MyMessage *pMsg)
+// Send right away, blocks until the radio is done
+bool RF24ServerClass::ProcessSend(MyMessage *pMsg, uint8_t pipe)
 {
 	if( !pMsg ) { pMsg = &msg; }
 
-	// Determine the receiver addresse
+	// Determine the receiver addresse, counters are shared with the worker
+	lockRadio();
 	_times++;
-	if( send(pMsg->getDestination(), *pMsg) )
-	{
+	bool sentOK = send(pMsg->getDestination(), *pMsg, pipe);
+	if( sentOK ) {
 		_succ++;
-		return true;
 	}
+	unlockRadio();
 
-	return false;
+	return sentOK;
 }
 
-bool RF24ServerClass::ProcessReceive()
+// Read one message from the radio, radio access only
+/// return 0 if nothing available, -1 if too short, -length if too long, otherwise length
+int RF24ServerClass::receiveMessage(MyMessage &my_msg, uint8_t &to, uint8_t &pipe)
 {
-  bool sentOK = false;
-  uint8_t to = 0;
-  uint8_t pipe;
-  if (!available(&to, &pipe))
-    return false;
+  to = 0;
+  lockRadio();
+  if( !available(&to, &pipe) ) {
+    unlockRadio();
+    return 0;
+  }
+  uint8_t len = receive((UC *)&(my_msg.msg));
+  unlockRadio();
+
+  if( len < HEADER_SIZE || len > MAX_MESSAGE_LENGTH ) {
+    m_rxCorrupt++;
+    return(len < HEADER_SIZE ? -1 : -(int)len);
+  }
+  _received++;
+  return len;
+}
 
-  uint8_t len = receive(msgData);
-  if( len < HEADER_SIZE )
+// Receive and handle in place, used when there is no worker
+bool RF24ServerClass::ProcessReceive()
+{
+  MyMessage lv_msg;
+  uint8_t to, pipe;
+  int len = receiveMessage(lv_msg, to, pipe);
+  if( len == 0 ) return false;
+  if( len == -1 )
   {
     LOGW(LOGTAG_MSG, "got corrupt dynamic payload!");
     return false;
-  } else if( len > MAX_MESSAGE_LENGTH )
+  } else if( len < 0 )
   {
-    LOGW(LOGTAG_MSG, "message length exceeded: %d", len);
+    LOGW(LOGTAG_MSG, "message length exceeded: %d", -len);
     return false;
   }
 
-  char strDisplay[SENSORDATA_JSON_SIZE];
-  _received++;
   LOGD(LOGTAG_MSG, "Received from pipe %d msg-len=%d, from:%d to:%d dest:%d cmd:%d type:%d sensor:%d payl-len:%d",
-        pipe, len, msg.getSender(), to, msg.getDestination(), msg.getCommand(),
-        msg.getType(), msg.getSensor(), msg.getLength());
+        pipe, len, lv_msg.getSender(), to, lv_msg.getDestination(), lv_msg.getCommand(),
+        lv_msg.getType(), lv_msg.getSensor(), lv_msg.getLength());
+  handleMessage(lv_msg, to, pipe);
+  return true;
+}
+
+// Act on a received message, application thread only
+void RF24ServerClass::handleMessage(MyMessage &my_msg, uint8_t to, uint8_t pipe)
+{
+  bool sentOK = false;
+  char strDisplay[SENSORDATA_JSON_SIZE];
+
+  // Any message is a sign of life, but a stamp before the RTC is synced
+  // would age the node to offline once the time jumps
+  if( Time.isValid() ) theConfig.lstNodes.touch(my_msg.getSender(), Time.now());
 	/*
   memset(strDisplay, 0x00, sizeof(strDisplay));
-  msg.getJsonString(strDisplay);
+  my_msg.getJsonString(strDisplay);
   SERIAL_LN("  JSON: %s, len: %d", strDisplay, strlen(strDisplay));
   memset(strDisplay, 0x00, sizeof(strDisplay));
-  SERIAL_LN("  Serial: %s, len: %d", msg.getSerialString(strDisplay), strlen(strDisplay));
+  SERIAL_LN("  Serial: %s, len: %d", my_msg.getSerialString(strDisplay), strlen(strDisplay));
 	*/
 
-  switch( msg.getCommand() )
+  switch( my_msg.getCommand() )
   {
     case C_INTERNAL:
-      if( msg.getType() == I_ID_REQUEST && msg.getSender() == AUTO ) {
+      if( my_msg.getType() == I_ID_REQUEST && my_msg.getSender() == AUTO ) {
         // On ID Request message
         /// Get new ID
         UC newID = GetNextAvailableNodeId();
-        UC replyTo = msg.getSender();
+        UC replyTo = my_msg.getSender();
         /// Send response message
-        msg.build(getAddress(), replyTo, newID, C_INTERNAL, I_ID_RESPONSE, false);
-        msg.set(getMyNetworkID());
+        my_msg.build(getAddress(), replyTo, newID, C_INTERNAL, I_ID_RESPONSE, false);
+        my_msg.set(getMyNetworkID());
         SERIAL("Now sending NodeId response message to %d with new NodeID:%d, NetworkID:%s...", replyTo, newID, PrintUint64(strDisplay, getMyNetworkID()));
-        _times++;
-        sentOK = send(replyTo, msg, pipe);
-        if( sentOK ) {
-          _succ++;
-          SERIAL_LN("OK");
+        if( IsWorkerRunning() ) {
+          sentOK = PostSend(my_msg, pipe);
+          SERIAL_LN(sentOK ? "queued" : "failed");
         } else {
-          SERIAL_LN("failed");
+          sentOK = ProcessSend(&my_msg, pipe);
+          SERIAL_LN(sentOK ? "OK" : "failed");
         }
-      } else if( msg.getType() == I_ID_RESPONSE ) {
-        if( msg.getSensor() > MAX_DEVICE_PER_CONTROLLER ) {
+      } else if( my_msg.getType() == I_ID_RESPONSE ) {
+        if( my_msg.getSensor() > MAX_DEVICE_PER_CONTROLLER ) {
             SERIAL_LN("Node Table is full!");
         } else {
-					uint64_t lv_networkID = msg.getUInt64();
-          uint8_t lv_nodeID = msg.getSensor();
+					uint64_t lv_networkID = my_msg.getUInt64();
+          uint8_t lv_nodeID = my_msg.getSensor();
           SERIAL_LN("Get NodeId: %d, networkId: %s", lv_nodeID, PrintUint64(strDisplay, lv_networkID));
+          lockRadio();
           setAddress(lv_nodeID, lv_networkID);
+          unlockRadio();
         }
       }
       break;
@@ -284,8 +407,147 @@ bool RF24ServerClass::ProcessReceive()
     default:
       break;
   }
+}
 
+//------------------------------------------------------------------
+// Worker thread
+//------------------------------------------------------------------
+// Start the radio thread, notifyTask is signalled when results are ready
+bool RF24ServerClass::StartWorker(UC notifyTask)
+{
+  m_notifyTask = notifyTask;
+#ifdef RF_USE_WORKER
+  if( m_pWorker ) return true;
+  if( !m_txQueue.Create(RF_QUEUE_SIZE) || !m_rxQueue.Create(RF_QUEUE_SIZE) ) {
+    LOGE(LOGTAG_MSG, F("Failed to create RF queues"));
+    return false;
+  }
+  if( os_mutex_recursive_create(&m_radioLock) != 0 ) {
+    m_radioLock = NULL;
+    LOGE(LOGTAG_MSG, F("Failed to create RF lock"));
+    return false;
+  }
+  m_pWorker = new Thread("rf24", gc_rfWorker, this, OS_THREAD_PRIORITY_DEFAULT, RF_WORKER_STACK);
+  if( !m_pWorker ) {
+    LOGE(LOGTAG_MSG, F("Failed to start RF worker"));
+    return false;
+  }
+  LOGI(LOGTAG_MSG, F("RF worker started"));
   return true;
+#else
+  return false;
+#endif
+}
+
+bool RF24ServerClass::IsWorkerRunning()
+{
+#ifdef RF_USE_WORKER
+  return(m_pWorker != NULL);
+#else
+  return false;
+#endif
+}
+
+// Queue a message for the worker, falls back to sending right away
+bool RF24ServerClass::PostSend(MyMessage &my_msg, uint8_t pipe)
+{
+  if( !IsWorkerRunning() ) return ProcessSend(&my_msg, pipe);
+
+  RFRequest_t *lv_pReq = (RFRequest_t *)m_txQueue.WriteReserve(sizeof(RFRequest_t));
+  if( !lv_pReq ) {
+    m_txDropped++;
+    return false;
+  }
+  lv_pReq->seq = ++m_txSeq;
+  lv_pReq->time = millis();
+  lv_pReq->pipe = pipe;
+  lv_pReq->msg = my_msg;
+  m_txQueue.WriteCommit(sizeof(RFRequest_t));
+  return true;
+}
+
+// Worker side: hand a result over to the application thread
+void RF24ServerClass::pushResult(RFResult_t &result)
+{
+  if( !m_rxQueue.Push((UC *)&result, sizeof(RFResult_t)) ) {
+    m_rxDropped++;
+    return;
+  }
+  theScheduler.Signal(m_notifyTask);
+}
+
+// Thread body, never returns. No logging or DevStatus access in here
+void RF24ServerClass::WorkerLoop()
+{
+  RFRequest_t lv_req;
+  RFResult_t lv_res;
+
+  while( true ) {
+    // Send everything queued
+    while( m_txQueue.Pop((UC *)&lv_req, sizeof(RFRequest_t)) > 0 ) {
+      lv_res.type = rfResultSent;
+      lv_res.ok = ProcessSend(&lv_req.msg, lv_req.pipe);
+      lv_res.to = lv_req.msg.getDestination();
+      lv_res.pipe = lv_req.pipe;
+      lv_res.seq = lv_req.seq;
+      lv_res.time = lv_req.time;
+      lv_res.msg = lv_req.msg;
+      pushResult(lv_res);
+    }
+
+    // Poll the radio
+    if( receiveMessage(lv_res.msg, lv_res.to, lv_res.pipe) > 0 ) {
+      lv_res.type = rfResultReceived;
+      lv_res.ok = true;
+      lv_res.seq = 0;
+      lv_res.time = millis();
+      pushResult(lv_res);
+      continue;
+    }
+
+    if( m_txQueue.Count() == 0 ) delay(RF_WORKER_IDLE);
+  }
+}
+
+// Application side: called by the command task
+void RF24ServerClass::ProcessResults()
+{
+  if( !IsWorkerRunning() ) {
+    ProcessReceive();
+    return;
+  }
+
+  RFResult_t lv_res;
+  while( m_rxQueue.Pop((UC *)&lv_res, sizeof(RFResult_t)) > 0 ) {
+    if( lv_res.type == rfResultSent ) {
+      UL lv_latency = millis() - lv_res.time;
+      if( lv_latency > m_latencyMax ) m_latencyMax = lv_latency;
+      m_latencyTotal += lv_latency;
+      m_latencyCount++;
+      if( !lv_res.ok ) {
+        LOGW(LOGTAG_MSG, "Failed to send message %lu to %d", lv_res.seq, lv_res.to);
+        theSys.OnMessageFailed(lv_res.msg);
+        continue;
+      }
+      theSys.OnMessageSent(lv_res.msg);
+    } else {
+      LOGD(LOGTAG_MSG, "Received from pipe %d from:%d to:%d dest:%d cmd:%d type:%d sensor:%d payl-len:%d",
+            lv_res.pipe, lv_res.msg.getSender(), lv_res.to, lv_res.msg.getDestination(), lv_res.msg.getCommand(),
+            lv_res.msg.getType(), lv_res.msg.getSensor(), lv_res.msg.getLength());
+      handleMessage(lv_res.msg, lv_res.to, lv_res.pipe);
+    }
+  }
+}
+
+void RF24ServerClass::PrintWorkerStatus()
+{
+  SERIAL_LN("RF worker: %s, sent %lu/%lu, received %lu, corrupt %lu",
+      IsWorkerRunning() ? "running" : "off", _succ, _times, _received, m_rxCorrupt);
+  if( IsWorkerRunning() ) {
+    SERIAL_LN("  queued tx:%lu rx:%lu, dropped tx:%lu rx:%lu", m_txQueue.Count(), m_rxQueue.Count(), m_txDropped, m_rxDropped);
+    SERIAL_LN("  send latency avg:%lums max:%lums",
+        m_latencyCount > 0 ? m_latencyTotal / m_latencyCount : 0, m_latencyMax);
+  }
 }
 
 // Just for testing now
@@ -4,6 +4,43 @@
 #define xlxRF24Server_h
 
 #include "MyTransportNRF24.h"
+#include "RingBuffer.h"
+
+// Radio runs on its own thread if the platform supports it
+#if defined(RF_WORKER_THREAD) && PLATFORM_THREADING
+  #define RF_USE_WORKER
+#endif
+
+#define RF_QUEUE_SIZE             1024        // Bytes of each direction queue
+#define RF_WORKER_STACK           3072
+#define RF_WORKER_IDLE            2           // Radio polling interval (ms) when there is nothing to send
+
+// Send request, application -> worker
+typedef struct
+{
+  UL seq;
+  UL time;                                    // millis() when queued
+  UC pipe;
+  MyMessage msg;
+} RFRequest_t;
+
+typedef enum
+{
+  rfResultSent = 0,
+  rfResultReceived
+} rfResult_t;
+
+// Send result or received message, worker -> application
+typedef struct
+{
+  UC type;                                    // rfResult_t
+  UC ok;
+  UC to;
+  UC pipe;
+  UL seq;
+  UL time;                                    // millis() when queued (sent) or received
+  MyMessage msg;
+} RFResult_t;
 
 // RF24 Server class
 class RF24ServerClass : public MyTransportNRF24
@@ -15,15 +52,54 @@ public:
   uint64_t GetNetworkID();
   void SetRole_Gateway();
   bool ChangeNodeID(const uint8_t bNodeID);
+
+  // Radio access from the application thread, serialized with the worker
+  bool isValid();
+  void PrintRFDetails();
+  void enableBaseNetwork(bool sw = true);
+  bool switch2BaseNetwork();
+  bool switch2MyNetwork();
+
+  bool BuildMessage(String &strMsg, MyMessage &my_msg, const char **pDesc = NULL);
   bool ProcessSend(String &strMsg, MyMessage &my_msg);
   bool ProcessSend(String &strMsg); //overloaded
-  bool ProcessSend(MyMessage *pMsg = NULL);
+  bool ProcessSend(MyMessage *pMsg = NULL, uint8_t pipe = 255);
   bool ProcessReceive();
   uint8_t GetNextAvailableNodeId();
 
+  // Worker thread
+  bool StartWorker(UC notifyTask);
+  bool IsWorkerRunning();
+  bool PostSend(MyMessage &my_msg, uint8_t pipe = 255);
+  void ProcessResults();
+  void WorkerLoop();
+  void PrintWorkerStatus();
+
   unsigned long _times;
   unsigned long _succ;
   unsigned long _received;
+
+protected:
+  int receiveMessage(MyMessage &my_msg, uint8_t &to, uint8_t &pipe);
+  void handleMessage(MyMessage &my_msg, uint8_t to, uint8_t pipe);
+  void pushResult(RFResult_t &result);
+  void lockRadio();
+  void unlockRadio();
+
+  CRecordQueue m_txQueue;
+  CRecordQueue m_rxQueue;
+  UC m_notifyTask;
+  UL m_txSeq;
+  UL m_txDropped;
+  UL m_rxDropped;
+  UL m_rxCorrupt;
+  UL m_latencyMax;
+  UL m_latencyTotal;
+  UL m_latencyCount;
+#ifdef RF_USE_WORKER
+  Thread *m_pWorker;
+  os_mutex_recursive_t m_radioLock;
+#endif
 };
 
 //------------------------------------------------------------------
@@ -0,0 +1,418 @@
+/**
+ * xlxRuleEngine.cpp - Xlight sensor triggered rule conditions
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. The 'cond' of a rule is compiled once, when the rule is configured,
+ *    into a few bytes of stack machine code (RuleProg_t), which is also
+ *    kept in flash next to the rule table
+ * 2. Syntax: comparisons of variables and integers, combined with
+ *    && || ! and parentheses. Variables: temp humid als pir mic time dev(n)
+ * 3. Each variable has an index of the rules reading it, so a sensor update
+ *    only runs those rules. Variable values are fetched once per update
+ * 4. Rules are edge triggered: the scenario is applied when the condition
+ *    turns from false to true
+ *
+ * ToDo:
+**/
+
+#include "xlxRuleEngine.h"
+
+//------------------------------------------------------------------
+// the one and only instance of RuleEngineClass
+RuleEngineClass theRuleEngine;
+
+const char *strRuleVarNames[] = {
+  "temp",
+  "humid",
+  "als",
+  "pir",
+  "mic",
+  "time",
+  "dev"
+};
+
+//------------------------------------------------------------------
+// Condition Compiler, recursive descent
+//   expr  := and { '||' and }
+//   and   := unary { '&&' unary }
+//   unary := '!' unary | '(' expr ')' | operand [ relop operand ]
+//------------------------------------------------------------------
+typedef struct
+{
+  const char *pos;
+  RuleProg_t *prog;
+  UC depth;
+  BOOL error;
+} RuleParser_t;
+
+static void rp_skip(RuleParser_t &p)
+{
+  while( *p.pos == ' ' || *p.pos == '\t' ) p.pos++;
+}
+
+static BOOL rp_match(RuleParser_t &p, const char *token)
+{
+  rp_skip(p);
+  UC lv_len = strlen(token);
+  if( strncmp(p.pos, token, lv_len) != 0 ) return false;
+  p.pos += lv_len;
+  return true;
+}
+
+static void rp_emit(RuleParser_t &p, UC byte)
+{
+  if( p.prog->len >= RULE_CODE_SIZE ) {
+    p.error = true;
+    return;
+  }
+  p.prog->code[p.prog->len++] = byte;
+}
+
+// Every push goes through here to keep the stack depth in check
+static void rp_push(RuleParser_t &p)
+{
+  if( ++p.depth > RULE_STACK_DEPTH ) p.error = true;
+}
+
+// Binary operator: two pops, one push
+static void rp_binary(RuleParser_t &p, UC op)
+{
+  rp_emit(p, op);
+  p.depth--;
+}
+
+static BOOL rp_number(RuleParser_t &p, long *value)
+{
+  rp_skip(p);
+  char *lv_end;
+  *value = strtol(p.pos, &lv_end, 10);
+  if( lv_end == p.pos || *value < -32768 || *value > 32767 ) return false;
+  p.pos = lv_end;
+  return true;
+}
+
+static void rp_operand(RuleParser_t &p)
+{
+  rp_skip(p);
+  long lv_value;
+  if( isalpha(*p.pos) ) {
+    UC lv_len = 0;
+    while( isalpha(p.pos[lv_len]) ) lv_len++;
+    UC lv_var;
+    for( lv_var = 0; lv_var < ruleVarMax; lv_var++ ) {
+      if( strlen(strRuleVarNames[lv_var]) == lv_len && strncmp(p.pos, strRuleVarNames[lv_var], lv_len) == 0 ) break;
+    }
+    if( lv_var >= ruleVarMax ) {
+      p.error = true;
+      return;
+    }
+    p.pos += lv_len;
+    if( lv_var == ruleVarDev ) {
+      if( !rp_match(p, "(") || !rp_number(p, &lv_value) || lv_value < 0 || lv_value > 255 || !rp_match(p, ")") ) {
+        p.error = true;
+        return;
+      }
+      rp_emit(p, ruleOpDev);
+      rp_emit(p, (UC)lv_value);
+    } else {
+      rp_emit(p, ruleOpLoad);
+      rp_emit(p, lv_var);
+    }
+    p.prog->mask |= (1 << lv_var);
+  } else if( rp_number(p, &lv_value) ) {
+    if( lv_value >= -128 && lv_value <= 127 ) {
+      rp_emit(p, ruleOpPush8);
+      rp_emit(p, (UC)(int8_t)lv_value);
+    } else {
+      rp_emit(p, ruleOpPush16);
+      rp_emit(p, (UC)(lv_value & 0xFF));
+      rp_emit(p, (UC)((lv_value >> 8) & 0xFF));
+    }
+  } else {
+    p.error = true;
+    return;
+  }
+  rp_push(p);
+}
+
+static void rp_expr(RuleParser_t &p);
+
+static void rp_unary(RuleParser_t &p)
+{
+  if( p.error ) return;
+  if( rp_match(p, "!") ) {
+    rp_unary(p);
+    rp_emit(p, ruleOpNot);
+    return;
+  }
+  if( rp_match(p, "(") ) {
+    rp_expr(p);
+    if( !rp_match(p, ")") ) p.error = true;
+    return;
+  }
+
+  rp_operand(p);
+  // Longer operators first
+  UC lv_op = ruleOpEnd;
+  if( rp_match(p, "==") ) lv_op = ruleOpEQ;
+  else if( rp_match(p, "!=") ) lv_op = ruleOpNE;
+  else if( rp_match(p, "<=") ) lv_op = ruleOpLE;
+  else if( rp_match(p, ">=") ) lv_op = ruleOpGE;
+  else if( rp_match(p, "<") ) lv_op = ruleOpLT;
+  else if( rp_match(p, ">") ) lv_op = ruleOpGT;
+  if( lv_op != ruleOpEnd ) {
+    rp_operand(p);
+    rp_binary(p, lv_op);
+  }
+}
+
+static void rp_and(RuleParser_t &p)
+{
+  rp_unary(p);
+  while( !p.error && rp_match(p, "&&") ) {
+    rp_unary(p);
+    rp_binary(p, ruleOpAnd);
+  }
+}
+
+static void rp_expr(RuleParser_t &p)
+{
+  rp_and(p);
+  while( !p.error && rp_match(p, "||") ) {
+    rp_and(p);
+    rp_binary(p, ruleOpOr);
+  }
+}
+
+//------------------------------------------------------------------
+// Xlight Rule Engine Class
+//------------------------------------------------------------------
+RuleEngineClass::RuleEngineClass()
+{
+  memset(m_progs, 0x00, sizeof(m_progs));
+  memset(m_indexLen, 0x00, sizeof(m_indexLen));
+  memset(m_state, 0x00, sizeof(m_state));
+  memset(m_values, 0x00, sizeof(m_values));
+  m_indexDirty = false;
+  m_pending = 0;
+  m_busy = false;
+  m_fetch = NULL;
+  m_fire = NULL;
+  m_evals = 0;
+  m_fires = 0;
+  m_lastUs = 0;
+}
+
+void RuleEngineClass::Init(RuleFetchFunc_t fetch, RuleFireFunc_t fire)
+{
+  m_fetch = fetch;
+  m_fire = fire;
+}
+
+BOOL RuleEngineClass::Compile(const char *src, RuleProg_t *prog)
+{
+  memset(prog, 0x00, sizeof(RuleProg_t));
+  if( !src ) return false;
+
+  RuleParser_t lv_parser;
+  lv_parser.pos = src;
+  lv_parser.prog = prog;
+  lv_parser.depth = 0;
+  lv_parser.error = false;
+  rp_expr(lv_parser);
+  rp_skip(lv_parser);
+  if( lv_parser.error || *lv_parser.pos != '\0' || lv_parser.depth != 1 ) {
+    memset(prog, 0x00, sizeof(RuleProg_t));
+    return false;
+  }
+  return true;
+}
+
+int RuleEngineClass::Execute(const UC *code, UC len, const int16_t *values, RuleFetchFunc_t fetch)
+{
+  int16_t lv_stack[RULE_STACK_DEPTH];
+  UC lv_sp = 0;
+  UC pc = 0;
+
+  while( pc < len ) {
+    UC lv_op = code[pc++];
+    if( lv_op < ruleOpEQ ) {
+      // Push
+      if( lv_sp >= RULE_STACK_DEPTH || pc >= len ) return -1;
+      int16_t lv_value;
+      switch( lv_op ) {
+      case ruleOpPush8:
+        lv_value = (int8_t)code[pc++];
+        break;
+      case ruleOpPush16:
+        if( pc + 1 >= len ) return -1;
+        lv_value = (int16_t)(code[pc] | (code[pc + 1] << 8));
+        pc += 2;
+        break;
+      case ruleOpLoad:
+        if( code[pc] >= ruleVarMax ) return -1;
+        lv_value = values[code[pc++]];
+        break;
+      case ruleOpDev:
+        lv_value = (fetch ? fetch(ruleVarDev, code[pc]) : 0);
+        pc++;
+        break;
+      default:
+        return -1;
+      }
+      lv_stack[lv_sp++] = lv_value;
+    } else if( lv_op == ruleOpNot ) {
+      if( lv_sp < 1 ) return -1;
+      lv_stack[lv_sp - 1] = !lv_stack[lv_sp - 1];
+    } else {
+      if( lv_sp < 2 ) return -1;
+      lv_sp--;
+      int16_t a = lv_stack[lv_sp - 1];
+      int16_t b = lv_stack[lv_sp];
+      int16_t r;
+      switch( lv_op ) {
+      case ruleOpEQ:  r = (a == b); break;
+      case ruleOpNE:  r = (a != b); break;
+      case ruleOpLT:  r = (a < b); break;
+      case ruleOpLE:  r = (a <= b); break;
+      case ruleOpGT:  r = (a > b); break;
+      case ruleOpGE:  r = (a >= b); break;
+      case ruleOpAnd: r = (a && b); break;
+      case ruleOpOr:  r = (a || b); break;
+      default: return -1;
+      }
+      lv_stack[lv_sp - 1] = r;
+    }
+  }
+
+  return(lv_sp == 1 ? (lv_stack[0] != 0) : -1);
+}
+
+BOOL RuleEngineClass::SetProgram(UC uid, const RuleProg_t &prog)
+{
+  if( uid >= MAX_RT_ROWS ) return false;
+  // Flash not written yet reads as RULE_PROG_EMPTY
+  if( prog.len == RULE_PROG_EMPTY || prog.len > RULE_CODE_SIZE ) {
+    Remove(uid);
+    return false;
+  }
+  m_progs[uid] = prog;
+  m_state[uid / 32] &= ~(1UL << (uid % 32));
+  m_indexDirty = true;
+  return true;
+}
+
+void RuleEngineClass::Remove(UC uid)
+{
+  if( uid >= MAX_RT_ROWS ) return;
+  memset(&m_progs[uid], 0x00, sizeof(RuleProg_t));
+  m_state[uid / 32] &= ~(1UL << (uid % 32));
+  m_indexDirty = true;
+}
+
+const RuleProg_t *RuleEngineClass::GetProgram(UC uid)
+{
+  return(uid < MAX_RT_ROWS ? &m_progs[uid] : NULL);
+}
+
+BOOL RuleEngineClass::HasCondition(UC uid)
+{
+  return(uid < MAX_RT_ROWS && m_progs[uid].len > 0);
+}
+
+BOOL RuleEngineClass::Check(UC uid)
+{
+  if( !HasCondition(uid) ) return true;
+  if( m_fetch ) {
+    for( UC i = 0; i < ruleVarDev; i++ ) m_values[i] = m_fetch(i, 0);
+  }
+  return(Execute(m_progs[uid].code, m_progs[uid].len, m_values, m_fetch) == 1);
+}
+
+void RuleEngineClass::buildIndex()
+{
+  memset(m_indexLen, 0x00, sizeof(m_indexLen));
+  for( UC uid = 0; uid < MAX_RT_ROWS; uid++ ) {
+    if( m_progs[uid].len == 0 ) continue;
+    for( UC var = 0; var < ruleVarMax; var++ ) {
+      if( m_progs[uid].mask & (1 << var) ) m_index[var][m_indexLen[var]++] = uid;
+    }
+  }
+  m_indexDirty = false;
+}
+
+void RuleEngineClass::OnUpdate(UC var)
+{
+  if( var >= ruleVarMax ) return;
+  m_pending |= (1 << var);
+  // Firing a rule may update variables again (e.g. device state)
+  if( m_busy ) return;
+
+  m_busy = true;
+  UL lv_start = micros();
+  while( m_pending ) {
+    if( m_indexDirty ) buildIndex();
+
+    UC lv_vars = m_pending;
+    m_pending = 0;
+    if( m_fetch ) {
+      for( UC i = 0; i < ruleVarDev; i++ ) m_values[i] = m_fetch(i, 0);
+    }
+
+    for( UC lv_var = 0; lv_var < ruleVarMax; lv_var++ ) {
+      if( !(lv_vars & (1 << lv_var)) ) continue;
+      for( UC i = 0; i < m_indexLen[lv_var]; i++ ) {
+        UC uid = m_index[lv_var][i];
+        // A rule reading several updated variables runs once
+        if( (lv_vars & m_progs[uid].mask) & ((1 << lv_var) - 1) ) continue;
+
+        int lv_result = Execute(m_progs[uid].code, m_progs[uid].len, m_values, m_fetch);
+        m_evals++;
+        if( lv_result < 0 ) continue;
+
+        UL lv_bit = (1UL << (uid % 32));
+        if( lv_result ) {
+          if( !(m_state[uid / 32] & lv_bit) ) {
+            m_state[uid / 32] |= lv_bit;
+            m_fires++;
+            if( m_fire ) m_fire(uid);
+          }
+        } else {
+          m_state[uid / 32] &= ~lv_bit;
+        }
+      }
+    }
+  }
+  m_lastUs = micros() - lv_start;
+  m_busy = false;
+}
+
+void RuleEngineClass::PrintStatus()
+{
+  if( m_indexDirty ) buildIndex();
+  SERIAL_LN("Rule conditions: evaluated %lu, fired %lu, last update %lu us", m_evals, m_fires, m_lastUs);
+  for( UC var = 0; var < ruleVarMax; var++ ) {
+    SERIAL_LN("  %-5s %d rules", strRuleVarNames[var], m_indexLen[var]);
+  }
+  for( UC uid = 0; uid < MAX_RT_ROWS; uid++ ) {
+    if( m_progs[uid].len == 0 ) continue;
+    SERIAL_LN("  rule %d: %d bytes, %s", uid, m_progs[uid].len,
+        (m_state[uid / 32] & (1UL << (uid % 32))) ? "true" : "false");
+  }
+}
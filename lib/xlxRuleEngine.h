@@ -0,0 +1,109 @@
+//  xlxRuleEngine.h - Xlight sensor triggered rule conditions
+
+#ifndef xlxRuleEngine_h
+#define xlxRuleEngine_h
+
+#include "xliCommon.h"
+#include "xlxConfig.h"
+
+#define RULE_PROG_SIZE            32          // Bytes per rule in RAM and flash
+#define RULE_CODE_SIZE            (RULE_PROG_SIZE - 2)
+#define RULE_STACK_DEPTH          8
+#define RULE_PROG_EMPTY           0xFF        // Erased flash
+#define RULE_NO_SCHEDULE          0xFF        // SCT_uid of a rule without schedule
+
+// Condition variables
+typedef enum
+{
+  ruleVarTemp = 0,                          // temp: degree C
+  ruleVarHumid,                             // humid: %
+  ruleVarALS,                               // als: brightness level
+  ruleVarPIR,                               // pir: 0 / 1
+  ruleVarMIC,                               // mic: toneEvent_t
+  ruleVarTime,                              // time: local hhmm, e.g. 1830
+  ruleVarDev,                               // dev(node_id): 1 if any ring is on
+  ruleVarMax
+} ruleVar_t;
+
+// Stack machine opcodes, operands follow inline
+typedef enum
+{
+  ruleOpEnd = 0,
+  ruleOpPush8,                              // int8 constant
+  ruleOpPush16,                             // int16 constant, little endian
+  ruleOpLoad,                               // variable
+  ruleOpDev,                                // node_id
+  ruleOpEQ = 0x10,
+  ruleOpNE,
+  ruleOpLT,
+  ruleOpLE,
+  ruleOpGT,
+  ruleOpGE,
+  ruleOpAnd = 0x20,
+  ruleOpOr,
+  ruleOpNot
+} ruleOp_t;
+
+// Compiled condition, also the flash layout
+typedef struct
+{
+  UC len;                                   // Code length, 0 for no condition
+  UC mask;                                  // Bitmap of ruleVar_t read by the code
+  UC code[RULE_CODE_SIZE];
+} RuleProg_t;
+
+// Value of ruleVarDev for node arg, other variables ignore arg
+typedef int16_t (*RuleFetchFunc_t)(UC var, UC arg);
+// The condition of rule uid turned true
+typedef void (*RuleFireFunc_t)(UC uid);
+
+//------------------------------------------------------------------
+// Xlight Rule Engine Class
+//------------------------------------------------------------------
+class RuleEngineClass
+{
+private:
+  RuleProg_t m_progs[MAX_RT_ROWS];          // Indexed by rule uid
+  UC m_index[ruleVarMax][MAX_RT_ROWS];      // Rules reading each variable
+  UC m_indexLen[ruleVarMax];
+  BOOL m_indexDirty;
+  UL m_state[(MAX_RT_ROWS + 31) / 32];      // Last result of each rule
+  int16_t m_values[ruleVarMax];
+  UC m_pending;                             // Variables updated while busy
+  BOOL m_busy;
+  RuleFetchFunc_t m_fetch;
+  RuleFireFunc_t m_fire;
+  UL m_evals;
+  UL m_fires;
+  UL m_lastUs;
+
+  void buildIndex();
+
+public:
+  RuleEngineClass();
+  void Init(RuleFetchFunc_t fetch, RuleFireFunc_t fire);
+
+  // Compile a condition, e.g. "pir==1 && als<30 && time>=1800",
+  // returns false on syntax error or if it doesn't fit
+  static BOOL Compile(const char *src, RuleProg_t *prog);
+  // 1 or 0, -1 for broken code
+  static int Execute(const UC *code, UC len, const int16_t *values, RuleFetchFunc_t fetch);
+
+  BOOL SetProgram(UC uid, const RuleProg_t &prog);
+  void Remove(UC uid);
+  const RuleProg_t *GetProgram(UC uid);
+  BOOL HasCondition(UC uid);
+  // True if the rule has no condition or it holds now
+  BOOL Check(UC uid);
+
+  // A variable changed, evaluate the rules depending on it
+  void OnUpdate(UC var);
+  void PrintStatus();
+};
+
+//------------------------------------------------------------------
+// Function & Class Helper
+//------------------------------------------------------------------
+extern RuleEngineClass theRuleEngine;
+
+#endif /* xlxRuleEngine_h */
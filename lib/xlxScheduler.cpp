@@ -0,0 +1,169 @@
+/**
+ * xlxScheduler.cpp - Xlight cooperative main loop scheduler
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. Every subsystem registers a task with a period, an optional readiness
+ *    check (e.g. serial input available) and can be signalled by an event
+ * 2. Run() executes all tasks that are due, ready or signalled, then idles
+ *    until the earliest deadline. While idle, readiness checks are polled
+ *    every ms, so input is served right away instead of after a fixed delay
+ * 3. The idle time is capped by SCHED_MAX_IDLE, then Run() returns and
+ *    loop() gives the system firmware a chance to run
+ * 4. Signal() only sets a bit, it can be called from interrupt handlers
+ *
+ * ToDo:
+**/
+
+#include "xlxScheduler.h"
+
+//------------------------------------------------------------------
+// the one and only instance of SchedulerClass
+SchedulerClass theScheduler;
+
+//------------------------------------------------------------------
+// Xlight Scheduler Class
+//------------------------------------------------------------------
+SchedulerClass::SchedulerClass()
+{
+  m_numTasks = 0;
+  m_signals = 0;
+  m_idleTime = 0;
+  m_startTime = 0;
+}
+
+// Register a task, the first run is due right away
+UC SchedulerClass::AddTask(const char *name, SchedTaskFunc_t func, UL period, SchedReadyFunc_t ready)
+{
+  if( m_numTasks >= SCHED_MAX_TASKS || !func ) return SCHED_INVALID_TASK;
+
+  SchedTask_t &lv_task = m_tasks[m_numTasks];
+  memset(&lv_task, 0x00, sizeof(SchedTask_t));
+  lv_task.name = name;
+  lv_task.func = func;
+  lv_task.ready = ready;
+  lv_task.period = period;
+  lv_task.due = millis();
+  lv_task.enabled = true;
+  m_signalTime[m_numTasks] = 0;
+  if( m_startTime == 0 ) m_startTime = millis();
+
+  return m_numTasks++;
+}
+
+void SchedulerClass::EnableTask(UC id, BOOL sw)
+{
+  if( id < m_numTasks ) m_tasks[id].enabled = sw;
+}
+
+// Request the task to run as soon as possible
+void SchedulerClass::Signal(UC id)
+{
+  if( id < SCHED_MAX_TASKS ) {
+    noInterrupts();
+    if( !(m_signals & (1UL << id)) ) m_signalTime[id] = millis();
+    m_signals |= (1UL << id);
+    interrupts();
+  }
+}
+
+// Override the next deadline of the task, e.g. when it knows better
+void SchedulerClass::SetNextRun(UC id, UL delayMs)
+{
+  if( id < m_numTasks ) m_tasks[id].due = millis() + delayMs;
+}
+
+BOOL SchedulerClass::isReady(UC id, UL now)
+{
+  SchedTask_t &lv_task = m_tasks[id];
+  if( !lv_task.enabled ) return false;
+  if( m_signals & (1UL << id) ) return true;
+  if( lv_task.period > 0 && (long)(now - lv_task.due) >= 0 ) return true;
+  if( lv_task.ready && lv_task.ready() ) return true;
+  return false;
+}
+
+void SchedulerClass::runTask(UC id, UL now)
+{
+  SchedTask_t &lv_task = m_tasks[id];
+  UL lv_latency = 0;
+
+  noInterrupts();
+  if( m_signals & (1UL << id) ) lv_latency = now - m_signalTime[id];
+  m_signals &= ~(1UL << id);
+  interrupts();
+  if( lv_task.period > 0 && (long)(now - lv_task.due) > (long)lv_latency ) {
+    lv_latency = now - lv_task.due;
+  }
+  if( lv_latency > lv_task.maxLatency ) lv_task.maxLatency = lv_latency;
+
+  // The next deadline is taken from now, so a late task doesn't burst
+  if( lv_task.period > 0 ) lv_task.due = now + lv_task.period;
+  lv_task.func();
+  lv_task.runs++;
+
+  UL lv_duration = millis() - now;
+  if( lv_duration > lv_task.maxDuration ) lv_task.maxDuration = lv_duration;
+}
+
+// Run everything that is due, then idle until the earliest deadline
+void SchedulerClass::Run()
+{
+  UL lv_now = millis();
+  for( UC i = 0; i < m_numTasks; i++ ) {
+    if( isReady(i, lv_now) ) {
+      runTask(i, lv_now);
+      lv_now = millis();
+    }
+  }
+
+  // Find the earliest deadline
+  UL lv_sleep = SCHED_MAX_IDLE;
+  for( UC i = 0; i < m_numTasks; i++ ) {
+    if( m_tasks[i].enabled && m_tasks[i].period > 0 ) {
+      long lv_left = (long)(m_tasks[i].due - lv_now);
+      if( lv_left <= 0 ) return;
+      if( (UL)lv_left < lv_sleep ) lv_sleep = lv_left;
+    }
+  }
+
+  // Idle, but wake up on events and ready input
+  UL lv_start = millis();
+  while( millis() - lv_start < lv_sleep ) {
+    if( m_signals ) break;
+    BOOL lv_ready = false;
+    for( UC i = 0; i < m_numTasks && !lv_ready; i++ ) {
+      if( m_tasks[i].enabled && m_tasks[i].ready && m_tasks[i].ready() ) lv_ready = true;
+    }
+    if( lv_ready ) break;
+    delay(1);
+  }
+  m_idleTime += millis() - lv_start;
+}
+
+void SchedulerClass::PrintStatus()
+{
+  UL lv_uptime = millis() - m_startTime;
+  SERIAL_LN("Scheduler: %d tasks, idle %lu%%", m_numTasks,
+      lv_uptime > 0 ? (UL)((unsigned long long)m_idleTime * 100 / lv_uptime) : 0);
+  for( UC i = 0; i < m_numTasks; i++ ) {
+    SchedTask_t &lv_task = m_tasks[i];
+    SERIAL_LN("  %-8s %s period:%lums runs:%lu max latency:%lums max run:%lums", lv_task.name,
+        lv_task.enabled ? "on " : "off", lv_task.period, lv_task.runs, lv_task.maxLatency, lv_task.maxDuration);
+  }
+}
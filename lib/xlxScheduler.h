@@ -0,0 +1,62 @@
+//  xlxScheduler.h - Xlight cooperative main loop scheduler
+
+#ifndef xlxScheduler_h
+#define xlxScheduler_h
+
+#include "xliCommon.h"
+
+#define SCHED_MAX_TASKS           16
+#define SCHED_INVALID_TASK        0xFF
+// Longest time the loop sleeps without returning to the system firmware (ms)
+#define SCHED_MAX_IDLE            100
+
+// Task body
+typedef void (*SchedTaskFunc_t)();
+// Optional readiness check, polled while idle. Return true to run the task now
+typedef bool (*SchedReadyFunc_t)();
+
+typedef struct
+{
+  const char *name;
+  SchedTaskFunc_t func;
+  SchedReadyFunc_t ready;
+  UL period;                                // ms, 0 means run on event only
+  UL due;                                   // millis() of the next run
+  BOOL enabled;
+  UL runs;
+  UL maxLatency;                            // Longest wait behind the deadline or event (ms)
+  UL maxDuration;                           // Longest run time (ms)
+} SchedTask_t;
+
+//------------------------------------------------------------------
+// Xlight Scheduler Class
+//------------------------------------------------------------------
+class SchedulerClass
+{
+private:
+  SchedTask_t m_tasks[SCHED_MAX_TASKS];
+  UC m_numTasks;
+  volatile UL m_signals;                    // One bit per task, set by Signal()
+  UL m_signalTime[SCHED_MAX_TASKS];
+  UL m_idleTime;
+  UL m_startTime;
+
+  BOOL isReady(UC id, UL now);
+  void runTask(UC id, UL now);
+
+public:
+  SchedulerClass();
+  UC AddTask(const char *name, SchedTaskFunc_t func, UL period, SchedReadyFunc_t ready = NULL);
+  void EnableTask(UC id, BOOL sw = true);
+  void Signal(UC id);                       // Also safe in interrupt context
+  void SetNextRun(UC id, UL delayMs);
+  void Run();
+  void PrintStatus();
+};
+
+//------------------------------------------------------------------
+// Function & Class Helper
+//------------------------------------------------------------------
+extern SchedulerClass theScheduler;
+
+#endif /* xlxScheduler_h */
@@ -0,0 +1,212 @@
+/**
+ * xlxSensorSched.cpp - Xlight adaptive sensor sampling scheduler
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. Each sensor type in sensors_t registers a read function with a
+ *    period range, a change threshold and an optional jitter. A second
+ *    value with its own threshold may be tracked, e.g. DHT humidity
+ * 2. The period halves when a value moves by its threshold or more, and
+ *    grows by 1/4 after SEN_STABLE_READS unchanged reads, within the range
+ * 3. Sensors start SEN_STAGGER apart, and at most one SEN_FLAG_SLOW read
+ *    is done per round, the others wait for the next round
+ * 4. Read time is accounted per sensor over SEN_ACCOUNT_PERIOD (1 hour)
+ * 5. Run() returns the delay to the next read, so the collect task can
+ *    sleep until then instead of polling on a fixed tick
+ *
+ * ToDo:
+**/
+
+#include "xlxSensorSched.h"
+#include "xlxConfig.h"
+
+//------------------------------------------------------------------
+// the one and only instance of SensorSchedClass
+SensorSchedClass theSensorSched;
+
+//------------------------------------------------------------------
+// Xlight Sensor Scheduler Class
+//------------------------------------------------------------------
+SensorSchedClass::SensorSchedClass()
+{
+  memset(m_slots, 0x00, sizeof(m_slots));
+  m_numRegistered = 0;
+  m_factor = 1;
+  m_windowStart = 0;
+  m_deferred = 0;
+}
+
+BOOL SensorSchedClass::Register(sensors_t id, const char *name, SensorReadFunc_t func, UL minPeriod, UL maxPeriod,
+    float threshold, UL jitter, UC flags, float threshold2)
+{
+  if( id >= SEN_MAX_SENSORS || !func || minPeriod == 0 || maxPeriod < minPeriod ) return false;
+
+  SensorSlot_t &lv_slot = m_slots[id];
+  BOOL lv_new = (lv_slot.read == NULL);
+  memset(&lv_slot, 0x00, sizeof(SensorSlot_t));
+  lv_slot.name = name;
+  lv_slot.read = func;
+  lv_slot.minPeriod = minPeriod;
+  lv_slot.maxPeriod = maxPeriod;
+  lv_slot.jitter = jitter;
+  lv_slot.threshold = threshold;
+  lv_slot.threshold2 = threshold2;
+  lv_slot.flags = flags;
+  lv_slot.period = minPeriod;
+  lv_slot.lastValue = NAN;
+  lv_slot.lastValue2 = NAN;
+  if( lv_new ) m_numRegistered++;
+  if( m_windowStart == 0 ) m_windowStart = millis();
+
+  // Spread the first reads
+  lv_slot.due = millis() + (UL)m_numRegistered * SEN_STAGGER;
+  return true;
+}
+
+BOOL SensorSchedClass::IsRegistered(UC id)
+{
+  return(id < SEN_MAX_SENSORS && m_slots[id].read != NULL);
+}
+
+// Sleep mode stretch of a sensor period
+UC SensorSchedClass::factor(UC id)
+{
+  return((m_slots[id].flags & SEN_FLAG_NOSLEEP) ? 1 : m_factor);
+}
+
+void SensorSchedClass::schedule(UC id, UL now)
+{
+  SensorSlot_t &lv_slot = m_slots[id];
+  lv_slot.due = now + lv_slot.period * factor(id);
+  if( lv_slot.jitter > 0 ) lv_slot.due += random(lv_slot.jitter + 1);
+}
+
+// Only track the change from the last moving value
+static BOOL valueMoved(float value, float &last, float threshold)
+{
+  if( isnan(value) ) return false;
+  if( isnan(last) ) {
+    last = value;
+    return false;
+  }
+
+  float lv_diff = value - last;
+  if( lv_diff < 0 ) lv_diff = -lv_diff;
+  if( lv_diff > 0 && lv_diff >= threshold ) {
+    last = value;
+    return true;
+  }
+  return false;
+}
+
+// New value(s) of a sensor, adapt its period
+void SensorSchedClass::Report(UC id, float value, float value2)
+{
+  if( !IsRegistered(id) || isnan(value) ) return;
+
+  SensorSlot_t &lv_slot = m_slots[id];
+  UL lv_period = lv_slot.period;
+  if( isnan(lv_slot.lastValue) ) {
+    lv_slot.lastValue = value;
+    if( lv_slot.threshold2 > 0 ) lv_slot.lastValue2 = value2;
+    return;
+  }
+
+  BOOL lv_moving = valueMoved(value, lv_slot.lastValue, lv_slot.threshold);
+  if( lv_slot.threshold2 > 0 && valueMoved(value2, lv_slot.lastValue2, lv_slot.threshold2) ) {
+    lv_moving = true;
+  }
+  if( lv_moving ) {
+    lv_slot.stableReads = 0;
+    lv_slot.period = max(lv_slot.minPeriod, lv_slot.period / 2);
+  } else if( ++lv_slot.stableReads >= SEN_STABLE_READS ) {
+    lv_slot.stableReads = 0;
+    lv_slot.period = min(lv_slot.maxPeriod, lv_slot.period + lv_slot.period / 4 + 1);
+  }
+  // Faster now, don't wait for the old deadline
+  if( lv_slot.period < lv_period ) schedule(id, millis());
+}
+
+UC SensorSchedClass::Run(BOOL sleep, UL *nextDue)
+{
+  UL lv_now = millis();
+  UC lv_count = 0;
+  BOOL lv_slowDone = false;
+
+  m_factor = (sleep ? SEN_SLEEP_FACTOR : 1);
+
+  // Roll the accounting window
+  if( lv_now - m_windowStart >= SEN_ACCOUNT_PERIOD ) {
+    for( UC i = 0; i < SEN_MAX_SENSORS; i++ ) {
+      m_slots[i].lastBusyUs = m_slots[i].busyUs;
+      m_slots[i].busyUs = 0;
+    }
+    m_windowStart = lv_now;
+  }
+
+  for( UC i = 0; i < SEN_MAX_SENSORS; i++ ) {
+    SensorSlot_t &lv_slot = m_slots[i];
+    if( !lv_slot.read || (long)(lv_now - lv_slot.due) < 0 ) continue;
+    if( !theConfig.IsSensorEnabled((sensors_t)i) ) continue;
+
+    if( lv_slot.flags & SEN_FLAG_SLOW ) {
+      if( lv_slowDone ) {
+        lv_slot.due = lv_now + SEN_STAGGER;
+        m_deferred++;
+        continue;
+      }
+      lv_slowDone = true;
+    }
+
+    UL lv_start = micros();
+    float lv_value = lv_slot.read();
+    lv_slot.busyUs += micros() - lv_start;
+    lv_slot.reads++;
+    schedule(i, lv_now);
+    if( !isnan(lv_value) ) {
+      Report(i, lv_value);
+      lv_count++;
+    }
+  }
+
+  if( nextDue ) {
+    long lv_next = SEN_ACCOUNT_PERIOD;
+    lv_now = millis();
+    for( UC i = 0; i < SEN_MAX_SENSORS; i++ ) {
+      if( !m_slots[i].read ) continue;
+      long lv_left = (long)(m_slots[i].due - lv_now);
+      if( lv_left < lv_next ) lv_next = lv_left;
+    }
+    *nextDue = (lv_next > 0 ? lv_next : 0);
+  }
+  return lv_count;
+}
+
+void SensorSchedClass::PrintStatus()
+{
+  UL lv_window = (millis() - m_windowStart) / 1000;
+  SERIAL_LN("Sensors: %d registered, %s mode, %lu slow reads deferred, window %lus",
+      m_numRegistered, (m_factor > 1 ? "sleep" : "normal"), m_deferred, lv_window);
+  SERIAL_LN("  %-5s %8s %13s %8s %10s %10s", "name", "period", "range", "reads", "us/window", "us/lasthr");
+  for( UC i = 0; i < SEN_MAX_SENSORS; i++ ) {
+    SensorSlot_t &lv_slot = m_slots[i];
+    if( !lv_slot.read ) continue;
+    SERIAL_LN("  %-5s %8lu %6lu-%-6lu %8lu %10lu %10lu", lv_slot.name, lv_slot.period * factor(i),
+        lv_slot.minPeriod, lv_slot.maxPeriod, lv_slot.reads, lv_slot.busyUs, lv_slot.lastBusyUs);
+  }
+}
@@ -0,0 +1,76 @@
+//  xlxSensorSched.h - Xlight adaptive sensor sampling scheduler
+
+#ifndef xlxSensorSched_h
+#define xlxSensorSched_h
+
+#include "xliCommon.h"
+
+#define SEN_MAX_SENSORS           (sensorBEAT + 1)
+#define SEN_STAGGER               100         // Initial offset between sensors (ms)
+#define SEN_SLEEP_FACTOR          4           // Periods are stretched by this in sleep mode
+#define SEN_STABLE_READS          3           // Unchanged reads before slowing down
+#define SEN_ACCOUNT_PERIOD        3600000     // Time accounting window (ms)
+
+// Sensor flags
+#define SEN_FLAG_SLOW             0x01        // Costly read, at most one per round
+#define SEN_FLAG_NOSLEEP          0x02        // Period is not stretched in sleep mode
+
+// Read one sample and report it, return the value for change tracking or
+// NAN if the result comes later through SensorSchedClass::Report()
+typedef float (*SensorReadFunc_t)();
+
+typedef struct
+{
+  const char *name;
+  SensorReadFunc_t read;
+  UL minPeriod;                             // ms, while the value moves
+  UL maxPeriod;                             // ms, when stable
+  UL jitter;                                // ms, random delay added to each period
+  float threshold;                          // Change that counts as moving
+  float threshold2;                         // Same for the second value, 0 if not used
+  UC flags;
+  UL period;                                // Current period
+  UL due;                                   // millis() of the next read
+  float lastValue;
+  float lastValue2;
+  UC stableReads;
+  UL reads;
+  UL busyUs;                                // Read time in the current window
+  UL lastBusyUs;                            // Read time in the last full window
+} SensorSlot_t;
+
+//------------------------------------------------------------------
+// Xlight Sensor Scheduler Class
+//------------------------------------------------------------------
+class SensorSchedClass
+{
+private:
+  SensorSlot_t m_slots[SEN_MAX_SENSORS];    // Indexed by sensors_t
+  UC m_numRegistered;
+  UC m_factor;                              // Period multiplier, SEN_SLEEP_FACTOR in sleep mode
+  UL m_windowStart;
+  UL m_deferred;                            // Slow reads pushed to the next round
+
+  void schedule(UC id, UL now);
+  UC factor(UC id);
+
+public:
+  SensorSchedClass();
+  BOOL Register(sensors_t id, const char *name, SensorReadFunc_t func, UL minPeriod, UL maxPeriod,
+      float threshold, UL jitter = 0, UC flags = 0, float threshold2 = 0);
+  BOOL IsRegistered(UC id);
+  // A sensor may give two values per read, e.g. DHT temperature and humidity,
+  // it is moving if either of them changes by its threshold
+  void Report(UC id, float value, float value2 = NAN);
+  // Read the sensors that are due, returns the number of values read.
+  // nextDue gets the delay (ms) to the next read
+  UC Run(BOOL sleep, UL *nextDue);
+  void PrintStatus();
+};
+
+//------------------------------------------------------------------
+// Function & Class Helper
+//------------------------------------------------------------------
+extern SensorSchedClass theSensorSched;
+
+#endif /* xlxSensorSched_h */
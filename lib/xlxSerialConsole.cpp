@@ -44,8 +44,16 @@
 #include "xlxSerialConsole.h"
 #include "xlSmartController.h"
 #include "xlxConfig.h"
+#include "xlxLightEngine.h"
 #include "xlxLogger.h"
+#include "xlxMQTTClient.h"
+#include "xlxPerf.h"
+#include "xlxProvision.h"
 #include "xlxRF24Server.h"
+#include "xlxRuleEngine.h"
+#include "xlxScheduler.h"
+#include "xlxSensorSched.h"
+#include "xlxSerialOut.h"
 
 //------------------------------------------------------------------
 // the one and only instance of SerialConsoleClass
@@ -99,51 +107,52 @@ typedef enum
 /// Matrix: actual definition for command/handler array
 const StateMachine_t fsmMain[] = {
   // Current-State    Next-State      Event-String        Function
-  {consoleRoot,       consoleRoot,    "?",                gc_doHelp},
-  {consoleRoot,       consoleRoot,    "help",             gc_doHelp},
-  {consoleRoot,       consoleRoot,    "check",            gc_doCheck},
-  {consoleRoot,       consoleRoot,    "show",             gc_doShow},
-  {consoleRoot,       consoleRoot,    "ping",             gc_doPing},
-  {consoleRoot,       consoleRoot,    "do",               gc_doAction},
-  {consoleRoot,       consoleRoot,    "test",             gc_doTest},
-  {consoleRoot,       consoleRoot,    "send",             gc_doSend},
-  {consoleRoot,       consoleRoot,    "set",              gc_doSet},
-  {consoleRoot,       consoleSys,     "sys",              gc_doSys},
+  {consoleRoot,       consoleRoot,    SM_EVENT("?"),      gc_doHelp},
+  {consoleRoot,       consoleRoot,    SM_EVENT("help"),   gc_doHelp},
+  {consoleRoot,       consoleRoot,    SM_EVENT("check"),  gc_doCheck},
+  {consoleRoot,       consoleRoot,    SM_EVENT("show"),   gc_doShow},
+  {consoleRoot,       consoleRoot,    SM_EVENT("ping"),   gc_doPing},
+  {consoleRoot,       consoleRoot,    SM_EVENT("do"),     gc_doAction},
+  {consoleRoot,       consoleRoot,    SM_EVENT("test"),   gc_doTest},
+  {consoleRoot,       consoleRoot,    SM_EVENT("send"),   gc_doSend},
+  {consoleRoot,       consoleRoot,    SM_EVENT("set"),    gc_doSet},
+  {consoleRoot,       consoleSys,     SM_EVENT("sys"),    gc_doSys},
   /// Menu default
-  {consoleRoot,       consoleRoot,    "",                 gc_doHelp},
+  {consoleRoot,       consoleRoot,    SM_EVENT(""),       gc_doHelp},
 
   /// Shared function
-  {consoleSys,        consoleRoot,    "reset",            gc_doSysSub},
-  {consoleSys,        consoleRoot,    "safe",             gc_doSysSub},
-  {consoleSys,        consoleRoot,    "dfu",              gc_doSysSub},
-  {consoleSys,        consoleRoot,    "update",           gc_doSysSub},
-  {consoleSys,        consoleRoot,    "base",             gc_doSysSub},
-  {consoleSys,        consoleRoot,    "private",          gc_doSysSub},
+  {consoleSys,        consoleRoot,    SM_EVENT("reset"),  gc_doSysSub},
+  {consoleSys,        consoleRoot,    SM_EVENT("safe"),   gc_doSysSub},
+  {consoleSys,        consoleRoot,    SM_EVENT("dfu"),    gc_doSysSub},
+  {consoleSys,        consoleRoot,    SM_EVENT("update"), gc_doSysSub},
+  {consoleSys,        consoleRoot,    SM_EVENT("base"),   gc_doSysSub},
+  {consoleSys,        consoleRoot,    SM_EVENT("private"), gc_doSysSub},
+  {consoleSys,        consoleRoot,    SM_EVENT("bin"),    gc_doSysSub},
   /// Workflow
-  {consoleSys,        consoleWF_YesNo,   "setup",         gc_doSysSetupWiFi},
+  {consoleSys,        consoleWF_YesNo,   SM_EVENT("setup"), gc_doSysSetupWiFi},
   /// Menu default
-  {consoleSys,        consoleRoot,    "",                 gc_doHelp},
-
-  {consoleWF_YesNo,   consoleWF_GetSSID, "yes",           gc_doSysSetupWiFi},
-  {consoleWF_YesNo,   consoleWF_GetSSID, "y",             gc_doSysSetupWiFi},
-  {consoleWF_YesNo,   consoleRoot,    "no",               gc_nop},
-  {consoleWF_YesNo,   consoleRoot,    "n",                gc_nop},
-  {consoleWF_YesNo,   consoleRoot,    "",                 gc_nop},
-  {consoleWF_GetSSID, consoleWF_GetPassword, "",          gc_doSysSetupWiFi},
-  {consoleWF_GetPassword, consoleWF_GetAUTH, "",          gc_doSysSetupWiFi},
-  {consoleWF_GetAUTH, consoleWF_Confirm, "0",             gc_doSysSetupWiFi},
-  {consoleWF_GetAUTH, consoleWF_Confirm, "1",             gc_doSysSetupWiFi},
-  {consoleWF_GetAUTH, consoleWF_Confirm, "2",             gc_doSysSetupWiFi},
-  {consoleWF_GetAUTH, consoleWF_Confirm, "3",             gc_doSysSetupWiFi},
-  {consoleWF_GetAUTH, consoleRoot,    "q",                gc_nop},
-  {consoleWF_Confirm, consoleRoot,    "yes",              gc_doSysSetWiFiCredential},
-  {consoleWF_Confirm, consoleRoot,    "y",                gc_doSysSetWiFiCredential},
-  {consoleWF_Confirm, consoleRoot,    "no",               gc_nop},
-  {consoleWF_Confirm, consoleRoot,    "n",                gc_nop},
-  {consoleWF_Confirm, consoleRoot,    "",                 gc_nop},
+  {consoleSys,        consoleRoot,    SM_EVENT(""),       gc_doHelp},
+
+  {consoleWF_YesNo,   consoleWF_GetSSID, SM_EVENT("yes"), gc_doSysSetupWiFi},
+  {consoleWF_YesNo,   consoleWF_GetSSID, SM_EVENT("y"),   gc_doSysSetupWiFi},
+  {consoleWF_YesNo,   consoleRoot,    SM_EVENT("no"),     gc_nop},
+  {consoleWF_YesNo,   consoleRoot,    SM_EVENT("n"),      gc_nop},
+  {consoleWF_YesNo,   consoleRoot,    SM_EVENT(""),       gc_nop},
+  {consoleWF_GetSSID, consoleWF_GetPassword, SM_EVENT(""), gc_doSysSetupWiFi},
+  {consoleWF_GetPassword, consoleWF_GetAUTH, SM_EVENT(""), gc_doSysSetupWiFi},
+  {consoleWF_GetAUTH, consoleWF_Confirm, SM_EVENT("0"),   gc_doSysSetupWiFi},
+  {consoleWF_GetAUTH, consoleWF_Confirm, SM_EVENT("1"),   gc_doSysSetupWiFi},
+  {consoleWF_GetAUTH, consoleWF_Confirm, SM_EVENT("2"),   gc_doSysSetupWiFi},
+  {consoleWF_GetAUTH, consoleWF_Confirm, SM_EVENT("3"),   gc_doSysSetupWiFi},
+  {consoleWF_GetAUTH, consoleRoot,    SM_EVENT("q"),      gc_nop},
+  {consoleWF_Confirm, consoleRoot,    SM_EVENT("yes"),    gc_doSysSetWiFiCredential},
+  {consoleWF_Confirm, consoleRoot,    SM_EVENT("y"),      gc_doSysSetWiFiCredential},
+  {consoleWF_Confirm, consoleRoot,    SM_EVENT("no"),     gc_nop},
+  {consoleWF_Confirm, consoleRoot,    SM_EVENT("n"),      gc_nop},
+  {consoleWF_Confirm, consoleRoot,    SM_EVENT(""),       gc_nop},
 
   /// System default
-  {consoleDummy,      consoleRoot,    "",                 gc_doHelp}
+  {consoleDummy,      consoleRoot,    SM_EVENT(""),       gc_doHelp}
 };
 
 const char *strAuthMethods[4] = {"None", "WPA2", "WEP", "TKIP"};
@@ -154,6 +163,8 @@ const char *strAuthMethods[4] = {"None", "WPA2", "WEP", "TKIP"};
 SerialConsoleClass::SerialConsoleClass()
 {
   isInCloudCommand = false;
+  m_cloudLen = 0;
+  m_cloudReply[0] = '\0';
 }
 
 void SerialConsoleClass::Init()
@@ -164,6 +175,12 @@ void SerialConsoleClass::Init()
 
 bool SerialConsoleClass::processCommand()
 {
+  // Binary provisioning takes over the serial port
+  if( theProvision.IsActive() ) {
+    theProvision.Process();
+    return true;
+  }
+
   bool retVal = readSerial();
   if( !retVal ) {
     SERIAL_LN(F("Unknown command or incorrect arguments\n\r"));
@@ -203,19 +220,28 @@ bool SerialConsoleClass::showThisHelp(String &strTopic)
     SERIAL_LN(F("--- Command: show <object> ---"));
     SERIAL_LN(F("To show value or summary information, where <object> could be:"));
     SERIAL_LN(F("   ble:     show BLE summary"));
+    SERIAL_LN(F("   cond:    show sensor conditions of rules"));
     SERIAL_LN(F("   debug:   show debug channel and level"));
     SERIAL_LN(F("   dev:     show device list"));
     SERIAL_LN(F("   flag:    show system flags"));
+    SERIAL_LN(F("   light:   show light transitions and RF frame pacing"));
+    SERIAL_LN(F("   log [n|all]: show last <n=10> or all records of flash log"));
+    SERIAL_LN(F("   mqtt:    show MQTT channel status"));
     SERIAL_LN(F("   net:     show network summary"));
     SERIAL_LN(F("   node:    show node summary"));
+    SERIAL_LN(F("   out:     show serial output buffer and drops"));
+    SERIAL_LN(F("   perf [hist]: show execution time statistics [with histograms]"));
+    SERIAL_LN(F("   report:  show sensor data reporting parameters and rate"));
     SERIAL_LN(F("   nlist:   show NodeID list"));
     SERIAL_LN(F("   rf:      print RF details"));
+    SERIAL_LN(F("   sched:   show main loop tasks and latency"));
+    SERIAL_LN(F("   sensor:  show sensor read periods and time spent"));
     SERIAL_LN(F("   time:    show current time and time zone"));
     SERIAL_LN(F("   var:     show system variables"));
     SERIAL_LN(F("   table:   show working memory tables"));
     SERIAL_LN(F("   version: show firmware version"));
     SERIAL_LN(F("e.g. show rf\n\r"));
-    CloudOutput(F("show ble|debug|dev|flag|net|node|rf|time|var|table|version"));
+    CloudOutput(F("show ble|cond|debug|dev|flag|light|log|mqtt|net|node|out|perf|report|rf|sched|sensor|time|var|table|version"));
   } else if(strTopic.equals("ping")) {
     SERIAL_LN(F("--- Command: ping <address> ---"));
     SERIAL_LN(F("To ping an IP or domain name, default address is 8.8.8.8"));
@@ -251,12 +277,18 @@ bool SerialConsoleClass::showThisHelp(String &strTopic)
     SERIAL_LN(F("e.g. set base [0|1]"));
     SERIAL_LN(F("e.g. set debug [log:level]"));
     SERIAL_LN(F("     , where log is [serial|flash|syslog|cloud|all"));
-    SERIAL_LN(F("     and level is [none|alter|critical|error|warn|notice|info|debug]\n\r"));
-    CloudOutput(F("set tz|nodeid|base|debug"));
+    SERIAL_LN(F("     and level is [none|alter|critical|error|warn|notice|info|debug]"));
+    SERIAL_LN(F("e.g. set syslog <host> [port=514]"));
+    SERIAL_LN(F("e.g. set report <field> <deadband> [min-interval max-interval]"));
+    SERIAL_LN(F("     , where field is [DHTt|DHTh|ALS|PIR], intervals in seconds"));
+    SERIAL_LN(F("e.g. set out [drop|block]"));
+    SERIAL_LN(F("     , what console output does when its buffer is full\n\r"));
+    CloudOutput(F("set tz|nodeid|base|debug|syslog|report|out"));
   } else if(strTopic.equals("sys")) {
     SERIAL_LN(F("--- Command: sys <mode> ---"));
     SERIAL_LN(F("To control the system status, where <mode> could be:"));
     SERIAL_LN(F("   base <duration>: switch to base network and accept new device for <duration=60> seconds"));
+    SERIAL_LN(F("   bin:     enter binary provisioning mode on serial port"));
     SERIAL_LN(F("   private: switch to private network"));
     SERIAL_LN(F("   reset:   reset the system"));
     SERIAL_LN(F("   safe:    enter safe/recover mode"));
@@ -264,7 +296,7 @@ bool SerialConsoleClass::showThisHelp(String &strTopic)
     SERIAL_LN(F("   dfu:     enter DFU mode"));
     SERIAL_LN(F("   update:  update firmware"));
     SERIAL_LN(F("e.g. sys reset\n\r"));
-    CloudOutput(F("sys base|private|reset|safe|setup|dfu|update"));
+    CloudOutput(F("sys base|bin|private|reset|safe|setup|dfu|update"));
   } else {
     SERIAL_LN(F("Available Commands:"));
     SERIAL_LN(F("    check, show, ping, do, test, send, set, sys, help or ?"));
@@ -304,11 +336,12 @@ bool SerialConsoleClass::doCheck(const char *cmd)
   bool retVal = true;
 
   char *sTopic = next();
+  uint32_t lv_topic = CommandHash(sTopic);
   if( sTopic ) {
-    if (strnicmp(sTopic, "rf", 2) == 0) {
+    if (CMD_IS(lv_topic, sTopic, "rf")) {
       SERIAL_LN("**RF module is %s\n\r", (theRadio.isValid() ? "available" : "not available!"));
       CloudOutput("RF module is %s", (theRadio.isValid() ? "available" : "not available!"));
-    } else if (strnicmp(sTopic, "wifi", 4) == 0) {
+    } else if (CMD_IS(lv_topic, sTopic, "wifi")) {
         SERIAL("**Wi-Fi module is %s, ", (WiFi.ready() ? "ready" : "not ready!"));
         int lv_RSSI = WiFi.RSSI();
         if( lv_RSSI < 0 ) {
@@ -319,10 +352,10 @@ bool SerialConsoleClass::doCheck(const char *cmd)
           SERIAL_LN("time-out\n\r");
         }
         CloudOutput("Wi-Fi module is %s, RSSI=%ddB", (WiFi.ready() ? "ready" : "not ready!"), lv_RSSI);
-    } else if (strnicmp(sTopic, "wlan", 4) == 0) {
+    } else if (CMD_IS(lv_topic, sTopic, "wlan")) {
         SERIAL_LN("**Resolving IP for www.google.com...%s\n\r", (WiFi.resolve("www.google.com") ? "OK" : "failed!"));
         CloudOutput("WLAN is OK");
-    } else if (strnicmp(sTopic, "flash", 5) == 0) {
+    } else if (CMD_IS(lv_topic, sTopic, "flash")) {
         SERIAL_LN("** Free memory: %lu bytes, total EEPROM space: %lu bytes\n\r", System.freeMemory(), EEPROM.length());
         CloudOutput("Free memory: %lu bytes, total EEPROM space: %lu bytes", System.freeMemory(), EEPROM.length());
     } else {
@@ -344,8 +377,9 @@ bool SerialConsoleClass::doShow(const char *cmd)
   char strDisplay[64];
 
   char *sTopic = next();
+  uint32_t lv_topic = CommandHash(sTopic);
   if( sTopic ) {
-    if (strnicmp(sTopic, "net", 3) == 0) {
+    if (CMD_IS(lv_topic, sTopic, "net")) {
       SERIAL_LN("** Network Summary **");
       SERIAL_LN("  Current RF NetworkID: %s", PrintUint64(strDisplay, theRadio.getCurrentNetworkID()));
       SERIAL_LN("  Private RF NetworkID: %s", PrintUint64(strDisplay, theRadio.getMyNetworkID()));
@@ -355,11 +389,11 @@ bool SerialConsoleClass::doShow(const char *cmd)
       SERIAL_LN("  MAC address: %s", PrintMacAddress(strDisplay, mac));
       if( WiFi.ready() ) {
         SERIAL("  IP Address: ");
-        Serial.println(WiFi.localIP());
+        gSerialOut.println(WiFi.localIP());
         SERIAL("  Subnet Mask: ");
-        Serial.println(WiFi.subnetMask());
+        gSerialOut.println(WiFi.subnetMask());
         SERIAL("  Gateway IP: ");
-        Serial.println(WiFi.gatewayIP());
+        gSerialOut.println(WiFi.gatewayIP());
         SERIAL_LN("  SSID: %s", WiFi.SSID());
       }
       SERIAL_LN("");
@@ -367,29 +401,30 @@ bool SerialConsoleClass::doShow(const char *cmd)
           PrintUint64(strDisplay, theRadio.getCurrentNetworkID()),
           PrintMacAddress(strDisplay, mac),
           WiFi.SSID());
-	} else if (strnicmp(sTopic, "node", 4) == 0) {
+	} else if (CMD_IS(lv_topic, sTopic, "node")) {
       uint8_t lv_NodeID = theRadio.getAddress();
       SERIAL_LN("**NodeID: %d (%s), Status: %d", lv_NodeID, (lv_NodeID==GATEWAY_ADDRESS ? "Gateway" : (lv_NodeID==AUTO ? "AUTO" : "Node")), theSys.GetStatus());
       SERIAL_LN("  Product Info: %s-%s-%d", theConfig.GetOrganization().c_str(), theConfig.GetProductName().c_str(), theConfig.GetVersion());
       SERIAL_LN("  System Info: %s-%s\n\r", theSys.GetSysID().c_str(), theSys.GetSysVersion().c_str());
       CloudOutput("NodeID: %d (%s), Status: %d", lv_NodeID, (lv_NodeID==GATEWAY_ADDRESS ? "Gateway" : (lv_NodeID==AUTO ? "AUTO" : "Node")), theSys.GetStatus());
-  } else if (strnicmp(sTopic, "nlist", 5) == 0) {
+  } else if (CMD_IS(lv_topic, sTopic, "nlist")) {
       SERIAL_LN("**Node List count:%d, size:%d", theConfig.lstNodes.count(), theConfig.lstNodes.size());
       theConfig.lstNodes.showList();
       CloudOutput("Nodelist count:%d, size:%d", theConfig.lstNodes.count(), theConfig.lstNodes.size());
-	} else if (strnicmp(sTopic, "ble", 3) == 0) {
+	} else if (CMD_IS(lv_topic, sTopic, "ble")) {
       // ToDo: show BLE summay
       SERIAL_LN("");
       CloudOutput("");
-	} else if (strnicmp(sTopic, "rf", 2) == 0) {
+	} else if (CMD_IS(lv_topic, sTopic, "rf")) {
       theRadio.PrintRFDetails();
+      theRadio.PrintWorkerStatus();
       SERIAL_LN("");
-	} else if (strnicmp(sTopic, "time", 4) == 0) {
+	} else if (CMD_IS(lv_topic, sTopic, "time")) {
       time_t time = Time.now();
       SERIAL_LN("Now is %s, zone: %d\n\r", Time.format(time, TIME_FORMAT_ISO8601_FULL).c_str(), -5);
       CloudOutput("Local time %s, zone: %d", Time.format(time, TIME_FORMAT_ISO8601_FULL).c_str(), -5);
 	}
-	else if (strnicmp(sTopic, "var", 3) == 0) {
+	else if (CMD_IS(lv_topic, sTopic, "var")) {
 		SERIAL_LN("theSys.m_isRF = \t\t\t%s", (theSys.IsRFGood() ? "true" : "false"));
 		SERIAL_LN("theSys.m_isBLE = \t\t\t%s", (theSys.IsBLEGood() ? "true" : "false"));
 		SERIAL_LN("theSys.m_isLAN = \t\t\t%s", (theSys.IsLANGood() ? "true" : "false"));
@@ -413,7 +448,7 @@ bool SerialConsoleClass::doShow(const char *cmd)
 		SERIAL_LN("theConfig.m_isRTChanged = \t\t%s", (theConfig.IsRTChanged() ? "true" : "false"));
 		SERIAL_LN("theConfig.m_isSNTChanged = \t\t%s\n\r", (theConfig.IsSNTChanged() ? "true" : "false"));
 
-	} else if (strnicmp(sTopic, "table", 5) == 0) {
+	} else if (CMD_IS(lv_topic, sTopic, "table")) {
 		SERIAL_LN("DST_ROW_SIZE: \t\t\t\t%u", DST_ROW_SIZE);
 		SERIAL_LN("RT_ROW_SIZE: \t\t\t\t%u", RT_ROW_SIZE);
 		SERIAL_LN("SCT_ROW_SIZE: \t\t\t\t%u", SCT_ROW_SIZE);
@@ -438,11 +473,46 @@ bool SerialConsoleClass::doShow(const char *cmd)
 				theSys.print_scenario_table(i);
 		SERIAL_LN("");
 
-	} else if (strnicmp(sTopic, "version", 7) == 0) {
+	} else if (CMD_IS(lv_topic, sTopic, "version")) {
       SERIAL_LN("System version: %s\n\r", System.version().c_str());
       CloudOutput("System version: %s", System.version().c_str());
-	} else if (strnicmp(sTopic, "debug", 5) == 0) {
+	} else if (CMD_IS(lv_topic, sTopic, "debug")) {
       CloudOutput(theLog.PrintDestInfo());
+	} else if (CMD_IS(lv_topic, sTopic, "log")) {
+      UL lv_lines = 10;
+      char *sParam1 = next();
+      if( sParam1 ) {
+        lv_lines = (strnicmp(sParam1, "all", 3) == 0 ? 0 : atoi(sParam1));
+      }
+      theLog.PrintFlashLog(lv_lines);
+      SERIAL_LN("");
+      CloudOutput("Flash log printed on serial port");
+	} else if (CMD_IS(lv_topic, sTopic, "report")) {
+      theSys.PrintReportInfo();
+      CloudOutput("Sensor data reporting info printed on serial port");
+	} else if (CMD_IS(lv_topic, sTopic, "mqtt")) {
+      theMQTT.PrintStatus();
+      CloudOutput("MQTT is %s", (theMQTT.IsConnected() ? "connected" : "disconnected"));
+	} else if (CMD_IS(lv_topic, sTopic, "cond")) {
+      theRuleEngine.PrintStatus();
+      CloudOutput("Rule conditions printed on serial port");
+	} else if (CMD_IS(lv_topic, sTopic, "light")) {
+      theLightEngine.PrintStatus();
+      CloudOutput("Light transitions printed on serial port");
+	} else if (CMD_IS(lv_topic, sTopic, "sched")) {
+      theScheduler.PrintStatus();
+      CloudOutput("Scheduler info printed on serial port");
+	} else if (CMD_IS(lv_topic, sTopic, "out")) {
+      theSerialOut.PrintStatus();
+      CloudOutput("Output buffer info printed on serial port");
+	} else if (CMD_IS(lv_topic, sTopic, "sensor")) {
+      theSensorSched.PrintStatus();
+      CloudOutput("Sensor info printed on serial port");
+	} else if (CMD_IS(lv_topic, sTopic, "perf")) {
+      char *sParam1 = next();
+      thePerf.PrintStats(sParam1 && strnicmp(sParam1, "hist", 4) == 0);
+      thePerf.UpdateSnapshot();
+      CloudOutput("%s", thePerf.m_snapshot.c_str());
 	} else {
       retVal = false;
     }
@@ -470,16 +540,17 @@ bool SerialConsoleClass::doAction(const char *cmd)
   bool retVal = false;
 
   char *sTopic = next();
+  uint32_t lv_topic = CommandHash(sTopic);
   if( sTopic ) {
-    if (strnicmp(sTopic, "on", 2) == 0) {
+    if (CMD_IS(lv_topic, sTopic, "on")) {
       // ToDo:
       SERIAL_LN("**Light is ON\n\r");
       retVal = true;
-    } else if (strnicmp(sTopic, "off", 3) == 0) {
+    } else if (CMD_IS(lv_topic, sTopic, "off")) {
       // ToDo:
       SERIAL_LN("**Light is OFF\n\r");
       retVal = true;
-    } else if (strnicmp(sTopic, "color", 5) == 0) {
+    } else if (CMD_IS(lv_topic, sTopic, "color")) {
       // ToDo:
       SERIAL_LN("**Color changed\n\r");
       retVal = true;
@@ -497,12 +568,13 @@ bool SerialConsoleClass::doTest(const char *cmd)
   bool retVal = false;
 
   char *sTopic = next();
+  uint32_t lv_topic = CommandHash(sTopic);
   if( sTopic ) {
-    if (strnicmp(sTopic, "ping", 4) == 0) {
+    if (CMD_IS(lv_topic, sTopic, "ping")) {
       char *sIPaddress = next();
       PingAddress(sIPaddress);
       retVal = true;
-    } else if (strnicmp(sTopic, "send", 4) == 0) {
+    } else if (CMD_IS(lv_topic, sTopic, "send")) {
       char *sParam = next();
       if( strlen(sParam) >= 3 ) {
         String strMsg = sParam;
@@ -540,9 +612,10 @@ bool SerialConsoleClass::doSet(const char *cmd)
   bool retVal = false;
 
   char *sTopic = next();
+  uint32_t lv_topic = CommandHash(sTopic);
   char *sParam1;
   if( sTopic ) {
-    if (strnicmp(sTopic, "tz", 2) == 0) {
+    if (CMD_IS(lv_topic, sTopic, "tz")) {
       sParam1 = next();
       if( sParam1) {
         // ToDo: set time zone
@@ -550,13 +623,13 @@ bool SerialConsoleClass::doSet(const char *cmd)
         CloudOutput("Set Time Zone to %s", sParam1);
         retVal = true;
       }
-    } else if (strnicmp(sTopic, "nodeid", 6) == 0) {
+    } else if (CMD_IS(lv_topic, sTopic, "nodeid")) {
       sParam1 = next();
       if( sParam1) {
         uint8_t bNodeID = (uint8_t)(atoi(sParam1) % 256);
         retVal = theRadio.ChangeNodeID(bNodeID);
       }
-    } else if (strnicmp(sTopic, "base", 4) == 0) {
+    } else if (CMD_IS(lv_topic, sTopic, "base")) {
       sParam1 = next();
       if( sParam1) {
         theRadio.enableBaseNetwork(atoi(sParam1) > 0);
@@ -564,7 +637,7 @@ bool SerialConsoleClass::doSet(const char *cmd)
         CloudOutput("Base RF network is %s", (theRadio.isBaseNetworkEnabled() ? "enabled" : "disabled"));
         retVal = true;
       }
-    } else if (strnicmp(sTopic, "debug", 5) == 0) {
+    } else if (CMD_IS(lv_topic, sTopic, "debug")) {
       sParam1 = next();
       if( sParam1) {
         String strMsg = sParam1;
@@ -574,6 +647,47 @@ bool SerialConsoleClass::doSet(const char *cmd)
           CloudOutput("Set Debug Level to %s", sParam1);
         }
       }
+    } else if (CMD_IS(lv_topic, sTopic, "syslog")) {
+      sParam1 = next();
+      if( sParam1) {
+        US lv_port = XLA_SYSLOG_PORT;
+        char *sParam2 = next();
+        if( sParam2 ) lv_port = atoi(sParam2);
+        retVal = theLog.InitSysLog(sParam1, lv_port);
+        SERIAL_LN("Set syslog server to %s:%d %s\n\r", sParam1, lv_port, (retVal ? "OK" : "failed"));
+        CloudOutput("Set syslog server to %s:%d %s", sParam1, lv_port, (retVal ? "OK" : "failed"));
+      }
+    } else if (CMD_IS(lv_topic, sTopic, "report")) {
+      sParam1 = next();
+      char *sParam2 = next();
+      if( sParam1 && sParam2 ) {
+        UC lv_field = theSys.FindReportField(sParam1);
+        char *sMin = next();
+        char *sMax = (sMin ? next() : NULL);
+        if( lv_field < REPORT_DUMMY ) {
+          retVal = theSys.SetReportParam(lv_field, atof(sParam2),
+              (sMin ? atoi(sMin) : SEN_REPORT_MIN_INTERVAL), (sMax ? atoi(sMax) : SEN_REPORT_MAX_INTERVAL));
+        }
+        if( retVal ) {
+          SERIAL_LN("Set %s deadband to %s\n\r", sParam1, sParam2);
+          CloudOutput("Set %s deadband to %s", sParam1, sParam2);
+        }
+      }
+    } else if (CMD_IS(lv_topic, sTopic, "out")) {
+      sParam1 = next();
+      if( sParam1 ) {
+        if( strnicmp(sParam1, "block", 5) == 0 ) {
+          theSerialOut.SetPolicy(soutBlock);
+          retVal = true;
+        } else if( strnicmp(sParam1, "drop", 4) == 0 ) {
+          theSerialOut.SetPolicy(soutDrop);
+          retVal = true;
+        }
+        if( retVal ) {
+          SERIAL_LN("Set console output to %s on overflow\n\r", sParam1);
+          CloudOutput("Set console output to %s on overflow", sParam1);
+        }
+      }
     }
   }
 
@@ -595,30 +709,35 @@ bool SerialConsoleClass::doSysSub(const char *cmd)
 
   char strDisplay[64];
   const char *sTopic = CommandList[currentCommand].event;
+  uint32_t lv_topic = CommandList[currentCommand].hash;
   char *sParam1;
   if( sTopic ) {
-    if (strnicmp(sTopic, "reset", 5) == 0) {
+    if (CMD_IS(lv_topic, sTopic, "reset")) {
       SERIAL_LN(F("System is about to reset..."));
       CloudOutput("System is about to reset");
+      theLog.FlushFlash();
+      theSerialOut.FlushAll();
       delay(500);
       System.reset();
     }
-    else if (strnicmp(sTopic, "safe", 4) == 0) {
+    else if (CMD_IS(lv_topic, sTopic, "safe")) {
       SERIAL_LN(F("System is about to enter safe mode..."));
       CloudOutput("System is about to enter safe mod");
+      theSerialOut.FlushAll();
       delay(1000);
       System.enterSafeMode();
     }
-    else if (strnicmp(sTopic, "dfu", 3) == 0) {
+    else if (CMD_IS(lv_topic, sTopic, "dfu")) {
       SERIAL_LN(F("System is about to enter DFU mode..."));
       CloudOutput("System is about to enter DFU mode");
+      theSerialOut.FlushAll();
       delay(1000);
       System.dfu();
     }
-    else if (strnicmp(sTopic, "update", 6) == 0) {
+    else if (CMD_IS(lv_topic, sTopic, "update")) {
       // ToDo: to OTA
     }
-    else if (strnicmp(sTopic, "base", 4) == 0) {
+    else if (CMD_IS(lv_topic, sTopic, "base")) {
       // Switch to Base Network
       sParam1 = next();
       int nDur = 60;
@@ -629,7 +748,16 @@ bool SerialConsoleClass::doSysSub(const char *cmd)
       SERIAL_LN(F("Switched to base network\n\r"));
       CloudOutput(F("Switched to base network"));
     }
-    else if (strnicmp(sTopic, "private", 7) == 0) {
+    else if (CMD_IS(lv_topic, sTopic, "bin")) {
+      // Serial port only, frames follow right away
+      if( isInCloudCommand ) {
+        CloudOutput("Binary provisioning is only available on serial port");
+        return false;
+      }
+      SERIAL_LN(F("Binary provisioning mode, timeout %d ms"), PROV_TIMEOUT);
+      theProvision.Start();
+    }
+    else if (CMD_IS(lv_topic, sTopic, "private")) {
       // Switch to Private Network
       theRadio.switch2MyNetwork();
       SERIAL_LN(F("Switched to private network: %s\n\r"), PrintUint64(strDisplay, theRadio.getCurrentNetworkID()));
@@ -734,7 +862,7 @@ bool SerialConsoleClass::PingAddress(const char *sAddress)
   // Ping 4 times
   int pingStartTime = millis();
   SERIAL("Pinging %s (", sAddress);
-  Serial.print(ipAddr);
+  gSerialOut.print(ipAddr);
   SERIAL(")...");
   int myByteCount = WiFi.ping(ipAddr, 3);
   int elapsedTime = millis() - pingStartTime;
@@ -806,6 +934,8 @@ bool SerialConsoleClass::ExecuteCloudCommand(const char *cmd)
 {
   clearBuffer();
   setCommandBuffer(cmd);
+  m_cloudLen = 0;
+  m_cloudReply[0] = '\0';
   isInCloudCommand = true;
   bool rc = scanStateMachine();
   isInCloudCommand = false;
@@ -813,19 +943,29 @@ bool SerialConsoleClass::ExecuteCloudCommand(const char *cmd)
 }
 
 // Output concise result to the cloud
+// Results of one command are joined with "; " into a single reply
 void SerialConsoleClass::CloudOutput(const char *msg, ...)
 {
   if( !isInCloudCommand ) return;
 
   int nSize = 0;
-  char buf[MAX_MESSAGE_LEN];
+  int nPos = m_cloudLen;
+  if( nPos > 0 && nPos < MAX_MESSAGE_LEN - 3 ) {
+    m_cloudReply[nPos++] = ';';
+    m_cloudReply[nPos++] = ' ';
+  }
+  if( nPos >= MAX_MESSAGE_LEN - 1 ) return;
 
-  // Prepare message
+  // Append message
   va_list args;
   va_start(args, msg);
-  nSize = vsnprintf(buf, MAX_MESSAGE_LEN, msg, args);
-  buf[nSize] = NULL;
+  nSize = vsnprintf(m_cloudReply + nPos, MAX_MESSAGE_LEN - nPos, msg, args);
+  va_end(args);
+  if( nSize > 0 ) nPos += nSize;
+  if( nPos >= MAX_MESSAGE_LEN ) nPos = MAX_MESSAGE_LEN - 1;
+  m_cloudReply[nPos] = NULL;
+  m_cloudLen = nPos;
 
   // Set message
-  theSys.m_lastMsg = buf;
+  theSys.m_lastMsg = m_cloudReply;
 }
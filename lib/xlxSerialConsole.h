@@ -4,6 +4,7 @@
 #define xlxSerialConsole_h
 
 #include "SerialCommand.h"
+#include "xlxLogger.h"
 
 class SerialConsoleClass : public SerialCommand
 {
@@ -59,6 +60,8 @@ public:
 
 private:
   bool isInCloudCommand;
+  char m_cloudReply[MAX_MESSAGE_LEN];       // Reply of the current cloud command
+  int m_cloudLen;
 };
 
 //------------------------------------------------------------------
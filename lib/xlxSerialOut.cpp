@@ -0,0 +1,155 @@
+/**
+ * xlxSerialOut.cpp - Xlight buffered, non-blocking serial console output
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. SERIAL, SERIAL_LN and the serial log channel write into a RAM ring
+ *    instead of Serial, so a long 'show' or a slow / absent USB host never
+ *    stalls the caller
+ * 2. The "output" task drains the ring in chunks of whatever
+ *    Serial.availableForWrite() reports, i.e. never blocks either
+ * 3. Overflow: a message that doesn't fit is dropped as a whole (soutDrop,
+ *    default), and a "<n bytes lost>" line marks the gap once there is room
+ *    again. soutBlock waits for the host instead, only safe in the main loop.
+ *    'set out drop|block' switches between them
+ * 4. Writers are serialized with interrupts off, the drain side runs in the
+ *    main loop only
+ *
+ * ToDo:
+**/
+
+#include "xlxSerialOut.h"
+
+//------------------------------------------------------------------
+// the one and only instance of SerialOutClass
+SerialOutClass theSerialOut;
+// SERIAL and SERIAL_LN print through this, see xliCommon.h
+Print &gSerialOut = theSerialOut;
+
+//------------------------------------------------------------------
+// Xlight Serial Output Class
+//------------------------------------------------------------------
+SerialOutClass::SerialOutClass()
+{
+  m_ring.Create(SOUT_BUFFER_SIZE);
+  m_policy = soutDrop;
+  m_written = 0;
+  m_sent = 0;
+  m_dropped = 0;
+  m_drops = 0;
+  m_lostMark = 0;
+  m_maxPending = 0;
+}
+
+// All or nothing, interrupts must be off
+BOOL SerialOutClass::put(const uint8_t *buffer, size_t size)
+{
+  if( m_ring.Free() < size ) return false;
+
+  m_ring.Write(buffer, size);
+  m_written += size;
+  if( m_ring.Length() > m_maxPending ) m_maxPending = m_ring.Length();
+  return true;
+}
+
+BOOL SerialOutClass::append(const uint8_t *buffer, size_t size)
+{
+  BOOL lv_ok;
+
+  noInterrupts();
+  lv_ok = put(buffer, size);
+  interrupts();
+  return lv_ok;
+}
+
+size_t SerialOutClass::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t SerialOutClass::write(const uint8_t *buffer, size_t size)
+{
+  if( size == 0 ) return 0;
+
+  if( m_policy == soutBlock && size <= m_ring.Size() ) {
+    UL lv_start = millis();
+    while( m_ring.Free() < size && millis() - lv_start < SOUT_FLUSH_TIMEOUT ) {
+      if( Flush() == 0 ) delay(1);
+    }
+  }
+
+  // Mark the gap before going on, bytes an ISR loses meanwhile stay counted
+  UL lv_lost = m_lostMark;
+  if( lv_lost > 0 ) {
+    char lv_mark[32];
+    int lv_len = snprintf(lv_mark, sizeof(lv_mark), "\r\n<%lu bytes lost>\r\n", lv_lost);
+    noInterrupts();
+    if( put((const uint8_t *)lv_mark, lv_len) ) m_lostMark -= lv_lost;
+    interrupts();
+  }
+
+  if( !append(buffer, size) ) {
+    noInterrupts();
+    m_dropped += size;
+    m_drops++;
+    m_lostMark += size;
+    interrupts();
+    return 0;
+  }
+  return size;
+}
+
+BOOL SerialOutClass::IsReady()
+{
+  return(Pending() > 0 && Serial.availableForWrite() > 0);
+}
+
+UL SerialOutClass::Flush()
+{
+  UL lv_sent = 0;
+  int lv_room = Serial.availableForWrite();
+  const UC *lv_ptr;
+
+  while( lv_room > 0 ) {
+    UL lv_span = m_ring.ReadPeek(&lv_ptr);
+    if( lv_span == 0 ) break;
+    if( lv_span > (UL)lv_room ) lv_span = lv_room;
+    Serial.write(lv_ptr, lv_span);
+    m_ring.ReadCommit(lv_span);
+    lv_sent += lv_span;
+    lv_room -= lv_span;
+  }
+  m_sent += lv_sent;
+  return lv_sent;
+}
+
+void SerialOutClass::FlushAll(UL timeout)
+{
+  UL lv_start = millis();
+  while( Pending() > 0 && millis() - lv_start < timeout ) {
+    if( Flush() == 0 ) delay(1);
+  }
+}
+
+void SerialOutClass::PrintStatus()
+{
+  SERIAL_LN("Serial output %s, pending %lu of %lu bytes, max %lu",
+      (m_policy == soutBlock ? "blocking" : "dropping"), Pending(), m_ring.Size(), m_maxPending);
+  SERIAL_LN("  written %lu, sent %lu, dropped %lu bytes in %lu messages\n\r",
+      m_written, m_sent, m_dropped, m_drops);
+}
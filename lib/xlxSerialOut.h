@@ -0,0 +1,60 @@
+//  xlxSerialOut.h - Xlight buffered, non-blocking serial console output
+
+#ifndef xlxSerialOut_h
+#define xlxSerialOut_h
+
+#include "xliCommon.h"
+#include "RingBuffer.h"
+
+#define SOUT_BUFFER_SIZE          4096
+#define SOUT_FLUSH_TIMEOUT        500         // ms, longest wait in FlushAll()
+
+// What to do when a message doesn't fit
+typedef enum
+{
+  soutDrop = 0,                             // Drop the whole message and count it
+  soutBlock                                 // Wait for the host, main loop only
+} soutPolicy_t;
+
+//------------------------------------------------------------------
+// Xlight Serial Output Class
+//------------------------------------------------------------------
+class SerialOutClass : public Print
+{
+private:
+  CRingBuffer m_ring;
+  UC m_policy;
+  UL m_written;                             // Bytes accepted
+  UL m_sent;                                // Bytes handed to Serial
+  UL m_dropped;                             // Bytes dropped
+  UL m_drops;                               // Messages dropped
+  UL m_lostMark;                            // Dropped bytes not reported in the output yet
+  UL m_maxPending;
+
+  BOOL put(const uint8_t *buffer, size_t size);
+  BOOL append(const uint8_t *buffer, size_t size);
+
+public:
+  SerialOutClass();
+
+  virtual size_t write(uint8_t c);
+  virtual size_t write(const uint8_t *buffer, size_t size);
+
+  // 'set out drop|block' on the console
+  void SetPolicy(UC policy) { m_policy = policy; }
+  UL Pending() { return m_ring.Length(); }
+  // Ready to send something, without blocking
+  BOOL IsReady();
+  // Send as much as the USB host takes now, returns the bytes sent
+  UL Flush();
+  // Drain everything, e.g. before reset
+  void FlushAll(UL timeout = SOUT_FLUSH_TIMEOUT);
+  void PrintStatus();
+};
+
+//------------------------------------------------------------------
+// Function & Class Helper
+//------------------------------------------------------------------
+extern SerialOutClass theSerialOut;
+
+#endif /* xlxSerialOut_h */
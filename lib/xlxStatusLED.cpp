@@ -0,0 +1,137 @@
+/**
+ * xlxStatusLED.cpp - Xlight status indicator on the RGB LED
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. Each STATUS_* code maps to a color and a waveform: blink, breath or
+ *    heartbeat. Waveforms are small precomputed LUTs of brightness levels
+ * 2. Tick() runs in the system timer ISR (RTE_DELAY_SYSTIMER, 25ms): a
+ *    divider, a table lookup, and an output only when the level changes.
+ *    The main loop is not involved, status changes are picked up by the ISR
+ * 3. The LED is dimmed by SoftPWM in edge mode, the system firmware gives
+ *    up control of the RGB LED
+ *
+ * ToDo:
+**/
+
+#include "xlxStatusLED.h"
+#include "xliPinMap.h"
+#include "SoftPWM.h"
+
+// P1 RGB LED is common anode
+#define STATUS_LED_POLARITY       SOFTPWM_INVERTED
+// TIM3/TIM4 drive the PWM of D0-D3, A4 and A5, TIM6 is sysTimer and TIM7
+// the MIC sampler. TIM5 only serves WKP (A7), an analog input here
+#define STATUS_LED_TIMER          TIMER5
+
+//------------------------------------------------------------------
+// Waveforms, one entry per step
+//------------------------------------------------------------------
+const UC lutOn[] = {255};
+const UC lutBlink[] = {255, 0};
+// (0.5 - 0.5cos)^2, looks even to the eye
+const UC lutBreath[] = {
+  0, 0, 0, 2, 5, 13, 24, 41, 64, 91, 122, 154, 186, 214, 236, 250,
+  255, 250, 236, 214, 186, 154, 122, 91, 64, 41, 24, 13, 5, 2, 0, 0
+};
+const UC lutHeartbeat[] = {255, 96, 0, 255, 96, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+#define LUT(a)          a, sizeof(a)
+
+// Indexed by STATUS_*, at 25ms per tick
+const LEDPattern_t ledPatterns[] = {
+  {LUT(lutOn),        1,  0},               // STATUS_OFF: dark
+  {LUT(lutBlink),     4,  LED_BLUE},        // STATUS_INIT: fast blink, 5Hz
+  {LUT(lutBlink),     20, LED_BLUE},        // STATUS_BMW: slow blink, 1Hz
+  {LUT(lutHeartbeat), 3,  LED_RED | LED_GREEN}, // STATUS_DIS: heartbeat, 1.2s
+  {LUT(lutBreath),    2,  LED_GREEN},       // STATUS_NWS: breath, 1.6s
+  {LUT(lutBreath),    6,  LED_BLUE},        // STATUS_SLP: slow breath, 4.8s
+  {LUT(lutBlink),     4,  LED_WHITE},       // STATUS_RST: fast blink
+  {LUT(lutBlink),     4,  LED_RED}          // STATUS_ERR: fast blink
+};
+
+#define LED_PATTERNS    (sizeof(ledPatterns) / sizeof(ledPatterns[0]))
+
+void gc_statusLEDPins(UC color, UC level)
+{
+  SoftPWMSet(PIN_LED_RED, (color & LED_RED) ? level : 0);
+  SoftPWMSet(PIN_LED_GREEN, (color & LED_GREEN) ? level : 0);
+  SoftPWMSet(PIN_LED_BLUE, (color & LED_BLUE) ? level : 0);
+}
+
+//------------------------------------------------------------------
+// the one and only instance of StatusLEDClass
+StatusLEDClass theStatusLED;
+
+//------------------------------------------------------------------
+// Xlight Status LED Class
+//------------------------------------------------------------------
+StatusLEDClass::StatusLEDClass()
+{
+  m_out = NULL;
+  m_pattern = &ledPatterns[STATUS_OFF];
+  m_status = STATUS_OFF;
+  m_step = 0;
+  m_div = 0;
+  m_level = 0;
+}
+
+void StatusLEDClass::Init(LEDOutFunc_t out)
+{
+  // Stop the ISR while switching
+  m_out = NULL;
+  m_status = 0xFF;
+
+  if( !out ) {
+    RGB.control(true);
+    SoftPWMBegin(STATUS_LED_POLARITY, SOFTPWM_EDGE, STATUS_LED_TIMER);
+    // Register the channels here, not in the ISR
+    gc_statusLEDPins(0, 0);
+    out = gc_statusLEDPins;
+  }
+  m_out = out;
+}
+
+const LEDPattern_t *StatusLEDClass::GetPattern(UC status)
+{
+  return &ledPatterns[status < LED_PATTERNS ? status : STATUS_OFF];
+}
+
+void StatusLEDClass::Tick(UC status)
+{
+  if( !m_out ) return;
+
+  if( status != m_status ) {
+    m_status = status;
+    m_pattern = GetPattern(status);
+    m_step = 0;
+    m_div = 0;
+    m_level = m_pattern->lut[0];
+    (*m_out)(m_pattern->color, m_level);
+    return;
+  }
+
+  if( ++m_div < m_pattern->divider ) return;
+  m_div = 0;
+  if( ++m_step >= m_pattern->len ) m_step = 0;
+  UC lv_level = m_pattern->lut[m_step];
+  if( lv_level != m_level ) {
+    m_level = lv_level;
+    (*m_out)(m_pattern->color, m_level);
+  }
+}
@@ -0,0 +1,55 @@
+//  xlxStatusLED.h - Xlight status indicator on the RGB LED
+
+#ifndef xlxStatusLED_h
+#define xlxStatusLED_h
+
+#include "xliCommon.h"
+
+// Color bits
+#define LED_RED                   0x01
+#define LED_GREEN                 0x02
+#define LED_BLUE                  0x04
+#define LED_WHITE                 (LED_RED | LED_GREEN | LED_BLUE)
+
+// Waveform of a status: one LUT step every divider timer ticks
+typedef struct
+{
+  const UC *lut;
+  UC len;
+  UC divider;
+  UC color;
+} LEDPattern_t;
+
+// Drive the LED, level 0..255 on the color bits, 0 on the others
+typedef void (*LEDOutFunc_t)(UC color, UC level);
+
+//------------------------------------------------------------------
+// Xlight Status LED Class
+//------------------------------------------------------------------
+class StatusLEDClass
+{
+private:
+  LEDOutFunc_t m_out;
+  const LEDPattern_t *m_pattern;
+  UC m_status;
+  UC m_step;
+  UC m_div;
+  UC m_level;
+
+public:
+  StatusLEDClass();
+  // out = NULL: SoftPWM on PIN_LED_RED/GREEN/BLUE
+  void Init(LEDOutFunc_t out = NULL);
+
+  static const LEDPattern_t *GetPattern(UC status);
+
+  // Called from the system timer with the current STATUS_*
+  void Tick(UC status);
+};
+
+//------------------------------------------------------------------
+// Function & Class Helper
+//------------------------------------------------------------------
+extern StatusLEDClass theStatusLED;
+
+#endif /* xlxStatusLED_h */
@@ -0,0 +1,108 @@
+/**
+ * xlxSysLog.cpp - Xlight syslog (RFC5424 over UDP) log destination
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. WriteLog formats RFC5424 records into a bounded queue, nothing is sent
+ *    in the caller's context
+ * 2. Process() runs from main loop and packs as many queued records as fit
+ *    into one datagram, each one prefixed by its length and a space
+ *    (octet-counting framing, RFC6587)
+ * 3. When the queue is full, the oldest records are dropped and counted.
+ *    Writer and reader both run in the main loop, so the writer may pop
+ *    records from the single-consumer queue
+ *
+ * Record format:
+ * <PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID MSGID STRUCTURED-DATA MSG
+ *
+ * ToDo:
+**/
+
+#include "xlxSysLog.h"
+
+//------------------------------------------------------------------
+// Xlight SysLog Class
+//------------------------------------------------------------------
+SysLogClass::SysLogClass()
+  : m_queue(SYSLOG_QUEUE_SIZE)
+{
+  m_port = 0;
+  m_isReady = false;
+  m_dropped = 0;
+  m_sent = 0;
+}
+
+BOOL SysLogClass::Init(IPAddress server, US port)
+{
+  m_server = server;
+  m_port = port;
+  if( !m_isReady ) {
+    m_isReady = (m_udp.begin(SYSLOG_LOCAL_PORT) != 0);
+  }
+  return m_isReady;
+}
+
+// Format the record in place, the oldest records are dropped to make room
+BOOL SysLogClass::Append(UC level, const char *tag, const char *msg, const char *host)
+{
+  char *lv_pRec;
+  while( (lv_pRec = (char *)m_queue.WriteReserve(SYSLOG_MAX_RECORD)) == NULL ) {
+    if( m_queue.Count() == 0 ) return false;
+    m_queue.Pop();
+    m_dropped++;
+  }
+
+  int nLen = snprintf(lv_pRec, SYSLOG_MAX_RECORD, "<%d>1 %s %s %s - %.3s - %s",
+      SYSLOG_FACILITY * 8 + level,
+      Time.format(Time.now(), TIME_FORMAT_ISO8601_FULL).c_str(),
+      host, XLA_PRODUCT_NAME, tag, msg);
+  if( nLen < 0 ) return false;
+  if( nLen >= SYSLOG_MAX_RECORD ) nLen = SYSLOG_MAX_RECORD - 1;
+  m_queue.WriteCommit(nLen);
+
+  return true;
+}
+
+// Called from main loop: send queued records in batches
+void SysLogClass::Process()
+{
+  if( !m_isReady || !WiFi.ready() ) return;
+
+  char lv_datagram[SYSLOG_MAX_DATAGRAM];
+  UC lv_burst = 0;
+  while( m_queue.Count() > 0 && lv_burst < SYSLOG_MAX_BURST ) {
+    int nPos = 0;
+    US lv_len;
+    const UC *lv_pRec;
+    while( (lv_pRec = m_queue.Peek(&lv_len)) != NULL ) {
+      char lv_prefix[8];
+      int nPrefix = snprintf(lv_prefix, sizeof(lv_prefix), "%u ", lv_len);
+      if( nPos + nPrefix + lv_len > SYSLOG_MAX_DATAGRAM ) break;
+
+      memcpy(lv_datagram + nPos, lv_prefix, nPrefix);
+      memcpy(lv_datagram + nPos + nPrefix, lv_pRec, lv_len);
+      nPos += nPrefix + lv_len;
+      m_queue.Pop();
+      m_sent++;
+    }
+
+    if( nPos == 0 ) break;
+    m_udp.sendPacket((uint8_t *)lv_datagram, nPos, m_server, m_port);
+    lv_burst++;
+  }
+}
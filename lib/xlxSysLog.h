@@ -0,0 +1,48 @@
+//  xlxSysLog.h - Xlight syslog (RFC5424 over UDP) log destination
+
+#ifndef xlxSysLog_h
+#define xlxSysLog_h
+
+#include "xliCommon.h"
+#include "RingBuffer.h"
+
+// Facility local0
+#define SYSLOG_FACILITY           16
+#define SYSLOG_LOCAL_PORT         5140
+// Bytes of formatted records waiting for network, power of two
+#define SYSLOG_QUEUE_SIZE         2048
+// Longest formatted record
+#define SYSLOG_MAX_RECORD         256
+// Maximum UDP payload, several records are packed into one datagram
+#define SYSLOG_MAX_DATAGRAM       512
+// Maximum datagrams sent in one process round
+#define SYSLOG_MAX_BURST          4
+
+//------------------------------------------------------------------
+// Xlight SysLog Class
+//------------------------------------------------------------------
+class SysLogClass
+{
+private:
+  UDP m_udp;
+  IPAddress m_server;
+  US m_port;
+  BOOL m_isReady;
+  CRecordQueue m_queue;                     // Formatted records
+  UL m_dropped;
+  UL m_sent;
+
+public:
+  SysLogClass();
+  BOOL Init(IPAddress server, US port);
+  BOOL IsReady() { return m_isReady; }
+
+  BOOL Append(UC level, const char *tag, const char *msg, const char *host);
+  void Process();
+
+  UL GetDropped() { return m_dropped; }
+  UL GetSent() { return m_sent; }
+  UL GetQueueLength() { return m_queue.Length(); }
+};
+
+#endif /* xlxSysLog_h */
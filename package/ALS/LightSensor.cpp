@@ -19,6 +19,13 @@
  *
  * DESCRIPTION
  * 1. support 3-Pin light sensor (photoresistor)
+ * 2. sample() is called by the system timer, it reads a batch of
+ *    LS_BATCH_SAMPLES ADC values back to back and takes the median,
+ *    which removes spikes. A first order IIR filter in Q8 fixed point
+ *    smooths the batches, then the output only moves when the filter
+ *    moves more than LS_HYSTERESIS counts, so noise doesn't cause
+ *    publishes or flicker
+ * 3. getLux() maps the value to lux with a piece-wise linear table
  *
  * ToDo:
  * 1.
@@ -26,11 +33,18 @@
 
 #include "LightSensor.h"
 
+// ADC value -> lux, nominal GL5528 photoresistor over a 10K resistor at 3.3V
+static const uint16_t luxTable[LS_LUX_POINTS][2] = {
+  {0, 0}, {822, 1}, {1628, 5}, {2048, 10}, {2467, 20}, {2966, 50},
+  {3273, 100}, {3513, 200}, {3738, 500}, {3852, 1000}, {3931, 2000}
+};
+
 LightSensor::LightSensor(uint8_t pin, uint8_t type)
 {
 	_pin = pin;
 	_type = type;
   firstreading = true;
+  resetFilter();
 }
 
 // lval & uval: map voltages [0, 3.3] into integer values [0, 4095].
@@ -48,11 +62,84 @@ void LightSensor::begin(uint16_t lval, uint16_t uval, uint16_t minlevel, uint16_
 
 uint16_t LightSensor::getLevel()
 {
-  uint16_t val = read();
+  uint16_t val = getValue();
+  if( val < _lowVal ) val = _lowVal;
+  if( val > _upVal ) val = _upVal;
   uint16_t level = map(val, _lowVal, _upVal, _minLevel, _maxLevel);
   return level;
 }
 
+uint16_t LightSensor::getLux()
+{
+  return valueToLux(getValue());
+}
+
+// Filtered value if the system timer is sampling, otherwise a direct read
+uint16_t LightSensor::getValue()
+{
+  if( _batches > 0 ) return _stableValue;
+  return read();
+}
+
+void LightSensor::resetFilter()
+{
+  _filtered = 0;
+  _stableValue = 0;
+  _batches = 0;
+}
+
+void LightSensor::sample()
+{
+  uint16_t lv_samples[LS_BATCH_SAMPLES];
+  for( uint8_t i = 0; i < LS_BATCH_SAMPLES; i++ ) {
+    lv_samples[i] = analogRead(_pin);
+  }
+  filter(lv_samples, LS_BATCH_SAMPLES);
+}
+
+uint16_t LightSensor::filter(uint16_t *samples, uint8_t count)
+{
+  if( count == 0 ) return _stableValue;
+
+  // Median of the batch, insertion sort is fine for a handful of values
+  for( uint8_t i = 1; i < count; i++ ) {
+    uint16_t lv_val = samples[i];
+    uint8_t j = i;
+    for( ; j > 0 && samples[j - 1] > lv_val; j-- ) {
+      samples[j] = samples[j - 1];
+    }
+    samples[j] = lv_val;
+  }
+  uint32_t lv_median = samples[count / 2];
+  if( count % 2 == 0 ) lv_median = (lv_median + samples[count / 2 - 1] + 1) / 2;
+
+  // IIR: y += (x - y) / 2^n
+  if( _batches == 0 ) {
+    _filtered = lv_median << 8;
+  } else {
+    _filtered = (uint32_t)((int32_t)_filtered + (((int32_t)(lv_median << 8) - (int32_t)_filtered) >> LS_IIR_SHIFT));
+  }
+
+  // Hysteresis
+  uint16_t lv_value = (uint16_t)((_filtered + 128) >> 8);
+  int32_t lv_delta = (int32_t)lv_value - (int32_t)_stableValue;
+  if( _batches == 0 || lv_delta > LS_HYSTERESIS || lv_delta < -LS_HYSTERESIS ) {
+    _stableValue = lv_value;
+  }
+  _batches++;
+  return _stableValue;
+}
+
+uint16_t LightSensor::valueToLux(uint16_t value)
+{
+  if( value >= luxTable[LS_LUX_POINTS - 1][0] ) return luxTable[LS_LUX_POINTS - 1][1];
+  uint8_t i = 1;
+  while( value >= luxTable[i][0] ) i++;
+  uint32_t lv_span = luxTable[i][0] - luxTable[i - 1][0];
+  uint32_t lv_pos = value - luxTable[i - 1][0];
+  return luxTable[i - 1][1] + (uint16_t)((lv_pos * (luxTable[i][1] - luxTable[i - 1][1]) + lv_span / 2) / lv_span);
+}
+
 uint16_t LightSensor::read()
 {
   unsigned long currenttime;
@@ -5,6 +5,12 @@
 
 #include "application.h"
 
+// Sampling engine, see sample()
+#define LS_BATCH_SAMPLES      8         // ADC reads per batch, median taken
+#define LS_IIR_SHIFT          3         // Weight of a new batch in the IIR filter: 1 / 2^n
+#define LS_HYSTERESIS         24        // ADC counts, output only moves if the filter moves further
+#define LS_LUX_POINTS         11
+
 class LightSensor {
 	private:
 		uint8_t _pin;
@@ -18,10 +24,25 @@ class LightSensor {
     uint16_t _maxLevel;
     uint16_t read();
 
+    // Sampling engine
+    uint32_t _filtered;                 // IIR state, ADC counts in Q8
+    volatile uint16_t _stableValue;     // after hysteresis
+    volatile uint32_t _batches;
+
 	public:
     LightSensor(uint8_t pin, uint8_t type = 0);
 		void begin(uint16_t lval=0, uint16_t uval=4000, uint16_t minlevel=0, uint16_t maxlevel=100);
     uint16_t getLevel();
+    uint16_t getLux();
+    uint16_t getValue();
+
+    // Called by the system timer: batch read and filter, keep it short
+    void sample();
+    // Filter a batch of raw samples (sorted in place), returns the stable value
+    uint16_t filter(uint16_t *samples, uint8_t count);
+    void resetFilter();
+    uint32_t getBatches() { return _batches; }
+    static uint16_t valueToLux(uint16_t value);
 };
 
 #endif /* LightSensor_h */
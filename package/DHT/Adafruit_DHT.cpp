@@ -12,6 +12,11 @@ DHT::DHT(uint8_t pin, uint8_t type, uint8_t count) {
 	_type = type;
 	_count = count;
 	firstreading = true;
+	_state = DHT_IDLE;
+	_edgeCount = 0;
+	_stateTime = 0;
+	_callback = NULL;
+	_lastOK = false;
 }
 
 void DHT::begin(void) {
@@ -22,23 +27,27 @@ void DHT::begin(void) {
 }
 
 float DHT::readTemperature() {
+	if (read())
+		return dataToTemperature();
+	return NAN;
+}
+
+float DHT::dataToTemperature() {
 	float f;
 
-	if (read()) {
-		switch (_type) {
-			case DHT11:
-				f = data[2];
-				return f;
-			case DHT22:
-			case DHT21:
-				f = data[2] & 0x7F;
-				f *= 256;
-				f += data[3];
-				f /= 10;
-				if (data[2] & 0x80)
-					f *= -1;
-				return f;
-		}
+	switch (_type) {
+		case DHT11:
+			f = data[2];
+			return f;
+		case DHT22:
+		case DHT21:
+			f = data[2] & 0x7F;
+			f *= 256;
+			f += data[3];
+			f /= 10;
+			if (data[2] & 0x80)
+				f *= -1;
+			return f;
 	}
 	return NAN;
 }
@@ -80,21 +89,25 @@ float DHT::convertCtoK(float c) {
 }
 
 float DHT::readHumidity(void) {
+	if (read())
+		return dataToHumidity();
+	return NAN;
+}
+
+float DHT::dataToHumidity() {
 	float f;
 
-	if (read()) {
-		switch (_type) {
-			case DHT11:
-				f = data[0];
-				return f;
-			case DHT22:
-			case DHT21:
-				f = data[0];
-				f *= 256;
-				f += data[1];
-				f /= 10;
-				return f;
-		}
+	switch (_type) {
+		case DHT11:
+			f = data[0];
+			return f;
+		case DHT22:
+		case DHT21:
+			f = data[0];
+			f *= 256;
+			f += data[1];
+			f /= 10;
+			return f;
 	}
 	return NAN;
 }
@@ -128,6 +141,10 @@ boolean DHT::read(void) {
 	uint8_t j = 0, i;
 	unsigned long currenttime;
 
+// A non-blocking read is going on, don't touch the line
+	if (_state != DHT_IDLE)
+		return _lastOK;
+
 // Check if sensor was read less than two seconds ago and return early
 // to use last reading.
 	currenttime = millis();
@@ -207,3 +224,67 @@ boolean DHT::read(void) {
 	return false;
 
 }
+
+// Non-blocking read, returns false if busy or the last read is too recent
+boolean DHT::startRead(void) {
+	unsigned long currenttime = millis();
+	if (_state != DHT_IDLE)
+		return false;
+	if (!firstreading && ((currenttime - _lastreadtime) < DHT_MIN_INTERVAL))
+		return false;
+	firstreading = false;
+	_lastreadtime = currenttime;
+
+// pull it low, process() releases the line when the time is up
+	pinMode(_pin, OUTPUT);
+	digitalWrite(_pin, LOW);
+	_stateTime = currenttime;
+	_state = DHT_STARTING;
+	return true;
+}
+
+void DHT::onEdge(void) {
+	if (_edgeCount < MAXTIMINGS)
+		_edges[_edgeCount++] = micros();
+}
+
+void DHT::process(void) {
+	switch (_state) {
+		case DHT_STARTING:
+			if (millis() - _stateTime < DHT_START_LOW_MS)
+				return;
+			// release the line, the pull-up edge is recorded too and skipped by the decoder
+			_edgeCount = 0;
+			attachInterrupt(_pin, &DHT::onEdge, this, CHANGE);
+			pinMode(_pin, INPUT_PULLUP);
+			_stateTime = millis();
+			_state = DHT_CAPTURING;
+			break;
+
+		case DHT_CAPTURING:
+			// a frame takes about 5ms, all edges or time out
+			if (_edgeCount < MAXTIMINGS && millis() - _stateTime < DHT_CAPTURE_MS)
+				return;
+			finishRead();
+			break;
+
+		default:
+			break;
+	}
+}
+
+void DHT::finishRead(void) {
+	detachInterrupt(_pin);
+	_state = DHT_IDLE;
+	_lastOK = DHT_DecodeEdges(_edges, _edgeCount, data);
+	if (_callback)
+		_callback(this, _lastOK);
+}
+
+float DHT::getLastTempCelcius() {
+	return (_lastOK ? dataToTemperature() : NAN);
+}
+
+float DHT::getLastHumidity() {
+	return (_lastOK ? dataToHumidity() : NAN);
+}
@@ -10,6 +10,7 @@
 
 #include "application.h"
 #include "math.h"
+#include "DHTDecoder.h"
 
 // how many timing transitions we need to keep track of. 2 * number bits + extra
 #define MAXTIMINGS 85
@@ -19,6 +20,20 @@
 #define DHT21 21
 #define AM2301 21
 
+// Non-blocking read: start signal length, capture timeout and minimum interval (ms)
+#define DHT_START_LOW_MS 20
+#define DHT_CAPTURE_MS 10
+#define DHT_MIN_INTERVAL 2000
+
+enum {
+	DHT_IDLE = 0,
+	DHT_STARTING,		// host pulls the line low
+	DHT_CAPTURING		// sensor is sending, edges are captured by interrupt
+};
+
+class DHT;
+typedef void (*DHTCallback_t)(DHT *dht, bool ok);
+
 class DHT {
 	private:
 		uint8_t data[6];
@@ -33,6 +48,18 @@ class DHT {
 		float computeDewPoint(float tempCelcius, float percentHumidity);
 		float readHumidity(void);
 		boolean read(void);
+		float dataToTemperature();
+		float dataToHumidity();
+
+		// Non-blocking read
+		volatile uint8_t _state;
+		volatile uint8_t _edgeCount;
+		uint32_t _edges[MAXTIMINGS];
+		unsigned long _stateTime;
+		DHTCallback_t _callback;
+		boolean _lastOK;
+		void onEdge(void);
+		void finishRead(void);
 
 	public:
 		DHT(uint8_t pin, uint8_t type, uint8_t count=6);
@@ -44,5 +71,16 @@ class DHT {
 		float getHeatIndex();
                 float getDewPoint();
 
+		// Non-blocking read: startRead() pulls the line low, process()
+		// moves on when the time is up and decodes the captured edges.
+		// The callback is called from process() when done
+		void onComplete(DHTCallback_t cb) { _callback = cb; }
+		boolean startRead(void);
+		boolean isBusy(void) { return _state != DHT_IDLE; }
+		void process(void);
+		boolean lastReadOK(void) { return _lastOK; }
+		float getLastTempCelcius();
+		float getLastHumidity();
+
 };
 #endif
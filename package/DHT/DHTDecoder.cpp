@@ -0,0 +1,34 @@
+/* DHT bit train decoder
+ * */
+
+#include "DHTDecoder.h"
+
+bool DHT_DecodeEdges(const uint32_t *edges, uint8_t count, uint8_t *data) {
+	uint8_t start, i;
+
+	for (i = 0; i < 5; i++)
+		data[i] = 0;
+
+// find the response: two intervals of ~80us in a row
+	for (start = 0; start + DHT_FRAME_EDGES <= count; start++) {
+		uint32_t low = edges[start + 1] - edges[start];
+		uint32_t high = edges[start + 2] - edges[start + 1];
+		if (low >= DHT_PREAMBLE_MIN && low <= DHT_PREAMBLE_MAX &&
+		    high >= DHT_PREAMBLE_MIN && high <= DHT_PREAMBLE_MAX)
+			break;
+	}
+	if (start + DHT_FRAME_EDGES > count)
+		return false;
+
+// bit i is high between edge start+2i+3 and start+2i+4
+	for (i = 0; i < DHT_FRAME_BITS; i++) {
+		uint32_t high = edges[start + 2 * i + 4] - edges[start + 2 * i + 3];
+		if (high > DHT_BIT_MAX)
+			return false;
+		data[i / 8] <<= 1;
+		if (high > DHT_BIT_THRESHOLD)
+			data[i / 8] |= 1;
+	}
+
+	return (data[4] == ((data[0] + data[1] + data[2] + data[3]) & 0xFF));
+}
@@ -0,0 +1,26 @@
+/* DHT bit train decoder
+ *
+ * Pure function, no hardware access, so it can be fed with recorded edge
+ * timings on any platform.
+ * */
+
+#ifndef DHT_DECODER_H
+#define DHT_DECODER_H
+
+#include <stdint.h>
+
+// Frame: response low ~80us, response high ~80us, then 40 bits of
+// low ~50us + high ~27us (0) or ~70us (1)
+#define DHT_FRAME_BITS        40
+#define DHT_FRAME_EDGES       (2 * DHT_FRAME_BITS + 3)     // from the response falling edge
+#define DHT_PREAMBLE_MIN      60                           // us, response low/high
+#define DHT_PREAMBLE_MAX      120
+#define DHT_BIT_THRESHOLD     48                           // us, longer high is a 1
+#define DHT_BIT_MAX           100
+
+// Decode 5 data bytes from edge timestamps (us, any edge, free running).
+// Leading edges before the response (e.g. host release) are skipped.
+// Returns true if a complete frame with a valid checksum was found
+bool DHT_DecodeEdges(const uint32_t *edges, uint8_t count, uint8_t *data);
+
+#endif
@@ -3,7 +3,7 @@
 CManulSync::CManulSync()
 {
 	//m_lock = CreateMutex (NULL, false, NULL);
-	m_lock = false;
+	m_lock = 0;
 }
 
 /*
@@ -21,22 +21,29 @@ bool CManulSync::Enter(UL ms)
 {
 	//WaitForSingleObject (m_sync, INFINITE);
 	UL start = millis();
-	while( millis() - start  <= ms || ms == 0) {
-		if(!m_lock) break;
+	while( !TryEnter() ) {
+		if( ms > 0 && millis() - start > ms )
+			return false;
 	}
 
-	return !m_lock;
+	return true;
+}
+
+bool CManulSync::TryEnter()
+{
+	return( __sync_lock_test_and_set(&m_lock, 1) == 0 );
 }
 
 void CManulSync::Leave()
 {
 	//ReleaseMutex (m_sync);
-	m_lock = false;
+	__sync_lock_release(&m_lock);
 }
 
 CDataQueue::CDataQueue()
 {
 	m_pBuffer = NULL;
+	m_head = 0;
 	m_length = 0;
 	m_maxlen = 0;
 }
@@ -44,6 +51,7 @@ CDataQueue::CDataQueue()
 CDataQueue::CDataQueue(UL f_maxlen)
 {
 	m_pBuffer = NULL;
+	m_head = 0;
 	m_length = 0;
 	m_maxlen = 0;
 	CreateDataBuffer(f_maxlen);
@@ -62,6 +70,7 @@ void CDataQueue::CreateDataBuffer(UL f_nlen)
 		if( m_pBuffer )
 			delete[] m_pBuffer;
 		m_pBuffer = new UC[f_nlen];
+		m_head = 0;
 		m_length = 0;
 		m_maxlen = f_nlen;
 		m_sync.Leave();
@@ -95,7 +104,13 @@ UL CDataQueue::Append(const UC* data, UL len)
 		lv_retval = -1;
 	else
 	{
-		memcpy(m_pBuffer + m_length, data, len);
+		// Compact only when the tail room is used up
+		if( m_head + m_length + len > m_maxlen )
+		{
+			memmove(m_pBuffer, m_pBuffer + m_head, m_length);
+			m_head = 0;
+		}
+		memcpy(m_pBuffer + m_head + m_length, data, len);
 		m_length += len;
 		lv_retval = len;
 	}
@@ -111,13 +126,15 @@ UL CDataQueue::Remove(UL f_first, UC* data)
 	m_sync.Enter();
 
 	copylen = ( f_first > 0 ? f_first : m_length );
+	if( copylen > m_length )
+		copylen = m_length;
 	if( copylen > 0 )
 	{
 		if( data != NULL )
 		{
 			//try
 			//{
-				memcpy(data, m_pBuffer, copylen);
+				memcpy(data, m_pBuffer + m_head, copylen);
 				length = copylen;
 			//}
 			/*
@@ -127,8 +144,7 @@ UL CDataQueue::Remove(UL f_first, UC* data)
 			}*/
 		}
 		m_length -= copylen;
-		if( m_length )
-			memmove(m_pBuffer, m_pBuffer + copylen, m_length);
+		m_head = ( m_length ? m_head + copylen : 0 );
 	}
 	m_sync.Leave();
 
@@ -154,14 +170,16 @@ void CDataQueue::ClearBuffer()
 		delete[] m_pBuffer;
 		m_pBuffer = NULL;
 	}
+	m_head = 0;
 	m_length = 0;
 	m_maxlen = 0;
 	m_sync.Leave();
 }
 
+// Points to the first byte in queue
 UC *CDataQueue::GetBuffer()
 {
-	return m_pBuffer;
+	return( m_pBuffer ? m_pBuffer + m_head : NULL );
 }
 
 void CDataQueue::LockBuffer()
@@ -5,11 +5,13 @@
 #include "xliCommon.h"
 
 //	little class to make code more readable
+//	Spin lock taken with an atomic test-and-set. Never wait for it in an ISR,
+//	use TryEnter() there, or better one of the lock-free queues in RingBuffer.h
 class CManulSync;
 class CManulSync
 {
 protected:
-	bool		m_lock;
+	volatile int	m_lock;
 
 public:
 	CManulSync();
@@ -18,7 +20,8 @@ public:
 	CManulSync(CManulSync& s);
 	CManulSync& operator= (CManulSync& s);
 
-	bool Enter(UL ms=0);
+	bool Enter(UL ms=0);				// ms = 0: wait until available
+	bool TryEnter();
 	void Leave();
 };
 
@@ -42,6 +45,7 @@ public:
 protected:
 	UC			*m_pBuffer;
 	CManulSync	m_sync;
+	UL		m_head;						// offset of the first byte, data is moved only when needed
 	UL		m_length;
 	UL		m_maxlen;
 
@@ -0,0 +1,240 @@
+#include "RingBuffer.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// CRingBuffer
+///////////////////////////////////////////////////////////////////////////////
+CRingBuffer::CRingBuffer()
+{
+	m_pBuffer = NULL;
+	m_size = 0;
+	m_mask = 0;
+	m_head = 0;
+	m_tail = 0;
+}
+
+CRingBuffer::CRingBuffer(UL f_size)
+{
+	m_pBuffer = NULL;
+	m_size = 0;
+	m_mask = 0;
+	m_head = 0;
+	m_tail = 0;
+	Create(f_size);
+}
+
+CRingBuffer::~CRingBuffer()
+{
+	if( m_pBuffer )
+		delete[] m_pBuffer;
+}
+
+bool CRingBuffer::Create(UL f_size)
+{
+	if( f_size == 0 ) return false;
+
+	UL lv_size = 4;
+	while( lv_size < f_size && lv_size < 0x80000000UL )
+		lv_size <<= 1;
+
+	if( m_pBuffer )
+		delete[] m_pBuffer;
+	m_pBuffer = new UC[lv_size];
+	if( !m_pBuffer ) {
+		m_size = m_mask = 0;
+		return false;
+	}
+	m_size = lv_size;
+	m_mask = lv_size - 1;
+	m_head = m_tail = 0;
+	return true;
+}
+
+UL CRingBuffer::Length()
+{
+	return m_head - m_tail;
+}
+
+UL CRingBuffer::Free()
+{
+	return m_size - (m_head - m_tail);
+}
+
+void CRingBuffer::Clear()
+{
+	m_tail = m_head;
+}
+
+UL CRingBuffer::Write(const UC* data, UL len)
+{
+	UL lv_done = 0;
+	UC *lv_ptr;
+	while( lv_done < len ) {
+		UL lv_span = WritePeek(&lv_ptr);
+		if( lv_span == 0 ) break;
+		if( lv_span > len - lv_done ) lv_span = len - lv_done;
+		memcpy(lv_ptr, data + lv_done, lv_span);
+		WriteCommit(lv_span);
+		lv_done += lv_span;
+	}
+	return lv_done;
+}
+
+UL CRingBuffer::Read(UC* data, UL len)
+{
+	UL lv_done = 0;
+	const UC *lv_ptr;
+	while( lv_done < len ) {
+		UL lv_span = ReadPeek(&lv_ptr);
+		if( lv_span == 0 ) break;
+		if( lv_span > len - lv_done ) lv_span = len - lv_done;
+		if( data ) memcpy(data + lv_done, lv_ptr, lv_span);
+		ReadCommit(lv_span);
+		lv_done += lv_span;
+	}
+	return lv_done;
+}
+
+UL CRingBuffer::WritePeek(UC** ptr)
+{
+	UL lv_head = m_head;
+	UL lv_free = m_size - (lv_head - m_tail);
+	UL lv_pos = lv_head & m_mask;
+	UL lv_span = m_size - lv_pos;
+	*ptr = m_pBuffer + lv_pos;
+	return(lv_span < lv_free ? lv_span : lv_free);
+}
+
+void CRingBuffer::WriteCommit(UL len)
+{
+	// Data must be visible before the new head
+	RING_BARRIER();
+	m_head += len;
+}
+
+UL CRingBuffer::ReadPeek(const UC** ptr)
+{
+	UL lv_tail = m_tail;
+	UL lv_used = m_head - lv_tail;
+	// Don't read data older than the head we just loaded
+	RING_BARRIER();
+	UL lv_pos = lv_tail & m_mask;
+	UL lv_span = m_size - lv_pos;
+	*ptr = m_pBuffer + lv_pos;
+	return(lv_span < lv_used ? lv_span : lv_used);
+}
+
+void CRingBuffer::ReadCommit(UL len)
+{
+	// Finish reading before the space is given back
+	RING_BARRIER();
+	m_tail += len;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CRecordQueue
+// Record layout: [US length][US reserved][data][padding to 4 bytes]
+// A header with RECORD_PAD_MARK tells the reader to skip to the buffer start
+///////////////////////////////////////////////////////////////////////////////
+CRecordQueue::CRecordQueue()
+	: CRingBuffer()
+{
+	m_reserved = 0;
+	m_pushed = 0;
+	m_popped = 0;
+}
+
+CRecordQueue::CRecordQueue(UL f_size)
+	: CRingBuffer(f_size)
+{
+	m_reserved = 0;
+	m_pushed = 0;
+	m_popped = 0;
+}
+
+UL CRecordQueue::MaxRecord()
+{
+	// Worst case: a pad just short of the whole buffer, keep it simple
+	UL lv_max = m_size / 2 - RECORD_HEADER_SIZE;
+	return(lv_max < RECORD_PAD_MARK ? lv_max : RECORD_PAD_MARK - 1);
+}
+
+UL CRecordQueue::Count()
+{
+	return m_pushed - m_popped;
+}
+
+UC *CRecordQueue::WriteReserve(US len)
+{
+	if( !m_pBuffer || len > MaxRecord() ) return NULL;
+
+	UL lv_need = RECORD_ALIGN(RECORD_HEADER_SIZE + len);
+	UL lv_head = m_head;
+	UL lv_free = m_size - (lv_head - m_tail);
+	UL lv_pos = lv_head & m_mask;
+	UL lv_span = m_size - lv_pos;
+
+	if( lv_need <= lv_span ) {
+		if( lv_need > lv_free ) return NULL;
+		m_reserved = 0;
+		return m_pBuffer + lv_pos + RECORD_HEADER_SIZE;
+	}
+
+	// Doesn't fit before the end: pad the tail part and start over
+	if( lv_span + lv_need > lv_free ) return NULL;
+	*(US *)(m_pBuffer + lv_pos) = RECORD_PAD_MARK;
+	m_reserved = lv_span;
+	return m_pBuffer + RECORD_HEADER_SIZE;
+}
+
+void CRecordQueue::WriteCommit(US len)
+{
+	UL lv_pos = (m_head + m_reserved) & m_mask;
+	*(US *)(m_pBuffer + lv_pos) = len;
+	*(US *)(m_pBuffer + lv_pos + 2) = 0;
+	CRingBuffer::WriteCommit(m_reserved + RECORD_ALIGN(RECORD_HEADER_SIZE + len));
+	m_reserved = 0;
+	m_pushed++;
+}
+
+bool CRecordQueue::Push(const UC* data, US len)
+{
+	UC *lv_ptr = WriteReserve(len);
+	if( !lv_ptr ) return false;
+	memcpy(lv_ptr, data, len);
+	WriteCommit(len);
+	return true;
+}
+
+const UC *CRecordQueue::Peek(US* len)
+{
+	while( m_head != m_tail ) {
+		RING_BARRIER();
+		UL lv_pos = m_tail & m_mask;
+		US lv_len = *(US *)(m_pBuffer + lv_pos);
+		if( lv_len == RECORD_PAD_MARK ) {
+			CRingBuffer::ReadCommit(m_size - lv_pos);
+			continue;
+		}
+		if( len ) *len = lv_len;
+		return m_pBuffer + lv_pos + RECORD_HEADER_SIZE;
+	}
+	return NULL;
+}
+
+void CRecordQueue::Pop()
+{
+	US lv_len;
+	if( !Peek(&lv_len) ) return;
+	CRingBuffer::ReadCommit(RECORD_ALIGN(RECORD_HEADER_SIZE + lv_len));
+	m_popped++;
+}
+
+US CRecordQueue::Pop(UC* data, US size)
+{
+	US lv_len;
+	const UC *lv_ptr = Peek(&lv_len);
+	if( !lv_ptr ) return 0;
+	if( data ) memcpy(data, lv_ptr, (lv_len < size ? lv_len : size));
+	Pop();
+	return lv_len;
+}
@@ -0,0 +1,86 @@
+#ifndef PCS_RINGBUFFER_INCLUDED_
+#define PCS_RINGBUFFER_INCLUDED_
+
+#include "application.h"
+#include "xliCommon.h"
+
+// Single producer / single consumer queues, no lock needed.
+// One side may run in an ISR, the other one in the main loop (or a thread).
+// Head is only written by the producer, tail only by the consumer. Both are
+// free running 32-bit counters, the buffer size is a power of two.
+// Note: Clear() and any size change must be done when both sides are idle.
+
+// Memory barrier between data access and index publishing
+#define RING_BARRIER()		__sync_synchronize()
+
+//	byte stream ring buffer
+class CRingBuffer
+{
+public:
+	CRingBuffer();
+	CRingBuffer(UL f_size);
+	~CRingBuffer();
+
+	bool Create(UL f_size);				// size is rounded up to a power of two
+	UL Size() { return m_size; }
+	UL Length();						// bytes ready to read
+	UL Free();							// bytes ready to write
+	void Clear();
+
+	// Copy interface, return the number of bytes actually copied
+	UL Write(const UC* data, UL len);
+	UL Read(UC* data, UL len);
+
+	// Zero-copy interface: peek returns a contiguous span and its length,
+	// commit publishes (part of) it. A span ends at the buffer end, call
+	// again after commit for the wrapped part
+	UL WritePeek(UC** ptr);
+	void WriteCommit(UL len);
+	UL ReadPeek(const UC** ptr);
+	void ReadCommit(UL len);
+
+protected:
+	UC			*m_pBuffer;
+	UL			m_size;
+	UL			m_mask;
+	volatile UL	m_head;					// producer
+	volatile UL	m_tail;					// consumer
+};
+
+// Header of each record in CRecordQueue
+#define RECORD_HEADER_SIZE	4
+#define RECORD_PAD_MARK		0xFFFF		// rest of the buffer is unused, wrap around
+#define RECORD_ALIGN(n)		(((n) + 3) & ~3UL)
+
+//	variable length record queue, every record is contiguous in memory
+class CRecordQueue : public CRingBuffer
+{
+public:
+	CRecordQueue();
+	CRecordQueue(UL f_size);
+
+	UL MaxRecord();						// longest record that can ever fit
+	UL Count();							// records ready to read
+
+	// Producer: reserve space for len bytes, fill it in place then commit.
+	// Returns NULL if there is no room, nothing changes in this case
+	UC *WriteReserve(US len);
+	void WriteCommit(US len);			// len may be shorter than reserved
+	bool Push(const UC* data, US len);
+
+	// Consumer: front record or NULL if empty, Pop() releases it
+	const UC *Peek(US* len);
+	void Pop();
+	US Pop(UC* data, US size);			// copy out and release, returns length
+
+protected:
+	UL			m_reserved;				// bytes skipped before the reserved record
+	volatile UL	m_pushed;
+	volatile UL	m_popped;
+};
+
+#endif // PCS_RINGBUFFER_INCLUDED_
+
+///////////////////////////////////////////////////////////////////////////////
+// End of file
+///////////////////////////////////////////////////////////////////////////////
@@ -14,6 +14,8 @@
 
 MQTT::MQTT() {
     this->ip = NULL;
+    this->streamRemaining = 0;
+    this->oversized = 0;
 }
 
 MQTT::MQTT(char* domain, uint16_t port, void (*callback)(char*,uint8_t*,unsigned int)
@@ -27,6 +29,8 @@ MQTT::MQTT(char* domain, uint16_t port, void (*callback)(char*,uint8_t*,unsigned
     this->domain = domain;
     this->port = port;
     this->ip = NULL;
+    this->streamRemaining = 0;
+    this->oversized = 0;
 #if defined(SPARK) || (PLATFORM_ID==88)
     this->_client = new TCPClient();
 #elif defined(ARDUINO)
@@ -44,6 +48,8 @@ MQTT::MQTT(uint8_t *ip, uint16_t port, void (*callback)(char*,uint8_t*,unsigned
     this->qoscallback = NULL;
     this->ip = ip;
     this->port = port;
+    this->streamRemaining = 0;
+    this->oversized = 0;
 #if defined(SPARK) || (PLATFORM_ID==88)
     this->_client = new TCPClient();
 #elif defined(ARDUINO)
@@ -185,6 +191,7 @@ uint16_t MQTT::readPacket(uint8_t* lengthLength) {
     }
 
     if (len > MQTT_MAX_PACKET_SIZE) {
+        oversized++;
         len = 0; // This will cause the packet to be ignored.
     }
 
@@ -287,38 +294,108 @@ bool MQTT::publish(const char* topic, const uint8_t* payload, unsigned int pleng
 }
 
 bool MQTT::publish(const char* topic, const uint8_t* payload, unsigned int plength, bool retain, EMQTT_QOS qos, uint16_t *messageid) {
+    MQTT_SEGMENT segment = {payload, plength};
+    return publish(topic, &segment, 1, retain, qos, messageid);
+}
+
+// Scatter/gather publish: header, topic and every payload segment are
+// written to the client directly, nothing is staged in buffer[].
+bool MQTT::publish(const char* topic, const MQTT_SEGMENT *segments, uint8_t count, bool retain, EMQTT_QOS qos, uint16_t *messageid) {
+    unsigned long plength = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        plength += segments[i].length;
+    }
+
+    if (!beginPublish(topic, plength, retain, qos, messageid))
+        return false;
+    for (uint8_t i = 0; i < count; i++) {
+        if (writePayload(segments[i].data, segments[i].length) != segments[i].length)
+            return false;
+    }
+    return endPublish();
+}
+
+// Streaming publish: the total payload length must be known up front,
+// then the payload is written in any number of pieces.
+bool MQTT::beginPublish(const char* topic, unsigned long plength, bool retain, EMQTT_QOS qos, uint16_t *messageid) {
     if (isConnected()) {
-        // Leave room in the buffer for header and variable length field
-        uint16_t length = 5;
-        memset(buffer, 0, sizeof(buffer));
+        return writePublishHeader(topic, plength, retain, qos, messageid);
+    }
+    return false;
+}
 
-        length = writeString(topic, buffer, length);
+size_t MQTT::writePayload(const uint8_t *data, size_t length) {
+    if (length > streamRemaining)
+        length = streamRemaining;
+    if (length == 0)
+        return 0;
 
-        if (qos == QOS2 || qos == QOS1) {
-            *messageid = nextMsgId++;
-            buffer[length++] = (*messageid >> 8);
-            buffer[length++] = (*messageid & 0xFF);
-        }
+    size_t rc = _client->write(data, length);
+    streamRemaining -= rc;
+    lastOutActivity = millis();
+    return rc;
+}
 
-        for (uint16_t i=0; i < plength && length < MQTT_MAX_PACKET_SIZE; i++) {
-            buffer[length++] = payload[i];
-        }
+bool MQTT::endPublish() {
+    if (streamRemaining > 0) {
+        // Packet is incomplete, the session can't be recovered
+        streamRemaining = 0;
+        _client->stop();
+        return false;
+    }
+    return true;
+}
+
+bool MQTT::writePublishHeader(const char* topic, unsigned long plength, bool retain, EMQTT_QOS qos, uint16_t *messageid) {
+    uint8_t header[8];
+    uint8_t pos = 0;
+    uint16_t tlen = strlen(topic);
+    unsigned long len = 2 + tlen + plength;
+
+    if (qos == QOS2 || qos == QOS1)
+        len += 2;
+    // Remaining length is encoded in up to 4 bytes
+    if (len > 268435455UL)
+        return false;
+
+    header[pos] = MQTTPUBLISH;
+    if (retain)
+        header[pos] |= 1;
+    if (qos == QOS2)
+        header[pos] |= MQTTQOS2_HEADER_MASK;
+    else if (qos == QOS1)
+        header[pos] |= MQTTQOS1_HEADER_MASK;
+    pos++;
 
-        uint8_t header = MQTTPUBLISH;
-        if (retain) {
-            header |= 1;
+    do {
+        uint8_t digit = len % 128;
+        len = len / 128;
+        if (len > 0) {
+            digit |= 0x80;
         }
+        header[pos++] = digit;
+    } while(len > 0);
 
-        if (qos == QOS2)
-            header |= MQTTQOS2_HEADER_MASK;
-        else if (qos == QOS1)
-            header |= MQTTQOS1_HEADER_MASK;
-        else
-            header |= MQTTQOS0_HEADER_MASK;
+    header[pos++] = (tlen >> 8);
+    header[pos++] = (tlen & 0xFF);
+    if (_client->write(header, pos) != pos)
+        return false;
+    if (_client->write((const uint8_t *)topic, tlen) != tlen)
+        return false;
 
-        return write(header, buffer, length-5);
+    if (qos == QOS2 || qos == QOS1) {
+        if (nextMsgId == 0)
+            nextMsgId = 1;
+        *messageid = nextMsgId++;
+        header[0] = (*messageid >> 8);
+        header[1] = (*messageid & 0xFF);
+        if (_client->write(header, 2) != 2)
+            return false;
     }
-    return false;
+
+    streamRemaining = plength;
+    lastOutActivity = millis();
+    return true;
 }
 
 bool MQTT::publishRelease(uint16_t messageid) {
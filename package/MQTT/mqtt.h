@@ -92,6 +92,12 @@ typedef enum{
     QOS2 = 2,
 }EMQTT_QOS;
 
+// One piece of payload for scatter/gather publish
+typedef struct{
+    const uint8_t *data;
+    unsigned int length;
+}MQTT_SEGMENT;
+
 private:
 #if defined(SPARK) || (PLATFORM_ID==88)
     TCPClient *_client;
@@ -108,6 +114,9 @@ private:
     uint16_t readPacket(uint8_t*);
     uint8_t readByte();
     bool write(uint8_t header, uint8_t* buf, uint16_t length);
+    bool writePublishHeader(const char *topic, unsigned long plength, bool retain, EMQTT_QOS qos, uint16_t *messageid);
+    unsigned long streamRemaining;
+    unsigned long oversized;
     uint16_t writeString(const char* string, uint8_t* buf, uint16_t pos);
     String domain;
     uint8_t *ip;
@@ -141,6 +150,10 @@ public:
     bool publish(const char *, const uint8_t *, unsigned int, EMQTT_QOS, uint16_t *messageid);
     bool publish(const char *, const uint8_t *, unsigned int, bool);
     bool publish(const char *, const uint8_t *, unsigned int, bool, EMQTT_QOS, uint16_t *messageid);
+    bool publish(const char *, const MQTT_SEGMENT *, uint8_t, bool, EMQTT_QOS, uint16_t *messageid);
+    bool beginPublish(const char *, unsigned long, bool, EMQTT_QOS, uint16_t *messageid);
+    size_t writePayload(const uint8_t *, size_t);
+    bool endPublish();
     void addQosCallback(void (*qoscallback)(unsigned int));
     bool publishRelease(uint16_t messageid);
 
@@ -149,6 +162,8 @@ public:
     bool unsubscribe(const char *);
     bool loop();
     bool isConnected();
+    // Packets thrown away by readPacket() for not fitting MQTT_MAX_PACKET_SIZE
+    unsigned long getOversized() { return oversized; }
 };
 
 
@@ -40,6 +40,7 @@ IntervalTimer refreshTimer;
 
 volatile uint8_t _isr_softcount = 0xff;
 uint8_t _softpwm_defaultPolarity = SOFTPWM_NORMAL;
+uint8_t _softpwm_mode = SOFTPWM_TICK;
 
 typedef struct
 {
@@ -48,19 +49,79 @@ typedef struct
   uint8_t polarity;
   uint8_t pwmvalue;
   uint8_t checkval;
-  uint8_t fadeuprate;
-  uint8_t fadedownrate;
+  uint16_t level;         // current width, 8.8 fixed point
+  uint16_t fadeuprate;    // 8.8 steps per period, 0 to jump
+  uint16_t fadedownrate;
 } softPWMChannel;
 
 softPWMChannel _softpwm_channels[SOFTPWM_MAXCHANNELS];
 
+// Edge mode: channels switching off at the same tick share an edge
+typedef struct
+{
+  uint8_t time;           // tick in the period
+  uint16_t mask;          // channels to switch off
+} softPWMEdge;
+
+softPWMEdge _softpwm_edges[SOFTPWM_MAXCHANNELS];
+uint8_t _softpwm_edgecount = 0;
+uint8_t _softpwm_edgeindex = 0;
+volatile uint8_t _softpwm_dirty = 1;    // rebuild the edge list next period
+
+// Statistics
+volatile uint32_t _softpwm_calls = 0;
+volatile uint32_t _softpwm_busy = 0;
+
+
+// Step the width toward pwmvalue, once per period
+// Returns true if the width changed
+static inline bool SoftPWM_Fade(softPWMChannel *ch)
+{
+  uint16_t target = (uint16_t)ch->pwmvalue << 8;
+  uint8_t oldval = ch->checkval;
+
+  if (ch->level < target)
+  {
+    if (ch->fadeuprate > 0 && target - ch->level > ch->fadeuprate)
+      ch->level += ch->fadeuprate;
+    else
+      ch->level = target;
+  }
+  else if (ch->level > target)
+  {
+    if (ch->fadedownrate > 0 && ch->level - target > ch->fadedownrate)
+      ch->level -= ch->fadedownrate;
+    else
+      ch->level = target;
+  }
+  ch->checkval = ch->level >> 8;
+  return(ch->checkval != oldval);
+}
+
+static inline void SoftPWM_PinOn(softPWMChannel *ch)
+{
+  if (ch->polarity == SOFTPWM_NORMAL)
+    pinSetFast(ch->pin);
+  else
+    pinResetFast(ch->pin);
+}
+
+static inline void SoftPWM_PinOff(softPWMChannel *ch)
+{
+  if (ch->polarity == SOFTPWM_NORMAL)
+    pinResetFast(ch->pin);
+  else
+    pinSetFast(ch->pin);
+}
+
 
 // Here is the meat and gravy
 void SoftPWM_Timer_Interrupt(void)
 {
   uint8_t i;
-  int16_t newvalue;
-  int16_t direction;
+#ifdef SOFTPWM_STATS
+  uint32_t start = micros();
+#endif
 
   if(++_isr_softcount == 0)
   {
@@ -68,43 +129,11 @@ void SoftPWM_Timer_Interrupt(void)
     // and accept new checkvals
     for (i = 0; i < SOFTPWM_MAXCHANNELS; i++)
     {
-      if (_softpwm_channels[i].fadeuprate > 0 || _softpwm_channels[i].fadedownrate > 0)
-      {
-        // we want to fade to the new value
-        direction = _softpwm_channels[i].pwmvalue - _softpwm_channels[i].checkval;
-
-        // we will default to jumping to the new value
-        newvalue = _softpwm_channels[i].pwmvalue;
-
-        if (direction > 0 && _softpwm_channels[i].fadeuprate > 0)
-        {
-          newvalue = _softpwm_channels[i].checkval + _softpwm_channels[i].fadeuprate;
-          if (newvalue > _softpwm_channels[i].pwmvalue)
-            newvalue = _softpwm_channels[i].pwmvalue;
-        }
-        else if (direction < 0 && _softpwm_channels[i].fadedownrate > 0)
-        {
-          newvalue = _softpwm_channels[i].checkval - _softpwm_channels[i].fadedownrate;
-          if (newvalue < _softpwm_channels[i].pwmvalue)
-            newvalue = _softpwm_channels[i].pwmvalue;
-        }
-
-        _softpwm_channels[i].checkval = newvalue;
-      }
-      else  // just set the channel to the new value
-        _softpwm_channels[i].checkval = _softpwm_channels[i].pwmvalue;
+      SoftPWM_Fade(&_softpwm_channels[i]);
 
       // now set the pin high (if not 0)
-      if (_softpwm_channels[i].checkval > 0)  // don't set if checkval == 0
-      {
-        if (_softpwm_channels[i].polarity == SOFTPWM_NORMAL)
-		  //PIN_MAP[_softpwm_channels[i].pin].gpio_peripheral->BSRR = PIN_MAP[_softpwm_channels[i].pin].gpio_pin;	//hi
-		  pinSetFast(_softpwm_channels[i].pin);
-        else
-		  //PIN_MAP[_softpwm_channels[i].pin].gpio_peripheral->BRR = PIN_MAP[_softpwm_channels[i].pin].gpio_pin;	//lo
-		  pinResetFast(_softpwm_channels[i].pin);
-      }
-
+      if (_softpwm_channels[i].pin >= 0 && _softpwm_channels[i].checkval > 0)  // don't set if checkval == 0
+        SoftPWM_PinOn(&_softpwm_channels[i]);
     }
   }
 
@@ -115,34 +144,133 @@ void SoftPWM_Timer_Interrupt(void)
       if (_softpwm_channels[i].checkval == _isr_softcount)  // if we have hit the width
       {
         // turn off the channel
-        if (_softpwm_channels[i].polarity == SOFTPWM_NORMAL)
-		  //PIN_MAP[_softpwm_channels[i].pin].gpio_peripheral->BRR = PIN_MAP[_softpwm_channels[i].pin].gpio_pin;	//lo
-		  pinResetFast(_softpwm_channels[i].pin);
-        else
-		  //PIN_MAP[_softpwm_channels[i].pin].gpio_peripheral->BSRR = PIN_MAP[_softpwm_channels[i].pin].gpio_pin;	//hi
-		  pinSetFast(_softpwm_channels[i].pin);
+        SoftPWM_PinOff(&_softpwm_channels[i]);
       }
     }
   }
+
+  _softpwm_calls++;
+#ifdef SOFTPWM_STATS
+  _softpwm_busy += micros() - start;
+#endif
 }
 
+// Edge mode, period start: fades, pins on, and the sorted edge list
+static void SoftPWM_Period_Start(void)
+{
+  uint8_t i, j, k;
+  bool changed = _softpwm_dirty;
 
+  _softpwm_dirty = 0;
+  for (i = 0; i < SOFTPWM_MAXCHANNELS; i++)
+  {
+    if (_softpwm_channels[i].pin < 0)
+      continue;
+    if (SoftPWM_Fade(&_softpwm_channels[i]))
+      changed = true;
+    if (_softpwm_channels[i].checkval > 0)
+      SoftPWM_PinOn(&_softpwm_channels[i]);
+  }
+
+  if (changed)
+  {
+    // Insertion sort, at most SOFTPWM_MAXCHANNELS entries
+    _softpwm_edgecount = 0;
+    for (i = 0; i < SOFTPWM_MAXCHANNELS; i++)
+    {
+      uint8_t t = _softpwm_channels[i].checkval;
+      if (_softpwm_channels[i].pin < 0 || t == 0)
+        continue;
+
+      for (j = 0; j < _softpwm_edgecount && _softpwm_edges[j].time < t; j++);
+      if (j < _softpwm_edgecount && _softpwm_edges[j].time == t)
+      {
+        _softpwm_edges[j].mask |= (1 << i);
+        continue;
+      }
+      for (k = _softpwm_edgecount; k > j; k--)
+        _softpwm_edges[k] = _softpwm_edges[k - 1];
+      _softpwm_edges[j].time = t;
+      _softpwm_edges[j].mask = (1 << i);
+      _softpwm_edgecount++;
+    }
+  }
+  _softpwm_edgeindex = 0;
+}
 
-void SoftPWMBegin(uint8_t defaultPolarity)
+void SoftPWM_Edge_Interrupt(void)
 {
-  uint8_t i;
+  uint16_t now, next;
+#ifdef SOFTPWM_STATS
+  uint32_t start = micros();
+#endif
+
+  if (_softpwm_edgeindex >= _softpwm_edgecount)
+  {
+    SoftPWM_Period_Start();
+    now = 0;
+  }
+  else
+  {
+    // turn off the channels of this edge
+    uint16_t mask = _softpwm_edges[_softpwm_edgeindex].mask;
+    while (mask)
+    {
+      uint8_t i = __builtin_ctz(mask);
+      mask &= mask - 1;
+      if (_softpwm_channels[i].pin >= 0)
+        SoftPWM_PinOff(&_softpwm_channels[i]);
+    }
+    now = _softpwm_edges[_softpwm_edgeindex++].time;
+  }
+
+  // Sleep until the next edge, or the end of the period
+  next = (_softpwm_edgeindex < _softpwm_edgecount ? _softpwm_edges[_softpwm_edgeindex].time : 256);
+  refreshTimer.resetPeriod_SIT((next - now) * SOFTPWM_TICK_US, uSec);
+
+  _softpwm_calls++;
+#ifdef SOFTPWM_STATS
+  _softpwm_busy += micros() - start;
+#endif
+}
 
-  refreshTimer.begin(SoftPWM_Timer_Interrupt, 66, uSec);	//Set for 60Hz
+
+
+void SoftPWMBegin(uint8_t defaultPolarity, uint8_t mode, TIMid timer)
+{
+  uint8_t i;
 
   for (i = 0; i < SOFTPWM_MAXCHANNELS; i++)
   {
     _softpwm_channels[i].pin = -1;
     _softpwm_channels[i].polarity = SOFTPWM_NORMAL;
+    _softpwm_channels[i].pwmvalue = 0;
+    _softpwm_channels[i].checkval = 0;
+    _softpwm_channels[i].level = 0;
     _softpwm_channels[i].fadeuprate = 0;
     _softpwm_channels[i].fadedownrate = 0;
   }
 
   _softpwm_defaultPolarity = defaultPolarity;
+  _softpwm_mode = mode;
+  _softpwm_edgecount = _softpwm_edgeindex = 0;
+  _softpwm_dirty = 1;
+
+  if (mode == SOFTPWM_EDGE)
+    refreshTimer.begin(SoftPWM_Edge_Interrupt, 256 * SOFTPWM_TICK_US, uSec, timer);
+  else
+    refreshTimer.begin(SoftPWM_Timer_Interrupt, SOFTPWM_TICK_US, uSec, timer);	//Set for 60Hz
+}
+
+
+void SoftPWMGetStats(uint32_t *calls, uint32_t *busyUs)
+{
+  noInterrupts();
+  if (calls) *calls = _softpwm_calls;
+  if (busyUs) *busyUs = _softpwm_busy;
+  _softpwm_calls = 0;
+  _softpwm_busy = 0;
+  interrupts();
 }
 
 
@@ -179,7 +307,9 @@ void SoftPWMSet(int8_t pin, uint8_t value, uint8_t hardset)
   {
 	//Reset hardware timer?
     _isr_softcount = 0xff;
+    _softpwm_edgeindex = _softpwm_edgecount;
   }
+  _softpwm_dirty = 1;
 
   // If the pin isn't already set, add it
   for (i = 0; i < SOFTPWM_MAXCHANNELS; i++)
@@ -205,7 +335,8 @@ void SoftPWMSet(int8_t pin, uint8_t value, uint8_t hardset)
     _softpwm_channels[firstfree].pin = pin;
     _softpwm_channels[firstfree].polarity = _softpwm_defaultPolarity;
     _softpwm_channels[firstfree].pwmvalue = value;
-//    _softpwm_channels[firstfree].checkval = 0;
+    _softpwm_channels[firstfree].checkval = 0;
+    _softpwm_channels[firstfree].level = 0;
 
     // now prepare the pin for output
     // turn it off to start (no glitch)
@@ -232,6 +363,7 @@ void SoftPWMEnd(int8_t pin)
 
       // remove the pin
       _softpwm_channels[i].pin = -1;
+      _softpwm_dirty = 1;
     }
   }
 }
@@ -239,7 +371,7 @@ void SoftPWMEnd(int8_t pin)
 
 void SoftPWMSetFadeTime(int8_t pin, uint16_t fadeUpTime, uint16_t fadeDownTime)
 {
-  int16_t fadeAmount;
+  uint32_t fadeAmount;
   uint8_t i;
 
   for (i = 0; i < SOFTPWM_MAXCHANNELS; i++)
@@ -248,15 +380,17 @@ void SoftPWMSetFadeTime(int8_t pin, uint16_t fadeUpTime, uint16_t fadeDownTime)
        (pin >= 0 && _softpwm_channels[i].pin == pin))  // individual pin
     {
 
+      // One period is about 16ms, steps are 8.8 fixed point so slow
+      // fades don't round down to a jump
       fadeAmount = 0;
       if (fadeUpTime > 0)
-        fadeAmount = 255UL * 16 / fadeUpTime;
+        fadeAmount = min(255UL * 256 * 16 / fadeUpTime, 0xFFFFUL);
 
       _softpwm_channels[i].fadeuprate = fadeAmount;
 
       fadeAmount = 0;
       if (fadeDownTime > 0)
-        fadeAmount = 255UL * 16 / fadeDownTime;
+        fadeAmount = min(255UL * 256 * 16 / fadeDownTime, 0xFFFFUL);
 
       _softpwm_channels[i].fadedownrate = fadeAmount;
 
@@ -28,6 +28,8 @@
 #ifndef SOFTPWM_H
 #define SOFTPWM_H
 
+#include "SparkIntervalTimer.h"
+
 #include "application.h"
 
 
@@ -37,14 +39,31 @@
 #define SOFTPWM_NORMAL 0
 #define SOFTPWM_INVERTED 1
 
+// SOFTPWM_TICK: the timer fires every tick, each one visits all channels
+// SOFTPWM_EDGE: the timer is reprogrammed to the next edge of a sorted edge
+//               list, work is only done at edges and once per period
+#define SOFTPWM_TICK 0
+#define SOFTPWM_EDGE 1
+
+#define SOFTPWM_TICK_US 66    // 256 ticks per period, about 60Hz
+
+// Uncomment to time the ISR with micros(), see SoftPWMGetStats(). It costs
+// two micros() calls per interrupt, so keep it for benchmarks only
+//#define SOFTPWM_STATS
+
 #define ALL -1
 
-void SoftPWMBegin(uint8_t defaultPolarity = SOFTPWM_NORMAL);
+// timer: hardware timer of the ISR, pick one that no PWM pin needs
+void SoftPWMBegin(uint8_t defaultPolarity = SOFTPWM_NORMAL, uint8_t mode = SOFTPWM_TICK, TIMid timer = AUTO);
 void SoftPWMSet(int8_t pin, uint8_t value, uint8_t hardset = 0);
 void SoftPWMSetPercent(int8_t pin, uint8_t percent, uint8_t hardset = 0);
 void SoftPWMEnd(int8_t pin);
 void SoftPWMSetFadeTime(int8_t pin, uint16_t fadeUpTime, uint16_t fadeDownTime);
 void SoftPWMSetPolarity(int8_t pin, uint8_t polarity);
 
+// ISR statistics since the last call: interrupts and time spent in them,
+// the time is 0 unless SOFTPWM_STATS is defined
+void SoftPWMGetStats(uint32_t *calls, uint32_t *busyUs);
+
 #endif
 
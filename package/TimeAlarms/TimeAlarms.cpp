@@ -34,12 +34,19 @@ extern "C" {
 //* Alarm Class Constructor
 
 AlarmClass::AlarmClass()
+{
+  clear();
+  nextFree = dtINVALID_ALARM_ID;
+}
+
+void AlarmClass::clear()
 {
   Mode.isEnabled = Mode.isOneShot = 0;
   Mode.alarmType = dtNotAllocated;
   value = nextTrigger = 0;
   onTickHandler = NULL;  // prevent a callback until this pointer is explicitly set
   tag = NULL;
+  heapIndex = dtINVALID_ALARM_ID;
 }
 
 //**************************************************************
@@ -102,8 +109,12 @@ void AlarmClass::updateNextTrigger()
 TimeAlarmsClass::TimeAlarmsClass()
 {
   isServicing = false;
-  for(uint8_t id = 0; id < dtNBR_ALARMS; id++)
-     free(id);   // ensure  all Alarms are cleared and available for allocation
+  servicedAlarmId = dtINVALID_ALARM_ID;
+  // the pool is allocated on the first create()
+  Alarm = NULL;
+  Heap = NULL;
+  poolSize = heapSize = numAllocated = 0;
+  freeList = dtINVALID_ALARM_ID;
 }
 
 // this method creates a trigger at the given absolute time_t
@@ -168,13 +179,16 @@ AlarmID_t TimeAlarmsClass::alarmRepeat(time_t value, OnTick_t onTickHandler){ //
       if(isAllocated(ID)) {
         Alarm[ID].Mode.isEnabled = (Alarm[ID].value != 0) && (Alarm[ID].onTickHandler != 0) ;  // only enable if value is non zero and a tick handler has been set
         Alarm[ID].updateNextTrigger(); // trigger is updated whenever  this is called, even if already enabled
+        reschedule(ID);
       }
     }
 
     void TimeAlarmsClass::disable(AlarmID_t ID)
     {
-      if(isAllocated(ID))
+      if(isAllocated(ID)) {
         Alarm[ID].Mode.isEnabled = false;
+        heapRemove(ID);
+      }
     }
 
     // write the given value to the given alarm
@@ -209,24 +223,18 @@ AlarmID_t TimeAlarmsClass::alarmRepeat(time_t value, OnTick_t onTickHandler){ //
     {
       if(isAllocated(ID))
       {
-        Alarm[ID].Mode.isEnabled = false;
-    	Alarm[ID].Mode.alarmType = dtNotAllocated;
-        Alarm[ID].onTickHandler = 0;
-    	Alarm[ID].value = 0;
-    	Alarm[ID].nextTrigger = 0;
+        heapRemove(ID);
+        Alarm[ID].clear();
+        Alarm[ID].nextFree = freeList;
+        freeList = ID;
+        numAllocated--;
       }
     }
 
     // returns the number of allocated timers
-    uint8_t TimeAlarmsClass::count()
+    uint16_t TimeAlarmsClass::count()
     {
-       uint8_t c = 0;
-       for(uint8_t id = 0; id < dtNBR_ALARMS; id++)
-       {
-          if(isAllocated(id))
-            c++;
-       }
-       return c;
+       return numAllocated;
     }
 
     // returns true only if id is allocated and the type is a time based alarm, returns false if not allocated or if its a timer
@@ -238,7 +246,7 @@ AlarmID_t TimeAlarmsClass::alarmRepeat(time_t value, OnTick_t onTickHandler){ //
      // returns true if this id is allocated
      bool TimeAlarmsClass::isAllocated(AlarmID_t ID)
      {
-        return( ID < dtNBR_ALARMS && Alarm[ID].Mode.alarmType != dtNotAllocated );
+        return( ID < poolSize && Alarm[ID].Mode.alarmType != dtNotAllocated );
      }
 
 
@@ -310,22 +318,27 @@ AlarmID_t TimeAlarmsClass::alarmRepeat(time_t value, OnTick_t onTickHandler){ //
 
     void TimeAlarmsClass::serviceAlarms()
     {
-      if(! isServicing)
+      if(! isServicing && heapSize > 0)
       {
         isServicing = true;
-        for( servicedAlarmId = 0; servicedAlarmId < dtNBR_ALARMS; servicedAlarmId++)
+        time_t time = now_tz();
+        // Every alarm is serviced at most once per call, even if its new
+        // trigger time is still in the past
+        uint16_t budget = heapSize;
+        while( budget-- > 0 && heapSize > 0 && Alarm[Heap[0]].nextTrigger <= time )
         {
-          if( Alarm[servicedAlarmId].Mode.isEnabled && (now_tz() >= Alarm[servicedAlarmId].nextTrigger)  )
+          servicedAlarmId = Heap[0];
+          OnTick_t TickHandler = Alarm[servicedAlarmId].onTickHandler;
+          uint32_t tag = Alarm[servicedAlarmId].tag;
+          if(Alarm[servicedAlarmId].Mode.isOneShot)
+             free(servicedAlarmId);  // free the ID if mode is OnShot
+          else
           {
-            OnTick_t TickHandler = Alarm[servicedAlarmId].onTickHandler;
-            uint32_t tag = Alarm[servicedAlarmId].tag;
-            if(Alarm[servicedAlarmId].Mode.isOneShot)
-               free(servicedAlarmId);  // free the ID if mode is OnShot
-            else
-               Alarm[servicedAlarmId].updateNextTrigger();
-            if( TickHandler != NULL) {
-              (*TickHandler)(tag);     // call the handler
-            }
+             Alarm[servicedAlarmId].updateNextTrigger();
+             reschedule(servicedAlarmId);
+          }
+          if( TickHandler != NULL) {
+            (*TickHandler)(tag);     // call the handler
           }
         }
         isServicing = false;
@@ -335,17 +348,7 @@ AlarmID_t TimeAlarmsClass::alarmRepeat(time_t value, OnTick_t onTickHandler){ //
     // returns the absolute time of the next scheduled alarm, or 0 if none
      time_t TimeAlarmsClass::getNextTrigger()
      {
-     time_t nextTrigger = 0xffffffff;  // the max time value
-
-        for(uint8_t id = 0; id < dtNBR_ALARMS; id++)
-        {
-          if(isAllocated(id) )
-          {
-        	if(Alarm[id].nextTrigger <  nextTrigger)
-    		   nextTrigger = Alarm[id].nextTrigger;
-          }
-    	}
-        return nextTrigger == 0xffffffff ? 0 : nextTrigger;
+        return heapSize > 0 ? Alarm[Heap[0]].nextTrigger : 0;
      }
 
     // attempt to create an alarm and return true if successful
@@ -353,21 +356,124 @@ AlarmID_t TimeAlarmsClass::alarmRepeat(time_t value, OnTick_t onTickHandler){ //
     {
       if( ! (dtIsAlarm(alarmType) && now_tz() < SECS_PER_YEAR)) // only create alarm ids if the time is at least Jan 1 1971
       {
-    	for(uint8_t id = 0; id < dtNBR_ALARMS; id++)
-        {
-          if( Alarm[id].Mode.alarmType == dtNotAllocated )
-    	  {
-    	  // here if there is an Alarm id that is not allocated
-      	    Alarm[id].onTickHandler = onTickHandler;
-    	    Alarm[id].Mode.isOneShot = isOneShot;
-    	    Alarm[id].Mode.alarmType = alarmType;
-    	    Alarm[id].value = value;
-    	    isEnabled ?  enable(id) : disable(id);
-            return id;  // alarm created ok
-    	  }
-        }
+        if( freeList == dtINVALID_ALARM_ID && !grow() )
+          return dtINVALID_ALARM_ID; // no IDs available
+
+        // here if there is an Alarm id that is not allocated
+        AlarmID_t id = freeList;
+        freeList = Alarm[id].nextFree;
+        numAllocated++;
+        Alarm[id].onTickHandler = onTickHandler;
+        Alarm[id].Mode.isOneShot = isOneShot;
+        Alarm[id].Mode.alarmType = alarmType;
+        Alarm[id].value = value;
+        isEnabled ?  enable(id) : disable(id);
+        return id;  // alarm created ok
+      }
+      return dtINVALID_ALARM_ID; // time is invalid
+    }
+
+    // double the alarm pool, new ids are put on the free list
+    bool TimeAlarmsClass::grow()
+    {
+      uint16_t newSize = (poolSize == 0 ? dtNBR_ALARMS : poolSize * 2);
+      if( newSize > dtMAX_ALARMS ) newSize = dtMAX_ALARMS;
+      if( newSize <= poolSize ) return false;
+
+      AlarmClass *newAlarm = (AlarmClass *)realloc(Alarm, newSize * sizeof(AlarmClass));
+      if( !newAlarm ) return false;
+      Alarm = newAlarm;
+      AlarmID_t *newHeap = (AlarmID_t *)realloc(Heap, newSize * sizeof(AlarmID_t));
+      if( !newHeap ) return false;
+      Heap = newHeap;
+
+      // chain new slots in ascending order, so low ids are used first
+      for(uint16_t id = newSize; id > poolSize; id--)
+      {
+        Alarm[id - 1].clear();
+        Alarm[id - 1].nextFree = freeList;
+        freeList = id - 1;
+      }
+      poolSize = newSize;
+      return true;
+    }
+
+    //***********************************************************
+    //* Trigger heap
+
+    void TimeAlarmsClass::heapSet(uint16_t pos, AlarmID_t ID)
+    {
+      Heap[pos] = ID;
+      Alarm[ID].heapIndex = pos;
+    }
+
+    void TimeAlarmsClass::heapUp(uint16_t pos)
+    {
+      AlarmID_t id = Heap[pos];
+      while( pos > 0 )
+      {
+        uint16_t parent = (pos - 1) / 2;
+        if( Alarm[Heap[parent]].nextTrigger <= Alarm[id].nextTrigger ) break;
+        heapSet(pos, Heap[parent]);
+        pos = parent;
+      }
+      heapSet(pos, id);
+    }
+
+    void TimeAlarmsClass::heapDown(uint16_t pos)
+    {
+      AlarmID_t id = Heap[pos];
+      while( true )
+      {
+        uint16_t child = pos * 2 + 1;
+        if( child >= heapSize ) break;
+        if( child + 1 < heapSize && Alarm[Heap[child + 1]].nextTrigger < Alarm[Heap[child]].nextTrigger )
+          child++;
+        if( Alarm[id].nextTrigger <= Alarm[Heap[child]].nextTrigger ) break;
+        heapSet(pos, Heap[child]);
+        pos = child;
+      }
+      heapSet(pos, id);
+    }
+
+    void TimeAlarmsClass::heapInsert(AlarmID_t ID)
+    {
+      heapSet(heapSize, ID);
+      heapUp(heapSize++);
+    }
+
+    void TimeAlarmsClass::heapRemove(AlarmID_t ID)
+    {
+      uint16_t pos = Alarm[ID].heapIndex;
+      if( pos == dtINVALID_ALARM_ID ) return;
+      Alarm[ID].heapIndex = dtINVALID_ALARM_ID;
+
+      // move the last entry into the hole and restore heap order
+      if( pos != --heapSize )
+      {
+        AlarmID_t moved = Heap[heapSize];
+        heapSet(pos, moved);
+        heapUp(pos);
+        heapDown(Alarm[moved].heapIndex);
+      }
+    }
+
+    // keep the heap in step with the enable flag and trigger time of the alarm
+    void TimeAlarmsClass::reschedule(AlarmID_t ID)
+    {
+      if( !Alarm[ID].Mode.isEnabled )
+      {
+        heapRemove(ID);
+      }
+      else if( Alarm[ID].heapIndex == dtINVALID_ALARM_ID )
+      {
+        heapInsert(ID);
+      }
+      else
+      {
+        heapUp(Alarm[ID].heapIndex);
+        heapDown(Alarm[ID].heapIndex);
       }
-      return dtINVALID_ALARM_ID; // no IDs available or time is invalid
     }
 
     // make one instance for the user to use
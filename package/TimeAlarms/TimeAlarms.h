@@ -56,7 +56,10 @@ extern time_t time_zone_cache;  // from spark_wiring_time.cpp
 
 //-------------------------------------
 
-#define dtNBR_ALARMS 6   // max is 255
+#define dtNBR_ALARMS 8      // initial size of the alarm pool, doubled on demand
+// upper limit of the alarm pool, max is 65535. Each alarm costs about 30 bytes of
+// heap on the P1 (pool slot and heap entry), so RAM runs out well before this
+#define dtMAX_ALARMS 4096
 
 #define USE_SPECIALIST_METHODS  // define this for testing
 
@@ -79,10 +82,10 @@ typedef enum  {dtNotAllocated, dtTimer, dtExplicitAlarm, dtDailyAlarm, dtWeeklyA
 // macro to return true if the given type is a time based alarm, false if timer or not allocated
 #define dtIsAlarm(_type_)  (_type_ >= dtExplicitAlarm && _type_ < dtLastAlarmType)
 
-typedef uint8_t AlarmID_t;
+typedef uint16_t AlarmID_t;
 typedef AlarmID_t AlarmId;  // Arduino friendly name
 
-#define dtINVALID_ALARM_ID 255
+#define dtINVALID_ALARM_ID 0xFFFF
 #define dtINVALID_TIME     0L
 
 class AlarmClass;  // forward reference
@@ -96,22 +99,39 @@ private:
 public:
   AlarmClass();
   OnTick_t onTickHandler;
+  void clear();
   void updateNextTrigger();
   time_t value;
   time_t nextTrigger;
   AlarmMode_t Mode;
 	uint32_t tag;
+  AlarmID_t heapIndex;  // position in the trigger heap, dtINVALID_ALARM_ID if not scheduled
+  AlarmID_t nextFree;   // link in the free list while not allocated
 };
 
 // class containing the collection of alarms
+// Alarms live in a pool that grows on demand. Enabled alarms are also kept
+// in a binary min-heap ordered by nextTrigger, so arm/cancel is O(log n)
+// and servicing only touches the alarms that are due.
 class TimeAlarmsClass
 {
 private:
-   AlarmClass Alarm[dtNBR_ALARMS];
-   void serviceAlarms();
+   AlarmClass *Alarm;           // alarm pool, indexed by AlarmID_t
+   AlarmID_t *Heap;             // ids of enabled alarms, Heap[0] triggers first
+   uint16_t poolSize;
+   uint16_t heapSize;
+   uint16_t numAllocated;
+   AlarmID_t freeList;          // first unallocated id
    uint8_t isServicing;
-   uint8_t servicedAlarmId; // the alarm currently being serviced
+   AlarmID_t servicedAlarmId;   // the alarm currently being serviced
    AlarmID_t create( time_t value, OnTick_t onTickHandler, uint8_t isOneShot, dtAlarmPeriod_t alarmType, uint8_t isEnabled=true);
+   bool grow();
+   void heapSet(uint16_t pos, AlarmID_t ID);
+   void heapUp(uint16_t pos);
+   void heapDown(uint16_t pos);
+   void heapInsert(AlarmID_t ID);
+   void heapRemove(AlarmID_t ID);
+   void reschedule(AlarmID_t ID);
 
 public:
   TimeAlarmsClass();
@@ -134,6 +154,7 @@ public:
   AlarmID_t timerRepeat(const int H,  const int M,  const int S, OnTick_t onTickHandler);   // As above with HMS arguments
 
   void delay(unsigned long ms);
+  void serviceAlarms();                     // trigger all alarms that are due, call it from the main loop
 
   // utility methods
   uint8_t getDigitsNow( dtUnits_t Units);         // returns the current digit value for the given time unit
@@ -158,7 +179,7 @@ public:
 private:  // the following methods are for testing and are not documented as part of the standard library
 #endif
   void free(AlarmID_t ID);                  // free the id to allow its reuse
-  uint8_t count();                          // returns the number of allocated timers
+  uint16_t count();                         // returns the number of allocated timers
   time_t getNextTrigger();                  // returns the time of the next scheduled alarm
   bool isAllocated(AlarmID_t ID);           // returns true if this id is allocated
   bool isAlarm(AlarmID_t ID);               // returns true if id is for a time based alarm, false if its a timer or not allocated
@@ -0,0 +1,170 @@
+/**
+ * ToneDetect.cpp - Xlight MIC tone detection lib
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. A timer ISR calls sample() at TONE_SAMPLE_RATE, samples go into a
+ *    double buffer. When a block is full the buffers swap
+ * 2. process() runs in FastProcess, it takes the full block through a bank
+ *    of Goertzel filters in fixed point (Q14 coefficients, 64-bit power)
+ * 3. Whistle: one bin holds TONE_PURITY % of the block energy for
+ *    TONE_HOLD_BLOCKS blocks. Clap: a block well above the noise floor
+ *    without a dominant tone
+ * 4. The event is kept until getEvent() is called from the main loop
+ *
+ * ToDo:
+ * 1. More bins or a small FFT if we need to tell more tones apart
+**/
+
+#include "ToneDetect.h"
+
+// Goertzel bins k = f * TONE_BLOCK_SIZE / TONE_SAMPLE_RATE
+static const uint16_t toneFreqs[TONE_FILTERS] = {500, 750, 1000, 1250, 1500, 1750};
+// 2 * cos(2 * pi * k / TONE_BLOCK_SIZE) in Q14
+static const int32_t toneCoeffs[TONE_FILTERS] = {23170, 12540, 0, -12540, -23170, -30274};
+
+ToneDetect::ToneDetect(uint8_t pin)
+{
+  _pin = pin;
+  _blocks = 0;
+  _overruns = 0;
+  _events = 0;
+  begin();
+}
+
+void ToneDetect::begin()
+{
+  _fill = 0;
+  _pos = 0;
+  _ready = -1;
+  _noise = 0;
+  _lastTone = -1;
+  _toneBlocks = 0;
+  _event = toneNone;
+  _eventFreq = 0;
+}
+
+void ToneDetect::sample()
+{
+  _buffer[_fill][_pos++] = analogRead(_pin);
+  if( _pos >= TONE_BLOCK_SIZE ) {
+    // The previous block was not processed in time, it's dropped
+    if( _ready >= 0 ) _overruns++;
+    _ready = _fill;
+    _fill ^= 1;
+    _pos = 0;
+  }
+}
+
+bool ToneDetect::process()
+{
+  if( _ready < 0 ) return false;
+  uint8_t lv_event = processBlock(_buffer[_ready], TONE_BLOCK_SIZE);
+  _ready = -1;
+  if( lv_event != toneNone ) {
+    _event = lv_event;
+    _events++;
+  }
+  return true;
+}
+
+uint8_t ToneDetect::processBlock(const uint16_t *samples, uint16_t count)
+{
+  if( count == 0 ) return toneNone;
+  _blocks++;
+
+  // Remove DC
+  uint32_t lv_sum = 0;
+  for( uint16_t i = 0; i < count; i++ ) lv_sum += samples[i];
+  int32_t lv_dc = (int32_t)((lv_sum + count / 2) / count);
+
+  // Goertzel bank and block energy in one pass
+  int32_t s1[TONE_FILTERS], s2[TONE_FILTERS];
+  for( uint8_t f = 0; f < TONE_FILTERS; f++ ) s1[f] = s2[f] = 0;
+  uint64_t lv_energy = 0;
+  for( uint16_t i = 0; i < count; i++ ) {
+    int32_t x = (int32_t)samples[i] - lv_dc;
+    lv_energy += (uint64_t)(x * x);
+    for( uint8_t f = 0; f < TONE_FILTERS; f++ ) {
+      int32_t s0 = x + (int32_t)(((int64_t)toneCoeffs[f] * s1[f]) >> 14) - s2[f];
+      s2[f] = s1[f];
+      s1[f] = s0;
+    }
+  }
+  uint32_t lv_power = (uint32_t)(lv_energy / count);
+  uint32_t lv_noise = (_blocks > 1 ? _noise : lv_power);
+  // Noise floor follows quiet blocks fast, a short burst hardly moves it
+  if( lv_power < lv_noise ) _noise = (lv_noise + lv_power) / 2;
+  else _noise = (lv_noise * 15 + lv_power) / 16;
+  if( lv_power < TONE_MIN_POWER ) {
+    _lastTone = -1;
+    _toneBlocks = 0;
+    return toneNone;
+  }
+
+  // Strongest bin: |X|^2 = s1^2 + s2^2 - coeff * s1 * s2
+  int8_t lv_best = -1;
+  int64_t lv_bestPower = 0;
+  for( uint8_t f = 0; f < TONE_FILTERS; f++ ) {
+    int64_t lv_p = (int64_t)s1[f] * s1[f] + (int64_t)s2[f] * s2[f]
+        - ((((int64_t)toneCoeffs[f] * s1[f]) >> 14) * s2[f]);
+    if( lv_p > lv_bestPower ) {
+      lv_bestPower = lv_p;
+      lv_best = f;
+    }
+  }
+
+  // A pure tone puts |X|^2 = energy * N / 2 into its bin
+  if( lv_best >= 0 && (uint64_t)lv_bestPower * 200 >= lv_energy * count * TONE_PURITY ) {
+    if( lv_best == _lastTone ) {
+      if( _toneBlocks < 0xFF ) _toneBlocks++;
+    } else {
+      _lastTone = lv_best;
+      _toneBlocks = 1;
+    }
+    // Report once when the tone has lasted long enough
+    if( _toneBlocks == TONE_HOLD_BLOCKS ) {
+      _eventFreq = toneFreqs[lv_best];
+      return toneWhistle;
+    }
+    return toneNone;
+  }
+
+  _lastTone = -1;
+  _toneBlocks = 0;
+  if( lv_power >= lv_noise * TONE_CLAP_RATIO && lv_power >= TONE_MIN_POWER * TONE_CLAP_RATIO ) {
+    _eventFreq = 0;
+    return toneClap;
+  }
+  return toneNone;
+}
+
+uint8_t ToneDetect::getEvent(uint16_t *freq)
+{
+  noInterrupts();
+  uint8_t lv_event = _event;
+  if( freq ) *freq = _eventFreq;
+  _event = toneNone;
+  interrupts();
+  return lv_event;
+}
+
+uint16_t ToneDetect::getFilterFreq(uint8_t index)
+{
+  return(index < TONE_FILTERS ? toneFreqs[index] : 0);
+}
@@ -0,0 +1,65 @@
+//  ToneDetect.h - Xlight MIC tone detection lib
+
+#ifndef ToneDetect_h
+#define ToneDetect_h
+
+#include "application.h"
+
+// Sampling: TONE_BLOCK_SIZE samples per block at TONE_SAMPLE_RATE,
+// i.e. 64ms per block and 15.6Hz per Goertzel bin
+#define TONE_SAMPLE_RATE      4000
+#define TONE_SAMPLE_PERIOD    250       // us
+#define TONE_BLOCK_SIZE       256
+#define TONE_FILTERS          6         // 500Hz - 1750Hz, step 250Hz
+
+// Detection thresholds
+#define TONE_MIN_POWER        100       // Mean square of a block (ADC counts^2) to look at it at all
+#define TONE_PURITY           40        // % of block energy in one bin to call it a tone
+#define TONE_HOLD_BLOCKS      2         // Same tone in consecutive blocks to report it
+#define TONE_CLAP_RATIO       8         // Burst above the noise floor to call it a clap
+
+typedef enum
+{
+  toneNone = 0,
+  toneClap,
+  toneWhistle
+} toneEvent_t;
+
+class ToneDetect {
+	private:
+    uint8_t _pin;
+
+    // Double buffer, one is filled by the sampling ISR, the other one is processed
+    uint16_t _buffer[2][TONE_BLOCK_SIZE];
+    volatile uint8_t _fill;
+    volatile uint16_t _pos;
+    volatile int8_t _ready;
+
+    // Detection state
+    uint32_t _noise;                    // Noise floor, mean square
+    int8_t _lastTone;                   // Filter index of the tone in the last block
+    uint8_t _toneBlocks;
+    volatile uint8_t _event;
+    volatile uint16_t _eventFreq;
+
+	public:
+    uint32_t _blocks;
+    uint32_t _overruns;
+    uint32_t _events;
+
+    ToneDetect(uint8_t pin);
+    void begin();
+
+    // Sampling ISR, one ADC read every TONE_SAMPLE_PERIOD
+    void sample();
+    // Run the kernel on a full buffer, returns true if one was processed
+    bool process();
+    // Detection kernel on a block of raw ADC samples, returns toneEvent_t
+    uint8_t processBlock(const uint16_t *samples, uint16_t count);
+
+    // Latest event, cleared by reading
+    uint8_t getEvent(uint16_t *freq = NULL);
+    static uint16_t getFilterFreq(uint8_t index);
+};
+
+#endif /* ToneDetect_h */
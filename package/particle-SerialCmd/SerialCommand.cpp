@@ -139,31 +139,22 @@ bool SerialCommand::scanStateMachine()
 	} else {
 		token = next();
 	}
-	int i = findFirstCommand(currentState);
-	for (; i<numCommand; i++) {
-		if( currentState != (uint8_t)(CommandList[i].state) )
-			break;
-
-	  // Compare the found event against the list of known events in the same state for a match
-		if (strlen(CommandList[i].event) == 0 ||
-		    strnicmp(token, CommandList[i].event, SERIALCOMMANDBUFFER) == 0)
-		{
-			currentCommand = i;
-			matched = true;
-			prevState = currentState;
-			currentState = (uint8_t)(CommandList[i].next);			// Change to the next state
-
-			IF_SERIAL_DEBUG(SERIAL_LN("Matched Command: %s in state %d, index=%d", token, currentState, i));
-
-			// Execute the stored handler function for the command
-			if( CommandList[i].function ) {
-				bRunCmd = (*CommandList[i].function)(token);
-			} else {
-				bRunCmd = callbackCommand(token);
-			}
-			clearBuffer();
-			break;
+	int i = FindCommand(currentState, token);
+	if (i >= 0) {
+		currentCommand = i;
+		matched = true;
+		prevState = currentState;
+		currentState = (uint8_t)(CommandList[i].next);			// Change to the next state
+
+		IF_SERIAL_DEBUG(SERIAL_LN("Matched Command: %s in state %d, index=%d", token, currentState, i));
+
+		// Execute the stored handler function for the command
+		if( CommandList[i].function ) {
+			bRunCmd = (*CommandList[i].function)(token);
+		} else {
+			bRunCmd = callbackCommand(token);
 		}
+		clearBuffer();
 	}
 
 	// No macthed item found
@@ -179,6 +170,22 @@ bool SerialCommand::scanStateMachine()
 	return bRunCmd;
 }
 
+// Rows of a state are compared by hash, the string only confirms a hit.
+// An empty event matches any token
+int SerialCommand::FindCommand(uint8_t state, const char *token)
+{
+	uint32_t hash = CommandHash(token);
+	for (int i = findFirstCommand(state); i < numCommand; i++) {
+		if( state != (uint8_t)(CommandList[i].state) )
+			break;
+
+		if (CommandList[i].event[0] == '\0' ||
+		    (CommandList[i].hash == hash && strnicmp(token, CommandList[i].event, SERIALCOMMANDBUFFER) == 0))
+			return i;
+	}
+	return -1;
+}
+
 int SerialCommand::findFirstCommand(uint8_t state)
 {
 	int nStart, nMid, nEnd, nFound;
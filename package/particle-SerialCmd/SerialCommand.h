@@ -40,6 +40,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define SerialCommand_h
 
 #include <application.h>
+#include <type_traits>
 
 // If you want to use SerialCommand with the hardware serial port only, and want to disable
 // SoftwareSerial support, and thus don't have to use "#include <SoftwareSerial.h>" in your
@@ -63,11 +64,27 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define SERIALCOMMANDBUFFER 32          // Maximum length of a command
 #define MAXDELIMETER 2
 
+// Case insensitive FNV-1a hash of a command token, NULL hashes as ""
+#define COMMAND_HASH_BASIS	2166136261UL
+#define COMMAND_HASH_PRIME	16777619UL
+constexpr uint32_t CommandHash(const char *str, uint32_t hash = COMMAND_HASH_BASIS)
+{
+	return (!str || !*str) ? hash :
+		CommandHash(str + 1, (hash ^ (uint8_t)((*str >= 'A' && *str <= 'Z') ? *str + 32 : *str)) * COMMAND_HASH_PRIME);
+}
+// Forced to be evaluated at compile time
+#define CMD_HASH(s)			(std::integral_constant<uint32_t, CommandHash(s)>::value)
+// Event and its hash for StateMachine_t
+#define SM_EVENT(s)			s, CMD_HASH(s)
+// Token matches s: hash is CommandHash(token), the string confirms a hit
+#define CMD_IS(hash, token, s)	((hash) == CMD_HASH(s) && strnicmp(token, s, SERIALCOMMANDBUFFER) == 0)
+
 typedef bool (*PFunc) (const char *cmd);
 typedef struct {
 	uint8_t state;												// Current State
 	uint8_t next;													// Next State
 	char event[SERIALCOMMANDBUFFER];			// Event
+	uint32_t hash;												// CommandHash(event), use SM_EVENT()
 	PFunc function;												// Action
 } StateMachine_t;            // Data structure to hold Command/Handler function key-value pairs
 
@@ -85,6 +102,7 @@ class SerialCommand
 		bool readSerial();    // Main entry point.
 		void addDefaultHandler(PFunc = NULL);    			// A handler to call when no valid command received.
 		void SetStateMachine(const StateMachine_t *newSM, int sizeSM, uint8_t initState = 0);
+		int FindCommand(uint8_t state, const char *token);	// index in the state machine, -1 if none
 
   private:
 		char inChar;          // A character read from the serial stream
@@ -12,9 +12,20 @@
 #include "xliConfig.h"
 
 #include "xlxCloudObj.h"
+#include "xlxColor.h"
 #include "xlxConfig.h"
+#include "xlxLightEngine.h"
 #include "xlxLogger.h"
+#include "xlxProvision.h"
 #include "xlxSerialConsole.h"
+#include "xlxRuleEngine.h"
+#include "xlxScheduler.h"
+#include "xlxSerialOut.h"
+#include "xlxStatusLED.h"
+#include "DHTDecoder.h"
+#include "LightSensor.h"
+#include "SoftPWM.h"
+#include "ToneDetect.h"
 
 //><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
 // Intergration Tests
@@ -76,6 +87,674 @@ test(alarm_all_red)
   theSys.CldJSONConfig("\"node_id\":1, \"SCT_uid\":1, \"SNT_uid\":0, \"notif_uid\":0}");
 }
 
+void alarmHeapTick(uint32_t tag) {}
+
+test(alarm_heap)
+{
+  // More alarms than the old fixed table, then cancel half of them
+  const int nAlarms = 200;
+  AlarmId ids[nAlarms];
+  US before = Alarm.count();
+  time_t lv_now = now_tz();
+
+  UL lv_start = micros();
+  for( int i = 0; i < nAlarms; i++ ) {
+    ids[i] = Alarm.timerOnce(1000 + (i * 37) % nAlarms, alarmHeapTick);
+    assertNotEqual(ids[i], dtINVALID_ALARM_ID);
+    Alarm.setAlarmTag(ids[i], i);
+  }
+  SERIAL_LN("%d alarms armed in %lu us", nAlarms, micros() - lv_start);
+  assertEqual(Alarm.count(), before + nAlarms);
+  assertLessOrEqual(Alarm.getNextTrigger(), lv_now + 1000 + 1);
+
+  lv_start = micros();
+  for( int i = 0; i < nAlarms; i += 2 ) {
+    Alarm.free(ids[i]);
+  }
+  SERIAL_LN("%d alarms cancelled in %lu us", nAlarms / 2, micros() - lv_start);
+  assertEqual(Alarm.count(), before + nAlarms / 2);
+  assertFalse(Alarm.isAllocated(ids[0]));
+  assertTrue(Alarm.isAllocated(ids[1]));
+
+  for( int i = 1; i < nAlarms; i += 2 ) {
+    Alarm.free(ids[i]);
+  }
+  assertEqual(Alarm.count(), before);
+}
+
+// Edge timings of a DHT22 frame as the pin interrupt records them,
+// starting with the host release edge
+UC dhtFrameEdges(uint32_t *edges, const UC *data, uint32_t t)
+{
+  UC n = 0;
+  edges[n++] = t; t += 30;                      // host releases the line
+  edges[n++] = t; t += 80;                      // response low
+  edges[n++] = t; t += 80;                      // response high
+  for( UC i = 0; i < 40; i++ ) {
+    edges[n++] = t; t += 50;
+    edges[n++] = t; t += ((data[i / 8] >> (7 - i % 8)) & 1) ? 70 : 27;
+  }
+  edges[n++] = t;
+  return n;
+}
+
+test(dht_decode)
+{
+  // 65.2%RH, 35.1C
+  UC frame[5] = {0x02, 0x8C, 0x01, 0x5F, 0xEE};
+  uint32_t edges[DHT_FRAME_EDGES + 2];
+  UC data[5];
+
+  // Timestamps wrap around in the middle of the frame
+  UC n = dhtFrameEdges(edges, frame, 0xFFFFFF00UL);
+  assertTrue(DHT_DecodeEdges(edges, n, data));
+  assertEqual(memcmp(data, frame, 5), 0);
+
+  // Missing edges or bad checksum
+  assertFalse(DHT_DecodeEdges(edges, n - 10, data));
+  frame[4] ^= 0x01;
+  n = dhtFrameEdges(edges, frame, 0);
+  assertFalse(DHT_DecodeEdges(edges, n, data));
+}
+
+test(als_filter)
+{
+  // Noisy trace with spikes: 2000 +/-100 counts, then a step to 3000
+  LightSensor lv_als(PIN_SEN_LIGHT);
+  uint16_t lv_batch[LS_BATCH_SAMPLES];
+  uint16_t lv_out = 0, lv_last = 0;
+  UL lv_changes = 0, lv_cost = 0;
+  randomSeed(1);
+
+  for( int k = 0; k < 400; k++ ) {
+    int lv_base = (k < 200 ? 2000 : 3000);
+    for( UC i = 0; i < LS_BATCH_SAMPLES; i++ ) {
+      lv_batch[i] = (random(20) == 0 ? 4095 : lv_base + random(-100, 101));
+    }
+    UL lv_start = micros();
+    lv_out = lv_als.filter(lv_batch, LS_BATCH_SAMPLES);
+    lv_cost += micros() - lv_start;
+    if( lv_out != lv_last ) { lv_changes++; lv_last = lv_out; }
+    if( k == 199 ) {
+      assertLessOrEqual(abs(lv_out - 2000), 40);
+      // Only the initial settling, noise doesn't move the output
+      assertLessOrEqual(lv_changes, 5);
+    }
+  }
+  assertLessOrEqual(abs(lv_out - 3000), 40);
+  SERIAL_LN("ALS filter: %lu output changes, %lu us per 100 batches", lv_changes, lv_cost / 4);
+
+  assertEqual(LightSensor::valueToLux(0), 0);
+  assertEqual(LightSensor::valueToLux(2048), 10);
+  assertEqual(LightSensor::valueToLux(4095), 2000);
+}
+
+// One MIC block: tone of amplitude amp at freq Hz, plus noise and a click
+void toneBlock(uint16_t *block, float freq, int amp, int noise, bool click)
+{
+  for( int i = 0; i < TONE_BLOCK_SIZE; i++ ) {
+    float v = 2048 + amp * sin(2 * M_PI * freq * i / TONE_SAMPLE_RATE) + random(-noise, noise + 1);
+    if( click && i < 40 ) v += (i % 2 ? 1500 : -1500) * exp(-i / 10.0);
+    block[i] = constrain((int)v, 0, 4095);
+  }
+}
+
+test(tone_detect)
+{
+  ToneDetect lv_mic(PIN_SEN_MIC);
+  uint16_t lv_block[TONE_BLOCK_SIZE];
+  randomSeed(3);
+
+  // Quiet room
+  for( int k = 0; k < 10; k++ ) {
+    toneBlock(lv_block, 0, 0, 20, false);
+    assertEqual(lv_mic.processBlock(lv_block, TONE_BLOCK_SIZE), (UC)toneNone);
+  }
+
+  // Whistle at 1KHz is reported once, when it has lasted TONE_HOLD_BLOCKS
+  UC lv_events = 0;
+  UL lv_cost = 0;
+  for( int k = 0; k < 5; k++ ) {
+    toneBlock(lv_block, 1000, 300, 20, false);
+    UL lv_start = micros();
+    UC lv_event = lv_mic.processBlock(lv_block, TONE_BLOCK_SIZE);
+    lv_cost += micros() - lv_start;
+    if( lv_event == toneWhistle ) lv_events++;
+  }
+  assertEqual(lv_events, 1);
+  SERIAL_LN("Tone kernel: %lu us per block", lv_cost / 5);
+
+  // Clap after some quiet
+  for( int k = 0; k < 3; k++ ) {
+    toneBlock(lv_block, 0, 0, 20, false);
+    lv_mic.processBlock(lv_block, TONE_BLOCK_SIZE);
+  }
+  toneBlock(lv_block, 0, 0, 20, true);
+  assertEqual(lv_mic.processBlock(lv_block, TONE_BLOCK_SIZE), (UC)toneClap);
+}
+
+int16_t ruleTestFetch(UC var, UC arg)
+{
+  return(var == ruleVarDev && arg == 3);
+}
+
+test(rule_bytecode)
+{
+  int16_t lv_values[ruleVarMax];
+  memset(lv_values, 0x00, sizeof(lv_values));
+  lv_values[ruleVarPIR] = 1;
+  lv_values[ruleVarALS] = 20;
+  lv_values[ruleVarTime] = 1900;
+  lv_values[ruleVarTemp] = -5;
+
+  RuleProg_t lv_prog;
+  assertTrue(RuleEngineClass::Compile("pir==1 && als<30 && time>=1800 && time<2300", &lv_prog));
+  assertEqual(lv_prog.mask, (1 << ruleVarPIR) | (1 << ruleVarALS) | (1 << ruleVarTime));
+  assertEqual(RuleEngineClass::Execute(lv_prog.code, lv_prog.len, lv_values, ruleTestFetch), 1);
+  assertTrue(RuleEngineClass::Compile("!(pir) || dev(3)", &lv_prog));
+  assertEqual(RuleEngineClass::Execute(lv_prog.code, lv_prog.len, lv_values, ruleTestFetch), 1);
+  assertTrue(RuleEngineClass::Compile("temp > -2 || dev(4)", &lv_prog));
+  assertEqual(RuleEngineClass::Execute(lv_prog.code, lv_prog.len, lv_values, ruleTestFetch), 0);
+
+  // Syntax errors and out of range constants
+  assertFalse(RuleEngineClass::Compile("pir==", &lv_prog));
+  assertFalse(RuleEngineClass::Compile("foo>1", &lv_prog));
+  assertFalse(RuleEngineClass::Compile("(pir==1", &lv_prog));
+  assertFalse(RuleEngineClass::Compile("als<70000", &lv_prog));
+
+  // 1000 rules on a PIR edge
+  assertTrue(RuleEngineClass::Compile("pir==1 && als<30 && time>=1800 && time<2300", &lv_prog));
+  int lv_true = 0;
+  UL lv_start = micros();
+  for( int i = 0; i < 1000; i++ ) {
+    if( RuleEngineClass::Execute(lv_prog.code, lv_prog.len, lv_values, ruleTestFetch) == 1 ) lv_true++;
+  }
+  UL lv_cost = micros() - lv_start;
+  SERIAL_LN("Rule evaluator: %lu us per 1000 rules", lv_cost);
+  assertEqual(lv_true, 1000);
+  assertLess(lv_cost, 5000);
+}
+
+// Frame of 5 scenario rows, uid from first
+US provScenarioFrame(UC *buf, UC seq, UC first)
+{
+  UC lv_payload[1 + 5 * SNT_ROW_SIZE];
+  lv_payload[0] = provTabScenario;
+  for( UC i = 0; i < 5; i++ ) {
+    ScenarioRow_t lv_row;
+    memset(&lv_row, 0x00, sizeof(lv_row));
+    lv_row.op_flag = POST;
+    lv_row.flash_flag = UNSAVED;
+    lv_row.run_flag = UNEXECUTED;
+    lv_row.uid = first + i;
+    lv_row.ring1.State = 1;
+    lv_row.ring1.WW = 128;
+    memcpy(lv_payload + 1 + i * SNT_ROW_SIZE, &lv_row, SNT_ROW_SIZE);
+  }
+  return ProvisionClass::BuildFrame(buf, provFrameRows, seq, lv_payload, sizeof(lv_payload));
+}
+
+test(prov_loopback)
+{
+  UC lv_buf[PROV_OVERHEAD + PROV_MAX_PAYLOAD];
+  US lv_len;
+
+  // 10 frames of 5 rows, dry run keeps the stored scenarios untouched
+  theProvision.Start(NULL, true);
+  UL lv_start = micros();
+  for( UC seq = 0; seq < 10; seq++ ) {
+    lv_len = provScenarioFrame(lv_buf, seq, 100 + seq * 5);
+    for( US i = 0; i < lv_len; i++ ) theProvision.Feed(lv_buf[i]);
+  }
+  UL lv_cost = micros() - lv_start;
+  assertEqual(theProvision.GetRows(), 50);
+  assertEqual(theProvision.GetErrors(), 0);
+  SERIAL_LN("Provisioning: %lu us per 50 rows, %lu rows/s without link", lv_cost, 50000000UL / (lv_cost + 1));
+
+  // Corrupted frame is dropped, so is the next one until it is resent
+  lv_len = provScenarioFrame(lv_buf, 10, 150);
+  lv_buf[PROV_HEADER_SIZE + 3] ^= 0x55;
+  for( US i = 0; i < lv_len; i++ ) theProvision.Feed(lv_buf[i]);
+  lv_len = provScenarioFrame(lv_buf, 11, 155);
+  for( US i = 0; i < lv_len; i++ ) theProvision.Feed(lv_buf[i]);
+  assertEqual(theProvision.GetRows(), 50);
+  assertEqual(theProvision.GetErrors(), 1);
+  lv_len = provScenarioFrame(lv_buf, 10, 150);
+  for( US i = 0; i < lv_len; i++ ) theProvision.Feed(lv_buf[i]);
+  assertEqual(theProvision.GetRows(), 55);
+
+  lv_len = ProvisionClass::BuildFrame(lv_buf, provFrameEnd, 11, NULL, 0);
+  for( US i = 0; i < lv_len; i++ ) theProvision.Feed(lv_buf[i]);
+  assertFalse(theProvision.IsActive());
+}
+
+test(console_dispatch)
+{
+  assertEqual(CommandHash("Show"), CMD_HASH("show"));
+
+  // Root menu: exact, case insensitive, unknown tokens go to the menu default
+  int lv_show = theConsole.FindCommand(0, "show");
+  assertMoreOrEqual(lv_show, 0);
+  assertEqual(theConsole.FindCommand(0, "SHOW"), lv_show);
+  int lv_default = theConsole.FindCommand(0, "foo");
+  assertMore(lv_default, lv_show);
+  assertEqual(theConsole.FindCommand(0, "shows"), lv_default);
+
+  // Replay a command script
+  const char *lv_script[] = {"show", "set", "do", "sys", "help", "?", "check", "send", "test", "foo"};
+  const int lv_count = sizeof(lv_script) / sizeof(lv_script[0]);
+  UL lv_start = micros();
+  for( int k = 0; k < 100; k++ ) {
+    for( int i = 0; i < lv_count; i++ ) theConsole.FindCommand(0, lv_script[i]);
+  }
+  UL lv_cost = micros() - lv_start;
+  SERIAL_LN("Console dispatch: %lu ns per lookup", lv_cost * 1000 / (100 * lv_count));
+
+  // Whole command through the cloud path
+  lv_start = micros();
+  assertTrue(theConsole.ExecuteCloudCommand("show version"));
+  SERIAL_LN("Console command: %lu us", micros() - lv_start);
+}
+
+test(serial_out_drop)
+{
+  // Not flushed, the ring just fills up
+  SerialOutClass lv_out;
+  UC lv_line[100];
+  memset(lv_line, '.', sizeof(lv_line));
+  for( int i = 0; i < 40; i++ ) assertEqual(lv_out.write(lv_line, sizeof(lv_line)), sizeof(lv_line));
+  assertEqual(lv_out.Pending(), 4000);
+
+  // Whole message dropped, nothing half written
+  assertEqual(lv_out.write(lv_line, sizeof(lv_line)), 0);
+  assertEqual(lv_out.Pending(), 4000);
+
+  // The next one that fits is preceded by the lost marker
+  assertEqual(lv_out.write(lv_line, 50), 50);
+  assertMore(lv_out.Pending(), 4050);
+}
+
+test(softpwm_bench)
+{
+  // Status LED channels at different widths, ISR calls and time (with
+  // SOFTPWM_STATS) per second in both modes
+  UL lv_calls[2], lv_busy[2];
+  for( UC lv_mode = SOFTPWM_TICK; lv_mode <= SOFTPWM_EDGE; lv_mode++ ) {
+    SoftPWMBegin(SOFTPWM_NORMAL, lv_mode, TIMER5);
+    SoftPWMSet(PIN_LED_RED, 20);
+    SoftPWMSet(PIN_LED_GREEN, 120);
+    SoftPWMSet(PIN_LED_BLUE, 200);
+    SoftPWMGetStats(NULL, NULL);
+    delay(1000);
+    SoftPWMGetStats(&lv_calls[lv_mode], &lv_busy[lv_mode]);
+    SoftPWMEnd(ALL);
+    SERIAL_LN("SoftPWM %s: %lu ISR/s, %lu us/s", (lv_mode == SOFTPWM_EDGE ? "edge" : "tick"), lv_calls[lv_mode], lv_busy[lv_mode]);
+  }
+  assertLess(lv_calls[SOFTPWM_EDGE], lv_calls[SOFTPWM_TICK]);
+#ifdef SOFTPWM_STATS
+  assertLess(lv_busy[SOFTPWM_EDGE], lv_busy[SOFTPWM_TICK]);
+#endif
+  // Give the LED back to the status indicator
+  theStatusLED.Init();
+}
+
+UC g_ledColor;
+UC g_ledLevel;
+UL g_ledOutputs;
+void gc_captureLED(UC color, UC level) { g_ledColor = color; g_ledLevel = level; g_ledOutputs++; }
+
+test(status_led)
+{
+  StatusLEDClass lv_led;
+  lv_led.Init(gc_captureLED);
+
+  // Render one period of each status: # bright, + dim, . dark
+  char lv_wave[65];
+  for( UC lv_status = STATUS_OFF; lv_status <= STATUS_ERR; lv_status++ ) {
+    const LEDPattern_t *lv_pat = StatusLEDClass::GetPattern(lv_status);
+    int lv_ticks = lv_pat->len * lv_pat->divider;
+    lv_led.Tick(lv_status);
+    UC lv_first = g_ledLevel;
+    int i;
+    for( i = 0; i < lv_ticks; i++ ) {
+      if( i < 64 ) lv_wave[i] = (g_ledLevel > 128 ? '#' : (g_ledLevel > 0 ? '+' : '.'));
+      lv_led.Tick(lv_status);
+    }
+    lv_wave[i < 64 ? i : 64] = '\0';
+    SERIAL_LN("status %d color %d: %s", lv_status, g_ledColor, lv_wave);
+    assertEqual(g_ledColor, lv_pat->color);
+    // Back where it started after one period
+    assertEqual(g_ledLevel, lv_first);
+  }
+
+  // ISR budget: a tick must stay well under 1us (120 cycles)
+  g_ledOutputs = 0;
+  UL lv_start = micros();
+  for( int i = 0; i < 10000; i++ ) lv_led.Tick(STATUS_NWS);
+  UL lv_cost = micros() - lv_start;
+  SERIAL_LN("Status LED: %lu ns per tick, %lu outputs", lv_cost / 10, g_ledOutputs);
+  assertLess(lv_cost, 10000);
+  // Output only on level changes
+  assertLess(g_ledOutputs, 10000 / 2);
+}
+
+// Simulated radio: every send succeeds at once, except to g_simBadNode
+LightEngineClass g_simLight;
+UL g_simMsgs[64 + 1];
+UC g_simBadNode;
+BOOL gc_simLightSend(UC node_id, UC ring, const Hue_t &hue)
+{
+  g_simMsgs[node_id]++;
+  g_simLight.OnSendResult(node_id, node_id != g_simBadNode);
+  return true;
+}
+
+test(light_fade_sim)
+{
+  Hue_t lv_from[3] = {{1, 0, 0, 0, 0, 0}, {1, 0, 0, 0, 0, 0}, {1, 0, 0, 0, 0, 0}};
+  Hue_t lv_to[3] = {{1, 255, 0, 255, 0, 0}, {1, 0, 255, 128, 0, 0}, {1, 0, 0, 64, 255, 0}};
+  const UC lv_lamps[] = {1, 4, 8, LIGHT_MAX_LAMPS};
+
+  // Frames per second of each lamp against lamp count, 2s fades, 10ms ticks
+  for( UC k = 0; k < sizeof(lv_lamps); k++ ) {
+    g_simLight.Init(gc_simLightSend);
+    memset(g_simMsgs, 0x00, sizeof(g_simMsgs));
+    g_simBadNode = (k > 0 ? 1 : 0);
+    for( UC n = 1; n <= lv_lamps[k]; n++ ) assertTrue(g_simLight.Fade(n, lv_from, lv_to, 2000));
+
+    UL lv_start = micros();
+    for( UL t = 10; t < 4000; t += 10 ) g_simLight.Process(t);
+    UL lv_cost = micros() - lv_start;
+
+    UL lv_msgs = 0, lv_frames = 0;
+    for( UC n = 1; n <= lv_lamps[k]; n++ ) {
+      lv_msgs += g_simMsgs[n];
+      if( n != g_simBadNode ) lv_frames += g_simLight.GetFrames(n);
+    }
+    UC lv_good = lv_lamps[k] - (g_simBadNode ? 1 : 0);
+    SERIAL_LN("Light sim %d lamps: %lu msgs, %lu.%lu fps per lamp, %lu us cpu",
+        lv_lamps[k], lv_msgs, lv_frames * 5 / lv_good / 10, lv_frames * 5 / lv_good % 10, lv_cost);
+    // Airtime cap holds and every good lamp reached its target
+    assertLessOrEqual(lv_msgs, LIGHT_RF_RATE * 4 + LIGHT_RF_BURST);
+    assertFalse(g_simLight.IsActive());
+    // A failing lamp backs off instead of eating airtime
+    if( g_simBadNode ) assertLess(g_simLight.GetFrames(g_simBadNode), 10);
+  }
+}
+
+// Float references of the color conversions
+UC refGamma(float x)
+{
+  return (UC)lroundf(255 * powf(x / 255.0f, 2.2f));
+}
+
+void refHSV(US h, UC s, UC v, Hue_t &hue)
+{
+  float lv_h = h / 60.0f, lv_s = s / 255.0f, lv_v = v;
+  int i = (int)lv_h;
+  float f = lv_h - i;
+  float p = lv_v * (1 - lv_s), q = lv_v * (1 - lv_s * f), t = lv_v * (1 - lv_s * (1 - f));
+  float r, g, b;
+  switch( i ) {
+  case 0:   r = lv_v; g = t; b = p; break;
+  case 1:   r = q; g = lv_v; b = p; break;
+  case 2:   r = p; g = lv_v; b = t; break;
+  case 3:   r = p; g = q; b = lv_v; break;
+  case 4:   r = t; g = p; b = lv_v; break;
+  default:  r = lv_v; g = p; b = q; break;
+  }
+  hue.R = refGamma(r);
+  hue.G = refGamma(g);
+  hue.B = refGamma(b);
+}
+
+void refCCT(US kelvin, UC brightness, Hue_t &hue)
+{
+  float lv_warm = 1e6f / COLOR_CCT_MIN, lv_cold = 1e6f / COLOR_CCT_MAX;
+  UC lv_level = refGamma(brightness);
+  hue.CW = (UC)lroundf(lv_level * (lv_warm - 1e6f / kelvin) / (lv_warm - lv_cold));
+  hue.WW = lv_level - hue.CW;
+}
+
+UC colorError(UC a, UC b)
+{
+  return (a > b ? a - b : b - a);
+}
+
+test(color_convert)
+{
+  Hue_t lv_hue, lv_ref;
+  UC lv_maxHSV = 0, lv_maxCCT = 0, lv_err;
+
+  // Accuracy against the float conversions
+  for( US h = 0; h < 360; h += 3 ) {
+    for( US s = 0; s < 256; s += 15 ) {
+      for( US v = 0; v < 256; v += 15 ) {
+        ColorFromHSV(h, s, v, lv_hue);
+        refHSV(h, s, v, lv_ref);
+        lv_err = max(colorError(lv_hue.R, lv_ref.R), max(colorError(lv_hue.G, lv_ref.G), colorError(lv_hue.B, lv_ref.B)));
+        if( lv_err > lv_maxHSV ) lv_maxHSV = lv_err;
+      }
+    }
+  }
+  for( US k = COLOR_CCT_MIN; k <= COLOR_CCT_MAX; k += 7 ) {
+    for( US br = 0; br < 256; br += 5 ) {
+      ColorFromCCT(k, br, lv_hue);
+      refCCT(k, br, lv_ref);
+      lv_err = max(colorError(lv_hue.CW, lv_ref.CW), colorError(lv_hue.WW, lv_ref.WW));
+      if( lv_err > lv_maxCCT ) lv_maxCCT = lv_err;
+    }
+  }
+  SERIAL_LN("Color max error: HSV %d, CCT %d", lv_maxHSV, lv_maxCCT);
+  assertLessOrEqual(lv_maxHSV, 3);
+  assertLessOrEqual(lv_maxCCT, 1);
+
+  // Out of range color temperatures are clamped
+  ColorFromCCT(1000, 255, lv_hue);
+  assertEqual(lv_hue.CW, 0);
+  assertEqual(lv_hue.WW, 255);
+  ColorFromCCT(10000, 255, lv_hue);
+  assertEqual(lv_hue.CW, 255);
+  ColorFromHSV(120, 255, 0, lv_hue);
+  assertEqual(lv_hue.State, 0);
+
+  // Cost per conversion
+  UL lv_start = micros();
+  for( US i = 0; i < 10000; i++ ) ColorFromHSV(i % 360, 200, i & 0xFF, lv_hue);
+  UL lv_hsv = micros() - lv_start;
+  lv_start = micros();
+  for( US i = 0; i < 10000; i++ ) ColorFromCCT(COLOR_CCT_MIN + i % 3800, i & 0xFF, lv_hue);
+  UL lv_cct = micros() - lv_start;
+  lv_start = micros();
+  for( US i = 0; i < 10000; i++ ) refHSV(i % 360, 200, i & 0xFF, lv_ref);
+  UL lv_float = micros() - lv_start;
+  SERIAL_LN("Color cost per conversion: HSV %lu ns, CCT %lu ns, float HSV %lu ns",
+      lv_hsv / 10, lv_cct / 10, lv_float / 10);
+  assertLess(lv_hsv, lv_float);
+}
+
+// More lamps than the controller drives, to see where the airtime ends
+LightEngineClass g_simFx(64);
+BOOL gc_simFxSend(UC node_id, UC ring, const Hue_t &hue)
+{
+  g_simMsgs[node_id]++;
+  g_simFx.OnSendResult(node_id, node_id != g_simBadNode);
+  return true;
+}
+
+test(light_effect_sim)
+{
+  Hue_t lv_base[3] = {{1, 0, 200, 0, 0, 0}, {1, 0, 200, 0, 0, 0}, {1, 0, 200, 0, 0, 0}};
+  const UC lv_lamps[] = {1, 16, 64};
+
+  // Frames per second of each lamp against lamp count, 10s effects, 10ms ticks
+  for( UC fx = effectBreathe; fx < effectMax; fx++ ) {
+    for( UC k = 0; k < sizeof(lv_lamps); k++ ) {
+      g_simFx.Init(gc_simFxSend);
+      memset(g_simMsgs, 0x00, sizeof(g_simMsgs));
+      g_simBadNode = (k > 0 ? 1 : 0);
+      for( UC n = 1; n <= lv_lamps[k]; n++ ) assertTrue(g_simFx.Effect(n, fx, lv_base, 0, 10000));
+
+      UL lv_start = micros();
+      for( UL t = 10; t < 10000; t += 10 ) g_simFx.Process(t);
+      UL lv_cost = micros() - lv_start;
+
+      UL lv_msgs = 0, lv_frames = 0;
+      for( UC n = 1; n <= lv_lamps[k]; n++ ) {
+        lv_msgs += g_simMsgs[n];
+        if( n != g_simBadNode ) lv_frames += g_simFx.GetFrames(n);
+      }
+      UC lv_good = lv_lamps[k] - (g_simBadNode ? 1 : 0);
+      SERIAL_LN("Effect %d sim %d lamps: %lu msgs, %lu.%02lu fps per lamp, %lu us cpu",
+          fx, lv_lamps[k], lv_msgs, lv_frames / lv_good / 10, lv_frames * 10 / lv_good % 100, lv_cost);
+      assertLessOrEqual(lv_msgs, LIGHT_RF_RATE * 10 + LIGHT_RF_BURST);
+      // A failing lamp keeps probing, once per backoff at most
+      if( g_simBadNode ) {
+        assertMoreOrEqual(g_simFx.GetFrames(g_simBadNode), 2);
+        assertLessOrEqual(g_simFx.GetFrames(g_simBadNode), 10);
+      }
+    }
+  }
+
+  // Ending an effect goes back to the base rings
+  g_simFx.Init(gc_simFxSend);
+  g_simBadNode = 0;
+  assertTrue(g_simFx.Effect(3, effectBreathe, lv_base, 1000, 0));
+  for( UL t = 10; t < 1230; t += 10 ) g_simFx.Process(t);
+  assertLess(g_simFx.GetCurrent(3)[0].WW, 200);
+  g_simFx.Effect(3, effectNone, NULL, 0, 0);
+  for( UL t = 1230; t < 1500; t += 10 ) g_simFx.Process(t);
+  assertFalse(g_simFx.IsActive());
+}
+
+UL g_presenceEvents[nodeOffline + 1];
+void gc_simPresence(UC nid, UC presence)
+{
+  g_presenceEvents[presence]++;
+}
+
+test(node_presence)
+{
+  NodeListClass lv_list(255);
+  NodeIdRow_t lv_node;
+  memset(&lv_node, 0x00, sizeof(lv_node));
+  memset(g_presenceEvents, 0x00, sizeof(g_presenceEvents));
+  lv_list.setPresenceCallback(gc_simPresence);
+
+  // Worst case inserts: descending ids shift every row
+  for( int nid = 255; nid > 0; nid-- ) {
+    lv_node.nid = nid;
+    assertMoreOrEqual(lv_list.add(&lv_node), 0);
+  }
+  assertEqual(lv_list.count(), 255);
+  assertFalse(lv_list.touch(0, 1000));
+
+  // Stamps through the index
+  UL lv_start = micros();
+  for( int nid = 1; nid <= 255; nid++ ) assertTrue(lv_list.touch(nid, 1000));
+  UL lv_touch = micros() - lv_start;
+  lv_node.nid = 200;
+  assertEqual(lv_list.get(&lv_node), 199);
+  assertEqual(lv_node.recentActive, 1000);
+
+  // First touch is silent, so is the classification that follows
+  assertEqual(g_presenceEvents[nodeOnline], 0);
+  UL lv_worst = 0, lv_calls = 0;
+  UC lv_changes = 0;
+  // Half of the nodes go quiet
+  for( int nid = 1; nid <= 255; nid += 2 ) lv_list.touch(nid, 1000 + NODELIST_OFFLINE);
+  for( int i = 0; i < 2 * (255 / NODELIST_SWEEP_BUDGET + 1); i++ ) {
+    lv_start = micros();
+    lv_changes += lv_list.sweep(1000 + NODELIST_OFFLINE);
+    UL lv_cost = micros() - lv_start;
+    if( lv_cost > lv_worst ) lv_worst = lv_cost;
+    lv_calls++;
+  }
+  SERIAL_LN("Presence 255 nodes: touch %lu ns, sweep of %d nodes max %lu us, full pass %lu calls",
+      lv_touch * 1000 / 255, NODELIST_SWEEP_BUDGET, lv_worst, lv_calls / 2);
+  assertEqual(lv_changes, 127);
+  assertEqual(g_presenceEvents[nodeOffline], 127);
+  assertEqual(lv_list.getPresence(2), nodeOffline);
+  assertEqual(lv_list.getPresence(3), nodeOnline);
+
+  // Back online with the next message
+  assertTrue(lv_list.touch(2, 1000 + NODELIST_OFFLINE + 1));
+  assertEqual(g_presenceEvents[nodeOnline], 1);
+
+  // Remove keeps the index in step
+  lv_node.nid = 100;
+  assertTrue(lv_list.remove(&lv_node));
+  assertFalse(lv_list.touch(100, 5000));
+  assertTrue(lv_list.touch(101, 5000));
+  lv_node.nid = 101;
+  assertEqual(lv_list.get(&lv_node), 99);
+}
+
+// Counts instead of writing EEPROM
+class SimNodeList : public NodeListClass
+{
+public:
+  SimNodeList() : NodeListClass(MAX_NODE_PER_CONTROLLER) {}
+  UL m_lastSlot;
+protected:
+  virtual void putRow(UC slot, const NodeIdRow_t &row) { m_lastSlot = slot; }
+};
+
+test(nodelist_delta_save)
+{
+  SimNodeList lv_list;
+  NodeIdRow_t lv_node;
+  memset(&lv_node, 0x00, sizeof(lv_node));
+
+  // One day: 24 lamps talking every minute, a node joins every 30 minutes
+  // and leaves 15 minutes later, the save task runs every 5 seconds
+  for( int nid = 1; nid <= 24; nid++ ) {
+    lv_node.nid = nid;
+    lv_list.add(&lv_node);
+  }
+  lv_list.m_combineWindow = 0;
+  lv_list.saveList(0);
+  lv_list.m_combineWindow = NODELIST_COMBINE_WINDOW;
+  lv_list.m_bytesWritten = 0;
+  lv_list.m_rowsWritten = 0;
+
+  UL lv_legacy = 0;
+  UL lv_start = micros();
+  for( UL t = 5; t <= 86400; t += 5 ) {
+    bool lv_changed = false;
+    // Each lamp once a minute, spread over the minute
+    for( int nid = 1; nid <= 24; nid++ ) {
+      if( (t + nid * 5) % 60 == 0 ) lv_changed |= lv_list.touch(nid, t);
+    }
+    lv_node.nid = 30 + (t / 1800) % 32;
+    if( t % 1800 == 0 ) { lv_list.add(&lv_node); lv_changed = true; }
+    if( t % 1800 == 900 ) { lv_node.nid = 30 + ((t - 900) / 1800) % 32; lv_list.remove(&lv_node); lv_changed = true; }
+
+    // The whole block whenever something changed
+    if( lv_changed ) lv_legacy += MEM_NODELIST_LEN;
+    lv_list.saveList(t * 1000);
+  }
+  UL lv_cost = micros() - lv_start;
+  SERIAL_LN("NodeList EEPROM bytes per day: whole block %lu, dirty rows %lu (%lu rows), %lu us",
+      lv_legacy, lv_list.m_bytesWritten, lv_list.m_rowsWritten, lv_cost);
+  assertLess(lv_list.m_bytesWritten * 20, lv_legacy);
+
+  // A single change writes one row, after the combining window
+  const UL lv_t0 = 100000000;
+  lv_list.saveList(lv_t0);
+  lv_list.saveList(lv_t0 + NODELIST_COMBINE_WINDOW);
+  UL lv_rows = lv_list.m_rowsWritten;
+  lv_node.nid = 5;
+  lv_list.get(&lv_node);
+  lv_node.identify[0] = 0xAA;
+  lv_list.add(&lv_node);
+  assertFalse(lv_list.saveList(lv_t0 + 20000));
+  assertEqual(lv_list.m_rowsWritten, lv_rows);
+  assertTrue(lv_list.saveList(lv_t0 + 20000 + NODELIST_COMBINE_WINDOW));
+  assertEqual(lv_list.m_rowsWritten, lv_rows + 1);
+  assertEqual(lv_list.m_lastSlot, 4);
+}
+
 //>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 // Call Start Func to Init Tests
 //>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
@@ -198,15 +877,7 @@ test(alarm_all_red)
   void loop()
   {
     //Serial.print (".");
-    static UC tick = 0;
-
-    IF_MAINLOOP_TIMER( theSys.ProcessCommands(), "ProcessCommands" );
-
-    IF_MAINLOOP_TIMER( theSys.CollectData(tick++), "CollectData" );
-
-  	IF_MAINLOOP_TIMER( theSys.ReadNewRules(), "ReadNewRules" );
-
-    IF_MAINLOOP_TIMER( theSys.SelfCheck(RTE_DELAY_SELFCHECK), "SelfCheck" );
+    theScheduler.Run();
 
     if (flag)
       Test::run();
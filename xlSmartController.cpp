@@ -24,10 +24,19 @@
 **/
 #include "xlSmartController.h"
 #include "xliPinMap.h"
+#include "xlxColor.h"
 #include "xlxConfig.h"
+#include "xlxLightEngine.h"
 #include "xlxLogger.h"
+#include "xlxMQTTClient.h"
+#include "xlxPerf.h"
 #include "xlxRF24Server.h"
+#include "xlxRuleEngine.h"
+#include "xlxScheduler.h"
+#include "xlxSensorSched.h"
 #include "xlxSerialConsole.h"
+#include "xlxSerialOut.h"
+#include "xlxStatusLED.h"
 
 #include "Adafruit_DHT.h"
 #include "ArduinoJson.h"
@@ -35,6 +44,7 @@
 #include "LightSensor.h"
 #include "MotionSensor.h"
 #include "TimeAlarms.h"
+#include "ToneDetect.h"
 
 //------------------------------------------------------------------
 // Global Data Structures & Variables
@@ -49,15 +59,61 @@ LedLevelBar indicatorBrightness(ledLBarProgress, 3);
 
 MotionSensor senMotion(PIN_SEN_PIR);
 
+ToneDetect senMic(PIN_SEN_MIC);
+
 //------------------------------------------------------------------
-// Alarm Triggered Actions
+// Main Loop Tasks
 //------------------------------------------------------------------
-void AlarmTimerTriggered(uint32_t tag)
+void gc_taskCommands() { PERF_PROBE( perfCommands, theSys.ProcessCommands() ); }
+bool gc_readyCommands() { return(Serial.available() > 0); }
+void gc_taskCollectData() { PERF_PROBE( perfCollectData, theSys.CollectData() ); }
+void gc_taskReadNewRules() { PERF_PROBE( perfReadNewRules, theSys.ReadNewRules() ); }
+void gc_taskAlarms() { PERF_PROBE( perfAlarms, Alarm.serviceAlarms() ); }
+void gc_taskLog() { PERF_PROBE( perfLog, theLog.Process() ); }
+void gc_taskSaveConfig() { PERF_PROBE( perfSaveConfig, theConfig.SaveConfig() ); }
+void gc_taskSelfCheck() { PERF_PROBE( perfSelfCheck, theSys.SelfCheck() ); }
+void gc_taskPerf() { thePerf.UpdateSnapshot(); }
+void gc_taskDHT() { senDHT.process(); }
+void gc_taskLight() { theSys.ProcessLight(); }
+void gc_taskNodes() { if (Time.isValid()) PERF_PROBE( perfNodeSweep, theConfig.lstNodes.sweep(Time.now()) ); }
+void gc_taskOutput() { theSerialOut.Flush(); }
+bool gc_readyOutput() { return theSerialOut.IsReady(); }
+void gc_dhtComplete(DHT *dht, bool ok) { theSys.OnDHTComplete(ok); }
+
+// Node went online, stale or offline
+void gc_nodePresence(UC nid, UC presence)
 {
-	uint8_t rule_uid = (uint8_t)tag;
-	SERIAL_LN("Rule %u Alarm Triggered", rule_uid);
+	const char *lv_names[] = {"unknown", "online", "stale", "offline"};
+	LOGI(LOGTAG_EVENT, "Node %d %s", nid, lv_names[presence & 0x03]);
+
+	char buf[48];
+	snprintf(buf, sizeof(buf), "{\"nid\":%d,\"presence\":\"%s\"}", nid, lv_names[presence & 0x03]);
+	theMQTT.Publish(MQTT_TOPIC_PRESENCE, buf);
+}
 
+//------------------------------------------------------------------
+// Sensor Read Functions, see xlxSensorSched
+//------------------------------------------------------------------
+float gc_readDHT() { theSys.StartReadDHT(); return NAN; }
+float gc_readALS() { uint16_t lv_level = senLight.getLevel(); theSys.UpdateBrightness(lv_level); return lv_level; }
+float gc_readPIR() { bool lv_motion = senMotion.getMotion(); theSys.UpdateMotion(lv_motion); return lv_motion; }
+float gc_readMIC()
+{
+	US freq;
+	UC event = senMic.getEvent(&freq);
+	if (event != toneNone) {
+		LOGD(LOGTAG_EVENT, "MIC event %d, freq %d", event, freq);
+	}
+	theSys.UpdateSound(event);
+	return event;
+}
 
+//------------------------------------------------------------------
+// Alarm Triggered Actions
+//------------------------------------------------------------------
+// Apply the scenario of the rule to its node
+void ApplyRuleScenario(uint8_t rule_uid)
+{
 	//search Rule table for matching UID
 	ListNode<RuleRow_t> *RuleRowptr = theSys.Rule_table.search(rule_uid);
 	if (RuleRowptr == NULL)
@@ -70,34 +126,78 @@ void AlarmTimerTriggered(uint32_t tag)
 	uint8_t SNT_uid = RuleRowptr->data.SNT_uid;
 	uint8_t node_id = RuleRowptr->data.node_id;
 
-	//get SNT_uid from rule rows and find
-	ListNode<ScenarioRow_t> *rowptr = theSys.SearchScenario(SNT_uid);
-
-	if (rowptr)
-	{
-		String ring1_payload = theSys.CreateColorPayload(1, rowptr->data.ring1.State, rowptr->data.ring1.CW, rowptr->data.ring1.WW, rowptr->data.ring1.R, rowptr->data.ring1.G, rowptr->data.ring1.B);
-		String ring2_payload = theSys.CreateColorPayload(2, rowptr->data.ring2.State, rowptr->data.ring2.CW, rowptr->data.ring2.WW, rowptr->data.ring2.R, rowptr->data.ring2.G, rowptr->data.ring2.B);
-		String ring3_payload = theSys.CreateColorPayload(3, rowptr->data.ring3.State, rowptr->data.ring3.CW, rowptr->data.ring3.WW, rowptr->data.ring3.R, rowptr->data.ring3.G, rowptr->data.ring3.B);
-
-		char buf[64];
+	theSys.FadeToScenario(node_id, SNT_uid, RTE_FADE_SCENARIO);
+}
 
-		sprintf(buf, "%d;%d;%d;%d;%d;%s", node_id, S_CUSTOM, C_SET, 1, V_STATUS, ring1_payload.c_str());
-		String ring1_cmd(buf);
-		theSys.ExecuteLightCommand(ring1_cmd);
+void AlarmTimerTriggered(uint32_t tag)
+{
+	uint8_t rule_uid = (uint8_t)tag;
+	SERIAL_LN("Rule %u Alarm Triggered", rule_uid);
 
-		sprintf(buf, "%d;%d;%d;%d;%d;%s", node_id, S_CUSTOM, C_SET, 1, V_STATUS, ring2_payload.c_str());
-		String ring2_cmd(buf);
-		theSys.ExecuteLightCommand(ring2_cmd);
+	// Rules with a condition only act while it holds
+	if (!theRuleEngine.Check(rule_uid))
+	{
+		LOGI(LOGTAG_EVENT, "Rule %u condition not met", rule_uid);
+		return;
+	}
+	ApplyRuleScenario(rule_uid);
+}
 
-		sprintf(buf, "%d;%d;%d;%d;%d;%s", node_id, S_CUSTOM, C_SET, 1, V_STATUS, ring3_payload.c_str());
-		String ring3_cmd(buf);
-		theSys.ExecuteLightCommand(ring3_cmd);
+//------------------------------------------------------------------
+// Rule Condition Callbacks, see xlxRuleEngine
+//------------------------------------------------------------------
+int16_t gc_ruleFetch(UC var, UC arg)
+{
+	switch (var)
+	{
+	case ruleVarTemp: return (int16_t)theSys.m_temperature;
+	case ruleVarHumid: return (int16_t)theSys.m_humidity;
+	case ruleVarALS: return theSys.m_brightness;
+	case ruleVarPIR: return theSys.m_motion;
+	case ruleVarMIC: return theSys.m_sound;
+	case ruleVarTime:
+	{
+		time_t lv_now = now_tz();
+		return Time.hour(lv_now) * 100 + Time.minute(lv_now);
 	}
-	else
+	case ruleVarDev:
 	{
-		LOGE(LOGTAG_MSG, "Could not change node:%d light's color, scenerio %d not found", node_id, SNT_uid);
-		return;
+		ListNode<DevStatusRow_t> *DevStatusRowPtr = theSys.SearchDevStatus(arg);
+		if (!DevStatusRowPtr) return 0;
+		return (DevStatusRowPtr->data.ring1.State || DevStatusRowPtr->data.ring2.State || DevStatusRowPtr->data.ring3.State);
 	}
+	}
+	return 0;
+}
+
+void gc_ruleFire(UC uid)
+{
+	SERIAL_LN("Rule %u Condition Triggered", uid);
+	ApplyRuleScenario(uid);
+}
+
+//------------------------------------------------------------------
+// Light Frame Callback, see xlxLightEngine
+//------------------------------------------------------------------
+BOOL gc_lightSend(UC node_id, UC ring, const Hue_t &hue)
+{
+	String payload = theSys.CreateColorPayload(ring, hue.State, hue.CW, hue.WW, hue.R, hue.G, hue.B);
+	char buf[64];
+	sprintf(buf, "%d;%d;%d;%d;%d;%s", node_id, S_CUSTOM, C_SET, 1, V_VAR1, payload.c_str());
+	String strCmd(buf);
+
+	// Quiet version of ExecuteLightCommand(), there may be up to LIGHT_RF_RATE frames
+	// per second; BuildMessage() prints nothing and OnMessageSent()
+	// stays quiet for all but the last frame of a transition
+	MyMessage msg;
+	if (!theRadio.BuildMessage(strCmd, msg))
+		return false;
+	if (theRadio.IsWorkerRunning())
+		return theRadio.PostSend(msg);
+	if (!theRadio.ProcessSend(&msg))
+		return false;
+	theSys.OnMessageSent(msg);
+	return true;
 }
 
 //------------------------------------------------------------------
@@ -109,6 +209,12 @@ SmartControllerClass::SmartControllerClass()
 	m_isBLE = false;
 	m_isLAN = false;
 	m_isWAN = false;
+	m_taskRules = SCHED_INVALID_TASK;
+	m_taskAlarms = SCHED_INVALID_TASK;
+	m_taskDHT = SCHED_INVALID_TASK;
+	m_taskCollect = SCHED_INVALID_TASK;
+	m_taskLight = SCHED_INVALID_TASK;
+	m_ruleMinute = 0xFF;
 }
 
 // Primitive initialization before loading configuration
@@ -130,7 +236,15 @@ void SmartControllerClass::Init()
 
 	// Initialize Logger
 	theLog.Init(m_SysID);
-	theLog.InitFlash(MEM_OFFLINE_DATA_OFFSET, MEM_OFFLINE_DATA_LEN);
+	theLog.InitFlash(theConfig.P1Flash, MEM_OFFLINE_DATA_OFFSET, MEM_OFFLINE_DATA_LEN);
+
+	// Initialize Profiler
+	thePerf.Init();
+
+	// Rule conditions read sensor values and apply scenarios through theSys
+	theRuleEngine.Init(gc_ruleFetch, gc_ruleFire);
+	theLightEngine.Init(gc_lightSend);
+	theConfig.lstNodes.setPresenceCallback(gc_nodePresence);
 
 	LOGN(LOGTAG_MSG, "SmartController is starting...SysID=%s", m_SysID.c_str());
 }
@@ -169,8 +283,8 @@ void SmartControllerClass::InitNetwork()
 			SetStatus(STATUS_NWS);
 
 			// Initialize Logger: syslog & cloud log
+			theLog.InitSysLog(XLA_SYSLOG_HOST, XLA_SYSLOG_PORT);
 			// ToDo: substitude network parameters
-			//theLog.InitSysLog();
 			//theLog.InitCloud();
 		}
 		else if (GetStatus() == STATUS_BMW && IsLANGood())
@@ -178,6 +292,12 @@ void SmartControllerClass::InitNetwork()
 			LOGN(LOGTAG_MSG, F("LAN is working."));
 			SetStatus(STATUS_DIS);
 		}
+
+		// MQTT broker could be on LAN or WAN
+		if (IsLANGood() || IsWANGood())
+		{
+			theMQTT.Init(XLA_MQTT_BROKER, XLA_MQTT_PORT, m_SysID);
+		}
 	}
 }
 
@@ -188,9 +308,8 @@ void SmartControllerClass::InitPins()
 #ifdef MCU_TYPE_P1
 	pinMode(PIN_BTN_SETUP, INPUT);
 	pinMode(PIN_BTN_RESET, INPUT);
-	pinMode(PIN_LED_RED, OUTPUT);
-	pinMode(PIN_LED_GREEN, OUTPUT);
-	pinMode(PIN_LED_BLUE, OUTPUT);
+	// Status RGB LED, driven by the system timer
+	theStatusLED.Init();
 #endif
 
 	// Workaround for Paricle Analog Pin mode problem
@@ -224,15 +343,26 @@ void SmartControllerClass::InitSensors()
 	// DHT
 	if (theConfig.IsSensorEnabled(sensorDHT)) {
 		senDHT.begin();
+		senDHT.onComplete(gc_dhtComplete);
+		theSensorSched.Register(sensorDHT, "DHT", gc_readDHT, SEN_DHT_PERIOD_MIN, SEN_DHT_PERIOD_MAX,
+				SEN_DHT_T_DEADBAND, SEN_DHT_JITTER, SEN_FLAG_SLOW, SEN_DHT_H_DEADBAND);
 		LOGD(LOGTAG_MSG, F("DHT sensor works."));
 	}
 
 	// Light
 	if (theConfig.IsSensorEnabled(sensorALS)) {
 		senLight.begin(SEN_LIGHT_MIN, SEN_LIGHT_MAX);
+		theSensorSched.Register(sensorALS, "ALS", gc_readALS, SEN_ALS_PERIOD_MIN, SEN_ALS_PERIOD_MAX, SEN_ALS_DEADBAND);
 		LOGD(LOGTAG_MSG, F("Light sensor works."));
 	}
 
+	// MIC, sampled by its own timer, see SampleMIC()
+	if (theConfig.IsSensorEnabled(sensorMIC)) {
+		senMic.begin();
+		theSensorSched.Register(sensorMIC, "MIC", gc_readMIC, SEN_MIC_PERIOD, SEN_MIC_PERIOD, 1);
+		LOGD(LOGTAG_MSG, F("MIC works."));
+	}
+
 	// Brightness indicator
 	indicatorBrightness.configPin(0, PIN_LED_LEVEL_B0);
 	indicatorBrightness.configPin(1, PIN_LED_LEVEL_B1);
@@ -242,6 +372,7 @@ void SmartControllerClass::InitSensors()
 	//PIR
 	if (theConfig.IsSensorEnabled(sensorPIR)) {
 		senMotion.begin();
+		theSensorSched.Register(sensorPIR, "PIR", gc_readPIR, SEN_PIR_PERIOD_MIN, SEN_PIR_PERIOD_MAX, 1, 0, SEN_FLAG_NOSLEEP);
 		LOGD(LOGTAG_MSG, F("Motion sensor works."));
 	}
 
@@ -269,6 +400,27 @@ BOOL SmartControllerClass::Start()
 			theConfig.GetOrganization().c_str(), theConfig.GetProductName().c_str(), theConfig.GetVersion());
 	LOGI(LOGTAG_MSG, "System Info: %s-%s",
 			GetSysID().c_str(), GetSysVersion().c_str());
+
+	// Register main loop tasks, the loop sleeps until the earliest one is due
+	UC lv_taskCommands = theScheduler.AddTask("command", gc_taskCommands, RTE_DELAY_COMMAND, gc_readyCommands);
+	m_taskCollect = theScheduler.AddTask("collect", gc_taskCollectData, RTE_DELAY_COLLECT);
+	m_taskRules = theScheduler.AddTask("rules", gc_taskReadNewRules, RTE_DELAY_RULES);
+	m_taskAlarms = theScheduler.AddTask("alarms", gc_taskAlarms, RTE_DELAY_ALARM);
+	theScheduler.AddTask("log", gc_taskLog, RTE_DELAY_PUBLISH);
+	theScheduler.AddTask("save", gc_taskSaveConfig, RTE_DELAY_SAVECONFIG);
+	theScheduler.AddTask("check", gc_taskSelfCheck, RTE_DELAY_SELFCHECK);
+	theScheduler.AddTask("perf", gc_taskPerf, RTE_DELAY_PERF);
+	theScheduler.AddTask("output", gc_taskOutput, RTE_DELAY_OUTPUT, gc_readyOutput);
+	// Only runs while a DHT read is going on
+	m_taskDHT = theScheduler.AddTask("dht", gc_taskDHT, RTE_DELAY_DHT);
+	theScheduler.EnableTask(m_taskDHT, false);
+	// Only runs while lights are in transition
+	m_taskLight = theScheduler.AddTask("light", gc_taskLight, RTE_DELAY_LIGHT);
+	theScheduler.EnableTask(m_taskLight, false);
+	theScheduler.AddTask("nodes", gc_taskNodes, RTE_DELAY_NODES);
+
+	// Radio runs on its own thread from now on, results wake up the command task
+	theRadio.StartWorker(lv_taskCommands);
 	return true;
 }
 
@@ -331,27 +483,13 @@ BOOL SmartControllerClass::CheckBLE()
 	return true;
 }
 
-BOOL SmartControllerClass::SelfCheck(UL ms)
+// Called by the scheduler every RTE_DELAY_SELFCHECK
+BOOL SmartControllerClass::SelfCheck()
 {
-	static UC tickSaveConfig = 0;				// must be static
-	static UC tickCheckRadio = 0;				// must be static
-
-	// Check all alarms. This triggers them.
-	Alarm.delay(ms);
-
-	// Save config if it was changed
-	if (++tickSaveConfig > 10) {
-		tickSaveConfig = 0;
-		theConfig.SaveConfig();
-	}
-
   // Check RF module
-  if (++tickCheckRadio > 60) {
-		tickCheckRadio = 0;
-    if( !IsRFGood() ) {
-      if( CheckRF() ) {
-        LOGN(LOGTAG_MSG, F("RF24 module recovered."));
-      }
+  if( !IsRFGood() ) {
+    if( CheckRF() ) {
+      LOGN(LOGTAG_MSG, F("RF24 module recovered."));
     }
   }
 
@@ -384,93 +522,77 @@ BOOL SmartControllerClass::IsWANGood()
 // Process all kinds of commands
 void SmartControllerClass::ProcessCommands()
 {
-	// Check and process RF2.4 messages
-	//m_cmRF24.CheckMessageBuffer();
+	// Check and process RF2.4 messages and send results
+	theRadio.ProcessResults();
 
 	// Process Console Command
   theConsole.processCommand();
 
-	// ToDo: process commands from other sources (Wifi, BLE)
+	// Process MQTT messages and send queued ones
+	theMQTT.Process();
+
+	// ToDo: process commands from other sources (BLE)
 	// ToDo: Potentially move ReadNewRules here
 }
 
 // Collect data from all enabled sensors
-/// use tick to control the collection speed of each sensor,
-/// and avoid reading too many data in one loop
-void SmartControllerClass::CollectData(UC tick)
+/// each sensor is read when it's due, see xlxSensorSched,
+/// then the task sleeps until the next one is due
+void SmartControllerClass::CollectData()
 {
-	BOOL blnReadDHT = false;
-	BOOL blnReadALS = false;
-	BOOL blnReadPIR = false;
+	BOOL blnSleep;
+	UL lv_next = RTE_DELAY_COLLECT;
 
 	switch (GetStatus()) {
 	case STATUS_DIS:
 	case STATUS_NWS:    // Normal speed
-		if (theConfig.IsSensorEnabled(sensorDHT)) {
-			if (tick % SEN_DHT_SPEED_NORMAL == 0)
-				blnReadDHT = true;
-		}
-		if (theConfig.IsSensorEnabled(sensorALS)) {
-			if (tick % SEN_ALS_SPEED_NORMAL == 0)
-				blnReadALS = true;
-		}
-		if (theConfig.IsSensorEnabled(sensorPIR)) {
-			if (tick % SEN_PIR_SPEED_NORMAL == 0)
-				blnReadPIR = true;
-		}
+		blnSleep = false;
 		break;
 
 	case STATUS_SLP:    // Lower speed in sleep mode
-		if (theConfig.IsSensorEnabled(sensorDHT)) {
-			if (tick % SEN_DHT_SPEED_LOW == 0)
-				blnReadDHT = true;
-		}
-		if (theConfig.IsSensorEnabled(sensorALS)) {
-			if (tick % SEN_ALS_SPEED_LOW == 0)
-				blnReadALS = true;
-		}
-		if (theConfig.IsSensorEnabled(sensorPIR)) {
-			if (tick % SEN_PIR_SPEED_LOW == 0)
-				blnReadPIR = true;
-		}
+		blnSleep = true;
 		break;
 
 	default:
 		return;
 	}
 
-	// Read from DHT
-	if (blnReadDHT) {
-		float t = senDHT.getTempCelcius();
-		float h = senDHT.getHumidity();
-
-		if (!isnan(t)) {
-			UpdateTemperature(t);
-		}
-		if (!isnan(h)) {
-			UpdateHumidity(h);
-		}
-	}
-
-	// Read from ALS
-	if (blnReadALS) {
-		UpdateBrightness(senLight.getLevel());
-	}
-
-	// Motion detection
-	if (blnReadPIR) {
-		UpdateMotion(senMotion.getMotion());
-	}
-
 	// Update json data and publish on to the cloud
-	if (blnReadDHT || blnReadALS || blnReadPIR) {
+	if (theSensorSched.Run(blnSleep, &lv_next) > 0) {
 		UpdateJSONData();
 	}
+	theScheduler.SetNextRun(m_taskCollect, min(lv_next, (UL)RTE_DELAY_COLLECT));
 
 	// ToDo: Proximity detection
 	// from all channels including Wi-Fi, BLE, etc. for MAC addresses and distance to device
 }
 
+// Start reading DHT, results come in OnDHTComplete()
+void SmartControllerClass::StartReadDHT()
+{
+	if (senDHT.startRead())
+		theScheduler.EnableTask(m_taskDHT, true);
+}
+
+// DHT read finished, called by senDHT.process()
+void SmartControllerClass::OnDHTComplete(bool ok)
+{
+	theScheduler.EnableTask(m_taskDHT, false);
+	if (!ok) return;
+
+	float t = senDHT.getLastTempCelcius();
+	float h = senDHT.getLastHumidity();
+
+	if (!isnan(t)) {
+		UpdateTemperature(t);
+	}
+	if (!isnan(h)) {
+		UpdateHumidity(h);
+	}
+	theSensorSched.Report(sensorDHT, t, h);
+	UpdateJSONData();
+}
+
 //------------------------------------------------------------------
 // Device Control Functions
 //------------------------------------------------------------------
@@ -525,6 +647,22 @@ void SmartControllerClass::FastProcess()
 	// Refresh LED brightness indicator
 	indicatorBrightness.refreshLevelBar();
 
+	// Oversample ambient light, CollectData picks up the filtered level
+	if (theConfig.IsSensorEnabled(sensorALS)) {
+		senLight.sample();
+	}
+
+	// Tone detection on the last full MIC block
+	if (theConfig.IsSensorEnabled(sensorMIC)) {
+		senMic.process();
+	}
+}
+
+// MIC sampling timer, every TONE_SAMPLE_PERIOD
+void SmartControllerClass::SampleMIC()
+{
+	senMic.sample();
+
 	// ToDo:
 }
 
@@ -622,6 +760,7 @@ int SmartControllerClass::CldJSONCommand(String jsonCmd)
 		}
 		const int node_id = (*m_jpCldCmd)["node_id"].as<int>();
 		const int state = (*m_jpCldCmd)["state"].as<int>();
+		theLightEngine.Stop(node_id);
 
 		char buf[64];
 		sprintf(buf, "%d;%d;%d;%d;%d;%d", node_id, S_DIMMER, C_SET, 1, V_STATUS, state);
@@ -643,6 +782,7 @@ int SmartControllerClass::CldJSONCommand(String jsonCmd)
 		const uint8_t R = (*m_jpCldCmd)["color"][3].as<uint8_t>();
 		const uint8_t G = (*m_jpCldCmd)["color"][4].as<uint8_t>();
 		const uint8_t B = (*m_jpCldCmd)["color"][5].as<uint8_t>();
+		theLightEngine.Stop(node_id);
 
 		String payload = CreateColorPayload(ring, State, CW, WW, R, G, B);
 
@@ -668,6 +808,7 @@ int SmartControllerClass::CldJSONCommand(String jsonCmd)
 	}
 
 	//COMMAND 4: Change color with scenerio input
+	/// {"cmd":4,"node_id":1,"SNT_id":2[,"fade":1.5]}
 	if (strCmd == CMD_SCENARIO) {
 		if (!(*m_jpCldCmd).containsKey("node_id") || !(*m_jpCldCmd).containsKey("SNT_id")) {
 			LOGE(LOGTAG_MSG, "Error json cmd format: %s", jsonCmd.c_str());
@@ -676,38 +817,99 @@ int SmartControllerClass::CldJSONCommand(String jsonCmd)
 		const int node_id = (*m_jpCldCmd)["node_id"].as<int>();
 		const int SNT_uid = (*m_jpCldCmd)["SNT_id"].as<int>();
 
-		//find hue data of the 3 rings
-		ListNode<ScenarioRow_t> *rowptr = SearchScenario(SNT_uid);
-		if (rowptr)
-		{
-			String ring1_payload = CreateColorPayload(1, rowptr->data.ring1.State, rowptr->data.ring1.CW, rowptr->data.ring1.WW, rowptr->data.ring1.R, rowptr->data.ring1.G, rowptr->data.ring1.B);
-			String ring2_payload = CreateColorPayload(2, rowptr->data.ring2.State, rowptr->data.ring2.CW, rowptr->data.ring2.WW, rowptr->data.ring2.R, rowptr->data.ring2.G, rowptr->data.ring2.B);
-			String ring3_payload = CreateColorPayload(3, rowptr->data.ring3.State, rowptr->data.ring3.CW, rowptr->data.ring3.WW, rowptr->data.ring3.R, rowptr->data.ring3.G, rowptr->data.ring3.B);
-
-			char buf[64];
+		if (!FadeToScenario(node_id, SNT_uid, GetFadeTime(*m_jpCldCmd)))
+			return 0;
+	}
 
-			sprintf(buf, "%d;%d;%d;%d;%d;%s", node_id, S_CUSTOM, C_SET, 1, V_VAR1, ring1_payload.c_str());
-			String ring1_cmd(buf);
-			ExecuteLightCommand(ring1_cmd);
+	//COMMAND 5: Change white rings by color temperature and brightness (0-100)
+	/// {"cmd":5,"node_id":1,"ring":0,"K":4000,"br":80[,"fade":1.5]}
+	if (strCmd == CMD_CCT) {
+		if (!(*m_jpCldCmd).containsKey("node_id") || !(*m_jpCldCmd).containsKey("K") || !(*m_jpCldCmd).containsKey("br")) {
+			LOGE(LOGTAG_MSG, "Error json cmd format: %s", jsonCmd.c_str());
+			return 0;
+		}
+		const int node_id = (*m_jpCldCmd)["node_id"].as<int>();
+		const uint8_t ring = (*m_jpCldCmd)["ring"].as<int>();
+		const US kelvin = (*m_jpCldCmd)["K"].as<int>();
+		const int br = constrain((*m_jpCldCmd)["br"].as<int>(), 0, 100);
 
-			sprintf(buf, "%d;%d;%d;%d;%d;%s", node_id, S_CUSTOM, C_SET, 1, V_VAR1, ring2_payload.c_str());
-			String ring2_cmd(buf);
-			ExecuteLightCommand(ring2_cmd);
+		Hue_t hue;
+		ColorFromCCT(kelvin, (br * 255 + 50) / 100, hue);
+		if (!FadeToHue(node_id, ring, hue, GetFadeTime(*m_jpCldCmd)))
+			return 0;
+	}
 
-			sprintf(buf, "%d;%d;%d;%d;%d;%s", node_id, S_CUSTOM, C_SET, 1, V_VAR1, ring3_payload.c_str());
-			String ring3_cmd(buf);
-			ExecuteLightCommand(ring3_cmd);
+	//COMMAND 6: Change color rings by hue (0-359), saturation and value (0-100)
+	/// {"cmd":6,"node_id":1,"ring":0,"hsv":[240,100,80][,"fade":1.5]}
+	if (strCmd == CMD_HSV) {
+		if (!(*m_jpCldCmd).containsKey("node_id") || !(*m_jpCldCmd).containsKey("hsv")) {
+			LOGE(LOGTAG_MSG, "Error json cmd format: %s", jsonCmd.c_str());
+			return 0;
 		}
-		else
-		{
-			LOGE(LOGTAG_MSG, "Could not change node:%d light's color, scenerio %d not found", node_id, SNT_uid);
+		const int node_id = (*m_jpCldCmd)["node_id"].as<int>();
+		const uint8_t ring = (*m_jpCldCmd)["ring"].as<int>();
+		const US h = (*m_jpCldCmd)["hsv"][0].as<int>();
+		const int sat = constrain((*m_jpCldCmd)["hsv"][1].as<int>(), 0, 100);
+		const int val = constrain((*m_jpCldCmd)["hsv"][2].as<int>(), 0, 100);
+
+		Hue_t hue;
+		ColorFromHSV(h, (sat * 255 + 50) / 100, (val * 255 + 50) / 100, hue);
+		if (!FadeToHue(node_id, ring, hue, GetFadeTime(*m_jpCldCmd)))
+			return 0;
+	}
+
+	//COMMAND 7: Run an effect on one or more lamps, effect 0 ends it
+	/// {"cmd":7,"node_id":1 or [1,2,3],"effect":1[,"SNT_id":2][,"period":4][,"time":60][,"br":100]}
+	/// effect: 1 breathe, 2 rainbow, 3 candle; SNT_id sets the base rings, period and time in seconds
+	if (strCmd == CMD_EFFECT) {
+		if (!(*m_jpCldCmd).containsKey("node_id") || !(*m_jpCldCmd).containsKey("effect")) {
+			LOGE(LOGTAG_MSG, "Error json cmd format: %s", jsonCmd.c_str());
 			return 0;
 		}
+		const uint8_t effect = (*m_jpCldCmd)["effect"].as<int>();
+		const UL period = (UL)((*m_jpCldCmd)["period"].as<float>() * 1000);
+		const UL duration = (UL)((*m_jpCldCmd)["time"].as<float>() * 1000);
+		int br = 100;
+		if ((*m_jpCldCmd).containsKey("br"))
+			br = constrain((*m_jpCldCmd)["br"].as<int>(), 0, 100);
+
+		Hue_t lv_base[3];
+		const Hue_t *base = NULL;
+		if ((*m_jpCldCmd).containsKey("SNT_id")) {
+			ListNode<ScenarioRow_t> *rowptr = SearchScenario((*m_jpCldCmd)["SNT_id"].as<int>());
+			if (!rowptr) {
+				LOGE(LOGTAG_MSG, "Scenario %d not found", (*m_jpCldCmd)["SNT_id"].as<int>());
+				return 0;
+			}
+			lv_base[0] = rowptr->data.ring1;
+			lv_base[1] = rowptr->data.ring2;
+			lv_base[2] = rowptr->data.ring3;
+			base = lv_base;
+		}
+
+		bool rc = true;
+		if ((*m_jpCldCmd)["node_id"].is<JsonArray&>()) {
+			JsonArray& nodes = (*m_jpCldCmd)["node_id"];
+			for (size_t i = 0; i < nodes.size(); i++)
+				rc &= StartEffect(nodes[i].as<int>(), effect, base, period, duration, (br * 255 + 50) / 100);
+		} else {
+			rc = StartEffect((*m_jpCldCmd)["node_id"].as<int>(), effect, base, period, duration, (br * 255 + 50) / 100);
+		}
+		if (!rc)
+			return 0;
 	}
 
 	return 1;
 }
 
+// Optional transition time of a light command: "fade" in seconds
+UL SmartControllerClass::GetFadeTime(JsonObject& data)
+{
+	if (!data.containsKey("fade")) return 0;
+	float fade = data["fade"].as<float>();
+	return (fade > 0 ? (UL)(fade * 1000) : 0);
+}
+
 int SmartControllerClass::CldJSONConfig(String jsonData) //future actions
 {
   //based on the input (ie whether it is a rule, scenario, or schedule), send the json string(s) to appropriate function.
@@ -809,9 +1011,36 @@ bool SmartControllerClass::ParseCmdRow(JsonObject& data)
 			row.SNT_uid = data["SNT_uid"];
 			row.notif_uid = data["notif_uid"];
 
+			// Sensor condition, a rule without schedule fires when it turns true
+			if (op_flag == DELETE)
+			{
+				theRuleEngine.Remove(row.uid);
+			}
+			else if (data.containsKey("cond"))
+			{
+				RuleProg_t prog;
+				if (!RuleEngineClass::Compile(data["cond"].as<const char*>(), &prog))
+				{
+					LOGE(LOGTAG_MSG, "UID:%s Invalid 'cond'", uidWhole);
+					return 0;
+				}
+				if (!theRuleEngine.SetProgram(row.uid, prog))
+				{
+					LOGE(LOGTAG_MSG, "UID:%s Unable to set 'cond'", uidWhole);
+					return 0;
+				}
+				if (!data.containsKey("SCT_uid")) row.SCT_uid = RULE_NO_SCHEDULE;
+			}
+			else if (op_flag != GET)
+			{
+				theRuleEngine.Remove(row.uid);
+			}
+
 			isSuccess = Change_Rule(row);
 			if (!isSuccess)
 			{
+				// Don't leave a condition behind for a rule that isn't stored
+				if (op_flag != DELETE && data.containsKey("cond")) theRuleEngine.Remove(row.uid);
 				LOGE(LOGTAG_MSG, "UID:%s Unable to write row to Rule_t", uidWhole);
 				return 0;
 			}
@@ -986,6 +1215,7 @@ bool SmartControllerClass::Change_Rule(RuleRow_t row)
 			break;
 	}
 	theConfig.SetRTChanged(true);
+	theScheduler.Signal(m_taskRules);
 	return true;
 }
 
@@ -1312,21 +1542,168 @@ bool SmartControllerClass::ExecuteLightCommand(String mySerialStr)
 
 	//mysensors serial message
 	MyMessage msg;
-	if (theRadio.ProcessSend(mySerialStr, msg)) //send message
-	{
-		SERIAL_LN("Sent message: from:%d dest:%d cmd:%d type:%d sensor:%d payl-len:%d",
-			msg.getSender(), msg.getDestination(), msg.getCommand(),
-			msg.getType(), msg.getSensor(), msg.getLength());
+	if (!theRadio.BuildMessage(mySerialStr, msg))
+		return false;
 
-		if (updateDevStatusRow(msg)) //update devstatus;
-		{
-			//ToDo: update brightness indicator
-			return true;
-		}
+	// With the radio worker, DevStatus is updated once the send result comes back
+	if (theRadio.IsWorkerRunning())
+		return theRadio.PostSend(msg);
+
+	if (theRadio.ProcessSend(&msg)) //send message
+		return OnMessageSent(msg);
+	return false;
+}
+
+// A message has been sent out successfully, application thread only
+bool SmartControllerClass::OnMessageSent(MyMessage &msg)
+{
+	// Intermediate frames of a light transition
+	if (msg.getCommand() == C_SET && theLightEngine.OnSendResult(msg.getDestination(), true))
+		return true;
+
+	SERIAL_LN("Sent message: from:%d dest:%d cmd:%d type:%d sensor:%d payl-len:%d",
+		msg.getSender(), msg.getDestination(), msg.getCommand(),
+		msg.getType(), msg.getSensor(), msg.getLength());
+
+	// Only light commands change DevStatus
+	if (msg.getCommand() != C_SET)
+		return true;
+
+	if (updateDevStatusRow(msg)) //update devstatus;
+	{
+		//ToDo: update brightness indicator
+		PublishDevStatus(msg.getDestination());
+		theRuleEngine.OnUpdate(ruleVarDev);
+		return true;
 	}
 	return false;
 }
 
+// A message could not be sent, application thread only
+void SmartControllerClass::OnMessageFailed(MyMessage &msg)
+{
+	if (msg.getCommand() == C_SET)
+		theLightEngine.OnSendResult(msg.getDestination(), false);
+}
+
+// Rings of the lamp as they are now: moving with the light engine or as in DevStatus
+bool SmartControllerClass::GetLampRings(UC node_id, Hue_t *rings)
+{
+	const Hue_t *lv_cur = theLightEngine.GetCurrent(node_id);
+	if (lv_cur)
+	{
+		for (UC r = 0; r < 3; r++) rings[r] = lv_cur[r];
+		return true;
+	}
+
+	ListNode<DevStatusRow_t> *DevStatusRowPtr = SearchDevStatus(node_id);
+	if (!DevStatusRowPtr) return false;
+	rings[0] = DevStatusRowPtr->data.ring1;
+	rings[1] = DevStatusRowPtr->data.ring2;
+	rings[2] = DevStatusRowPtr->data.ring3;
+	return true;
+}
+
+bool SmartControllerClass::FadeRings(UC node_id, const Hue_t *from, const Hue_t *to, UL duration)
+{
+	if (!theLightEngine.Fade(node_id, from, to, duration))
+	{
+		LOGW(LOGTAG_MSG, "No room for the transition of node:%d", node_id);
+		return false;
+	}
+	theScheduler.EnableTask(m_taskLight, true);
+	return true;
+}
+
+// Change the lamp to a scenario over duration ms, 0 for instant
+bool SmartControllerClass::FadeToScenario(UC node_id, UC SNT_uid, UL duration)
+{
+	ListNode<ScenarioRow_t> *rowptr = SearchScenario(SNT_uid);
+	if (!rowptr)
+	{
+		LOGE(LOGTAG_MSG, "Could not change node:%d light's color, scenerio %d not found", node_id, SNT_uid);
+		return false;
+	}
+
+	Hue_t lv_to[3] = {rowptr->data.ring1, rowptr->data.ring2, rowptr->data.ring3};
+
+	// The filter of a scenario selects an effect on top of its rings, other
+	// values are left to the cloud and the rings just fade
+	if (rowptr->data.filter >= effectBreathe && rowptr->data.filter <= effectCandle)
+		return StartEffect(node_id, rowptr->data.filter, lv_to, 0, 0);
+
+	Hue_t lv_from[3] = {lv_to[0], lv_to[1], lv_to[2]};
+	GetLampRings(node_id, lv_from);
+	return FadeRings(node_id, lv_from, lv_to, duration);
+}
+
+// Change one ring (0 for all) of the lamp over duration ms, the others stay
+bool SmartControllerClass::FadeToHue(UC node_id, UC ring, const Hue_t &hue, UL duration)
+{
+	Hue_t lv_from[3] = {hue, hue, hue};
+	GetLampRings(node_id, lv_from);
+
+	Hue_t lv_to[3];
+	for (UC r = 0; r < 3; r++)
+		lv_to[r] = (ring == 0 || ring == r + 1) ? hue : lv_from[r];
+	return FadeRings(node_id, lv_from, lv_to, duration);
+}
+
+// Run an effect on the lamp, base NULL for the rings it has now
+bool SmartControllerClass::StartEffect(UC node_id, UC effect, const Hue_t *base, UL period, UL duration, UC level)
+{
+	// Where a running fade or effect ends, the lamp as it is, or warm white
+	Hue_t lv_base[3] = {{1, 0, 255, 0, 0, 0}, {1, 0, 255, 0, 0, 0}, {1, 0, 255, 0, 0, 0}};
+	if (!base) base = theLightEngine.GetTarget(node_id);
+	if (base)
+	{
+		for (UC r = 0; r < 3; r++) lv_base[r] = base[r];
+	}
+	else
+	{
+		GetLampRings(node_id, lv_base);
+	}
+
+	if (!theLightEngine.Effect(node_id, effect, lv_base, period, duration, level))
+	{
+		LOGW(LOGTAG_MSG, "Could not start effect %d on node:%d", effect, node_id);
+		return false;
+	}
+	theScheduler.EnableTask(m_taskLight, true);
+	return true;
+}
+
+void SmartControllerClass::ProcessLight()
+{
+	if (!theLightEngine.Process(millis()))
+		theScheduler.EnableTask(m_taskLight, false);
+}
+
+// Format device status row, in the same order as CMD_COLOR:
+/// {"node_id":1,"ring1":[State,CW,WW,R,G,B],"ring2":[...],"ring3":[...]}
+int SmartControllerClass::FormatDevStatus(char *buf, int size, const DevStatusRow_t &row)
+{
+	int nPos = snprintf(buf, size, "{\"node_id\":%d", row.node_id);
+	const Hue_t *pRing[3] = {&row.ring1, &row.ring2, &row.ring3};
+	for (int i = 0; i < 3 && nPos < size; i++) {
+		nPos += snprintf(buf + nPos, size - nPos, ",\"ring%d\":[%d,%d,%d,%d,%d,%d]", i + 1,
+			pRing[i]->State, pRing[i]->CW, pRing[i]->WW, pRing[i]->R, pRing[i]->G, pRing[i]->B);
+	}
+	if (nPos < size) nPos += snprintf(buf + nPos, size - nPos, "}");
+	return nPos;
+}
+
+// Publish device status row of the node
+void SmartControllerClass::PublishDevStatus(UC node_id)
+{
+	ListNode<DevStatusRow_t> *DevStatusRowPtr = SearchDevStatus(node_id);
+	if (!DevStatusRowPtr) return;
+
+	char buf[MQTT_QUEUE_PAYLOAD];
+	FormatDevStatus(buf, sizeof(buf), DevStatusRowPtr->data);
+	theMQTT.Publish(MQTT_TOPIC_DEVSTATUS, buf);
+}
+
 bool SmartControllerClass::Change_Sensor()
 {
   	//Possible subactions: GET
@@ -1350,6 +1727,14 @@ void SmartControllerClass::ReadNewRules()
 			ruleRowPtr = ruleRowPtr->next;
 		} //end of loop
 	}
+
+	// Time window conditions move on with the clock
+	UC lv_minute = Time.minute(now_tz());
+	if (lv_minute != m_ruleMinute)
+	{
+		m_ruleMinute = lv_minute;
+		theRuleEngine.OnUpdate(ruleVarTime);
+	}
 }
 
 bool SmartControllerClass::CreateAlarm(ListNode<ScheduleRow_t>* scheduleRow, uint32_t tag)
@@ -1394,6 +1779,7 @@ bool SmartControllerClass::CreateAlarm(ListNode<ScheduleRow_t>* scheduleRow, uin
 	}
 	//Update that schedule row's alarm_id field with the newly created alarm's alarm_id
 	scheduleRow->data.alarm_id = alarm_id;
+	theScheduler.Signal(m_taskAlarms);
 	LOGI(LOGTAG_MSG, "Alarm %u created via UID:%c%d", alarm_id, CLS_RULE, tag);
 	LOGD(LOGTAG_MSG, "Alarm %u creation info:", alarm_id);
 	LOGD(LOGTAG_MSG, "-----repeat %d", (int)scheduleRow->data.isRepeat);
@@ -1425,13 +1811,13 @@ bool SmartControllerClass::Action_Rule(ListNode<RuleRow_t> *rulePtr)
 	if (rulePtr->data.run_flag == UNEXECUTED)
 	{
 		// Process Schedule
-		Action_Schedule(rulePtr->data.op_flag, rulePtr->data.SCT_uid, rulePtr->data.uid);
+		if (rulePtr->data.SCT_uid != RULE_NO_SCHEDULE)
+			Action_Schedule(rulePtr->data.op_flag, rulePtr->data.SCT_uid, rulePtr->data.uid);
 
 		//Search for SNT data
 		ListNode<ScenarioRow_t> *scenarioPtr = SearchScenario(rulePtr->data.SNT_uid);
 
-		// ToDo: search and set other trigger conditions
-		//...
+		// Sensor conditions are compiled when the rule is parsed, see ParseRows()
 
 		rulePtr->data.run_flag = EXECUTED;
 		scenarioPtr->data.run_flag = EXECUTED;
@@ -26,6 +26,12 @@ private:
   BOOL m_isBLE;
   BOOL m_isLAN;
   BOOL m_isWAN;
+  UC m_taskRules;
+  UC m_taskAlarms;
+  UC m_taskDHT;
+  UC m_taskCollect;
+  UC m_taskLight;
+  UC m_ruleMinute;
 
   String hue_to_string(Hue_t hue);
   bool updateDevStatusRow(MyMessage msg);
@@ -46,7 +52,7 @@ public:
   BOOL CheckRF();
   BOOL CheckNetwork();
   BOOL CheckBLE();
-  BOOL SelfCheck(UL ms);
+  BOOL SelfCheck();
   BOOL IsRFGood();
   BOOL IsBLEGood();
   BOOL IsLANGood();
@@ -54,20 +60,34 @@ public:
 
   // Process all kinds of commands
   void ProcessCommands();
-  void CollectData(UC tick);
+  void CollectData();
+  void StartReadDHT();
+  void OnDHTComplete(bool ok);
   bool ExecuteLightCommand(String mySerialStr);
+  bool OnMessageSent(MyMessage &msg);
+  void OnMessageFailed(MyMessage &msg);
+  bool GetLampRings(UC node_id, Hue_t *rings);
+  bool FadeRings(UC node_id, const Hue_t *from, const Hue_t *to, UL duration);
+  bool FadeToScenario(UC node_id, UC SNT_uid, UL duration);
+  bool FadeToHue(UC node_id, UC ring, const Hue_t &hue, UL duration);
+  bool StartEffect(UC node_id, UC effect, const Hue_t *base, UL period, UL duration, UC level = 255);
+  void ProcessLight();
+  int FormatDevStatus(char *buf, int size, const DevStatusRow_t &row);
+  void PublishDevStatus(UC node_id);
   
   // Device Control Functions
   int DevSoftSwitch(BOOL sw, UC dev = 0);
 
   // High speed system timer process
   void FastProcess();
+  void SampleMIC();
 
   // Cloud interface implementation
   int CldSetTimeZone(String tzStr);
   int CldPowerSwitch(String swStr);
   int CldJSONCommand(String jsonCmd);
   int CldJSONConfig(String jsonData);
+  UL GetFadeTime(JsonObject& data);
 
   // Parsing Functions
   bool ParseCmdRow(JsonObject& data);
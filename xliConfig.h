@@ -8,6 +8,7 @@
 #define SYS_SERIAL_DEBUG
 #define SERIAL_DEBUG
 //#define MAINLOOP_TIMER
+#define RF_WORKER_THREAD
 
 /**********************/
 
@@ -19,11 +20,8 @@
   #define IF_SERIAL_DEBUG(x)
 #endif
 
-#ifdef MAINLOOP_TIMER
-  #define IF_MAINLOOP_TIMER(x, name) ({unsigned long ulStart = millis(); x; SERIAL_LN("%s spent %lu ms", (name), millis() - ulStart);})
-#else
-  #define IF_MAINLOOP_TIMER(x, name) ({x;})
-#endif
+// MAINLOOP_TIMER: also print every PERF_PROBE measurement, see xlxPerf.h
+// RF_WORKER_THREAD: run RF24 send/receive on its own thread, see xlxRF24Server.h
 
 // Xlight Application Identification
 #define XLA_ORGANIZATION          "xlight.ca"               // Default value. Read from EEPROM
@@ -31,13 +29,34 @@
 #define XLA_AUTHORIZATION         "use-token-auth"
 #define XLA_TOKEN                 "your-access-token"       // Can update online
 
+// Syslog server, leave host blank to disable. Can change by console
+#define XLA_SYSLOG_HOST           ""
+#define XLA_SYSLOG_PORT           514
+
+// MQTT broker, leave host blank to disable
+#define XLA_MQTT_BROKER           ""
+#define XLA_MQTT_PORT             1883
+#define XLA_MQTT_TOPIC_ROOT       "xlc"
+
 //------------------------------------------------------------------
 // System level working constants
 //------------------------------------------------------------------
 // Running Time Environment Parameters
 #define RTE_DELAY_PUBLISH         500
 #define RTE_DELAY_SYSTIMER        50          // System Timer interval, can be very fast, e.g. 50 means 25ms
-#define RTE_DELAY_SELFCHECK       500         // Self-check interval
+#define RTE_DELAY_SELFCHECK       30000       // Self-check interval, e.g. RF module recovery
+// Main loop task periods (ms), see xlxScheduler
+#define RTE_DELAY_COMMAND         50          // Commands are also served as soon as input is available
+#define RTE_DELAY_COLLECT         500         // Longest wait of the collect task, sensors are read when due
+#define RTE_DELAY_RULES           500
+#define RTE_DELAY_ALARM           1000
+#define RTE_DELAY_SAVECONFIG      5000
+#define RTE_DELAY_PERF            10000       // Refresh of profiler cloud variable
+#define RTE_DELAY_DHT             5           // Polling of a DHT read in progress
+#define RTE_DELAY_LIGHT           10          // Light transition frames, only while lights are changing
+#define RTE_DELAY_OUTPUT          20          // Serial output drain, also runs as soon as the host takes data
+#define RTE_DELAY_NODES           200         // Node presence sweep, NODELIST_SWEEP_BUDGET nodes per run
+#define RTE_FADE_SCENARIO         1000        // ms, transition to a scenario applied by a rule, 0 for instant
 
 // Number of ticks on System Timer
 #define RTE_TICK_FASTPROCESS			1						// Pace of execution of FastProcess
@@ -45,8 +64,9 @@
 // Maximum number of rows for any working memory table implimented using ChainClass
 #define MAX_TABLE_SIZE    8
 
-// Change it only if Config_t structure is updated
-#define VERSION_CONFIG_DATA         1
+// Change it only if Config_t structure or a stored table layout is updated
+// 2: ScheduleRow_t.alarm_id is 16 bits
+#define VERSION_CONFIG_DATA         2
 
 // Maximum number of device associated to one controller
 #define MAX_DEVICE_PER_CONTROLLER   16